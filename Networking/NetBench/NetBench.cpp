@@ -0,0 +1,1348 @@
+/*********************************************************************
+* Pruebas de rendimiento de la librería CapNet.                      *
+* Cada prueba se ejecuta en el mismo proceso usando la interfaz de   *
+* loopback (127.0.0.1), así no depende de la red.                    *
+*                                                                    *
+* Cada prueba se calienta una vez y después se repite varias veces,  *
+* se reporta la mediana (más estable que el promedio), el mínimo y   *
+* el máximo en nanosegundos por operación. Con --json o --out el     *
+* resultado sale en JSON para poder compararlo entre versiones.      *
+*                                                                    *
+* En Linux se puede compilar con:                                    *
+*   g++ -std=c++20 -O2 -I../asio-1.18.0/include -I../NetCommon       *
+*       NetBench.cpp -o NetBench -pthread                            *
+*********************************************************************/
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <future>
+#include <condition_variable>
+#include <new>
+#include <malloc.h>
+#include <cap_net.h>
+
+// Tipos de mensajes que usan las pruebas.
+enum class BenchMsgTypes : uint32_t {
+	Echo,
+};
+
+// Mismos mensajes pero con todo el cuerpo en el heap, para comparar contra los cuerpos pequeños dentro del mensaje.
+enum class BenchHeapMsgTypes : uint32_t {
+	Ping,
+};
+
+namespace cap {
+	namespace net {
+		template <>
+		struct body_policy<BenchHeapMsgTypes> {
+			static constexpr size_t nInlineCapacity = 0;
+		};
+	}
+}
+
+// Si se compila con NETBENCH_TRACE se rastrea el recorrido de cada mensaje y al final se exporta a netbench_trace.json,
+// el cual se puede abrir con chrome://tracing o Perfetto. Los tiempos medidos incluyen el costo del rastreo.
+#if defined(NETBENCH_TRACE)
+namespace cap {
+	namespace net {
+		template <>
+		struct trace_policy<BenchMsgTypes> : trace_enabled {};
+	}
+}
+#endif
+
+using bench_message = cap::net::message<BenchMsgTypes>;
+using bench_connection = std::shared_ptr<cap::net::connection<BenchMsgTypes>>;
+using bench_clock = std::chrono::steady_clock;
+
+// Versión del formato del JSON, se sube si cambian los nombres o el significado de los campos.
+const int nBenchFormat = 1;
+
+// Destino de los resultados que no se usan, así el compilador no puede eliminar el código medido.
+volatile uint64_t g_nSink = 0;
+
+// Bytes vivos y cantidad de reservas hechas con new, para las pruebas de memoria.
+	// Se cuenta el tamaño real del bloque que da malloc (con su redondeo), que es lo que ocupa en el heap.
+std::atomic<int64_t> g_nHeapBytes{ 0 };
+std::atomic<uint64_t> g_nHeapAllocations{ 0 };
+
+size_t HeapBlockSize(void* p) {
+#if defined(_WIN32)
+	return _msize(p);
+#else
+	return malloc_usable_size(p);
+#endif
+}
+
+void* operator new(size_t nSize) {
+	void* p = std::malloc(nSize > 0 ? nSize : 1);
+	if (!p) {
+		throw std::bad_alloc();
+	}
+	g_nHeapBytes.fetch_add(int64_t(HeapBlockSize(p)), std::memory_order_relaxed);
+	g_nHeapAllocations.fetch_add(1, std::memory_order_relaxed);
+	return p;
+}
+
+void operator delete(void* p) noexcept {
+	if (p) {
+		g_nHeapBytes.fetch_sub(int64_t(HeapBlockSize(p)), std::memory_order_relaxed);
+		std::free(p);
+	}
+}
+
+void operator delete(void* p, size_t) noexcept {
+	operator delete(p);
+}
+
+//*****************************************************************************//
+// Arnés de las pruebas.
+//*****************************************************************************//
+
+// Resultado de una prueba.
+struct bench_result {
+	std::string sName;
+
+	// Operaciones por repetición y cuantas repeticiones se midieron.
+	size_t nOps = 0;
+	size_t nRepetitions = 0;
+
+	// Nanosegundos por operación: mediana, mínimo y máximo entre las repeticiones.
+	double dMedian = 0.0;
+	double dMin = 0.0;
+	double dMax = 0.0;
+
+	// Datos extra de la prueba (por ejemplo percentiles del servidor), en el orden en que se agregaron.
+	std::vector<std::pair<std::string, double>> vExtra;
+};
+
+// Configuración del arnés, se llena con los argumentos.
+struct bench_config {
+	// Solo se corren las pruebas cuyo nombre contenga este texto.
+	std::string sFilter;
+
+	// Repeticiones medidas de cada prueba, después de una de calentamiento.
+	size_t nRepetitions = 5;
+
+	// Divide la cantidad de operaciones para una corrida rápida (los resultados son menos estables).
+	bool bQuick = false;
+
+	// Imprime el resultado como JSON al final, y/o lo guarda en un archivo.
+	bool bJson = false;
+	std::string sOutPath;
+};
+
+class bench_harness {
+public:
+	bench_harness(const bench_config& config) : m_config(config) {}
+
+	// Retorna verdadero si la prueba se debe correr según el filtro.
+	bool Enabled(const std::string& sName) const {
+		return this->m_config.sFilter.empty() || sName.find(this->m_config.sFilter) != std::string::npos;
+	}
+
+	// Ajusta la cantidad de operaciones para el modo rápido.
+	size_t Ops(size_t nOps) const {
+		return this->m_config.bQuick ? std::max<size_t>(nOps / 10, 1) : nOps;
+	}
+
+	// Mide una prueba: fnRun ejecuta nOps operaciones y retorna los segundos que tardo solo la parte medida,
+	// así la preparación de cada repetición no cuenta.
+	bench_result& Measure(const std::string& sName, size_t nOps, const std::function<double(size_t)>& fnRun) {
+		nOps = this->Ops(nOps);
+
+		// La primera corrida calienta caches, asignadores de memoria y conexiones, y no se cuenta.
+		fnRun(nOps);
+
+		std::vector<double> vSamples;
+		for (size_t i = 0; i < this->m_config.nRepetitions; i++) {
+			vSamples.push_back(fnRun(nOps) * 1e9 / double(nOps));
+		}
+		std::sort(vSamples.begin(), vSamples.end());
+
+		bench_result result;
+		result.sName = sName;
+		result.nOps = nOps;
+		result.nRepetitions = vSamples.size();
+		result.dMedian = vSamples[vSamples.size() / 2];
+		result.dMin = vSamples.front();
+		result.dMax = vSamples.back();
+
+		// Se imprime a stderr para que stdout quede solo con el JSON si se pidió.
+		fprintf(stderr, "%-40s %12.1f ns/op  (min %.1f, max %.1f, %zu ops x %zu)\n",
+			sName.c_str(), result.dMedian, result.dMin, result.dMax, result.nOps, result.nRepetitions);
+
+		this->m_vResults.push_back(std::move(result));
+		return this->m_vResults.back();
+	}
+
+	// Arma el JSON con todos los resultados.
+	std::string Json() const {
+		std::ostringstream json;
+		json << "{\"format\":" << nBenchFormat << ",\"threads\":" << std::thread::hardware_concurrency()
+			<< ",\"repetitions\":" << this->m_config.nRepetitions << ",\"quick\":" << (this->m_config.bQuick ? "true" : "false")
+			<< ",\"benchmarks\":[";
+
+		for (size_t i = 0; i < this->m_vResults.size(); i++) {
+			const bench_result& r = this->m_vResults[i];
+			json << (i > 0 ? "," : "") << "{\"name\":\"" << r.sName << "\",\"ops\":" << r.nOps << ",\"repetitions\":" << r.nRepetitions
+				<< ",\"ns_per_op\":" << r.dMedian << ",\"min_ns_per_op\":" << r.dMin << ",\"max_ns_per_op\":" << r.dMax;
+			for (auto& [sKey, dValue] : r.vExtra) {
+				json << ",\"" << sKey << "\":" << dValue;
+			}
+			json << "}";
+		}
+
+		json << "]}";
+		return json.str();
+	}
+
+protected:
+	bench_config m_config;
+	std::deque<bench_result> m_vResults;
+};
+
+// Segundos transcurridos desde un momento.
+double SecondsSince(bench_clock::time_point tpStart) {
+	return std::chrono::duration<double>(bench_clock::now() - tpStart).count();
+}
+
+//*****************************************************************************//
+// Servidores y utilidades de las pruebas de red.
+//*****************************************************************************//
+
+// Opciones de las conexiones de las pruebas.
+	// Sin TCP_NODELAY cada ida y vuelta espera al ACK retrasado del kernel (el encabezado y el cuerpo
+	// se escriben por separado), y lo que se mediría seria ese retraso y no la librería.
+cap::net::connection_options BenchConnectionOptions() {
+	cap::net::connection_options options;
+	options.socket.bNoDelay = true;
+	return options;
+}
+
+// Servidor que regresa cada mensaje al cliente que lo mando, usando los eventos y Update().
+	// También cuenta los clientes validados, para las pruebas que esperan a que se conecten.
+class EchoServer : public cap::net::server_interface<BenchMsgTypes> {
+public:
+	EchoServer(uint16_t nPort, const cap::net::acceptor_options& options = {}) : cap::net::server_interface<BenchMsgTypes>(nPort, options) {
+		this->SetConnectionOptions(BenchConnectionOptions());
+	}
+
+	// Sin puerto, solo para conexiones en el mismo proceso.
+	EchoServer() : cap::net::server_interface<BenchMsgTypes>() {}
+
+	virtual void OnClientValidated(bench_connection client) override {
+		std::scoped_lock lock(this->m_muxValidated);
+		this->m_nValidated++;
+		this->m_cvValidated.notify_all();
+	}
+
+	// Espera a que se hayan validado nCount clientes desde que inicio el servidor.
+	void WaitValidated(size_t nCount) {
+		std::unique_lock<std::mutex> lock(this->m_muxValidated);
+		this->m_cvValidated.wait(lock, [&]() { return this->m_nValidated >= nCount; });
+	}
+
+	// Retorna cuantos clientes se han validado.
+	size_t Validated() {
+		std::scoped_lock lock(this->m_muxValidated);
+		return this->m_nValidated;
+	}
+
+	// Retorna cuantas conexiones se han aceptado y rechazado al aceptar, se puede llamar desde cualquier proceso.
+	uint64_t AcceptedOrRejected() const {
+		return this->m_nAccepted.load(std::memory_order_relaxed) + this->m_nRejected.load(std::memory_order_relaxed);
+	}
+
+	// Despierta al proceso que espera en Update() con un mensaje vacío sin conexión.
+	void Wake() {
+		this->m_qMessagesIn.push_back({});
+	}
+
+protected:
+	virtual bool OnClientConnect(bench_connection client) override {
+		return true;
+	}
+
+	virtual void OnMessage(bench_connection client, bench_message& msg) override {
+		if (client) {
+			client->Send(msg);
+		}
+	}
+
+	std::mutex m_muxValidated;
+	std::condition_variable m_cvValidated;
+	size_t m_nValidated = 0;
+};
+
+// Corre el Update() del servidor en su propio proceso mientras exista, como lo haría una aplicación normal.
+class server_runner {
+public:
+	server_runner(EchoServer& server) : m_server(server) {
+		this->m_server.Start();
+		this->m_thread = std::thread([this]() {
+				while (m_bRunning) {
+					m_server.Update(-1, true);
+				}
+			});
+	}
+
+	~server_runner() {
+		this->m_bRunning = false;
+		this->m_server.Wake();
+		this->m_thread.join();
+	}
+
+protected:
+	EchoServer& m_server;
+	std::atomic<bool> m_bRunning{ true };
+	std::thread m_thread;
+};
+
+// Espera a que el cliente termine de validarse con el servidor.
+	// La validación no tiene un evento del lado del cliente, así que se manda un eco y se espera a que regrese.
+template <typename Client>
+void WaitUntilValidated(Client& client) {
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	bench_message msg;
+	msg.header.id = BenchMsgTypes::Echo;
+	client.Send(msg);
+	client.Incoming().wait();
+	client.Incoming().pop_front();
+}
+
+// Saca nCount mensajes de la cola, esperando a que lleguen.
+void WaitMessages(cap::net::tsqueue<cap::net::owned_message<BenchMsgTypes>>& queue, size_t nCount) {
+	while (nCount > 0) {
+		queue.wait();
+		while (nCount > 0 && !queue.empty()) {
+			queue.pop_front();
+			nCount--;
+		}
+	}
+}
+
+//*****************************************************************************//
+// Pruebas de las primitivas.
+//*****************************************************************************//
+
+// Bloque de datos de tamaño fijo para empujar a los mensajes.
+template <size_t N>
+struct payload {
+	uint8_t data[N];
+};
+
+// Empujar y sacar datos de los mensajes con distintos tamaños.
+template <size_t N>
+void BenchMessage(bench_harness& harness) {
+	payload<N> data{};
+	std::string sSize = std::to_string(N);
+
+	// Mensaje nuevo cada vez, incluye reservar la memoria del cuerpo (si no cabe dentro del mensaje).
+	if (harness.Enabled("message/push_new/" + sSize)) {
+		double dAllocations = 0.0;
+		bench_result& result = harness.Measure("message/push_new/" + sSize, 200000, [&](size_t nOps) {
+				uint64_t nAllocations = g_nHeapAllocations.load();
+				auto tpStart = bench_clock::now();
+				for (size_t i = 0; i < nOps; i++) {
+					bench_message msg;
+					msg << data;
+					g_nSink = g_nSink + msg.header.size;
+				}
+				double dSeconds = SecondsSince(tpStart);
+				dAllocations = double(g_nHeapAllocations.load() - nAllocations) / double(nOps);
+				return dSeconds;
+			});
+		result.vExtra.emplace_back("allocations_per_op", dAllocations);
+	}
+
+	// Mismo mensaje, empujar y sacar sin reservar memoria nueva.
+	if (harness.Enabled("message/push_pop/" + sSize)) {
+		bench_message msg;
+		harness.Measure("message/push_pop/" + sSize, 500000, [&](size_t nOps) {
+				auto tpStart = bench_clock::now();
+				for (size_t i = 0; i < nOps; i++) {
+					msg << data;
+					msg >> data;
+				}
+				g_nSink = g_nSink + data.data[0] + msg.header.size;
+				return SecondsSince(tpStart);
+			});
+	}
+}
+
+// Armar un mensaje empujando muchos valores chicos uno por uno, como hacen las aplicaciones.
+void BenchMessageMany(bench_harness& harness, size_t nValues) {
+	std::string sName = "message/push_u32_x" + std::to_string(nValues);
+	if (!harness.Enabled(sName)) {
+		return;
+	}
+
+	harness.Measure(sName, 20000, [&](size_t nOps) {
+			auto tpStart = bench_clock::now();
+			for (size_t i = 0; i < nOps; i++) {
+				bench_message msg;
+				for (uint32_t v = 0; v < nValues; v++) {
+					msg << v;
+				}
+				g_nSink = g_nSink + msg.header.size;
+			}
+			return SecondsSince(tpStart);
+		});
+}
+
+// Lo mismo con los valores en un std::vector, que se empuja de una vez (ver operator << de los contenedores), y sacarlo
+	// copiándolo a un vector o como vista sin copiar (ver cap::net::PopView()).
+void BenchMessageVector(bench_harness& harness, size_t nValues) {
+	std::string sSuffix = "u32_x" + std::to_string(nValues);
+	std::vector<uint32_t> vValues(nValues);
+	for (uint32_t v = 0; v < nValues; v++) {
+		vValues[v] = v;
+	}
+
+	if (harness.Enabled("message/push_vector_" + sSuffix)) {
+		harness.Measure("message/push_vector_" + sSuffix, 20000, [&](size_t nOps) {
+				auto tpStart = bench_clock::now();
+				for (size_t i = 0; i < nOps; i++) {
+					bench_message msg;
+					msg << vValues;
+					g_nSink = g_nSink + msg.header.size;
+				}
+				return SecondsSince(tpStart);
+			});
+	}
+
+	if (harness.Enabled("message/pop_vector_" + sSuffix)) {
+		bench_message msg;
+		std::vector<uint32_t> vOut;
+		harness.Measure("message/pop_vector_" + sSuffix, 20000, [&](size_t nOps) {
+				auto tpStart = bench_clock::now();
+				for (size_t i = 0; i < nOps; i++) {
+					msg << vValues;
+					msg >> vOut;
+					g_nSink = g_nSink + vOut.back();
+				}
+				return SecondsSince(tpStart);
+			});
+	}
+
+	if (harness.Enabled("message/pop_view_" + sSuffix)) {
+		bench_message msg;
+		harness.Measure("message/pop_view_" + sSuffix, 20000, [&](size_t nOps) {
+				auto tpStart = bench_clock::now();
+				for (size_t i = 0; i < nOps; i++) {
+					msg << vValues;
+					cap::net::message_view<uint32_t> view = cap::net::PopView<uint32_t>(msg);
+					g_nSink = g_nSink + view[view.size() - 1];
+				}
+				return SecondsSince(tpStart);
+			});
+	}
+}
+
+// Mensaje pequeño como los pings o el ID que el servidor le manda a cada cliente: se arma, se copia una vez (como hace
+	// Send() al compartirlo) y se lee. Con BenchHeapMsgTypes el cuerpo siempre va en el heap, como antes de body_policy.
+template <typename MsgTypes>
+void BenchSmallMessage(bench_harness& harness, const std::string& sKind) {
+	std::string sName = "message/small/" + sKind;
+	if (!harness.Enabled(sName)) {
+		return;
+	}
+
+	double dAllocations = 0.0;
+	bench_result& result = harness.Measure(sName, 200000, [&](size_t nOps) {
+			uint64_t nAllocations = g_nHeapAllocations.load();
+			auto tpStart = bench_clock::now();
+			for (size_t i = 0; i < nOps; i++) {
+				cap::net::message<MsgTypes> msg;
+				msg << uint32_t(i) << uint64_t(i);
+				cap::net::message<MsgTypes> copy = msg;
+				uint64_t nValue = 0;
+				copy >> nValue;
+				g_nSink = g_nSink + nValue;
+			}
+			double dSeconds = SecondsSince(tpStart);
+			dAllocations = double(g_nHeapAllocations.load() - nAllocations) / double(nOps);
+			return dSeconds;
+		});
+	result.vExtra.emplace_back("allocations_per_op", dAllocations);
+	fprintf(stderr, "%-40s %12.2f allocations/op\n", "", dAllocations);
+}
+
+// Copiar mensajes con dueño, como pasa al sacarlos de la cola de entrada.
+void BenchOwnedMessageCopy(bench_harness& harness, size_t nBytes) {
+	std::string sName = "owned_message/copy/" + std::to_string(nBytes);
+	if (!harness.Enabled(sName)) {
+		return;
+	}
+
+	// La conexión no necesita estar conectada, solo importa el costo de copiar el pointer compartido.
+	asio::io_context context;
+	cap::net::tsqueue<cap::net::owned_message<BenchMsgTypes>> qIn;
+	auto pConnection = std::make_shared<cap::net::connection<BenchMsgTypes>>(cap::net::connection<BenchMsgTypes>::owner::server,
+		context, asio::ip::tcp::socket(context), qIn);
+
+	cap::net::owned_message<BenchMsgTypes> original;
+	original.remote = pConnection;
+	original.msg.body.assign(nBytes, 1);
+	original.msg.header.size = uint32_t(nBytes);
+
+	harness.Measure(sName, 200000, [&](size_t nOps) {
+			auto tpStart = bench_clock::now();
+			for (size_t i = 0; i < nOps; i++) {
+				cap::net::owned_message<BenchMsgTypes> copy = original;
+				g_nSink = g_nSink + copy.msg.header.size;
+			}
+			return SecondsSince(tpStart);
+		});
+}
+
+// Agregar y sacar de la cola de subprocesos con varios productores y un consumidor.
+void BenchTsqueue(bench_harness& harness, size_t nProducers) {
+	std::string sName = "tsqueue/push_pop/producers_" + std::to_string(nProducers);
+	if (!harness.Enabled(sName)) {
+		return;
+	}
+
+	harness.Measure(sName, 400000, [&](size_t nOps) {
+			cap::net::tsqueue<uint64_t> queue;
+			size_t nPerProducer = nOps / nProducers;
+			size_t nTotal = nPerProducer * nProducers;
+
+			auto tpStart = bench_clock::now();
+
+			std::vector<std::thread> vProducers;
+			for (size_t p = 0; p < nProducers; p++) {
+				vProducers.emplace_back([&queue, nPerProducer]() {
+						for (size_t i = 0; i < nPerProducer; i++) {
+							queue.push_back(i);
+						}
+					});
+			}
+
+			// El consumidor espera como lo hace Update(-1, true).
+			uint64_t nSum = 0;
+			for (size_t nPopped = 0; nPopped < nTotal;) {
+				queue.wait();
+				while (!queue.empty()) {
+					nSum += queue.pop_front();
+					nPopped++;
+				}
+			}
+
+			double dSeconds = SecondsSince(tpStart);
+			for (auto& thr : vProducers) {
+				thr.join();
+			}
+
+			g_nSink = g_nSink + nSum;
+			return dSeconds * double(nOps) / double(nTotal);
+		});
+}
+
+// Entidad de los estados de las pruebas (ver MakeSnapshot()).
+struct entity {
+	uint32_t nId;
+	float x, y, z;
+	float vx, vy, vz;
+	uint16_t nHealth;
+	uint8_t nState;
+	uint8_t nTeam;
+};
+
+// Datos parecidos a un estado del juego: entidades con posiciones, velocidades y vida que cambian poco entre sí.
+	// Siempre son los mismos para el mismo tamaño, así las pruebas se pueden comparar.
+std::vector<uint8_t> MakeSnapshot(size_t nBytes) {
+	std::mt19937 rng(1234);
+	std::vector<uint8_t> vData(nBytes);
+	for (size_t i = 0; i + sizeof(entity) <= nBytes; i += sizeof(entity)) {
+		uint32_t n = uint32_t(i / sizeof(entity));
+		entity e{ 1000 + n, float(n % 64) * 16.0f, 0.0f, float(n / 64) * 16.0f, 0.0f, 0.0f, 0.0f, 100, 0, uint8_t(n % 2) };
+
+		// Una de cada cuatro entidades se esta moviendo.
+		if (rng() % 4 == 0) {
+			e.x += float(rng() % 1000) / 100.0f;
+			e.vx = 1.5f;
+			e.nState = 1;
+		}
+		std::memcpy(vData.data() + i, &e, sizeof(entity));
+	}
+	return vData;
+}
+
+// Avanza un tick el estado de MakeSnapshot(): una de cada diez entidades se mueve y las demás quedan igual,
+	// así entre dos ticks cambia alrededor del 10% del estado.
+void AdvanceSnapshot(std::vector<uint8_t>& vState) {
+	for (size_t i = 0; i + sizeof(entity) <= vState.size(); i += sizeof(entity) * 10) {
+		entity e;
+		std::memcpy(&e, vState.data() + i, sizeof(entity));
+		e.x += 0.25f;
+		e.z += 0.125f;
+		e.nState = 1;
+		std::memcpy(vState.data() + i, &e, sizeof(entity));
+	}
+}
+
+// Datos al azar, no se pueden comprimir.
+std::vector<uint8_t> MakeRandom(size_t nBytes) {
+	std::mt19937 rng(1234);
+	std::vector<uint8_t> vData(nBytes);
+	for (auto& b : vData) {
+		b = uint8_t(rng());
+	}
+	return vData;
+}
+
+// Comprimir y descomprimir un cuerpo con el codec LZ de la librería.
+	// Además del tiempo se reporta la proporción (comprimido / original) y los MB/s sin comprimir, para elegir
+	// compression_options::nThreshold comparando el CPU que cuesta contra los bytes que se ahorran.
+void BenchCompress(bench_harness& harness, const std::string& sKind, const std::vector<uint8_t>& vData) {
+	std::string sSuffix = sKind + "_" + std::to_string(vData.size() / 1024) + "k";
+	std::vector<uint8_t> vCompressed;
+	std::vector<uint8_t> vOut;
+
+	bool bCompressed = cap::net::CompressBody(cap::net::compression_codec::lz, vData, vCompressed);
+	double dRatio = bCompressed ? double(vCompressed.size()) / double(vData.size()) : 1.0;
+
+	if (harness.Enabled("compress/lz/" + sSuffix)) {
+		bench_result& result = harness.Measure("compress/lz/" + sSuffix, 200000000 / (vData.size() + 1024), [&](size_t nOps) {
+				auto tpStart = bench_clock::now();
+				for (size_t i = 0; i < nOps; i++) {
+					g_nSink = g_nSink + cap::net::CompressBody(cap::net::compression_codec::lz, vData, vOut);
+				}
+				return SecondsSince(tpStart);
+			});
+		result.vExtra.emplace_back("ratio", dRatio);
+		result.vExtra.emplace_back("mbps", double(vData.size()) / result.dMedian * 1e3);
+	}
+
+	// Solo se puede descomprimir lo que si se comprimió.
+	if (bCompressed && harness.Enabled("decompress/lz/" + sSuffix)) {
+		bench_result& result = harness.Measure("decompress/lz/" + sSuffix, 400000000 / (vData.size() + 1024), [&](size_t nOps) {
+				auto tpStart = bench_clock::now();
+				for (size_t i = 0; i < nOps; i++) {
+					g_nSink = g_nSink + cap::net::DecompressBody(vCompressed, vOut, vData.size());
+				}
+				return SecondsSince(tpStart);
+			});
+		result.vExtra.emplace_back("ratio", dRatio);
+		result.vExtra.emplace_back("mbps", double(vData.size()) / result.dMedian * 1e3);
+	}
+}
+
+// Calcular y aplicar el delta entre dos ticks de un estado (ver net_snapshot.h).
+	// Se reporta la proporción (delta / estado) y los MB/s del estado, el calculo es lo que paga el servidor por cada base.
+void BenchDelta(bench_harness& harness, size_t nBytes) {
+	std::string sSuffix = "snapshot_" + std::to_string(nBytes / 1024) + "k";
+	std::vector<uint8_t> vBase = MakeSnapshot(nBytes);
+	std::vector<uint8_t> vState = vBase;
+	AdvanceSnapshot(vState);
+
+	std::vector<uint8_t> vDelta;
+	cap::net::delta::Encode(vState.data(), vState.size(), vBase.data(), vBase.size(), vDelta);
+	double dRatio = double(vDelta.size()) / double(vState.size());
+
+	if (harness.Enabled("delta/encode/" + sSuffix)) {
+		std::vector<uint8_t> vOut;
+		bench_result& result = harness.Measure("delta/encode/" + sSuffix, 400000000 / (nBytes + 1024), [&](size_t nOps) {
+				auto tpStart = bench_clock::now();
+				for (size_t i = 0; i < nOps; i++) {
+					vOut.clear();
+					cap::net::delta::Encode(vState.data(), vState.size(), vBase.data(), vBase.size(), vOut);
+					g_nSink = g_nSink + vOut.size();
+				}
+				return SecondsSince(tpStart);
+			});
+		result.vExtra.emplace_back("ratio", dRatio);
+		result.vExtra.emplace_back("mbps", double(nBytes) / result.dMedian * 1e3);
+	}
+
+	if (harness.Enabled("delta/decode/" + sSuffix)) {
+		std::vector<uint8_t> vOut(vState.size());
+		bench_result& result = harness.Measure("delta/decode/" + sSuffix, 400000000 / (nBytes + 1024), [&](size_t nOps) {
+				auto tpStart = bench_clock::now();
+				for (size_t i = 0; i < nOps; i++) {
+					g_nSink = g_nSink + cap::net::delta::Decode(vDelta.data(), vDelta.size(), vBase.data(), vBase.size(), vOut.data(), vOut.size());
+				}
+				return SecondsSince(tpStart);
+			});
+		result.vExtra.emplace_back("ratio", dRatio);
+		result.vExtra.emplace_back("mbps", double(nBytes) / result.dMedian * 1e3);
+	}
+}
+
+// Voltear un arreglo de 16 KB de números de nSize bytes, como lo hace el formato portable en procesadores big endian
+	// (ver cap::net::CopyWire()): en bloque con SIMD, contra número por número como lo haría operator <<.
+	// En procesadores little endian el formato no voltea nada, esta prueba solo mide lo que costaría.
+void BenchByteSwap(bench_harness& harness, size_t nSize) {
+	std::string sSuffix = "u" + std::to_string(nSize * 8) + "_16k";
+	const size_t nBytes = 16 * 1024;
+	std::vector<uint8_t> vSrc = MakeRandom(nBytes);
+	std::vector<uint8_t> vDst(nBytes);
+
+	if (harness.Enabled("wire/swap_bulk/" + sSuffix)) {
+		bench_result& result = harness.Measure("wire/swap_bulk/" + sSuffix, 100000, [&](size_t nOps) {
+				auto tpStart = bench_clock::now();
+				for (size_t i = 0; i < nOps; i++) {
+					cap::net::bswap::SwapCopy(vDst.data(), vSrc.data(), nBytes / nSize, nSize);
+					g_nSink = g_nSink + vDst[i % nBytes];
+				}
+				return SecondsSince(tpStart);
+			});
+		result.vExtra.emplace_back("mbps", double(nBytes) / result.dMedian * 1e3);
+	}
+
+	if (harness.Enabled("wire/swap_each/" + sSuffix)) {
+		bench_result& result = harness.Measure("wire/swap_each/" + sSuffix, 100000, [&](size_t nOps) {
+				auto tpStart = bench_clock::now();
+				for (size_t i = 0; i < nOps; i++) {
+					for (size_t k = 0; k < nBytes; k += nSize) {
+						if (nSize == 4) {
+							cap::net::StoreWire(vDst.data() + k, cap::net::bswap::SwapValue(cap::net::LoadWire<uint32_t>(vSrc.data() + k)));
+						}
+						else {
+							cap::net::StoreWire(vDst.data() + k, cap::net::bswap::SwapValue(cap::net::LoadWire<uint64_t>(vSrc.data() + k)));
+						}
+					}
+					g_nSink = g_nSink + vDst[i % nBytes];
+				}
+				return SecondsSince(tpStart);
+			});
+		result.vExtra.emplace_back("mbps", double(nBytes) / result.dMedian * 1e3);
+	}
+}
+
+// Guardar mensajes de 64 bytes en el buzón de los clientes desconectados (ver cap::net::outbox_log) repartidos entre
+	// 1000 clientes, y entregarlos de regreso al reconectar. nSyncMessages es cada cuantos mensajes se espera al disco,
+	// cero deja que el sistema operativo decida. Los segmentos se crean en el directorio actual y se borran al terminar.
+void BenchOutbox(bench_harness& harness, uint32_t nSyncMessages) {
+	std::string sSuffix = nSyncMessages == 0 ? "64" : "64_sync" + std::to_string(nSyncMessages);
+	cap::net::outbox_options options;
+	options.nSyncMessages = nSyncMessages;
+	options.syncInterval = std::chrono::milliseconds(0);
+	options.nMaxBytes = size_t(64) * 1024 * 1024;
+	options.nSegmentBytes = size_t(16) * 1024 * 1024;
+
+	bench_message msg;
+	msg << payload<64>{};
+
+	if (harness.Enabled("outbox/append_" + sSuffix)) {
+		cap::net::outbox_log<BenchMsgTypes> outbox;
+		if (outbox.Open(".", options)) {
+			harness.Measure("outbox/append_" + sSuffix, nSyncMessages == 1 ? 2000 : 200000, [&](size_t nOps) {
+					auto tpStart = bench_clock::now();
+					for (size_t i = 0; i < nOps; i++) {
+						outbox.Append(uint32_t(i % 1000), msg);
+					}
+					return SecondsSince(tpStart);
+				});
+		}
+	}
+
+	if (nSyncMessages == 0 && harness.Enabled("outbox/replay_" + sSuffix)) {
+		cap::net::outbox_log<BenchMsgTypes> outbox;
+		if (outbox.Open(".", options)) {
+			harness.Measure("outbox/replay_" + sSuffix, 100000, [&](size_t nOps) {
+					for (size_t i = 0; i < nOps; i++) {
+						outbox.Append(uint32_t(i % 1000), msg);
+					}
+
+					auto tpStart = bench_clock::now();
+					for (uint32_t nClient = 0; nClient < 1000; nClient++) {
+						outbox.Replay(nClient, [](const cap::net::message<BenchMsgTypes>& m) { g_nSink = g_nSink + m.header.size; });
+					}
+					return SecondsSince(tpStart);
+				});
+		}
+	}
+}
+
+//*****************************************************************************//
+// Pruebas de red por loopback.
+//*****************************************************************************//
+
+// Ida y vuelta con el modelo de eventos: el servidor procesa con Update() y el cliente revisa Incoming().
+void BenchCallbackRoundTrips(bench_harness& harness, uint16_t nPort) {
+	const std::string sName = "roundtrip/callback";
+	if (!harness.Enabled(sName)) {
+		return;
+	}
+
+	EchoServer server(nPort);
+	cap::net::client_interface<BenchMsgTypes> client;
+	{
+		server_runner runner(server);
+
+		client.SetConnectionOptions(BenchConnectionOptions());
+		client.Connect("127.0.0.1", nPort);
+		WaitUntilValidated(client);
+
+		bench_message msg;
+		msg.header.id = BenchMsgTypes::Echo;
+		msg << uint64_t(0);
+
+		bench_result& result = harness.Measure(sName, 20000, [&](size_t nOps) {
+				auto tpStart = bench_clock::now();
+				for (size_t i = 0; i < nOps; i++) {
+					client.Send(msg);
+					client.Incoming().wait();
+					client.Incoming().pop_front();
+				}
+				return SecondsSince(tpStart);
+			});
+
+		// Las métricas se leen desde este proceso ya que el del servidor esta ocupado en Update().
+			// Nota: recorrer las conexiones aquí es seguro solo por que ya no se conectan más clientes.
+		cap::net::server_metrics_snapshot metrics = server.GetMetrics();
+		result.vExtra.emplace_back("server_read_to_handler_p50_us", metrics.readToHandler.Percentile(50.0) / 1e3);
+		result.vExtra.emplace_back("server_read_to_handler_p99_us", metrics.readToHandler.Percentile(99.0) / 1e3);
+		result.vExtra.emplace_back("server_send_to_write_p50_us", metrics.sendToWrite.Percentile(50.0) / 1e3);
+		result.vExtra.emplace_back("server_send_to_write_p99_us", metrics.sendToWrite.Percentile(99.0) / 1e3);
+		result.vExtra.emplace_back("server_write_stalls", double(metrics.totals.nWriteStalls));
+	}
+	client.Disconnect();
+}
+
+// Ida y vuelta de un estado del juego de 64 KB, con o sin compresión en ambos sentidos.
+	// Además del tiempo se reportan los bytes que pasaron por el socket en cada ida y vuelta.
+void BenchSnapshotRoundTrips(bench_harness& harness, uint16_t nPort, cap::net::compression_codec codec) {
+	const std::string sName = std::string("roundtrip/snapshot_64k/") + (codec == cap::net::compression_codec::none ? "raw" : "lz");
+	if (!harness.Enabled(sName)) {
+		return;
+	}
+
+	cap::net::connection_options options = BenchConnectionOptions();
+	options.compression.codec = codec;
+
+	EchoServer server(nPort);
+	server.SetConnectionOptions(options);
+	cap::net::client_interface<BenchMsgTypes> client;
+	{
+		server_runner runner(server);
+
+		client.SetConnectionOptions(options);
+		client.Connect("127.0.0.1", nPort);
+		WaitUntilValidated(client);
+
+		bench_message msg;
+		msg.header.id = BenchMsgTypes::Echo;
+		std::vector<uint8_t> vSnapshot = MakeSnapshot(64 * 1024);
+		msg.body.assign(vSnapshot.begin(), vSnapshot.end());
+		msg.header.size = uint32_t(msg.body.size());
+
+		cap::net::connection_metrics_snapshot before = client.GetMetrics();
+		bench_result& result = harness.Measure(sName, 2000, [&](size_t nOps) {
+				auto tpStart = bench_clock::now();
+				for (size_t i = 0; i < nOps; i++) {
+					client.Send(msg);
+					client.Incoming().wait();
+					client.Incoming().pop_front();
+				}
+				return SecondsSince(tpStart);
+			});
+		cap::net::connection_metrics_snapshot after = client.GetMetrics();
+
+		// Incluye la corrida de calentamiento.
+		double dRoundTrips = double(result.nOps * (result.nRepetitions + 1));
+		result.vExtra.emplace_back("wire_bytes_per_roundtrip", double(after.nBytesOut - before.nBytesOut + after.nBytesIn - before.nBytesIn) / dRoundTrips);
+	}
+	client.Disconnect();
+}
+
+// Ida y vuelta igual que la anterior pero con una conexión en el mismo proceso, sin sockets.
+	// La diferencia con la anterior es lo que cuesta pasar por el kernel.
+void BenchLoopbackRoundTrips(bench_harness& harness) {
+	const std::string sName = "roundtrip/loopback";
+	if (!harness.Enabled(sName)) {
+		return;
+	}
+
+	EchoServer server;
+	cap::net::client_interface<BenchMsgTypes> client;
+	{
+		server_runner runner(server);
+		client.ConnectLoopback(server);
+
+		bench_message msg;
+		msg.header.id = BenchMsgTypes::Echo;
+		msg << uint64_t(0);
+
+		harness.Measure(sName, 20000, [&](size_t nOps) {
+				auto tpStart = bench_clock::now();
+				for (size_t i = 0; i < nOps; i++) {
+					client.Send(msg);
+					client.Incoming().wait();
+					client.Incoming().pop_front();
+				}
+				return SecondsSince(tpStart);
+			});
+	}
+	client.Disconnect();
+}
+
+#if defined(ASIO_HAS_CO_AWAIT)
+
+// Servidor de eco con corrutinas.
+class CoroEchoServer : public cap::net::coro_server<BenchMsgTypes> {
+public:
+	CoroEchoServer(uint16_t nPort) : cap::net::coro_server<BenchMsgTypes>(nPort) {}
+
+	// Corrutina que regresa cada mensaje recibido.
+	asio::awaitable<void> Run() {
+		for (;;) {
+			cap::net::owned_message<BenchMsgTypes> msg = co_await this->Receive();
+			msg.remote->Send(msg.msg);
+		}
+	}
+};
+
+// Corrutina del cliente que hace nOps idas y vueltas y deja el tiempo que tardo en promise.
+	// Todo lo que usa llega como parámetro, ya que una lambda temporal con capturas se destruye antes que la corrutina.
+asio::awaitable<void> CoroRoundTrips(cap::net::coro_client<BenchMsgTypes>& client, size_t nOps, std::promise<double>& promise) {
+	bench_message msg;
+	msg.header.id = BenchMsgTypes::Echo;
+	msg << uint64_t(0);
+
+	auto tpStart = bench_clock::now();
+	for (size_t i = 0; i < nOps; i++) {
+		client.Send(msg);
+		co_await client.Receive();
+	}
+	promise.set_value(SecondsSince(tpStart));
+}
+
+// Ida y vuelta con corrutinas: ambos lados esperan con co_await en vez de revisar colas.
+void BenchCoroRoundTrips(bench_harness& harness, uint16_t nPort) {
+	const std::string sName = "roundtrip/coroutine";
+	if (!harness.Enabled(sName)) {
+		return;
+	}
+
+	CoroEchoServer server(nPort);
+	server.SetConnectionOptions(BenchConnectionOptions());
+	server.Spawn(server.Run());
+	server.Start();
+
+	cap::net::coro_client<BenchMsgTypes> client;
+	client.SetConnectionOptions(BenchConnectionOptions());
+	client.Connect("127.0.0.1", nPort);
+	WaitUntilValidated(client);
+
+	harness.Measure(sName, 20000, [&](size_t nOps) {
+			std::promise<double> promise;
+			client.Spawn(CoroRoundTrips(client, nOps, promise));
+
+			return promise.get_future().get();
+		});
+}
+
+#endif
+
+// Envío a todos los clientes (MessageAllClients) con N clientes conectados.
+	// Cada operación es un mensaje enviado a todos, y termina cuando todos los clientes lo recibieron.
+void BenchFanout(bench_harness& harness, uint16_t nPort, size_t nClients) {
+	std::string sName = "server/fanout/clients_" + std::to_string(nClients);
+	if (!harness.Enabled(sName)) {
+		return;
+	}
+
+	EchoServer server(nPort);
+	server.Start();
+
+	std::vector<std::unique_ptr<cap::net::client_interface<BenchMsgTypes>>> vClients;
+	for (size_t i = 0; i < nClients; i++) {
+		vClients.push_back(std::make_unique<cap::net::client_interface<BenchMsgTypes>>());
+		vClients.back()->SetConnectionOptions(BenchConnectionOptions());
+		vClients.back()->Connect("127.0.0.1", nPort);
+	}
+	server.WaitValidated(nClients);
+
+	bench_message msg;
+	msg.header.id = BenchMsgTypes::Echo;
+	msg << payload<64>{};
+
+	// Se manda en lotes para que se mida el envío y no solo la latencia de cada ronda.
+	const size_t nBatch = 16;
+
+	bench_result& result = harness.Measure(sName, 2000, [&](size_t nOps) {
+			auto tpStart = bench_clock::now();
+			for (size_t nSent = 0; nSent < nOps; nSent += nBatch) {
+				size_t nCount = std::min(nBatch, nOps - nSent);
+				for (size_t i = 0; i < nCount; i++) {
+					server.MessageAllClients(msg);
+				}
+				for (auto& pClient : vClients) {
+					WaitMessages(pClient->Incoming(), nCount);
+				}
+			}
+			return SecondsSince(tpStart);
+		});
+
+	result.vExtra.emplace_back("ns_per_delivery", result.dMedian / double(nClients));
+
+	for (auto& pClient : vClients) {
+		pClient->Disconnect();
+	}
+}
+
+// Estados como delta (BroadcastSnapshot) de 64 KiB con N clientes conectados.
+	// Cada operación es un tick: se avanza el estado, se envía a todos y termina cuando todos lo reconstruyeron.
+	// Además del tiempo se reportan los bytes enviados contra los del estado completo, y el CPU por cliente.
+void BenchSnapshotBroadcast(bench_harness& harness, uint16_t nPort, size_t nClients) {
+	std::string sName = "snapshot/broadcast/clients_" + std::to_string(nClients);
+	if (!harness.Enabled(sName)) {
+		return;
+	}
+
+	EchoServer server(nPort);
+	server.Start();
+
+	std::vector<std::unique_ptr<cap::net::client_interface<BenchMsgTypes>>> vClients;
+	for (size_t i = 0; i < nClients; i++) {
+		vClients.push_back(std::make_unique<cap::net::client_interface<BenchMsgTypes>>());
+		vClients.back()->SetConnectionOptions(BenchConnectionOptions());
+		vClients.back()->Connect("127.0.0.1", nPort);
+	}
+	server.WaitValidated(nClients);
+
+	std::vector<uint8_t> vState = MakeSnapshot(64 * 1024);
+
+	bench_result& result = harness.Measure(sName, 2000, [&](size_t nOps) {
+			auto tpStart = bench_clock::now();
+			for (size_t i = 0; i < nOps; i++) {
+				AdvanceSnapshot(vState);
+				server.BroadcastSnapshot(BenchMsgTypes::Echo, vState);
+				for (auto& pClient : vClients) {
+					WaitMessages(pClient->Incoming(), 1);
+				}
+			}
+			return SecondsSince(tpStart);
+		});
+
+	cap::net::snapshot_stats stats = server.GetSnapshotStats();
+	result.vExtra.emplace_back("sent_ratio", stats.Ratio());
+	result.vExtra.emplace_back("bytes_per_client_tick", stats.nFull + stats.nDeltas > 0 ? double(stats.nSentBytes) / double(stats.nFull + stats.nDeltas) : 0.0);
+	result.vExtra.emplace_back("encode_p50_ns_per_client", double(stats.encode.Percentile(50.0)));
+	result.vExtra.emplace_back("encode_mean_ns_per_client", stats.encode.Mean());
+
+	for (auto& pClient : vClients) {
+		pClient->Disconnect();
+	}
+}
+
+// Aceptar y validar conexiones: cada operación es una conexión nueva hasta que el servidor la valida.
+	// Los clientes comparten un solo contexto de asio, así se mide al servidor y no la creación de procesos.
+void BenchAcceptValidate(bench_harness& harness, uint16_t nPort, size_t nBatch) {
+	std::string sName = "server/accept_validate/batch_" + std::to_string(nBatch);
+	if (!harness.Enabled(sName)) {
+		return;
+	}
+
+	EchoServer server(nPort);
+	server.Start();
+
+	asio::io_context context;
+	auto work = asio::make_work_guard(context);
+	std::thread thrContext([&]() { context.run(); });
+
+	asio::ip::tcp::resolver resolver(context);
+	auto endpoints = resolver.resolve("127.0.0.1", std::to_string(nPort));
+
+	harness.Measure(sName, nBatch, [&](size_t nOps) {
+			cap::net::tsqueue<cap::net::owned_message<BenchMsgTypes>> qIn;
+			std::vector<std::unique_ptr<cap::net::connection<BenchMsgTypes>>> vConnections;
+			size_t nTarget = server.Validated() + nOps;
+
+			auto tpStart = bench_clock::now();
+			for (size_t i = 0; i < nOps; i++) {
+				vConnections.push_back(std::make_unique<cap::net::connection<BenchMsgTypes>>(cap::net::connection<BenchMsgTypes>::owner::client,
+					context, asio::ip::tcp::socket(context), qIn, BenchConnectionOptions()));
+				vConnections.back()->ConnectToServer(endpoints);
+			}
+			server.WaitValidated(nTarget);
+			double dSeconds = SecondsSince(tpStart);
+
+			// Cerramos las conexiones y esperamos a que el contexto procese los cierres (y las lecturas canceladas)
+			// antes de destruirlas, así se liberan los sockets entre repeticiones.
+			for (auto& pConnection : vConnections) {
+				pConnection->Disconnect();
+			}
+			for (int i = 0; i < 2; i++) {
+				std::promise<void> promise;
+				asio::post(context, [&]() { promise.set_value(); });
+				promise.get_future().wait();
+			}
+
+			return dSeconds;
+		});
+
+	work.reset();
+	context.stop();
+	thrContext.join();
+}
+
+// Ráfaga de conexiones, como cuando todos los clientes vuelven a la vez después de una caída: cada operación es una
+	// conexión TCP (sin validarse) hasta que el servidor la acepta o la rechaza, con nPending aceptaciones pendientes.
+	// Con nMaxPerIp todas menos la primera se rechazan por su dirección, y se mide lo que cuesta rechazar.
+void BenchAcceptRate(bench_harness& harness, uint16_t nPort, size_t nPending, uint32_t nMaxPerIp) {
+	std::string sName = nMaxPerIp > 0 ? "server/accept_rate/per_ip_cap" : "server/accept_rate/pending_" + std::to_string(nPending);
+	if (!harness.Enabled(sName)) {
+		return;
+	}
+
+	cap::net::acceptor_options options;
+	options.nPendingAccepts = nPending;
+	options.nMaxConnectionsPerIp = nMaxPerIp;
+	options.bLogAccepts = false;
+
+	EchoServer server(nPort, options);
+	server.Start();
+
+	asio::io_context context;
+	auto work = asio::make_work_guard(context);
+	std::thread thrContext([&]() { context.run(); });
+
+	asio::ip::tcp::endpoint endpoint(asio::ip::make_address("127.0.0.1"), nPort);
+	const size_t nBurst = 200;
+
+	bench_result& result = harness.Measure(sName, nBurst, [&](size_t nOps) {
+			std::vector<std::unique_ptr<asio::ip::tcp::socket>> vSockets;
+			uint64_t nTarget = server.AcceptedOrRejected() + nOps;
+
+			auto tpStart = bench_clock::now();
+			for (size_t i = 0; i < nOps; i++) {
+				vSockets.push_back(std::make_unique<asio::ip::tcp::socket>(context));
+				vSockets.back()->async_connect(endpoint, [](std::error_code) {});
+			}
+			while (server.AcceptedOrRejected() < nTarget) {
+				std::this_thread::sleep_for(std::chrono::microseconds(50));
+			}
+			double dSeconds = SecondsSince(tpStart);
+
+			// Cerramos desde el proceso del contexto y esperamos, así los sockets se destruyen sin operaciones pendientes.
+			std::promise<void> promise;
+			asio::post(context, [&]() {
+					for (auto& pSocket : vSockets) {
+						std::error_code ec;
+						pSocket->close(ec);
+					}
+					promise.set_value();
+				});
+			promise.get_future().wait();
+			for (int i = 0; i < 2; i++) {
+				std::promise<void> flushed;
+				asio::post(context, [&]() { flushed.set_value(); });
+				flushed.get_future().wait();
+			}
+
+			return dSeconds;
+		});
+
+	result.vExtra.emplace_back("connections_per_s", 1e9 / result.dMedian);
+
+	work.reset();
+	context.stop();
+	thrContext.join();
+}
+
+// Conectar y recibir la respuesta al primer mensaje: cada operación conecta, manda un eco sin esperar a la validación
+	// (sale detrás de ella) y espera a que regrese. Con bResumed las conexiones usan el boleto de la anterior,
+	// así el servidor no pide la respuesta al desafío y el eco sale junto con el saludo.
+	// El cliente usa un contexto compartido, así la medición no incluye crear procesos.
+void BenchConnectFirstReply(bench_harness& harness, uint16_t nPort, bool bResumed) {
+	std::string sName = std::string("connect/first_reply/") + (bResumed ? "resumed" : "challenge");
+	if (!harness.Enabled(sName)) {
+		return;
+	}
+
+	cap::net::connection_options options = BenchConnectionOptions();
+	options.handshake.bResumption = bResumed;
+
+	EchoServer server(nPort);
+	server.SetConnectionOptions(options);
+
+	cap::net::io_pool pool(1);
+	cap::net::client_interface<BenchMsgTypes> client(pool);
+	client.SetConnectionOptions(options);
+
+	bench_message msg;
+	msg.header.id = BenchMsgTypes::Echo;
+	msg << uint64_t(0);
+
+	{
+		server_runner runner(server);
+
+		// La primera conexión hace la validación completa y deja el boleto para las siguientes.
+		client.Connect("127.0.0.1", nPort);
+		WaitUntilValidated(client);
+		client.Disconnect();
+
+		harness.Measure(sName, 200, [&](size_t nOps) {
+				double dSeconds = 0.0;
+				for (size_t i = 0; i < nOps; i++) {
+					// Solo se mide hasta que llega la respuesta, no el cierre.
+					auto tpStart = bench_clock::now();
+					client.Connect("127.0.0.1", nPort);
+					client.Send(msg);
+					client.Incoming().wait();
+					dSeconds += SecondsSince(tpStart);
+
+					client.Incoming().clear();
+					client.Disconnect();
+				}
+				return dSeconds;
+			});
+	}
+	client.Disconnect();
+}
+
+// Memoria de las conexiones inactivas: cada operación crea una conexión del servidor como las que se aceptan (desde el
+	// slab_pool, ver server_interface::MakeConnection()), y se mide cuanto heap ocupa cada una con nOps vivas a la vez.
+	// Los sockets no se abren (no hay 100k descriptores en una prueba), así que no cuentan los buffers del kernel,
+	// solo lo que reserva la librería. Los slabs se reutilizan entre repeticiones, por eso se cuentan los bloques en uso.
+void BenchIdleConnections(bench_harness& harness, size_t nConnections) {
+	std::string sName = "memory/idle_connection/" + std::to_string(nConnections / 1000) + "k";
+	if (!harness.Enabled(sName)) {
+		return;
+	}
+
+	asio::io_context context;
+	cap::net::tsqueue<cap::net::owned_message<BenchMsgTypes>> qIn;
+	cap::net::connection_options options = BenchConnectionOptions();
+	double dBytesPerConnection = 0.0;
+
+	bench_result& result = harness.Measure(sName, nConnections, [&](size_t nOps) {
+			// El arreglo se reserva antes de medir, así no cuenta como memoria de las conexiones.
+			std::vector<bench_connection> vConnections;
+			vConnections.reserve(nOps);
+
+			int64_t nHeapBefore = g_nHeapBytes.load() - int64_t(cap::net::slab_pool::TotalReservedBytes()) + int64_t(cap::net::slab_pool::TotalUsedBytes());
+			auto tpStart = bench_clock::now();
+			for (size_t i = 0; i < nOps; i++) {
+				vConnections.push_back(std::allocate_shared<cap::net::connection<BenchMsgTypes>>(cap::net::slab_allocator<cap::net::connection<BenchMsgTypes>>(),
+					cap::net::connection<BenchMsgTypes>::owner::server, context, asio::ip::tcp::socket(context), qIn, options));
+			}
+			double dSeconds = SecondsSince(tpStart);
+			int64_t nHeapAfter = g_nHeapBytes.load() - int64_t(cap::net::slab_pool::TotalReservedBytes()) + int64_t(cap::net::slab_pool::TotalUsedBytes());
+			dBytesPerConnection = double(nHeapAfter - nHeapBefore) / double(nOps);
+			return dSeconds;
+		});
+
+	result.vExtra.emplace_back("bytes_per_connection", dBytesPerConnection);
+	result.vExtra.emplace_back("sizeof_connection", double(sizeof(cap::net::connection<BenchMsgTypes>)));
+	fprintf(stderr, "%-40s %12.0f bytes/connection (sizeof %zu)\n", "", dBytesPerConnection, sizeof(cap::net::connection<BenchMsgTypes>));
+}
+
+//*****************************************************************************//
+
+// Imprime como se usa el programa.
+void PrintUsage() {
+	printf("Uso: NetBench [opciones]\n"
+		"  --filter <texto>       solo corre las pruebas cuyo nombre contenga el texto\n"
+		"  --repetitions <n>      repeticiones medidas de cada prueba (5)\n"
+		"  --quick                corre 10 veces menos operaciones\n"
+		"  --json                 imprime el resultado como JSON en la ultima linea\n"
+		"  --out <archivo>        guarda el resultado como JSON en el archivo\n");
+}
+
+// Lee los argumentos, retorna falso si alguno no es valido.
+bool ParseArgs(int argc, char** argv, bench_config& config) {
+	for (int i = 1; i < argc; i++) {
+		std::string sArg = argv[i];
+
+		if (sArg == "--quick") { config.bQuick = true; continue; }
+		if (sArg == "--json") { config.bJson = true; continue; }
+
+		if (i + 1 >= argc || sArg == "--help" || sArg == "-h") {
+			return false;
+		}
+		std::string sValue = argv[++i];
+
+		if (sArg == "--filter") config.sFilter = sValue;
+		else if (sArg == "--repetitions") config.nRepetitions = std::max<size_t>(std::strtoul(sValue.c_str(), nullptr, 10), 1);
+		else if (sArg == "--out") config.sOutPath = sValue;
+		else return false;
+	}
+
+	return true;
+}
+
+int main(int argc, char** argv) {
+	bench_config config;
+	if (!ParseArgs(argc, argv, config)) {
+		PrintUsage();
+		return 1;
+	}
+
+	bench_harness harness(config);
+
+	// Primitivas.
+	BenchMessage<8>(harness);
+	BenchMessage<64>(harness);
+	BenchMessage<1024>(harness);
+	BenchMessage<16384>(harness);
+	BenchMessageMany(harness, 16);
+	BenchSmallMessage<BenchMsgTypes>(harness, "inline");
+	BenchSmallMessage<BenchHeapMsgTypes>(harness, "heap");
+	BenchMessageMany(harness, 256);
+	BenchMessageVector(harness, 256);
+	BenchOwnedMessageCopy(harness, 0);
+	BenchOwnedMessageCopy(harness, 64);
+	BenchOwnedMessageCopy(harness, 1024);
+	BenchOwnedMessageCopy(harness, 16384);
+	BenchTsqueue(harness, 1);
+	BenchTsqueue(harness, 2);
+	BenchTsqueue(harness, 4);
+	BenchCompress(harness, "snapshot", MakeSnapshot(1024));
+	BenchCompress(harness, "snapshot", MakeSnapshot(16 * 1024));
+	BenchCompress(harness, "snapshot", MakeSnapshot(256 * 1024));
+	BenchCompress(harness, "random", MakeRandom(16 * 1024));
+	BenchDelta(harness, 64 * 1024);
+	BenchByteSwap(harness, 4);
+	BenchByteSwap(harness, 8);
+	BenchOutbox(harness, 0);
+	BenchOutbox(harness, 64);
+	BenchOutbox(harness, 1);
+	BenchIdleConnections(harness, 100000);
+
+	// Red por loopback, cada prueba en su propio puerto.
+		// Los puertos quedan debajo de los puertos efímeros (Linux usa desde 32768 y Windows desde 49152), así un cliente
+		// de una prueba anterior que quedo en TIME_WAIT con el mismo puerto no impide escuchar en el.
+	BenchCallbackRoundTrips(harness, 30100);
+	BenchLoopbackRoundTrips(harness);
+	BenchSnapshotRoundTrips(harness, 30108, cap::net::compression_codec::none);
+	BenchSnapshotRoundTrips(harness, 30109, cap::net::compression_codec::lz);
+#if defined(ASIO_HAS_CO_AWAIT)
+	BenchCoroRoundTrips(harness, 30101);
+#endif
+	BenchFanout(harness, 30102, 1);
+	BenchFanout(harness, 30103, 8);
+	BenchFanout(harness, 30104, 32);
+	BenchAcceptValidate(harness, 30105, 50);
+	BenchAcceptRate(harness, 30113, 1, 0);
+	BenchAcceptRate(harness, 30114, 8, 0);
+	BenchAcceptRate(harness, 30115, 8, 1);
+	BenchConnectFirstReply(harness, 30106, false);
+	BenchConnectFirstReply(harness, 30107, true);
+	BenchSnapshotBroadcast(harness, 30110, 1);
+	BenchSnapshotBroadcast(harness, 30111, 8);
+	BenchSnapshotBroadcast(harness, 30112, 32);
+
+#if defined(NETBENCH_TRACE)
+	if (cap::net::tracer::ExportChromeTrace("netbench_trace.json")) {
+		fprintf(stderr, "rastreo: se guardo en netbench_trace.json\n");
+	}
+#endif
+
+	std::string sJson = harness.Json();
+	if (config.bJson) {
+		printf("%s\n", sJson.c_str());
+	}
+	if (!config.sOutPath.empty()) {
+		std::ofstream file(config.sOutPath);
+		file << sJson << "\n";
+	}
+
+	return 0;
+}
\ No newline at end of file
@@ -1,17 +1,17 @@
 /*********************************************************************
-* Este ser el cliente que se encargara de hacer todos los procesos  *
-* y mandarlos al servidor, tambin se puede decir que aqu se puede  *
-* llevar el sistema que se quiere como un juego, aplicacin, etc.    *
+* Este será el cliente que se encargara de hacer todos los procesos  *
+* y mandarlos al servidor, también se puede decir que aquí se puede  *
+* llevar el sistema que se quiere como un juego, aplicación, etc.    *
 *********************************************************************/
 
 #include <iostream>
 #include "../NetCommon/cap_net.h"
 
-// Esta es una clase enumerada que se encargara de ser el tipo de mensajes que procesara la librera esttica CapNet
+// Esta es una clase enumerada que se encargara de ser el tipo de mensajes que procesara la librería estática CapNet
 enum class CustomMsgTypes : uint32_t {
 	// Tiene 5 miembros enumerados de tipo entero de 32 bits sin asignar.
-	// Estos sern los mensajes que se podrn manejar al utilizarse con el CapNet.
-	// Tambin estos nos serviran para indicarle al sistema del cliente que hacer.
+	// Estos serán los mensajes que se podrán manejar al utilizarse con el CapNet.
+	// También estos nos serviran para indicarle al sistema del cliente que hacer.
 	ServerAccept,
 	ServerDeny,
 	ServerPing,
@@ -26,39 +26,63 @@ private:
 
 protected:
 
+	// Canal RPC que empareja las respuestas del servidor con las peticiones hechas.
+	cap::net::rpc_channel<CustomMsgTypes> m_rpc{ [this](const cap::net::message<CustomMsgTypes>& msg) { Send(msg); }, [this]() { return IsConnected(); } };
+
 public:
 
-	// Funcin que nos permitir pingear al servidor.
+	// Retorna el canal RPC para que el ciclo principal le entregue los mensajes y lo actualice.
+	cap::net::rpc_channel<CustomMsgTypes>& Rpc() {
+		return m_rpc;
+	}
+
+	// Función que nos permitirá pingear al servidor.
 	void PingServer() {
-		// Creamos la variable de mensaje que aceptara el tipo de instruccin creada en la clase
+		// Creamos la variable de mensaje que aceptara el tipo de instrucción creada en la clase
 		// enumerada de CustomMsgTypes.
 		cap::net::message<CustomMsgTypes> msg;
 
-		// Le asignamos el tipo de id con instruccin que queremos.
+		// Le asignamos el tipo de id con instrucción que queremos.
 		msg.header.id = CustomMsgTypes::ServerPing;
 
-		// Para medir el tiempo de respuesta, tenemos que medir el tiempo y he aqu el problema.
-		// Necesitamos usar la librera chrono para esto ya que esto tiene unos mtodos y clases necesarios,
-		// lo que pasa es que esto es un poco "sucio" ya que normalmente se utiliza otros mtodos para medir
-		// ese tipo de cosas. An as hay que tener mucho cuidado con esto.
+		// Para medir el tiempo de respuesta, tenemos que medir el tiempo y he aquí el problema.
+		// Necesitamos usar la librería chrono para esto ya que esto tiene unos métodos y clases necesarios,
+		// lo que pasa es que esto es un poco "sucio" ya que normalmente se utiliza otros métodos para medir
+		// ese tipo de cosas. Aún así hay que tener mucho cuidado con esto.
 
-		// Creamos la variable que medir el punto del tiempo en el momento de la ejecucin
+		// Creamos la variable que medirá el punto del tiempo en el momento de la ejecución
 		std::chrono::system_clock::time_point timeNow = std::chrono::system_clock::now();
 
 		// Ahora lo agregamos al mensaje.
 		msg << timeNow;
 
-		// Y lo enviamos.
-		Send(msg);
+		// Y lo enviamos como petición RPC, así la respuesta llega directo a esta función en vez de buscarla a mano.
+		m_rpc.Call(msg, std::chrono::seconds(5), [](cap::net::rpc_result<CustomMsgTypes>& result) {
+				if (result.status == cap::net::rpc_status::ok) {
+					// Creamos de nuevo el tiempo actual con la librería chrono y a una variable le llamamos de en eso "then"
+					// que tomara el valor del mensaje.
+					std::chrono::system_clock::time_point timeNow = std::chrono::system_clock::now();
+					std::chrono::system_clock::time_point timeThen;
+
+					// Tomamos el mensaje enviado que guardaba el tiempo en el momento de hacer la petición y lo guardamos.
+					result.msg >> timeThen;
+
+					// He imprimimos el resultado
+					printf("Ping: %lf\n", std::chrono::duration<double>(timeNow - timeThen).count());
+				}
+				else {
+					printf("El ping no tuvo respuesta.\n");
+				}
+			});
 	}
 
-	// Funcin que permitira mandar un mensaje a todos los clientes.
+	// Función que permitira mandar un mensaje a todos los clientes.
 	void MessageAll() {
-		// Creamos la variable de mensaje que aceptara el tipo de instruccin creada en la clase
+		// Creamos la variable de mensaje que aceptara el tipo de instrucción creada en la clase
 		// enumerada de CustomMsgTypes.
 		cap::net::message<CustomMsgTypes> msg;
 
-		// Le ponemos de Id al mensaje la instruccin de mensaje a todos.
+		// Le ponemos de Id al mensaje la instrucción de mensaje a todos.
 		msg.header.id = CustomMsgTypes::MessageAll;
 
 		// Lo mandamos.
@@ -84,7 +108,7 @@ int main() {
 
 		// Verificamos que la ventana es la principal (activa).
 		if (GetForegroundWindow() == GetConsoleWindow()) {
-			// Y aqu estableceremos si las teclas 1, 2 y 3 han sido activadas.
+			// Y aquí estableceremos si las teclas 1, 2 y 3 han sido activadas.
 			key[0] = GetAsyncKeyState((unsigned short)'1') & 0x8000;
 			key[1] = GetAsyncKeyState((unsigned short)'2') & 0x8000;
 			key[2] = GetAsyncKeyState((unsigned short)'3') & 0x8000;
@@ -93,44 +117,37 @@ int main() {
 		// Verificamos que la tecla fue presionada y si si, esta ejecutara algo especial.
 		if (key[0] && !old_key[0]) { client.PingServer(); } // Pingearemos el servidor
 		if (key[1] && !old_key[1]) { client.MessageAll(); }
-		if (key[2] && !old_key[2]) { bQuit = true; } // Cancelaremos la conexin.
+		if (key[2] && !old_key[2]) { bQuit = true; } // Cancelaremos la conexión.
 
-		// Y ahora ya que se quedo grabado la tecla antes presionada, ahora la ponemos como antigua, para as generar el evento
+		// Y ahora ya que se quedo grabado la tecla antes presionada, ahora la ponemos como antigua, para así generar el evento
 		// Al presionar, Mantenida y dejar de presionar.
 		for (int i = 0; i < 3; i++) {
 			old_key[i] = key[i];
 		}
 
+		// Vencemos las peticiones RPC que ya pasaron su tiempo límite.
+		client.Rpc().Update();
+
 		// Verificamos que el cliente este conectado.
 		if (client.IsConnected()) {
-			// Verificamos que la cola de mensajes no este vaca.
+			// Verificamos que la cola de mensajes no este vacía.
 			if (!client.Incoming().empty()) {
 
-				// Si no esta vaca entonces comenzaremos tomando mensajes.
+				// Si no esta vacía entonces comenzaremos tomando mensajes.
 				auto msg = client.Incoming().pop_front().msg;
 
+				// Si es la respuesta a una petición RPC, el canal se encarga de ella.
+				if (client.Rpc().Dispatch(msg)) {
+					continue;
+				}
+
 				// Ahora verificaremos que tipo de mensaje fue el tomado y haremos un caso dependiente de este.
 				switch (msg.header.id) {
 
-					// Caso en el que el server haya aceptado la conexin.
+					// Caso en el que el server haya aceptado la conexión.
 					case CustomMsgTypes::ServerAccept: {
-						// Indicamos que el servidor acepto nuestra conexin.
-						printf("El servidor ha aceptado la conexin.\n");
-					}
-					break;
-
-					// Caso en el que se pidio el ping.
-					case CustomMsgTypes::ServerPing: {
-						// Creamos de nuevo el tiempo actual con la librera chrono y a una variable le llamamos de en eso "then"
-						// que tomara el valor del mensaje.
-						std::chrono::system_clock::time_point timeNow = std::chrono::system_clock::now();
-						std::chrono::system_clock::time_point timeThen;
-
-						// Tomamos el mensaje enviado que guardaba el tiempo en el momento de hacer la peticin y lo guardamos.
-						msg >> timeThen;
-
-						// He imprimimos el resultado
-						printf("Ping: %lf\n", std::chrono::duration<double>(timeNow - timeThen).count());
+						// Indicamos que el servidor acepto nuestra conexión.
+						printf("El servidor ha aceptado la conexión.\n");
 					}
 					break;
 
@@ -141,7 +158,7 @@ int main() {
 						msg >> clientID;
 
 						// He imprimimos el resultado con un formato bonito.
-						printf("[%u] Te ha mandado saludos!.\n", clientID);
+						printf("[%u] ¡Te ha mandado saludos!.\n", clientID);
 					}
 					break;
 
@@ -149,7 +166,7 @@ int main() {
 			}
 		}
 		else {
-			// Si no esta conectado, entonces significa que el servidor cerro la conexin, as que informamos y salimos del while.
+			// Si no esta conectado, entonces significa que el servidor cerro la conexión, así que informamos y salimos del while.
 			printf("Servidor cerrado\n");
 			bQuit = true;
 		}
@@ -5,4 +5,21 @@
 #include "net_client.h"
 #include "net_server.h"
 #include "net_connection.h"
-#include "net_tsqueue.h"
\ No newline at end of file
+#include "net_tsqueue.h"
+#include "net_options.h"
+#include "net_topics.h"
+#include "net_rpc.h"
+#include "net_coro.h"
+#include "net_metrics.h"
+#include "net_trace.h"
+#include "net_capture.h"
+#include "net_io_pool.h"
+#include "net_compress.h"
+#include "net_snapshot.h"
+#include "net_ratelimit.h"
+#include "net_admission.h"
+#include "net_memory.h"
+#include "net_body.h"
+#include "net_wire.h"
+#include "net_outbox.h"
+#include "net_federation.h"
\ No newline at end of file
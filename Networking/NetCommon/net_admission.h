@@ -0,0 +1,133 @@
+#pragma once
+
+#include "net_common.h"
+
+#include <array>
+#include <cstring>
+
+namespace cap {
+	namespace net {
+
+		// Tabla compacta de conexiones abiertas por dirección IP, para limitar cuantas puede tener cada una.
+			// Es de direccionamiento abierto (sondeo lineal) en un solo arreglo: cada casilla son los 16 bytes de la
+			// dirección y su cuenta, sin nodos ni memoria por entrada, así revisarla al aceptar cuesta casi nada.
+			// Las direcciones IPv4 se guardan como IPv6 mapeadas (::ffff:a.b.c.d), así ambas comparten la tabla.
+			// No tiene bloqueos, solo se debe usar desde un proceso (el de asio del servidor).
+		class ip_connection_table {
+		public:
+			using key = std::array<uint8_t, 16>;
+
+			// Convierte una dirección en su llave de la tabla.
+			static key Key(const asio::ip::address& address) {
+				key k{};
+				if (address.is_v4()) {
+					auto bytes = address.to_v4().to_bytes();
+					k[10] = 0xFF;
+					k[11] = 0xFF;
+					std::memcpy(k.data() + 12, bytes.data(), bytes.size());
+				}
+				else {
+					auto bytes = address.to_v6().to_bytes();
+					std::memcpy(k.data(), bytes.data(), bytes.size());
+				}
+				return k;
+			}
+
+			// Suma una conexión a la dirección, a menos que ya tenga nMax (cero no limita), en cuyo caso retorna falso.
+			bool Acquire(const key& k, uint32_t nMax) {
+				// Crecemos antes de pasar de 3/4 de ocupación, así las búsquedas siguen siendo cortas.
+				if ((this->m_nUsed + 1) * 4 > this->m_vSlots.size() * 3) {
+					this->Grow();
+				}
+
+				slot& s = this->m_vSlots[this->Find(k)];
+				if (s.nCount == 0) {
+					s.k = k;
+					this->m_nUsed++;
+				}
+				else if (nMax > 0 && s.nCount >= nMax) {
+					return false;
+				}
+
+				s.nCount++;
+				return true;
+			}
+
+			// Resta una conexión a la dirección, y la saca de la tabla cuando ya no tiene ninguna.
+			void Release(const key& k) {
+				if (this->m_vSlots.empty()) {
+					return;
+				}
+
+				size_t i = this->Find(k);
+				if (this->m_vSlots[i].nCount == 0 || --this->m_vSlots[i].nCount > 0) {
+					return;
+				}
+
+				// Borrado sin marcas: recorremos hacia atrás las casillas que siguen y cuya posición ideal
+					// queda antes del hueco, así ninguna búsqueda se corta antes de encontrarlas.
+				this->m_nUsed--;
+				size_t nMask = this->m_vSlots.size() - 1;
+				size_t nHole = i;
+				for (size_t j = (i + 1) & nMask; this->m_vSlots[j].nCount > 0; j = (j + 1) & nMask) {
+					size_t nHome = Hash(this->m_vSlots[j].k) & nMask;
+					if (((j - nHome) & nMask) >= ((j - nHole) & nMask)) {
+						this->m_vSlots[nHole] = this->m_vSlots[j];
+						nHole = j;
+					}
+				}
+				this->m_vSlots[nHole] = slot{};
+			}
+
+			// Retorna cuantas conexiones tiene la dirección.
+			uint32_t Count(const key& k) const {
+				return this->m_vSlots.empty() ? 0 : this->m_vSlots[this->Find(k)].nCount;
+			}
+
+			// Retorna cuantas direcciones distintas tienen conexiones.
+			size_t Size() const {
+				return this->m_nUsed;
+			}
+
+		protected:
+			// Una casilla vacía tiene cuenta cero.
+			struct slot {
+				key k{};
+				uint32_t nCount = 0;
+			};
+
+			static size_t Hash(const key& k) {
+				uint64_t a, b;
+				std::memcpy(&a, k.data(), sizeof(a));
+				std::memcpy(&b, k.data() + 8, sizeof(b));
+				uint64_t h = (a ^ (b * 0x9E3779B97F4A7C15ull)) * 0xBF58476D1CE4E5B9ull;
+				return size_t(h ^ (h >> 31));
+			}
+
+			// Retorna la casilla de la dirección, o la casilla vacía donde iría.
+			size_t Find(const key& k) const {
+				size_t nMask = this->m_vSlots.size() - 1;
+				size_t i = Hash(k) & nMask;
+				while (this->m_vSlots[i].nCount > 0 && this->m_vSlots[i].k != k) {
+					i = (i + 1) & nMask;
+				}
+				return i;
+			}
+
+			// Duplica el arreglo (siempre potencia de dos) y vuelve a acomodar las direcciones.
+			void Grow() {
+				std::vector<slot> vOld = std::move(this->m_vSlots);
+				this->m_vSlots.assign(std::max<size_t>(64, vOld.size() * 2), slot{});
+				for (const slot& s : vOld) {
+					if (s.nCount > 0) {
+						this->m_vSlots[this->Find(s.k)] = s;
+					}
+				}
+			}
+
+			std::vector<slot> m_vSlots;
+			size_t m_nUsed = 0;
+		};
+
+	}
+}
\ No newline at end of file
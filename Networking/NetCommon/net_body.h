@@ -0,0 +1,283 @@
+#pragma once
+
+#include "net_common.h"
+
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+
+namespace cap {
+	namespace net {
+
+		// Política del cuerpo de los mensajes por tipo de mensaje: cuantos bytes caben dentro del mensaje sin reservar memoria.
+			// La mayoría de los mensajes son pequeños (pings, IDs, confirmaciones), y con un std::vector cada uno reservaba
+			// memoria en el heap. Con 48 bytes el cuerpo completo ocupa 64 (una linea de cache).
+			// Para cambiarla se especializa para el tipo de mensajes de la aplicación, cero guarda todo en el heap:
+			//   namespace cap { namespace net { template <> struct body_policy<CustomMsgTypes> { static constexpr size_t nInlineCapacity = 112; }; } }
+			// Debe declararse antes de usar las clases de cap::net con ese tipo.
+		template <typename T>
+		struct body_policy {
+			static constexpr size_t nInlineCapacity = 48;
+		};
+
+		// Buffer de bytes con la misma interfaz que usa la librería de std::vector<uint8_t>, que guarda hasta nInline bytes
+		// dentro del objeto y solo reserva memoria en el heap si el contenido crece más.
+			// Una vez en el heap se queda ahí (crece al doble, como el vector) hasta Release() o shrink_to_fit().
+			// El tamaño y la capacidad son de 32 bits, igual que el tamaño en el encabezado de los mensajes.
+		template <size_t nInline>
+		class message_body {
+		public:
+			using value_type = uint8_t;
+			using iterator = uint8_t*;
+			using const_iterator = const uint8_t*;
+
+			message_body() noexcept = default;
+
+			message_body(const message_body& other) {
+				this->assign(other.begin(), other.end());
+			}
+
+			message_body(message_body&& other) noexcept {
+				this->Steal(other);
+			}
+
+			~message_body() {
+				this->FreeHeap();
+			}
+
+			message_body& operator = (const message_body& other) {
+				if (this != &other) {
+					this->assign(other.begin(), other.end());
+				}
+				return *this;
+			}
+
+			message_body& operator = (message_body&& other) noexcept {
+				if (this != &other) {
+					this->FreeHeap();
+					this->Steal(other);
+				}
+				return *this;
+			}
+
+			size_t size() const noexcept {
+				return this->m_nSize;
+			}
+
+			size_t capacity() const noexcept {
+				return this->m_nCapacity;
+			}
+
+			bool empty() const noexcept {
+				return this->m_nSize == 0;
+			}
+
+			// Indica si el contenido esta dentro del objeto (no reservo memoria).
+			bool IsInline() const noexcept {
+				return this->m_pData == this->m_aInline;
+			}
+
+			uint8_t* data() noexcept {
+				return this->m_pData;
+			}
+
+			const uint8_t* data() const noexcept {
+				return this->m_pData;
+			}
+
+			uint8_t* begin() noexcept {
+				return this->m_pData;
+			}
+
+			const uint8_t* begin() const noexcept {
+				return this->m_pData;
+			}
+
+			uint8_t* end() noexcept {
+				return this->m_pData + this->m_nSize;
+			}
+
+			const uint8_t* end() const noexcept {
+				return this->m_pData + this->m_nSize;
+			}
+
+			uint8_t& operator [] (size_t i) noexcept {
+				return this->m_pData[i];
+			}
+
+			const uint8_t& operator [] (size_t i) const noexcept {
+				return this->m_pData[i];
+			}
+
+			// Cambia el tamaño, los bytes nuevos quedan en cero como en el vector.
+			void resize(size_t nSize) {
+				this->resize(nSize, 0);
+			}
+
+			void resize(size_t nSize, uint8_t nValue) {
+				this->reserve(nSize);
+				if (nSize > this->m_nSize) {
+					std::memset(this->m_pData + this->m_nSize, nValue, nSize - this->m_nSize);
+				}
+				this->m_nSize = uint32_t(nSize);
+			}
+
+			// Asegura capacidad para nCapacity bytes, al crecer al menos duplica la anterior para que agregar de a poco
+				// (operator <<) no copie todo cada vez.
+				// Igual que el vector, pedir más de lo que puede guardar lanza std::length_error. Esto no revisa lecturas:
+				// operator >> revisa por su cuenta que el cuerpo tenga los bytes antes de leerlos.
+			void reserve(size_t nCapacity) {
+				if (nCapacity <= this->m_nCapacity) {
+					return;
+				}
+				if (nCapacity > UINT32_MAX) {
+					throw std::length_error("message_body");
+				}
+				this->Reallocate(std::min<size_t>(std::max<size_t>(nCapacity, size_t(this->m_nCapacity) * 2), UINT32_MAX));
+			}
+
+			void clear() noexcept {
+				this->m_nSize = 0;
+			}
+
+			void push_back(uint8_t nValue) {
+				if (this->m_nSize == this->m_nCapacity) {
+					this->reserve(size_t(this->m_nSize) + 1);
+				}
+				this->m_pData[this->m_nSize++] = nValue;
+			}
+
+			void assign(size_t nCount, uint8_t nValue) {
+				this->clear();
+				this->resize(nCount, nValue);
+			}
+
+			template <typename It, typename = typename std::iterator_traits<It>::iterator_category>
+			void assign(It first, It last) {
+				size_t nCount = size_t(std::distance(first, last));
+				this->reserve(nCount);
+				std::copy(first, last, this->m_pData);
+				this->m_nSize = uint32_t(nCount);
+			}
+
+			// Regresa el contenido dentro del objeto si cabe, o ajusta la memoria del heap a su tamaño.
+			void shrink_to_fit() {
+				if (this->IsInline() || this->m_nSize == this->m_nCapacity) {
+					return;
+				}
+				if (this->m_nSize <= nInline) {
+					uint8_t* pHeap = this->m_pData;
+					if (this->m_nSize > 0) {
+						std::memcpy(this->m_aInline, pHeap, this->m_nSize);
+					}
+					delete[] pHeap;
+					this->m_pData = this->m_aInline;
+					this->m_nCapacity = uint32_t(nInline);
+				}
+				else {
+					this->Reallocate(this->m_nSize);
+				}
+			}
+
+			// Vacía el cuerpo y libera la memoria del heap.
+			void Release() noexcept {
+				this->FreeHeap();
+				this->m_pData = this->m_aInline;
+				this->m_nSize = 0;
+				this->m_nCapacity = uint32_t(nInline);
+			}
+
+			// Intercambia el contenido, sin copiar si ambos están en el heap.
+			void swap(message_body& other) noexcept {
+				if (!this->IsInline() && !other.IsInline()) {
+					std::swap(this->m_pData, other.m_pData);
+					std::swap(this->m_nSize, other.m_nSize);
+					std::swap(this->m_nCapacity, other.m_nCapacity);
+					return;
+				}
+				message_body tmp(std::move(other));
+				other = std::move(*this);
+				*this = std::move(tmp);
+			}
+
+			friend void swap(message_body& a, message_body& b) noexcept {
+				a.swap(b);
+			}
+
+			// Compara el contenido, también contra un std::vector<uint8_t> como se hacia cuando el cuerpo era uno.
+			friend bool operator == (const message_body& a, const message_body& b) noexcept {
+				return Equal(a.data(), a.size(), b.data(), b.size());
+			}
+
+			friend bool operator == (const message_body& a, const std::vector<uint8_t>& b) noexcept {
+				return Equal(a.data(), a.size(), b.data(), b.size());
+			}
+
+			friend bool operator == (const std::vector<uint8_t>& a, const message_body& b) noexcept {
+				return Equal(a.data(), a.size(), b.data(), b.size());
+			}
+
+			friend bool operator != (const message_body& a, const message_body& b) noexcept {
+				return !(a == b);
+			}
+
+			friend bool operator != (const message_body& a, const std::vector<uint8_t>& b) noexcept {
+				return !(a == b);
+			}
+
+			friend bool operator != (const std::vector<uint8_t>& a, const message_body& b) noexcept {
+				return !(a == b);
+			}
+
+		protected:
+			static bool Equal(const uint8_t* pA, size_t nA, const uint8_t* pB, size_t nB) noexcept {
+				return nA == nB && (nA == 0 || std::memcmp(pA, pB, nA) == 0);
+			}
+
+			// Mueve el contenido de other a este cuerpo (que no debe tener memoria del heap) y deja a other vacío.
+				// La memoria del heap se pasa tal cual, lo que esta dentro del objeto se copia.
+			void Steal(message_body& other) noexcept {
+				if (other.IsInline()) {
+					this->m_pData = this->m_aInline;
+					this->m_nCapacity = uint32_t(nInline);
+					if (other.m_nSize > 0) {
+						std::memcpy(this->m_aInline, other.m_aInline, other.m_nSize);
+					}
+				}
+				else {
+					this->m_pData = other.m_pData;
+					this->m_nCapacity = other.m_nCapacity;
+					other.m_pData = other.m_aInline;
+					other.m_nCapacity = uint32_t(nInline);
+				}
+				this->m_nSize = other.m_nSize;
+				other.m_nSize = 0;
+			}
+
+			// Mueve el contenido a un bloque nuevo del heap de nCapacity bytes (sin inicializar).
+			void Reallocate(size_t nCapacity) {
+				uint8_t* pNew = new uint8_t[nCapacity];
+				if (this->m_nSize > 0) {
+					std::memcpy(pNew, this->m_pData, this->m_nSize);
+				}
+				this->FreeHeap();
+				this->m_pData = pNew;
+				this->m_nCapacity = uint32_t(nCapacity);
+			}
+
+			void FreeHeap() noexcept {
+				if (!this->IsInline()) {
+					delete[] this->m_pData;
+				}
+			}
+
+			uint8_t* m_pData = m_aInline;
+			uint32_t m_nSize = 0;
+			uint32_t m_nCapacity = uint32_t(nInline);
+
+			// Con nInline en cero el arreglo tiene un byte que nunca se usa, C++ no permite arreglos vacíos.
+			uint8_t m_aInline[nInline > 0 ? nInline : 1];
+		};
+
+	}
+}
\ No newline at end of file
@@ -0,0 +1,557 @@
+#pragma once
+
+#include "net_common.h"
+#include "net_message.h"
+#include "net_metrics.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace cap {
+	namespace net {
+
+		// Archivo mapeado a memoria al que solo se le agregan datos al final.
+			// Escribir es copiar a memoria, el sistema operativo se encarga de pasarlo al disco cuando le conviene,
+			// y si el programa se cae lo que ya se copio no se pierde (se queda en el cache de paginas del kernel).
+			// El archivo crece por bloques y al cerrarlo se recorta a lo que realmente se escribió.
+			// Nota: no es seguro entre procesos, se espera un solo escritor.
+		class mapped_append_file {
+		public:
+			// Cantidad de bytes que crece el archivo cada que se llena.
+			static constexpr size_t nGrowSize = size_t(64) * 1024 * 1024;
+
+			mapped_append_file() = default;
+			mapped_append_file(const mapped_append_file&) = delete;
+
+			virtual ~mapped_append_file() {
+				this->Close();
+			}
+
+			// Crea el archivo (si ya existía se sobrescribe) y lo mapea, retorna falso si no se pudo.
+			bool Open(const std::string& sPath) {
+				this->Close();
+
+#if defined(_WIN32)
+				this->m_hFile = CreateFileA(sPath.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+				if (this->m_hFile == INVALID_HANDLE_VALUE) {
+					return false;
+				}
+#else
+				this->m_nFile = ::open(sPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+				if (this->m_nFile < 0) {
+					return false;
+				}
+#endif
+
+				this->m_nSize = 0;
+				if (!this->Map(nGrowSize)) {
+					this->Close();
+					return false;
+				}
+				return true;
+			}
+
+			// Aparta nLength bytes al final del archivo y retorna donde escribirlos, o nullptr si no se pudo crecer.
+				// El pointer solo es valido hasta la siguiente llamada, ya que crecer puede mover el mapa.
+			uint8_t* Reserve(size_t nLength) {
+				if (!this->m_pData) {
+					return nullptr;
+				}
+
+				if (this->m_nSize + nLength > this->m_nCapacity) {
+					size_t nCapacity = this->m_nCapacity + std::max(nGrowSize, nLength);
+					if (!this->Map(nCapacity)) {
+						return nullptr;
+					}
+				}
+
+				uint8_t* pData = this->m_pData + this->m_nSize;
+				this->m_nSize += nLength;
+				return pData;
+			}
+
+			// Agrega los datos al final, retorna falso si no se pudo crecer el archivo.
+			bool Append(const void* pData, size_t nLength) {
+				uint8_t* pDest = this->Reserve(nLength);
+				if (!pDest) {
+					return false;
+				}
+				std::memcpy(pDest, pData, nLength);
+				return true;
+			}
+
+			// Pide al sistema operativo que empiece a escribir al disco lo que hay, sin esperar a que termine.
+			void Flush() {
+				if (!this->m_pData) {
+					return;
+				}
+#if defined(_WIN32)
+				FlushViewOfFile(this->m_pData, this->m_nSize);
+#else
+				msync(this->m_pData, this->m_nCapacity, MS_ASYNC);
+#endif
+			}
+
+			// Escribe al disco lo que hay y espera a que termine (fsync), así sobrevive aunque se caiga el sistema.
+				// Solo se escriben las paginas modificadas, pero igual cuesta una ida al disco, conviene juntar varias escrituras.
+			void Sync() {
+				if (!this->m_pData) {
+					return;
+				}
+#if defined(_WIN32)
+				FlushViewOfFile(this->m_pData, this->m_nSize);
+				FlushFileBuffers(this->m_hFile);
+#else
+				msync(this->m_pData, this->m_nSize, MS_SYNC);
+#endif
+			}
+
+			// Quita el mapa, recorta el archivo a lo escrito y lo cierra.
+			void Close() {
+				this->Unmap();
+
+#if defined(_WIN32)
+				if (this->m_hFile != INVALID_HANDLE_VALUE) {
+					LARGE_INTEGER nEnd;
+					nEnd.QuadPart = LONGLONG(this->m_nSize);
+					SetFilePointerEx(this->m_hFile, nEnd, nullptr, FILE_BEGIN);
+					SetEndOfFile(this->m_hFile);
+					CloseHandle(this->m_hFile);
+					this->m_hFile = INVALID_HANDLE_VALUE;
+				}
+#else
+				if (this->m_nFile >= 0) {
+					if (ftruncate(this->m_nFile, off_t(this->m_nSize)) != 0) {
+						// Si no se pudo recortar, el archivo se queda con ceros al final, quien lo lea debe usar su propio largo.
+					}
+					::close(this->m_nFile);
+					this->m_nFile = -1;
+				}
+#endif
+			}
+
+			// Retorna verdadero si el archivo esta abierto.
+			bool IsOpen() const {
+				return this->m_pData != nullptr;
+			}
+
+			// Retorna el inicio de lo escrito, solo es valido hasta la siguiente llamada a Reserve() o Append().
+			uint8_t* Data() {
+				return this->m_pData;
+			}
+
+			// Retorna la cantidad de bytes escritos.
+			size_t Size() const {
+				return this->m_nSize;
+			}
+
+		protected:
+			// Crece el archivo a la capacidad dada y lo vuelve a mapear completo.
+			bool Map(size_t nCapacity) {
+				this->Unmap();
+
+#if defined(_WIN32)
+				// Crear el mapa con un tamaño mayor al del archivo lo crece solo.
+				this->m_hMapping = CreateFileMappingA(this->m_hFile, nullptr, PAGE_READWRITE, DWORD(uint64_t(nCapacity) >> 32), DWORD(nCapacity & 0xFFFFFFFF), nullptr);
+				if (!this->m_hMapping) {
+					return false;
+				}
+
+				this->m_pData = static_cast<uint8_t*>(MapViewOfFile(this->m_hMapping, FILE_MAP_WRITE, 0, 0, nCapacity));
+				if (!this->m_pData) {
+					CloseHandle(this->m_hMapping);
+					this->m_hMapping = nullptr;
+					return false;
+				}
+#else
+				if (ftruncate(this->m_nFile, off_t(nCapacity)) != 0) {
+					return false;
+				}
+
+				void* pMap = mmap(nullptr, nCapacity, PROT_READ | PROT_WRITE, MAP_SHARED, this->m_nFile, 0);
+				if (pMap == MAP_FAILED) {
+					return false;
+				}
+				this->m_pData = static_cast<uint8_t*>(pMap);
+#endif
+
+				this->m_nCapacity = nCapacity;
+				return true;
+			}
+
+			// Quita el mapa actual, lo escrito se queda en el archivo.
+			void Unmap() {
+				if (!this->m_pData) {
+					return;
+				}
+
+#if defined(_WIN32)
+				UnmapViewOfFile(this->m_pData);
+				CloseHandle(this->m_hMapping);
+				this->m_hMapping = nullptr;
+#else
+				munmap(this->m_pData, this->m_nCapacity);
+#endif
+
+				this->m_pData = nullptr;
+				this->m_nCapacity = 0;
+			}
+
+#if defined(_WIN32)
+			HANDLE m_hFile = INVALID_HANDLE_VALUE;
+			HANDLE m_hMapping = nullptr;
+#else
+			int m_nFile = -1;
+#endif
+
+			// Inicio del mapa, bytes escritos y bytes mapeados.
+			uint8_t* m_pData = nullptr;
+			size_t m_nSize = 0;
+			size_t m_nCapacity = 0;
+		};
+
+		// Archivo mapeado a memoria solo para leer.
+		class mapped_file {
+		public:
+			mapped_file() = default;
+			mapped_file(const mapped_file&) = delete;
+
+			virtual ~mapped_file() {
+				this->Close();
+			}
+
+			// Abre y mapea el archivo completo, retorna falso si no se pudo.
+			bool Open(const std::string& sPath) {
+				this->Close();
+
+#if defined(_WIN32)
+				this->m_hFile = CreateFileA(sPath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+				if (this->m_hFile == INVALID_HANDLE_VALUE) {
+					return false;
+				}
+
+				LARGE_INTEGER nSize;
+				if (!GetFileSizeEx(this->m_hFile, &nSize)) {
+					this->Close();
+					return false;
+				}
+				this->m_nSize = size_t(nSize.QuadPart);
+
+				// Un archivo vacío no se puede mapear, pero es valido.
+				if (this->m_nSize > 0) {
+					this->m_hMapping = CreateFileMappingA(this->m_hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+					this->m_pData = this->m_hMapping ? static_cast<const uint8_t*>(MapViewOfFile(this->m_hMapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+					if (!this->m_pData) {
+						this->Close();
+						return false;
+					}
+				}
+#else
+				this->m_nFile = ::open(sPath.c_str(), O_RDONLY);
+				if (this->m_nFile < 0) {
+					return false;
+				}
+
+				struct stat st;
+				if (fstat(this->m_nFile, &st) != 0) {
+					this->Close();
+					return false;
+				}
+				this->m_nSize = size_t(st.st_size);
+
+				// Un archivo vacío no se puede mapear, pero es valido.
+				if (this->m_nSize > 0) {
+					void* pMap = mmap(nullptr, this->m_nSize, PROT_READ, MAP_PRIVATE, this->m_nFile, 0);
+					if (pMap == MAP_FAILED) {
+						this->Close();
+						return false;
+					}
+					this->m_pData = static_cast<const uint8_t*>(pMap);
+
+					// Se leerá de principio a fin, así el kernel puede adelantar la lectura.
+					madvise(pMap, this->m_nSize, MADV_SEQUENTIAL);
+				}
+#endif
+
+				this->m_bOpen = true;
+				return true;
+			}
+
+			// Quita el mapa y cierra el archivo.
+			void Close() {
+#if defined(_WIN32)
+				if (this->m_pData) {
+					UnmapViewOfFile(this->m_pData);
+				}
+				if (this->m_hMapping) {
+					CloseHandle(this->m_hMapping);
+					this->m_hMapping = nullptr;
+				}
+				if (this->m_hFile != INVALID_HANDLE_VALUE) {
+					CloseHandle(this->m_hFile);
+					this->m_hFile = INVALID_HANDLE_VALUE;
+				}
+#else
+				if (this->m_pData) {
+					munmap(const_cast<uint8_t*>(this->m_pData), this->m_nSize);
+				}
+				if (this->m_nFile >= 0) {
+					::close(this->m_nFile);
+					this->m_nFile = -1;
+				}
+#endif
+
+				this->m_pData = nullptr;
+				this->m_nSize = 0;
+				this->m_bOpen = false;
+			}
+
+			// Retorna verdadero si el archivo esta abierto.
+			bool IsOpen() const {
+				return this->m_bOpen;
+			}
+
+			const uint8_t* Data() const {
+				return this->m_pData;
+			}
+
+			size_t Size() const {
+				return this->m_nSize;
+			}
+
+		protected:
+#if defined(_WIN32)
+			HANDLE m_hFile = INVALID_HANDLE_VALUE;
+			HANDLE m_hMapping = nullptr;
+#else
+			int m_nFile = -1;
+#endif
+
+			const uint8_t* m_pData = nullptr;
+			size_t m_nSize = 0;
+			bool m_bOpen = false;
+		};
+
+		// Formato de los archivos de captura:
+			// Un encabezado (capture_file_header), seguido de un registro por mensaje: capture_record_header,
+			// el message_header<T> tal cual estaba en memoria y el cuerpo.
+			// Todo se guarda en el orden de bytes de la maquina, así que una captura solo se puede leer en
+			// una maquina de la misma arquitectura y con el mismo tipo de mensajes.
+		struct capture_file_header {
+			// Identificador del formato, siempre "CAPNETCP".
+			char magic[8] = { 'C', 'A', 'P', 'N', 'E', 'T', 'C', 'P' };
+
+			// Versión del formato, y el tamaño del message_header<T> con el que se capturo.
+			uint32_t nVersion = 1;
+			uint32_t nHeaderSize = 0;
+
+			// Momento en el que empezó la captura, en nanosegundos del reloj del sistema (solo informativo).
+			int64_t nStartTime = 0;
+
+			// Bytes de registros completos después del encabezado.
+				// Se actualiza después de cada registro, así se sabe donde terminan los datos validos aunque
+				// el programa se haya caído antes de recortar el archivo.
+			uint64_t nLength = 0;
+		};
+
+		// Encabezado de cada mensaje capturado.
+		struct capture_record_header {
+			// ID de la conexión que mando el mensaje.
+			uint32_t nConnection = 0;
+
+			// Tamaño del cuerpo guardado.
+			uint32_t nBodySize = 0;
+
+			// Nanosegundos desde que empezó la captura hasta que se termino de leer el mensaje del socket.
+			int64_t nTime = 0;
+		};
+
+		// Mensaje leído de una captura.
+		template <typename T>
+		struct captured_message {
+			// ID de la conexión que lo mando y cuando llego, medido desde el inicio de la captura.
+			uint32_t nConnection = 0;
+			std::chrono::nanoseconds time{ 0 };
+
+			message<T> msg;
+		};
+
+		// Escribe mensajes a un archivo de captura.
+			// Nota: no es seguro entre procesos, el servidor lo usa desde el proceso que llama a Update().
+		template <typename T>
+		class capture_writer {
+		public:
+			// Crea el archivo de captura, retorna falso si no se pudo.
+			bool Open(const std::string& sPath) {
+				if (!this->m_file.Open(sPath)) {
+					return false;
+				}
+
+				capture_file_header header;
+				header.nHeaderSize = sizeof(message_header<T>);
+				header.nStartTime = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+				this->m_file.Append(&header, sizeof(header));
+
+				this->m_tpStart = std::chrono::steady_clock::now();
+				this->m_nMessages = 0;
+				return true;
+			}
+
+			// Agrega un mensaje a la captura, tpReceived es cuando se termino de leer del socket.
+			bool Write(uint32_t nConnection, const message<T>& msg, std::chrono::steady_clock::time_point tpReceived) {
+				capture_record_header record;
+				record.nConnection = nConnection;
+				record.nBodySize = uint32_t(msg.body.size());
+				record.nTime = std::chrono::duration_cast<std::chrono::nanoseconds>(tpReceived - this->m_tpStart).count();
+
+				// Se aparta todo el registro de una vez, así solo se revisa una vez si hay que crecer el archivo.
+				size_t nLength = sizeof(record) + sizeof(message_header<T>) + msg.body.size();
+				uint8_t* pDest = this->m_file.Reserve(nLength);
+				if (!pDest) {
+					return false;
+				}
+
+				std::memcpy(pDest, &record, sizeof(record));
+				std::memcpy(pDest + sizeof(record), &msg.header, sizeof(message_header<T>));
+				if (!msg.body.empty()) {
+					std::memcpy(pDest + sizeof(record) + sizeof(message_header<T>), msg.body.data(), msg.body.size());
+				}
+
+				// Hasta ahora el registro cuenta como completo.
+				uint64_t nRecordsLength = uint64_t(this->m_file.Size() - sizeof(capture_file_header));
+				std::memcpy(this->m_file.Data() + offsetof(capture_file_header, nLength), &nRecordsLength, sizeof(nRecordsLength));
+
+				this->m_nMessages++;
+				return true;
+			}
+
+			// Cierra la captura.
+			void Close() {
+				this->m_file.Close();
+			}
+
+			bool IsOpen() const {
+				return this->m_file.IsOpen();
+			}
+
+			// Retorna cuantos mensajes se han guardado y cuantos bytes ocupa la captura.
+			uint64_t Messages() const {
+				return this->m_nMessages;
+			}
+
+			size_t Size() const {
+				return this->m_file.Size();
+			}
+
+		protected:
+			mapped_append_file m_file;
+			std::chrono::steady_clock::time_point m_tpStart;
+			uint64_t m_nMessages = 0;
+		};
+
+		// Lee los mensajes de un archivo de captura, en el orden en que llegaron.
+		template <typename T>
+		class capture_reader {
+		public:
+			// Abre la captura, retorna falso si no se pudo o si no es una captura del mismo tipo de mensajes.
+			bool Open(const std::string& sPath) {
+				if (!this->m_file.Open(sPath) || this->m_file.Size() < sizeof(capture_file_header)) {
+					this->m_file.Close();
+					return false;
+				}
+
+				std::memcpy(&this->m_header, this->m_file.Data(), sizeof(capture_file_header));
+				if (std::memcmp(this->m_header.magic, capture_file_header().magic, sizeof(this->m_header.magic)) != 0 ||
+					this->m_header.nVersion != 1 || this->m_header.nHeaderSize != sizeof(message_header<T>)) {
+					this->m_file.Close();
+					return false;
+				}
+
+				// Solo se lee hasta donde el escritor marco como completo.
+				this->m_nEnd = sizeof(capture_file_header) + size_t(std::min<uint64_t>(this->m_header.nLength, this->m_file.Size() - sizeof(capture_file_header)));
+				this->Rewind();
+				return true;
+			}
+
+			// Lee el siguiente mensaje, retorna falso al llegar al final.
+			bool Next(captured_message<T>& out) {
+				if (this->m_nOffset + sizeof(capture_record_header) + sizeof(message_header<T>) > this->m_nEnd) {
+					return false;
+				}
+
+				const uint8_t* pData = this->m_file.Data() + this->m_nOffset;
+				capture_record_header record;
+				std::memcpy(&record, pData, sizeof(record));
+
+				size_t nLength = sizeof(record) + sizeof(message_header<T>) + record.nBodySize;
+				if (this->m_nOffset + nLength > this->m_nEnd) {
+					return false;
+				}
+
+				out.nConnection = record.nConnection;
+				out.time = std::chrono::nanoseconds(record.nTime);
+				std::memcpy(&out.msg.header, pData + sizeof(record), sizeof(message_header<T>));
+				out.msg.body.assign(pData + sizeof(record) + sizeof(message_header<T>), pData + nLength);
+
+				this->m_nOffset += nLength;
+				return true;
+			}
+
+			// Regresa al primer mensaje.
+			void Rewind() {
+				this->m_nOffset = sizeof(capture_file_header);
+			}
+
+			// Retorna el encabezado de la captura.
+			const capture_file_header& Header() const {
+				return this->m_header;
+			}
+
+		protected:
+			mapped_file m_file;
+			capture_file_header m_header;
+
+			// Posición del siguiente registro y fin de los registros completos.
+			size_t m_nOffset = 0;
+			size_t m_nEnd = 0;
+		};
+
+		// Como se reparten en el tiempo los mensajes al reproducir una captura.
+		enum class replay_pacing {
+			// Lo más rápido posible, sirve para medir cuanto tardan los manejadores.
+			fastest,
+
+			// Respetando el tiempo en que llegaron originalmente (ajustado por replay_options::dSpeed).
+			original
+		};
+
+		// Opciones de la reproducción de una captura.
+		struct replay_options {
+			replay_pacing pacing = replay_pacing::fastest;
+
+			// Con el ritmo original, multiplica la velocidad (2.0 reproduce al doble de rápido).
+			double dSpeed = 1.0;
+		};
+
+		// Resultado de una reproducción.
+		struct replay_result {
+			// Mensajes entregados, bytes de sus cuerpos y conexiones que aparecieron en la captura.
+			uint64_t nMessages = 0;
+			uint64_t nBytes = 0;
+			uint64_t nConnections = 0;
+
+			// Segundos que tardo toda la reproducción.
+			double dSeconds = 0.0;
+
+			// Tiempo de cada llamada al manejador de mensajes.
+			histogram_snapshot handler;
+		};
+
+	}
+}
\ No newline at end of file
@@ -3,12 +3,14 @@
 #include "net_message.h"
 #include "net_tsqueue.h"
 #include "net_connection.h"
+#include "net_server.h"
+#include "net_io_pool.h"
 
 namespace cap {
 	namespace net {
 
-		// Esta clase es responsable de establecer y configurar asio y la conexin,
-		// tambin se comparte con un pointer para poder usar la aplicacin para comunicarse
+		// Esta clase es responsable de establecer y configurar asio y la conexión,
+		// también se comparte con un pointer para poder usar la aplicación para comunicarse
 		// con el server.
 
 		template <typename T>
@@ -22,15 +24,47 @@ namespace cap {
 
 			// Los contextos de asio manejas las transferencias de datos.
 			// Pero por cada contexto, este necesita su propio proceso para ejecutar sus comandos.
+				// El contexto puede ser propio (con su proceso) o uno compartido con otros clientes que corre alguien más,
+				// en cuyo caso m_ownContext queda vacío y m_context se refiere al compartido.
 
-			asio::io_context m_context;
+			std::optional<asio::io_context> m_ownContext;
+			asio::io_context& m_context;
 			std::thread thrContext;
 
-			// El cliente tiene una nica instancia de un objeto de "connection", el cual maneja la transferencia de datos.
-			std::unique_ptr<connection<T>> m_connection;
+			// El cliente tiene una única instancia de un objeto de "connection", el cual maneja la transferencia de datos.
+				// Se guarda compartida para que una conexión en el mismo proceso pueda referirse a ella (ver ConnectLoopback()).
+			std::shared_ptr<connection<T>> m_connection;
+
+			// Mantiene vivo al contexto con una conexión en el mismo proceso, ya que no tiene lecturas pendientes.
+			std::optional<asio::executor_work_guard<asio::io_context::executor_type>> m_workGuard;
+
+			// Opciones que se le aplicaran a la conexión al momento de crearla.
+			connection_options m_connectionOptions;
+
+			// Boleto de reanudación que dejo la conexión anterior, se usa al volver a conectar (ver handshake_options::bResumption).
+			uint64_t m_nResumeToken = 0;
+
+			// Evento cuando llega un pedazo de un mensaje grande leído por pedazos (ver message_limits::nStreamThreshold).
+				// Importante: se ejecuta en el proceso de asio, así que no debe bloquearse.
+				// Los datos solo son validos durante la llamada, bLast indica que es el ultimo pedazo del mensaje.
+			virtual void OnMessageChunk(const message_header<T>& header, const uint8_t* pData, size_t nLength, size_t nOffset, bool bLast) {
+
+			}
 
 		public:
-			client_interface() {
+			// Crea el cliente con su propio contexto de asio, el cual corre en su propio proceso al conectarse.
+			client_interface() : m_context(m_ownContext.emplace(1)) {
+			}
+
+			// Crea el cliente sobre un contexto compartido, así miles de clientes pueden usar unos cuantos procesos.
+				// Quien lo da se encarga de correrlo (por ejemplo con io_pool), y debe seguir corriendo hasta que
+				// el cliente se desconecte o se destruya. Los manejadores de la conexión corren en ese contexto,
+				// así que se espera que lo corra un solo proceso.
+			client_interface(asio::io_context& context) : m_context(context) {
+			}
+
+			// Crea el cliente sobre el siguiente contexto del grupo, el grupo debe vivir más que el cliente.
+			client_interface(io_pool& pool) : client_interface(pool.Next()) {
 			}
 
 			virtual ~client_interface() {
@@ -38,31 +72,67 @@ namespace cap {
 				this->Disconnect();
 			}
 
-			// Conecta al servidor con hostname o ip y con su puerto, retornara si la conexin fue posible.
+			// Cambia las opciones con las que se creara la conexión, debe llamarse antes de Connect().
+			void SetConnectionOptions(const connection_options& options) {
+				this->m_connectionOptions = options;
+			}
+
+			// Conecta al servidor con hostname o ip y con su puerto, retornara si la conexión fue posible.
 			bool Connect(const std::string& host, const uint16_t port) {
 				try {
 
-					// Resuelve el hostname/ip en una direccin fsica tangible.
+					// Resuelve el hostname/ip en una dirección física tangible.
 					asio::ip::tcp::resolver resolver(this->m_context);
 
-					// Creamos los puntos finales de la conexin y consigue el host y lo guarda en el punto final de la conexin.
+					// Creamos los puntos finales de la conexión y consigue el host y lo guarda en el punto final de la conexión.
 					asio::ip::tcp::resolver::results_type m_endpoints = resolver.resolve(host, std::to_string(port));
 
-					// Creando la conexin
+					// Creando la conexión
 						// Tenemos que especificarle que somos, el contexto que usamos y un socket con nuestro contexto.
-						// Y tambin la cola de nuestros mensajes entrantes.
-					this->m_connection = std::make_unique<connection<T>>(connection<T>::owner::client, this->m_context, asio::ip::tcp::socket(this->m_context), this->m_qMessagesIn); // TODO
+						// Y también la cola de nuestros mensajes entrantes.
+					this->m_connection = std::allocate_shared<connection<T>>(slab_allocator<connection<T>>(), connection<T>::owner::client, this->m_context, asio::ip::tcp::socket(this->m_context), this->m_qMessagesIn, this->m_connectionOptions); // TODO
+
+					// Si la conexión anterior nos dejo un boleto de reanudación, la nueva lo usa en su saludo.
+					this->m_connection->SetResumeToken(this->m_nResumeToken);
+
+					// Los pedazos de mensajes grandes se entregan al evento respectivo.
+					this->m_connection->SetChunkHandler([this](const message_header<T>& header, const uint8_t* pData, size_t nLength, size_t nOffset, bool bLast) {
+							OnMessageChunk(header, pData, nLength, nOffset, bLast);
+						});
 
-					// Le indica a la conexin que se conecte al server.
+					// Le indica a la conexión que se conecte al server.
 					this->m_connection->ConnectToServer(m_endpoints);
 
-					// Empieza un proceso con el contexto.
-					this->thrContext = std::thread([this]() { m_context.run(); });
+					// Empieza un proceso con el contexto, si es propio.
+					if (this->m_ownContext) {
+						this->thrContext = std::thread([this]() { m_context.run(); });
+					}
 
 				}
 				catch (std::exception& e) {
-					// Imprimimos la excepcin encontrada.
-					std::cerr << "Excepcin del Cliente: " << e.what() << "\n";
+					// Imprimimos la excepción encontrada.
+					std::cerr << "Excepción del Cliente: " << e.what() << "\n";
+					return false;
+				}
+
+				return true;
+			}
+
+			// Conecta a un servidor del mismo proceso sin sockets, retorna falso si el servidor rechazo la conexión.
+				// Los mensajes se pasan directo entre las colas conservando su orden, el servidor recibe OnClientConnect()
+				// y OnClientValidated() como con una conexión normal, y cualquiera de los dos lados puede desconectarse.
+				// Al regresar la conexión ya esta validada. El servidor debe estar iniciado con Start().
+			bool ConnectLoopback(server_interface<T>& server) {
+				this->m_connection = std::allocate_shared<connection<T>>(slab_allocator<connection<T>>(), connection<T>::owner::client, this->m_context, asio::ip::tcp::socket(this->m_context), this->m_qMessagesIn, this->m_connectionOptions);
+
+				// Los envíos pasan por el contexto del cliente, así que debe estar corriendo aunque no tenga operaciones pendientes.
+				if (this->m_ownContext) {
+					this->m_workGuard.emplace(this->m_context.get_executor());
+					this->thrContext = std::thread([this]() { m_context.run(); });
+				}
+
+				if (!server.AcceptLoopback(this->m_connection)) {
+					this->Disconnect();
 					return false;
 				}
 
@@ -70,20 +140,69 @@ namespace cap {
 			}
 
 			// Desconecta del servidor.
+				// Con un contexto compartido no se puede llamar desde su proceso, ya que espera a que la conexión se cierre en el.
 			void Disconnect() {
-				// Si la conexin existe, y esta conectada nos desconectamos.
-				if (this->IsConnected()) {
-					this->m_connection->Disconnect();
+				// Con un contexto compartido no lo podemos detener, ya que otros clientes lo usan.
+					// La conexión se cierra desde su proceso y se destruye hasta que ya ningún manejador la va a usar.
+				if (!this->m_ownContext) {
+					if (this->m_connection) {
+						std::promise<void> closed;
+						this->m_connection->Close([&closed]() { closed.set_value(); });
+						closed.get_future().wait();
+						this->m_nResumeToken = this->m_connection->GetResumeToken();
+						this->m_connection.reset();
+					}
+					return;
 				}
 
-				// Como acabamos con la conexin, tambin es necesario acabar con el contexto de asio y sus procesos.
+				// Como acabamos con la conexión, también es necesario detener el contexto de asio y su proceso.
+				this->m_workGuard.reset();
 				this->m_context.stop();
 				if (this->thrContext.joinable()) {
 					this->thrContext.join();
 				}
 
-				// Finalmente destruimos el objeto de la conexin.
-				this->m_connection.release();
+				// El contexto detenido aun guarda manejadores de la conexión, así que antes de destruirla la cerramos y
+					// corremos el contexto en este proceso hasta que ya ninguno la va a usar (ver connection::Close()).
+					// Se reinicia el mismo contexto en lugar de reemplazarlo, ya que otros objetos pueden seguir ligados a el
+					// (por ejemplo el receptor de coro_client y sus corrutinas esperando), y así se puede volver a conectar.
+				this->m_context.restart();
+				if (this->m_connection) {
+					bool bClosed = false;
+					this->m_connection->Close([&bClosed]() { bClosed = true; });
+					while (!bClosed && this->m_context.run_one() > 0) {
+					}
+
+					// Guardamos su boleto de reanudación para la siguiente conexión.
+					this->m_nResumeToken = this->m_connection->GetResumeToken();
+					this->m_connection.reset();
+
+					// Al quedarse sin trabajo el contexto se detiene solo, se reinicia de nuevo para la siguiente conexión.
+					this->m_context.restart();
+				}
+			}
+
+			// Desconecta del servidor de forma ordenada: termina de escribir lo que ya se había enviado, cierra su lado
+			// del socket y espera a que el servidor cierre el suyo (ver connection::Drain()), o a que pase el tiempo dado.
+				// Retorna falso si se tuvo que cerrar de golpe.
+			bool Disconnect(std::chrono::milliseconds timeout) {
+				bool bClean = true;
+
+				if (this->IsConnected()) {
+					auto tpDeadline = std::chrono::steady_clock::now() + timeout;
+					auto pDrained = std::make_shared<std::promise<bool>>();
+					auto future = pDrained->get_future();
+
+					this->m_connection->Drain(tpDeadline, [pDrained, tpDeadline]() {
+							pDrained->set_value(std::chrono::steady_clock::now() < tpDeadline);
+						});
+
+					// La conexión avisa a más tardar en el limite, se da un margen por si el proceso de asio va atrasado.
+					bClean = future.wait_until(tpDeadline + std::chrono::seconds(1)) == std::future_status::ready && future.get();
+				}
+
+				this->Disconnect();
+				return bClean;
 			}
 
 			// Revisa si el cliente esta conectado al servidor.
@@ -95,7 +214,30 @@ namespace cap {
 					return false;
 				}
 			}
+
+			// Revisa si la conexión ya termino la validación con el servidor.
+				// Los mensajes que se manden antes esperan y salen justo detrás de la validación.
+			bool IsValidated() {
+				return this->m_connection && this->m_connection->IsValidated();
+			}
+
+			// Retorna el contexto de asio del cliente, sirve para programar trabajo en el mismo proceso que su conexión.
+			asio::io_context& GetContext() {
+				return this->m_context;
+			}
+
+			// Retorna una copia de los contadores de la conexión al servidor, o ceros si no hay conexión.
+			connection_metrics_snapshot GetMetrics() {
+				return this->m_connection ? this->m_connection->GetMetrics() : connection_metrics_snapshot{};
+			}
 			
+			// Escribe de inmediato los mensajes que el modo agrupado tenga acumulados.
+			void Flush() {
+				if (this->IsConnected()) {
+					this->m_connection->Flush();
+				}
+			}
+
 			// Manda un mensaje al servidor.
 			void Send(const message<T>& msg) {
 				// Verificamos que este conectado el cliente.
@@ -104,6 +246,13 @@ namespace cap {
 				}
 			}
 
+			// Manda un mensaje compartido al servidor, sin copiarlo (ver connection::Send()).
+			void Send(std::shared_ptr<const message<T>> msg) {
+				if (this->IsConnected()) {
+					this->m_connection->Send(std::move(msg));
+				}
+			}
+
 			// Recupera la cola de mensajes del server.
 			tsqueue<owned_message<T>>& Incoming() {
 				return this->m_qMessagesIn;
@@ -1,6 +1,6 @@
 #pragma once
 
-// Agregando las librerias que se van a utilizar en esta librera estatica
+// Agregando las librerias que se van a utilizar en esta librería estatica
 #include <memory>
 #include <thread>
 #include <mutex>
@@ -16,8 +16,9 @@
 #include <string>
 #include <functional>
 #include <random>
+#include <utility>
 
-//* Agregando y definiendo libreras y parmetros para usar la librera asio. *//
+//* Agregando y definiendo librerías y parámetros para usar la librería asio. *//
 #define ASIO_STANDALONE
 
 #ifdef _WIN32
@@ -0,0 +1,280 @@
+#pragma once
+
+#include "net_common.h"
+#include "net_wire.h"
+
+#include <cstring>
+
+namespace cap {
+	namespace net {
+
+		// Codecs con los que se pueden comprimir los cuerpos de los mensajes.
+			// El valor es también su bit en la máscara que se anuncia al negociar (1 << valor).
+		enum class compression_codec : uint8_t {
+			none = 0,
+
+			// LZ de la familia de LZ4, incluido en la librería: rápido y sin dependencias.
+			lz = 1,
+		};
+
+		// Máscara de los codecs que esta versión de la librería puede descomprimir.
+		constexpr uint8_t nSupportedCodecs = uint8_t(1u << uint8_t(compression_codec::lz));
+
+		// Compresor LZ sencillo con el formato de bloques de LZ4:
+			// Cada secuencia es un byte con dos longitudes de 4 bits (literales y copia), las extensiones de las longitudes
+			// (bytes de 255 hasta uno menor), los literales, y la distancia de la copia en 2 bytes little endian.
+			// La ultima secuencia solo lleva literales. No es compatible con las herramientas de LZ4 (no hay marco),
+			// solo sirve para los mensajes de la librería.
+		namespace lz {
+			// Longitud mínima de una copia, los bytes al final que siempre van como literales, y la distancia máxima.
+			constexpr size_t nMinMatch = 4;
+			constexpr size_t nLastLiterals = 5;
+			constexpr size_t nMaxOffset = 65535;
+
+			// Bits de la tabla de posiciones, 4096 entradas de 32 bits (16 KB en la pila).
+			constexpr size_t nHashBits = 12;
+
+			inline uint32_t Read32(const uint8_t* p) {
+				uint32_t nValue;
+				std::memcpy(&nValue, p, sizeof(nValue));
+				return nValue;
+			}
+
+			inline uint64_t Read64(const uint8_t* p) {
+				uint64_t nValue;
+				std::memcpy(&nValue, p, sizeof(nValue));
+				return nValue;
+			}
+
+			inline uint32_t Hash(uint32_t nValue) {
+				return (nValue * 2654435761u) >> (32 - nHashBits);
+			}
+
+			// Tamaño máximo que puede ocupar la salida comprimida de nSize bytes.
+			inline size_t CompressBound(size_t nSize) {
+				return nSize + nSize / 255 + 16;
+			}
+
+			// Escribe una secuencia (literales y una copia opcional), retorna falso si no cabe en la salida.
+			inline bool WriteSequence(uint8_t*& op, uint8_t* opEnd, const uint8_t* pLiterals, size_t nLiterals, size_t nOffset, size_t nMatch, bool bLast) {
+				// Peor caso: el byte de longitudes, sus extensiones, los literales y la distancia.
+				if (size_t(opEnd - op) < 1 + nLiterals / 255 + 1 + nLiterals + 2 + nMatch / 255 + 1) {
+					return false;
+				}
+
+				uint8_t* pToken = op++;
+				*pToken = uint8_t(std::min<size_t>(nLiterals, 15) << 4);
+				if (nLiterals >= 15) {
+					size_t n = nLiterals - 15;
+					for (; n >= 255; n -= 255) {
+						*op++ = 255;
+					}
+					*op++ = uint8_t(n);
+				}
+
+				std::memcpy(op, pLiterals, nLiterals);
+				op += nLiterals;
+
+				if (bLast) {
+					return true;
+				}
+
+				*op++ = uint8_t(nOffset);
+				*op++ = uint8_t(nOffset >> 8);
+
+				// La longitud de la copia se guarda sin el mínimo.
+				nMatch -= nMinMatch;
+				*pToken |= uint8_t(std::min<size_t>(nMatch, 15));
+				if (nMatch >= 15) {
+					size_t n = nMatch - 15;
+					for (; n >= 255; n -= 255) {
+						*op++ = 255;
+					}
+					*op++ = uint8_t(n);
+				}
+
+				return true;
+			}
+
+			// Comprime pSrc en pDst, retorna el tamaño comprimido o cero si no cupo en nDstCapacity.
+				// Con una salida más chica que la entrada, cero significa que no vale la pena comprimirlo.
+			inline size_t Compress(const uint8_t* pSrc, size_t nSrc, uint8_t* pDst, size_t nDstCapacity) {
+				uint8_t* op = pDst;
+				uint8_t* opEnd = pDst + nDstCapacity;
+				const uint8_t* ip = pSrc;
+				const uint8_t* pAnchor = pSrc;
+
+				// Las copias no empiezan ni se extienden dentro de los últimos bytes.
+				if (nSrc > nMinMatch + nLastLiterals) {
+					const uint8_t* pLimit = pSrc + nSrc - nLastLiterals;
+					uint32_t table[size_t(1) << nHashBits] = {};
+
+					// Entre más fallos seguidos, más grande el salto, así los datos que no se comprimen se recorren rápido.
+					size_t nMisses = 0;
+
+					while (ip + nMinMatch <= pLimit) {
+						uint32_t nSeq = Read32(ip);
+						uint32_t nHash = Hash(nSeq);
+						const uint8_t* pRef = pSrc + table[nHash];
+						table[nHash] = uint32_t(ip - pSrc);
+
+						if (pRef >= ip || size_t(ip - pRef) > nMaxOffset || Read32(pRef) != nSeq) {
+							ip += 1 + (nMisses++ >> 6);
+							continue;
+						}
+						nMisses = 0;
+
+						// Extendemos la copia de 8 en 8 bytes, y el resto de uno en uno.
+						const uint8_t* pMatch = ip + nMinMatch;
+						const uint8_t* pRefMatch = pRef + nMinMatch;
+						while (pMatch + 8 <= pLimit && Read64(pMatch) == Read64(pRefMatch)) {
+							pMatch += 8;
+							pRefMatch += 8;
+						}
+						while (pMatch < pLimit && *pMatch == *pRefMatch) {
+							pMatch++;
+							pRefMatch++;
+						}
+
+						if (!WriteSequence(op, opEnd, pAnchor, size_t(ip - pAnchor), size_t(ip - pRef), size_t(pMatch - ip), false)) {
+							return 0;
+						}
+
+						ip = pMatch;
+						pAnchor = ip;
+					}
+				}
+
+				// Lo que queda va como literales en la ultima secuencia.
+				if (!WriteSequence(op, opEnd, pAnchor, size_t(pSrc + nSrc - pAnchor), 0, 0, true)) {
+					return 0;
+				}
+
+				return size_t(op - pDst);
+			}
+
+			// Lee la extensión de una longitud, retorna falso si se acaba la entrada.
+			inline bool ReadLength(const uint8_t*& ip, const uint8_t* ipEnd, size_t& nLength) {
+				uint8_t nByte = 0;
+				do {
+					if (ip >= ipEnd) {
+						return false;
+					}
+					nByte = *ip++;
+					nLength += nByte;
+				} while (nByte == 255);
+				return true;
+			}
+
+			// Descomprime pSrc en pDst, la salida debe tener exactamente nDst bytes.
+				// Revisa todos los limites, así un mensaje mal formado (o malicioso) solo hace que retorne falso.
+			inline bool Decompress(const uint8_t* pSrc, size_t nSrc, uint8_t* pDst, size_t nDst) {
+				const uint8_t* ip = pSrc;
+				const uint8_t* ipEnd = pSrc + nSrc;
+				uint8_t* op = pDst;
+				uint8_t* opEnd = pDst + nDst;
+
+				while (ip < ipEnd) {
+					uint8_t nToken = *ip++;
+
+					size_t nLiterals = nToken >> 4;
+					if (nLiterals == 15 && !ReadLength(ip, ipEnd, nLiterals)) {
+						return false;
+					}
+					if (nLiterals > size_t(ipEnd - ip) || nLiterals > size_t(opEnd - op)) {
+						return false;
+					}
+					std::memcpy(op, ip, nLiterals);
+					op += nLiterals;
+					ip += nLiterals;
+
+					// La ultima secuencia no lleva copia.
+					if (ip == ipEnd) {
+						break;
+					}
+
+					if (ipEnd - ip < 2) {
+						return false;
+					}
+					size_t nOffset = size_t(ip[0]) | size_t(ip[1]) << 8;
+					ip += 2;
+					if (nOffset == 0 || nOffset > size_t(op - pDst)) {
+						return false;
+					}
+
+					size_t nMatch = nToken & 15;
+					if (nMatch == 15 && !ReadLength(ip, ipEnd, nMatch)) {
+						return false;
+					}
+					nMatch += nMinMatch;
+					if (nMatch > size_t(opEnd - op)) {
+						return false;
+					}
+
+					// Si la copia se encima con lo que escribe (repeticiones más cortas que la copia), se copia en pedazos
+						// del tamaño de la distancia, los cuales ya no se enciman.
+					while (nMatch > 0) {
+						size_t nChunk = std::min(nOffset, nMatch);
+						std::memcpy(op, op - nOffset, nChunk);
+						op += nChunk;
+						nMatch -= nChunk;
+					}
+				}
+
+				return op == opEnd;
+			}
+		}
+
+		// Comprime un cuerpo con el codec dado. El resultado lleva al final el tamaño original (uint32_t) y el codec (uint8_t),
+			// igual que los datos que se empujan a un mensaje, así quien lo recibe sabe cuanta memoria reservar.
+			// Retorna falso si el codec no existe o si comprimido no queda más chico que el original.
+			// Los buffers pueden ser std::vector<uint8_t> o el cuerpo de un mensaje (message_body).
+		template <typename SrcBuffer, typename DstBuffer>
+		bool CompressBody(compression_codec codec, const SrcBuffer& vSrc, DstBuffer& vDst) {
+			if (codec != compression_codec::lz || vSrc.empty() || vSrc.size() > UINT32_MAX) {
+				return false;
+			}
+
+			// Solo aceptamos salidas más chicas que la entrada, contando lo que se agrega al final.
+			const size_t nTrailer = sizeof(uint32_t) + sizeof(uint8_t);
+			if (vSrc.size() <= nTrailer) {
+				return false;
+			}
+			vDst.resize(vSrc.size() - nTrailer);
+
+			size_t nCompressed = lz::Compress(vSrc.data(), vSrc.size(), vDst.data(), vDst.size());
+			if (nCompressed == 0) {
+				return false;
+			}
+
+			uint32_t nOriginal = uint32_t(vSrc.size());
+			vDst.resize(nCompressed + nTrailer);
+			StoreWire(vDst.data() + nCompressed, nOriginal);
+			vDst[nCompressed + sizeof(nOriginal)] = uint8_t(codec);
+			return true;
+		}
+
+		// Descomprime un cuerpo hecho con CompressBody(), sin pasarse de nMaxSize bytes.
+			// Retorna falso si el cuerpo esta mal formado, el codec no existe o el tamaño original se pasa del limite.
+		template <typename SrcBuffer, typename DstBuffer>
+		bool DecompressBody(const SrcBuffer& vSrc, DstBuffer& vDst, size_t nMaxSize) {
+			const size_t nTrailer = sizeof(uint32_t) + sizeof(uint8_t);
+			if (vSrc.size() < nTrailer) {
+				return false;
+			}
+
+			size_t nCompressed = vSrc.size() - nTrailer;
+			uint32_t nOriginal = LoadWire<uint32_t>(vSrc.data() + nCompressed);
+			compression_codec codec = compression_codec(vSrc[nCompressed + sizeof(nOriginal)]);
+
+			// Revisamos el tamaño antes de reservar, así un encabezado falso no puede pedir gigas de memoria.
+			if (codec != compression_codec::lz || nOriginal > nMaxSize) {
+				return false;
+			}
+
+			vDst.resize(nOriginal);
+			return lz::Decompress(vSrc.data(), nCompressed, vDst.data(), vDst.size());
+		}
+
+	}
+}
\ No newline at end of file
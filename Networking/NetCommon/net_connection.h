@@ -3,214 +3,929 @@
 #include "net_common.h"
 #include "net_tsqueue.h"
 #include "net_message.h"
+#include "net_options.h"
+#include "net_metrics.h"
+#include "net_trace.h"
+#include "net_snapshot.h"
+#include "net_memory.h"
 
 namespace cap {
 	namespace net {
 
-		// Declaracin primitiva.
+		// Declaración primitiva.
 		template<typename T>
 		class server_interface;
 
-		// Clase que nos permitir crear un pointer compartido dentro del todo el objeto.
-		// Esto actuara como la conexin.
+		// Clase que nos permitirá crear un pointer compartido dentro del todo el objeto.
+		// Esto actuara como la conexión.
 		template <typename T>
 		class connection : public std::enable_shared_from_this<connection<T>> {
 		private:
 
-			// Mtodo sincrnico, comprime el contexto listo para poder leer el encabezado de un mensaje.
+			// Método sincrónico, comprime el contexto listo para poder leer el encabezado de un mensaje.
 			void ReadHeader() {
-				// Le indicamos a asio que lea de forma sincrnica.
-					// Dndole el socket de conexin, un buffer donde se guardara el mensaje con el tamao del encabezado del mensaje.
-					// Y como en cada mtodo donde hay algo sincrnico, creamos una funcin lambda para que ejecute directamente.
-						// Donde pedir un manejador de errores y el tamao del encabezado.
-				asio::async_read(this->m_socket, asio::buffer(&this->m_msgTemporaryIn.header, sizeof(message_header<T>)), [this](std::error_code ec, std::size_t length) {
-						// Si no hay ningn error podemos continuar con la lectura del encabezado.
+				// Le indicamos a asio que lea de forma sincrónica.
+					// Dándole el socket de conexión, un buffer donde se guardara el mensaje con el tamaño del encabezado del mensaje.
+					// Y como en cada método donde hay algo sincrónico, creamos una función lambda para que ejecute directamente.
+						// Donde pedirá un manejador de errores y el tamaño del encabezado.
+				this->m_bReadingHeader = true;
+				asio::async_read(this->m_socket, this->HeaderInBuffer(), [this](std::error_code ec, std::size_t length) {
+						m_bReadingHeader = false;
+
+						// Si no hay ningún error podemos continuar con la lectura del encabezado.
 						if (!ec) {
-							// Verificamos que el mensaje temporal tenga tamao.
-							if (m_msgTemporaryIn.header.size > 0) {
-								// Si tiene espacio, significa que hay espacio para copear el mensaje.
-								// As que le asignamos el tamao al cuerpo el del encabezado.
-								m_msgTemporaryIn.body.resize(m_msgTemporaryIn.header.size);
-
-								// Ahora le indicamos que lea el cuerpo.
-								ReadBody();
+							// En el formato portable el encabezado se convierte de los bytes de la red.
+							if constexpr (!wire_header<T>::bDirect) {
+								wire_header<T>::Read(m_aHeaderIn, m_msgTemporaryIn.header);
 							}
-							else {
-								// Si se llega a esta parte, significa que el mensaje temporal no tiene espacio.
-								// Por ende no tiene cuerpo el mensaje.
 
-								// As que lo mandamos directamente a la cola de mensajes.
-								AddToIncomingMessageQueue();
+							// Los mensajes de control son de unos cuantos bytes, uno más grande no se lee (ver nMaxControlSize).
+							if ((m_msgTemporaryIn.header.flags & flag_control) && m_msgTemporaryIn.header.size > nMaxControlSize) {
+								printf("[%u] Mensaje de control demasiado grande (%u bytes).\n", id, m_msgTemporaryIn.header.size);
+								CloseSocket();
+							}
+							// Antes de leer el cuerpo revisamos los limites de lo que puede mandar el otro lado, si no es de confianza.
+								// Los mensajes de control también cuentan, ya que la bandera la pone el otro lado.
+							else if (m_options.rateLimits.Enabled() && !m_bTrusted) {
+								ApplyRateLimit();
+							}
+							else {
+								HandleHeader();
 							}
 						}
 						else {
-							// Si se ejecuta esta seccin es debido a que sucedi un fallo al intentar conseguir el encabezado.
+							// Si se ejecuta esta sección es debido a que sucedió un fallo al intentar conseguir el encabezado.
 							// Y notificamos que fallo.
 							printf("[%u] La lectura del encabezado fallo.\n", id);
 
 							// Y cerramos el socket para evitar flujos.
-							m_socket.close();
+							CloseSocket();
 						}
 					});
 			}
 
-			// Mtodo sincrnico, comprime el contexto listo para poder escribir el encabezado de un mensaje.
+			// Sigue con el mensaje cuyo encabezado se acaba de leer: lo lee por pedazos, completo, o lo entrega si no tiene cuerpo.
+			void HandleHeader() {
+				const message_limits& limits = this->m_options.limits;
+				uint32_t nSize = this->m_msgTemporaryIn.header.size;
+
+				// Si el mensaje es lo bastante grande y hay quien lo procese por pedazos, lo leemos así.
+					// Los comprimidos y los estados no, ya que solo se pueden descomprimir (o reconstruir) completos, ni los lotes de la federación.
+				if (this->m_fnChunkHandler && limits.nStreamThreshold > 0 && nSize > limits.nStreamThreshold && !(this->m_msgTemporaryIn.header.flags & (flag_compressed | flag_snapshot | flag_federation))) {
+					// Aun por pedazos, hay un limite para el tamaño total.
+					if (nSize > limits.nMaxStreamSize) {
+						printf("[%u] Mensaje por pedazos demasiado grande (%u bytes).\n", id, nSize);
+						this->CloseSocket();
+						return;
+					}
+
+					// Empezamos a leer desde el principio del cuerpo.
+					this->m_nStreamOffset = 0;
+					this->ReadChunk();
+				}
+				// Antes de reservar la memoria del cuerpo, revisamos que no se pase del limite.
+				else if (nSize > limits.nMaxMessageSize) {
+					printf("[%u] Mensaje demasiado grande (%u bytes).\n", id, nSize);
+					this->CloseSocket();
+				}
+				// Verificamos que el mensaje temporal tenga tamaño.
+				else if (nSize > 0) {
+					// Si tiene espacio, significa que hay espacio para copear el mensaje.
+					// Así que le asignamos el tamaño al cuerpo el del encabezado.
+					this->m_msgTemporaryIn.body.resize(this->m_msgTemporaryIn.header.size);
+
+					// Ahora le indicamos que lea el cuerpo.
+					this->ReadBody();
+				}
+				else {
+					// Si se llega a esta parte, significa que el mensaje temporal no tiene espacio.
+					// Por ende no tiene cuerpo el mensaje, así que limpiamos lo que haya quedado del mensaje anterior.
+					this->m_msgTemporaryIn.body.clear();
+
+					// Y lo mandamos directamente a la cola de mensajes.
+					this->AddToIncomingMessageQueue();
+				}
+			}
+
+			// Revisa si el mensaje cuyo encabezado se acaba de leer cabe en los limites (ver rate_limit_options), y si no,
+				// aplica la acción del limite: esperar antes de leer el cuerpo, leerlo sin guardarlo, o cerrar la conexión.
+				// Al esperar no se lee del socket, así el kernel deja de aceptar datos y el otro lado se frena solo.
+			void ApplyRateLimit() {
+				const rate_limit_options& options = this->m_options.rateLimits;
+				uint32_t nId = uint32_t(this->m_msgTemporaryIn.header.id);
+
+				// Los de control solo cuentan en el limite global, su ID no es de la aplicación.
+				const rate_limit* pById = nullptr;
+				if (!(this->m_msgTemporaryIn.header.flags & flag_control)) {
+					auto it = options.mapById.find(nId);
+					pById = it != options.mapById.end() ? &it->second : nullptr;
+				}
+
+				rate_limit_action action = rate_limit_action::delay;
+				std::chrono::nanoseconds wait{ 0 };
+				size_t nBytes = wire_header<T>::nSize + this->m_msgTemporaryIn.header.size;
+				if (this->m_rateLimiter.Admit(options.global, pById, nId, nBytes, std::chrono::steady_clock::now(), action, wait)) {
+					this->HandleHeader();
+					return;
+				}
+
+				switch (action) {
+					case rate_limit_action::delay: {
+						connection_metrics::Add(this->m_metrics.nRateDelayed, 1);
+						this->m_timerRate.expires_after(wait);
+						this->m_timerRate.async_wait([this](std::error_code ec) {
+								if (!ec && m_socket.is_open()) {
+									HandleHeader();
+								}
+							});
+					}
+					break;
+
+					case rate_limit_action::drop: {
+						// Un tamaño que no se aceptaría de todas formas no se lee, se cierra igual que en HandleHeader().
+						const message_limits& limits = this->m_options.limits;
+						uint32_t nMaxSize = this->m_fnChunkHandler && limits.nStreamThreshold > 0 ? std::max(limits.nMaxMessageSize, limits.nMaxStreamSize) : limits.nMaxMessageSize;
+						if (this->m_msgTemporaryIn.header.size > nMaxSize) {
+							printf("[%u] Mensaje demasiado grande (%u bytes).\n", id, this->m_msgTemporaryIn.header.size);
+							this->CloseSocket();
+							return;
+						}
+
+						connection_metrics::Add(this->m_metrics.nRateDropped, 1);
+						connection_metrics::Add(this->m_metrics.nBytesIn, wire_header<T>::nSize);
+						this->DiscardBody(this->m_msgTemporaryIn.header.size);
+					}
+					break;
+
+					default: {
+						printf("[%u] Se paso del limite de mensajes, se cierra la conexión.\n", id);
+						this->CloseSocket();
+					}
+					break;
+				}
+			}
+
+			// Lee y tira los siguientes nRemaining bytes del socket (el cuerpo de un mensaje descartado), y sigue con el
+				// siguiente encabezado. Se lee en un buffer fijo de la conexión, así descartar no reserva memoria.
+			void DiscardBody(size_t nRemaining) {
+				if (nRemaining == 0) {
+					this->ReadHeader();
+					return;
+				}
+
+				if (this->m_vDiscard.empty()) {
+					this->m_vDiscard.resize(4096);
+				}
+
+				size_t nRead = std::min(nRemaining, this->m_vDiscard.size());
+				asio::async_read(this->m_socket, asio::buffer(this->m_vDiscard.data(), nRead), [this, nRemaining](std::error_code ec, std::size_t length) {
+						if (!ec) {
+							connection_metrics::Add(m_metrics.nBytesIn, length);
+							DiscardBody(nRemaining - length);
+						}
+						else {
+							printf("[%u] La lectura del cuerpo fallo.\n", id);
+							CloseSocket();
+						}
+					});
+			}
+
+			// Método sincrónico, comprime el contexto listo para poder escribir el encabezado de un mensaje.
 			void WriteHeader() {
-				// Le indicamos a asio que escriba de forma sincrnica.
-					// Dndole el socket de conexin, un buffer donde se guardaran los mensajes salientes, y el tamao.
-					// Y como en cada mtodo donde hay algo sincrnico, creamos una funcin lambda para que ejecute directamente.
-						// Donde pedir un manejador de errores y el tamao del cuerpo.
-				asio::async_write(this->m_socket, asio::buffer(&this->m_qMessagesOut.front().header, sizeof(message_header<T>)), [this](std::error_code ec, std::size_t length) {
-						// Si no hay ningn error podemos continuar con la escritura del encabezado.
+				// Le indicamos a asio que escriba de forma sincrónica.
+					// Dándole el socket de conexión, un buffer donde se guardaran los mensajes salientes, y el tamaño.
+					// Y como en cada método donde hay algo sincrónico, creamos una función lambda para que ejecute directamente.
+						// Donde pedirá un manejador de errores y el tamaño del cuerpo.
+				this->m_tpWriteStart = std::chrono::steady_clock::now();
+				asio::async_write(this->m_socket, this->HeaderOutBuffer(this->m_qMessagesOut.front()->header), [this](std::error_code ec, std::size_t length) {
+						// Si no hay ningún error podemos continuar con la escritura del encabezado.
 						if (!ec) {
-							// Verificamos que haya tamao para poder escribir.
-							if (m_qMessagesOut.front().body.size() > 0) {
+							connection_metrics::Add(m_metrics.nBytesOut, length);
+
+							// Verificamos que haya tamaño para poder escribir.
+							if (m_qMessagesOut.front()->body.size() > 0) {
 								// Si lo hay, escribimos en el cuerpo.
 								WriteBody();
 							}
 							else {
-								// Si no lo hay, lo eliminamos.
+								// Si no lo hay, lo eliminamos y lo contamos como escrito.
 								m_qMessagesOut.pop_front();
+								MarkWritten(m_nSeqWritten + 1);
 
 								// Verificamos si no hay mensajes.
 								if (!m_qMessagesOut.empty()) {
-									// Si es as, volvemos a repetir el proceso.
+									// Si es así, volvemos a repetir el proceso.
 									WriteHeader();
 								}
+								else {
+									// Si ya no hay, puede que el buffer agrupado haya estado esperando a que terminemos.
+									WriteCorked();
+								}
 							}
 						}
 						else {
-							// Si hay algn error, debemos indicar que no se pudo escribir el encabezado, y cerramos la conexin.
+							// Si hay algún error, debemos indicar que no se pudo escribir el encabezado, y cerramos la conexión.
 							printf("[%u] La escritura del encabezado fallo.", id);
-							m_socket.close();
+							CloseSocket();
 						}
 					});
 			}
 
-			// Mtodo sincrnico, comprime el contexto listo para poder leer el cuerpo de un mensaje.
+			// Método sincrónico, comprime el contexto listo para poder leer el cuerpo de un mensaje.
 			void ReadBody() {
-				// Le indicamos a asio que lea de forma sincrnica.
-					// Dndole el socket de conexin, un buffer donde se guardara el mensaje con el tamao del cuerpo del mensaje.
-					// Y como en cada mtodo donde hay algo sincrnico, creamos una funcin lambda para que ejecute directamente.
-						// Donde pedir un manejador de errores y el tamao del cuerpo.
+				// Le indicamos a asio que lea de forma sincrónica.
+					// Dándole el socket de conexión, un buffer donde se guardara el mensaje con el tamaño del cuerpo del mensaje.
+					// Y como en cada método donde hay algo sincrónico, creamos una función lambda para que ejecute directamente.
+						// Donde pedirá un manejador de errores y el tamaño del cuerpo.
 				asio::async_read(this->m_socket, asio::buffer(this->m_msgTemporaryIn.body.data(), this->m_msgTemporaryIn.body.size()), [this](std::error_code ec, std::size_t length) {
-						// Si no hay ningn error podemos continuar con la lectura del cuerpo.
+						// Si no hay ningún error podemos continuar con la lectura del cuerpo.
 						if(!ec) {
-							// Entonces si no hubo ningn error significa que tanto hay cuerpo como encabezado y se pueden procesar ambos.
-							// As que lo agregamos a la cola de mensajes.
+							// Entonces si no hubo ningún error significa que tanto hay cuerpo como encabezado y se pueden procesar ambos.
+							// Así que lo agregamos a la cola de mensajes.
 							AddToIncomingMessageQueue();
 						}
 						else {
-							// Si llega a esta parte es por que hubo algn error.
-							// As que notificamos de ello.
+							// Si llega a esta parte es por que hubo algún error.
+							// Así que notificamos de ello.
 							printf("[%u] La lectura del cuerpo fallo.\n", id);
 
 							// Y cerramos el socket para evitar flujos.
-							m_socket.close();
+							CloseSocket();
+						}
+					});
+			}
+
+			// Método ASYNC, lee el siguiente pedazo de un mensaje grande y se lo entrega al manejador de pedazos.
+				// Siempre se usa el mismo buffer, así la memoria usada no depende del tamaño del mensaje.
+			void ReadChunk() {
+				// Calculamos cuanto falta y leemos como máximo un pedazo.
+				size_t nRemaining = this->m_msgTemporaryIn.header.size - this->m_nStreamOffset;
+				size_t nChunk = std::min<size_t>(nRemaining, std::max<uint32_t>(this->m_options.limits.nChunkSize, 1));
+				this->m_vChunkBuffer.resize(nChunk);
+
+				asio::async_read(this->m_socket, asio::buffer(this->m_vChunkBuffer.data(), nChunk), [this](std::error_code ec, std::size_t length) {
+						if (!ec) {
+							// Entregamos el pedazo junto con su posición dentro del cuerpo.
+							size_t nOffset = m_nStreamOffset;
+							m_nStreamOffset += length;
+							bool bLast = m_nStreamOffset == m_msgTemporaryIn.header.size;
+
+							// Contamos los bytes de cada pedazo, y el mensaje junto con su encabezado al llegar el ultimo.
+							connection_metrics::Add(m_metrics.nBytesIn, length);
+							if (bLast) {
+								connection_metrics::Add(m_metrics.nBytesIn, wire_header<T>::nSize);
+								connection_metrics::Add(m_metrics.nMessagesIn, 1);
+							}
+							m_fnChunkHandler(m_msgTemporaryIn.header, m_vChunkBuffer.data(), length, nOffset, bLast);
+
+							// Si ya era el ultimo pedazo, volvemos a esperar el siguiente encabezado, si no, seguimos leyendo.
+							if (bLast) {
+								ReadHeader();
+							}
+							else {
+								ReadChunk();
+							}
+						}
+						else {
+							// Si hubo un error notificamos y cerramos para evitar flujos.
+							printf("[%u] La lectura por pedazos fallo.\n", id);
+							CloseSocket();
 						}
 					});
 			}
 
-			// Mtodo sincrnico, comprime el contexto listo para poder escribir el cuerpo de un mensaje.
+			// Método sincrónico, comprime el contexto listo para poder escribir el cuerpo de un mensaje.
 			void WriteBody() {
-				// Le indicamos a asio que escriba de forma sincrnica.
-					// Dndole el socket de conexin, un buffer donde se guardaran los mensajes salientes del cuerpo, y el tamao.
-					// Y como en cada mtodo donde hay algo sincrnico, creamos una funcin lambda para que ejecute directamente.
-						// Donde pedir un manejador de errores y el tamao del cuerpo.
-				asio::async_write(this->m_socket, asio::buffer(this->m_qMessagesOut.front().body.data(), this->m_qMessagesOut.front().body.size()),
+				// Le indicamos a asio que escriba de forma sincrónica.
+					// Dándole el socket de conexión, un buffer donde se guardaran los mensajes salientes del cuerpo, y el tamaño.
+					// Y como en cada método donde hay algo sincrónico, creamos una función lambda para que ejecute directamente.
+						// Donde pedirá un manejador de errores y el tamaño del cuerpo.
+				asio::async_write(this->m_socket, asio::buffer(this->m_qMessagesOut.front()->body.data(), this->m_qMessagesOut.front()->body.size()),
 					[this](std::error_code ec, std::size_t length) {
-						// Verificamos que no haya ningn error.
+						// Verificamos que no haya ningún error.
 						if (!ec) {
-							// Entonces si no hubo ningn error significa que tanto el cuerpo y el encabezado fueron escritos correctamente.
-							// As que el mensaje fue escrito y se puede eliminar de la cola de mensajes escritos y procesados.
+							connection_metrics::Add(m_metrics.nBytesOut, length);
+
+							// Entonces si no hubo ningún error significa que tanto el cuerpo y el encabezado fueron escritos correctamente.
+							// Así que el mensaje fue escrito y se puede eliminar de la cola de mensajes escritos y procesados.
 							m_qMessagesOut.pop_front();
+							MarkWritten(m_nSeqWritten + 1);
 
 							// Verificamos que ya no haya mensajes a escribir, si no los hay, entonces podemos repetir el proceso.
 							if (!m_qMessagesOut.empty()) {
 								WriteHeader();
 							}
+							else {
+								// Si ya no hay, puede que el buffer agrupado haya estado esperando a que terminemos.
+								WriteCorked();
+							}
 						}
 						else {
 							// Si lo hay notificamos que fallo la escritura del cuerpo y cerramos para evitar flujos.
 							printf("[%u] La escritura del cuerpo fallo.", id);
-							m_socket.close();
+							CloseSocket();
+						}
+					});
+			}
+
+			// Método que agrega un mensaje al buffer agrupado (modo "corking").
+				// Se copia el encabezado y el cuerpo tal cual se mandarían por el socket, así al escribir
+				// el buffer completo el otro lado lo leerá como si fueran mensajes separados.
+			void Cork(const message<T>& msg) {
+				// Si el buffer estaba vacío, este es el primer mensaje del lote, así que armamos el temporizador
+				// para que el mensaje no espere más del tiempo máximo configurado.
+				if (this->m_vCorkBuffer.empty()) {
+					this->m_timerCork.expires_after(this->m_options.cork.maxDelay);
+					this->m_timerCork.async_wait([this](std::error_code ec) {
+							// Si el temporizador no fue cancelado, se venció el tiempo y escribimos lo que tengamos.
+							if (!ec) {
+								WriteCorked();
+							}
+						});
+				}
+
+				// Copiamos el encabezado y después el cuerpo al final del buffer.
+				size_t i = this->m_vCorkBuffer.size();
+				this->m_vCorkBuffer.resize(i + wire_header<T>::nSize + msg.body.size());
+				wire_header<T>::Write(msg.header, this->m_vCorkBuffer.data() + i);
+				if (!msg.body.empty()) {
+					std::memcpy(this->m_vCorkBuffer.data() + i + wire_header<T>::nSize, msg.body.data(), msg.body.size());
+				}
+
+				// Si ya llegamos al limite de bytes, no tiene caso seguir esperando.
+				if (this->m_vCorkBuffer.size() >= this->m_options.cork.nMaxBytes) {
+					WriteCorked();
+				}
+			}
+
+			// Método ASYNC, escribe todo el buffer agrupado en una sola escritura.
+			void WriteCorked() {
+				// Si no hay nada que escribir, o ya hay una escritura en curso, no hacemos nada.
+					// Cuando la escritura en curso termine, se volverá a llamar a este método.
+				if (this->m_vCorkBuffer.empty() || this->IsWriting()) {
+					return;
+				}
+
+				// Como vamos a escribir ya, el temporizador ya no es necesario.
+				this->m_timerCork.cancel();
+
+				// Intercambiamos los buffers, así podemos seguir acumulando mensajes mientras se escribe el lote.
+					// Todos los mensajes encolados hasta ahora van en este lote.
+				std::swap(this->m_vCorkBuffer, this->m_vCorkWriting);
+				this->m_bCorkWriting = true;
+				this->m_nSeqCorkWriting = this->m_nSeqQueued;
+				this->m_tpWriteStart = std::chrono::steady_clock::now();
+
+				asio::async_write(this->m_socket, asio::buffer(this->m_vCorkWriting.data(), this->m_vCorkWriting.size()), [this](std::error_code ec, std::size_t length) {
+						m_bCorkWriting = false;
+
+						if (!ec) {
+							connection_metrics::Add(m_metrics.nBytesOut, length);
+
+							// Limpiamos el buffer escrito, pero conservamos su capacidad para el siguiente lote.
+							m_vCorkWriting.clear();
+							MarkWritten(m_nSeqCorkWriting);
+
+							// Si mientras escribíamos se encolaron mensajes sin agrupar, les damos prioridad
+							// ya que fueron enviados antes de los que se siguieron acumulando.
+							if (!m_qMessagesOut.empty()) {
+								WriteHeader();
+							}
+							// Si se acumularon suficientes bytes, el tiempo del siguiente lote se venció mientras
+							// escribíamos, o ya no se esta agrupando, escribimos el siguiente lote de una vez.
+							else if (m_vCorkBuffer.size() >= m_options.cork.nMaxBytes || m_timerCork.expiry() <= std::chrono::steady_clock::now() || !m_options.cork.bEnabled) {
+								WriteCorked();
+							}
+						}
+						else {
+							// Si hubo un error notificamos y cerramos para evitar flujos.
+							printf("[%u] La escritura agrupada fallo.\n", id);
+							CloseSocket();
+						}
+					});
+			}
+
+			// Agrega el mensaje a la cola de salida (o al buffer agrupado) y empieza a escribir si no se estaba escribiendo.
+				// Se debe llamar desde el proceso de asio, retorna el número de secuencia que se le asigno al mensaje.
+				// tpSent es el momento en que se llamo a Send(), para medir cuanto tarda en escribirse.
+			uint64_t Enqueue(std::shared_ptr<const message<T>> msg, std::chrono::steady_clock::time_point tpSent) {
+				// Si el otro lado anuncio nuestro codec, los cuerpos grandes se envían comprimidos.
+				if (this->m_eSendCodec != compression_codec::none && msg->body.size() >= this->m_options.compression.nThreshold && !(msg->header.flags & flag_compressed)) {
+					msg = this->CompressMessage(std::move(msg));
+				}
+
+				uint64_t nSeq = ++this->m_nSeqQueued;
+				this->m_deqSendTimes.push_back(tpSent);
+				Trace<T>(trace_stage::send_enqueue, TraceId(this->id, nSeq), tpSent);
+				this->m_metrics.nQueueDepth.store(this->m_nSeqQueued - this->m_nSeqWritten, std::memory_order_relaxed);
+
+				// Si el modo agrupado esta activo, el mensaje se acumula en vez de escribirse directamente.
+					// Si se desactivo pero aun quedan mensajes acumulados, también va al buffer para no cambiar el orden.
+				if (this->m_options.cork.bEnabled || !this->m_vCorkBuffer.empty()) {
+					this->Cork(*msg);
+					return nSeq;
+				}
+
+				// Verificamos si esta escribiendo más mensajes.
+				bool bWritingMessage = this->IsWriting();
+
+				// Primero agregamos el mensaje a la cola de mensajes de salida.
+				this->m_qMessagesOut.push_back(std::move(msg));
+
+				// Verificamos que no este escribiendo más mensajes.
+				if (!bWritingMessage) {
+					// Y finalmente empezamos el proceso de escribir.
+					this->WriteHeader();
+				}
+
+				return nSeq;
+			}
+
+			// Marca como escritos todos los mensajes hasta el número de secuencia dado.
+				// Actualiza las métricas y avisa a quienes esperaban a que se escribieran.
+			void MarkWritten(uint64_t nSeq) {
+				auto tpNow = std::chrono::steady_clock::now();
+
+				// Si la escritura tardo demasiado, la contamos como atorada.
+				if (tpNow - this->m_tpWriteStart > this->m_options.metrics.writeStallThreshold) {
+					connection_metrics::Add(this->m_metrics.nWriteStalls, 1);
+				}
+
+				// Cada mensaje escrito tiene guardado el momento en el que se envió, en el mismo orden.
+				while (this->m_nSeqWritten < nSeq) {
+					if (this->m_pSendLatency && !this->m_deqSendTimes.empty()) {
+						this->m_pSendLatency->Record(tpNow - this->m_deqSendTimes.front());
+					}
+
+					if (!this->m_deqSendTimes.empty()) {
+						this->m_deqSendTimes.pop_front();
+					}
+
+					this->m_nSeqWritten++;
+					connection_metrics::Add(this->m_metrics.nMessagesOut, 1);
+					Trace<T>(trace_stage::write_complete, TraceId(this->id, this->m_nSeqWritten), tpNow);
+				}
+
+				this->m_metrics.nQueueDepth.store(this->m_nSeqQueued - this->m_nSeqWritten, std::memory_order_relaxed);
+				this->CompleteSendWaiters();
+			}
+
+			// Avisa a quienes esperaban que sus mensajes se terminaran de escribir.
+			void CompleteSendWaiters() {
+				while (!this->m_deqSendWaiters.empty() && this->m_deqSendWaiters.front().first <= this->m_nSeqWritten) {
+					auto fnWaiter = std::move(this->m_deqSendWaiters.front().second);
+					this->m_deqSendWaiters.pop_front();
+					fnWaiter(std::error_code());
+				}
+			}
+
+			// Cierra el socket, y avisa a quienes esperaban escrituras que ya no se van a completar.
+			void CloseSocket() {
+				std::error_code ec;
+				this->m_socket.close(ec);
+				this->m_timerRate.cancel();
+				this->m_timerIdle.cancel();
+
+				// Avisamos una sola vez que el socket se cerro, por ejemplo para que el servidor libere su lugar (ver SetCloseHandler()).
+				if (this->m_fnCloseHandler) {
+					auto fnClose = std::move(this->m_fnCloseHandler);
+					this->m_fnCloseHandler = nullptr;
+					fnClose();
+				}
+
+				while (!this->m_deqSendWaiters.empty()) {
+					auto fnWaiter = std::move(this->m_deqSendWaiters.front().second);
+					this->m_deqSendWaiters.pop_front();
+					fnWaiter(asio::error::operation_aborted);
+				}
+
+				// Si se estaba cerrando de forma ordenada, avisamos que ya termino.
+				if (this->m_fnDrained) {
+					this->m_timerDrain.cancel();
+					auto fnDrained = std::move(this->m_fnDrained);
+					this->m_fnDrained = nullptr;
+					fnDrained();
+				}
+			}
+
+			// Revisa cada memory_options::idleRelease si la conexión recibió o escribió algo desde la revisión anterior,
+				// y si no, libera sus buffers. Contar mensajes en lugar de guardar la hora evita leer el reloj en cada uno.
+			void ArmIdleTimer() {
+				if (this->m_options.memory.idleRelease.count() <= 0) {
+					return;
+				}
+
+				this->m_timerIdle.expires_after(this->m_options.memory.idleRelease);
+				this->m_timerIdle.async_wait([this](std::error_code ec) {
+						if (ec || !m_socket.is_open()) {
+							return;
+						}
+
+						uint64_t nMessages = m_metrics.nMessagesIn.load(std::memory_order_relaxed) + m_metrics.nMessagesOut.load(std::memory_order_relaxed);
+						if (nMessages == m_nIdleMark) {
+							ReleaseIdleBuffers();
 						}
+						m_nIdleMark = nMessages;
+						ArmIdleTimer();
 					});
 			}
 
-			// Esta funcin permitira que si el que ejecuta este proceso es el servidor
+			// Libera los buffers que no se están usando, se vuelven a reservar al necesitarlos.
+				// Se debe llamar desde el proceso de asio.
+			void ReleaseIdleBuffers() {
+				// El cuerpo de entrada y los buffers de lectura solo se usan entre que llega un encabezado y se entrega el mensaje.
+				if (this->m_bReadingHeader) {
+					this->m_msgTemporaryIn.body.Release();
+					this->m_vDecompressed.Release();
+					std::vector<uint8_t>().swap(this->m_vChunkBuffer);
+					std::vector<uint8_t>().swap(this->m_vDiscard);
+				}
+
+				// El de compresión solo se usa al encolar, y los de escritura cuando no hay nada pendiente.
+				std::vector<uint8_t>().swap(this->m_vCompressed);
+				if (!this->IsWriting() && this->m_vCorkBuffer.empty()) {
+					std::vector<uint8_t>().swap(this->m_vCorkBuffer);
+					std::vector<uint8_t>().swap(this->m_vCorkWriting);
+				}
+
+				this->m_qMessagesOut.Release();
+				this->m_deqSendWaiters.Release();
+				this->m_deqSendTimes.Release();
+			}
+
+			// Buffer donde se lee el encabezado: directo en el mensaje si en memoria es igual que en la red, si no en
+				// m_aHeaderIn para convertirlo al terminar la lectura.
+			asio::mutable_buffer HeaderInBuffer() {
+				if constexpr (wire_header<T>::bDirect) {
+					return asio::buffer(&this->m_msgTemporaryIn.header, wire_header<T>::nSize);
+				}
+				else {
+					return asio::buffer(this->m_aHeaderIn, wire_header<T>::nSize);
+				}
+			}
+
+			// Buffer con el encabezado a escribir, convertido en m_aHeaderOut si no se puede escribir directo.
+			asio::const_buffer HeaderOutBuffer(const message_header<T>& header) {
+				if constexpr (wire_header<T>::bDirect) {
+					return asio::buffer(&header, wire_header<T>::nSize);
+				}
+				else {
+					wire_header<T>::Write(header, this->m_aHeaderOut);
+					return asio::buffer(this->m_aHeaderOut, wire_header<T>::nSize);
+				}
+			}
+
+			// Cuenta en las métricas un mensaje enviado por una conexión sin socket.
+				// Sin socket no hay proceso de asio que escriba, así que el que envía es el único que escribe los contadores.
+			void CountDetachedSend(const message<T>& msg) {
+				connection_metrics::Add(this->m_metrics.nBytesOut, wire_header<T>::nSize + msg.body.size());
+				connection_metrics::Add(this->m_metrics.nMessagesOut, 1);
+			}
+
+			// Retorna verdadero si hay alguna escritura en curso, ya sea de mensajes sueltos o de un lote agrupado.
+				// Mientras se retienen las escrituras también cuenta como escribiendo, así nadie empieza una nueva.
+			bool IsWriting() {
+				return this->m_bHoldWrites || this->m_bCorkWriting || !this->m_qMessagesOut.empty();
+			}
+
+			// Aplica las opciones del socket configuradas y después las vuelve a leer,
+			// ya que el sistema operativo puede ajustar algunos valores (por ejemplo, Linux duplica los buffers).
+			void ApplySocketOptions() {
+				// Si el socket no esta abierto no hay nada que configurar.
+				if (!this->m_socket.is_open()) {
+					return;
+				}
+
+				// Los errores se ignoran a propósito, una opción no soportada no debe tumbar la conexión,
+				// y al leer de regreso se vera que valor quedo en realidad.
+				std::error_code ec;
+				const socket_options& opt = this->m_options.socket;
+
+				// El modo agrupado junta los mensajes por su cuenta, así que el algoritmo de Nagle solo agregaría latencia.
+				if (this->m_options.cork.bEnabled) {
+					this->m_socket.set_option(asio::ip::tcp::no_delay(true), ec);
+				}
+				else if (opt.bNoDelay) {
+					this->m_socket.set_option(asio::ip::tcp::no_delay(*opt.bNoDelay), ec);
+				}
+
+				if (opt.nSendBufferSize) {
+					this->m_socket.set_option(asio::socket_base::send_buffer_size(*opt.nSendBufferSize), ec);
+				}
+
+				if (opt.nReceiveBufferSize) {
+					this->m_socket.set_option(asio::socket_base::receive_buffer_size(*opt.nReceiveBufferSize), ec);
+				}
+
+#if defined(__linux__)
+				if (opt.nBusyPollMicros) {
+					this->m_socket.set_option(busy_poll(*opt.nBusyPollMicros), ec);
+				}
+
+				if (opt.bQuickAck) {
+					this->m_socket.set_option(quick_ack(*opt.bQuickAck), ec);
+				}
+
+				if (opt.nUserTimeoutMs) {
+					this->m_socket.set_option(user_timeout(int(*opt.nUserTimeoutMs)), ec);
+				}
+#endif
+
+				// Leemos de regreso lo que quedo aplicado.
+				this->ReadSocketOptions();
+			}
+
+			// Lee del socket los valores reales de las opciones y los guarda para poder consultarlos.
+			void ReadSocketOptions() {
+				std::error_code ec;
+				socket_options applied;
+
+				asio::ip::tcp::no_delay noDelay;
+				this->m_socket.get_option(noDelay, ec);
+				if (!ec) applied.bNoDelay = noDelay.value();
+
+				asio::socket_base::send_buffer_size sendSize;
+				this->m_socket.get_option(sendSize, ec);
+				if (!ec) applied.nSendBufferSize = sendSize.value();
+
+				asio::socket_base::receive_buffer_size receiveSize;
+				this->m_socket.get_option(receiveSize, ec);
+				if (!ec) applied.nReceiveBufferSize = receiveSize.value();
+
+#if defined(__linux__)
+				busy_poll busyPoll;
+				this->m_socket.get_option(busyPoll, ec);
+				if (!ec) applied.nBusyPollMicros = busyPoll.value();
+
+				quick_ack quickAck;
+				this->m_socket.get_option(quickAck, ec);
+				if (!ec) applied.bQuickAck = quickAck.value();
+
+				user_timeout userTimeout;
+				this->m_socket.get_option(userTimeout, ec);
+				if (!ec) applied.nUserTimeoutMs = (unsigned int)userTimeout.value();
+#endif
+
+				this->m_appliedSocketOptions = applied;
+			}
+
+			// Esta función permitira que si el que ejecuta este proceso es el servidor
 			// permitirle que transforme los mensajes a mensajes con autor.
 			void AddToIncomingMessageQueue() {
-				if (this->m_nOwnerType == owner::server) {
-					// Agregamos a la lista los mensajes entrantes para que sea compartidos en esta conexin.
-					this->m_qMessagesIn.push_back({ this->shared_from_this(), m_msgTemporaryIn });
+				// Los bytes que ocuparon en el socket, antes de descomprimir.
+				size_t nWireBytes = wire_header<T>::nSize + this->m_msgTemporaryIn.body.size();
+
+				// Si viene comprimido lo descomprimimos, sin pasarnos del limite de tamaño de los mensajes.
+					// El buffer de salida se intercambia con el cuerpo, así ambos conservan su capacidad para el siguiente.
+				if (this->m_msgTemporaryIn.header.flags & flag_compressed) {
+					if (!DecompressBody(this->m_msgTemporaryIn.body, this->m_vDecompressed, this->m_options.limits.nMaxMessageSize)) {
+						printf("[%u] No se pudo descomprimir el mensaje.\n", id);
+						CloseSocket();
+						return;
+					}
+
+					this->m_msgTemporaryIn.body.swap(this->m_vDecompressed);
+					this->m_msgTemporaryIn.header.size = uint32_t(this->m_msgTemporaryIn.body.size());
+					this->m_msgTemporaryIn.header.flags &= ~uint32_t(flag_compressed);
+				}
+
+				// Si es un estado lo reconstruimos, y le confirmamos al servidor que ya lo tenemos para que lo use como base.
+					// Un estado que no se puede reconstruir (su base ya no esta) se descarta, el servidor manda uno completo
+					// cuando la ultima confirmación se vuelve demasiado vieja.
+				if ((this->m_msgTemporaryIn.header.flags & flag_snapshot) && this->m_nOwnerType == owner::client) {
+					uint32_t nTick = this->ReceiveSnapshot(this->m_msgTemporaryIn);
+					if (nTick == 0) {
+						printf("[%u] Se descarto un estado que no se pudo reconstruir.\n", id);
+						ReadHeader();
+						return;
+					}
+
+					message<T> msgAck;
+					msgAck << nTick;
+					this->SendControl(control_kind::snapshot_ack, std::move(msgAck));
+				}
+
+				// Los mensajes internos de la librería no llegan a la aplicación.
+				if (this->m_msgTemporaryIn.header.flags & flag_control) {
+					this->HandleControl(this->m_msgTemporaryIn);
 				}
 				else {
-					// Si no es owner, entonces agregamos nicamente los mensajes entrantes.
-					this->m_qMessagesIn.push_back({ nullptr, m_msgTemporaryIn });
+					this->PushIncoming(this->m_msgTemporaryIn, nWireBytes);
 				}
 
 				// Ya terminado de agregar los mensajes, le indicamos que vuelva leer otro mensaje.
 				ReadHeader();
 			}
 
-			// Funcin de encriptar datos.
+			// Agrega un mensaje recibido a la cola de entrada, con su conexión si somos del servidor.
+				// Lo usan tanto la lectura del socket como la entrega de una conexión en el mismo proceso.
+				// nWireBytes son los bytes que ocupo al llegar, si no se da se usa el tamaño del mensaje.
+			void PushIncoming(const message<T>& msg, size_t nWireBytes = 0) {
+				connection_metrics::Add(this->m_metrics.nBytesIn, nWireBytes > 0 ? nWireBytes : wire_header<T>::nSize + msg.body.size());
+				connection_metrics::Add(this->m_metrics.nMessagesIn, 1);
+
+				// Guardamos cuando se termino de leer, para poder medir cuanto espera el mensaje antes de procesarse.
+				auto tpReceived = std::chrono::steady_clock::now();
+				uint64_t nTraceId = TraceId(this->id, this->m_metrics.nMessagesIn.load(std::memory_order_relaxed));
+				Trace<T>(trace_stage::read_complete, nTraceId, tpReceived);
+
+				if (this->m_nOwnerType == owner::server) {
+					// Agregamos a la lista los mensajes entrantes para que sea compartidos en esta conexión.
+					this->m_qMessagesIn.push_back({ this->shared_from_this(), msg, tpReceived, nTraceId });
+				}
+				else {
+					// Si no es owner, entonces agregamos únicamente los mensajes entrantes.
+					this->m_qMessagesIn.push_back({ nullptr, msg, tpReceived, nTraceId });
+				}
+
+				Trace<T>(trace_stage::enqueue, nTraceId);
+			}
+
+			// Procesa un mensaje interno de la librería (ver flag_control), los tipos desconocidos se ignoran.
+			void HandleControl(message<T>& msg) {
+				if (msg.body.empty()) {
+					return;
+				}
+
+				uint8_t nKind = 0;
+				msg >> nKind;
+
+				// El servidor nos dio un boleto para la siguiente conexión, reemplaza al anterior.
+				if (nKind == uint8_t(control_kind::resume_token) && this->m_nOwnerType == owner::client && msg.body.size() >= sizeof(uint64_t)) {
+					uint64_t nToken = 0;
+					msg >> nToken;
+					this->m_nResumeToken = nToken;
+				}
+				// El cliente confirmo un estado, solo avanza (las confirmaciones viejas que lleguen tarde no cuentan).
+				else if (nKind == uint8_t(control_kind::snapshot_ack) && this->m_nOwnerType == owner::server && msg.body.size() >= sizeof(uint32_t)) {
+					uint32_t nTick = 0;
+					msg >> nTick;
+					if (nTick > this->m_nSnapshotAck.load(std::memory_order_relaxed)) {
+						this->m_nSnapshotAck.store(nTick, std::memory_order_relaxed);
+					}
+				}
+				// El otro lado anuncio sus codecs, si puede descomprimir el nuestro empezamos a comprimir.
+				else if (nKind == uint8_t(control_kind::codec_offer) && msg.body.size() >= sizeof(uint8_t)) {
+					uint8_t nCodecs = 0;
+					msg >> nCodecs;
+
+					compression_codec codec = this->m_options.compression.codec;
+					if (codec != compression_codec::none && (nCodecs & (1u << uint8_t(codec)))) {
+						this->m_eSendCodec = codec;
+					}
+				}
+			}
+
+			// Método que envía un mensaje interno de la librería (ver flag_control), se debe llamar desde el proceso de asio.
+				// Va en orden con los demás mensajes.
+			void SendControl(control_kind kind, message<T> msg) {
+				msg << uint8_t(kind);
+				msg.header.flags |= flag_control;
+				this->Enqueue(std::make_shared<const message<T>>(std::move(msg)), std::chrono::steady_clock::now());
+			}
+
+			// Anuncia al otro lado los codecs que podemos descomprimir, si la compresión esta activa.
+				// Se llama al terminar la validación de cada lado.
+			void OfferCodecs() {
+				if (this->m_options.compression.codec != compression_codec::none) {
+					message<T> msg;
+					msg << nSupportedCodecs;
+					this->SendControl(control_kind::codec_offer, std::move(msg));
+				}
+			}
+
+			// Retorna el mensaje comprimido con el codec negociado, o el mismo mensaje si comprimido no queda más chico.
+				// Se comprime en un buffer de la conexión y se copia al tamaño justo, así lo que no se comprime no reserva memoria.
+			std::shared_ptr<const message<T>> CompressMessage(std::shared_ptr<const message<T>> msg) {
+				if (!CompressBody(this->m_eSendCodec, msg->body, this->m_vCompressed)) {
+					return msg;
+				}
+
+				auto pCompressed = std::make_shared<message<T>>();
+				pCompressed->header = msg->header;
+				pCompressed->header.flags |= flag_compressed;
+				pCompressed->header.size = uint32_t(this->m_vCompressed.size());
+				pCompressed->body.assign(this->m_vCompressed.begin(), this->m_vCompressed.end());
+
+				connection_metrics::Add(this->m_metrics.nCompressedOut, 1);
+				connection_metrics::Add(this->m_metrics.nCompressionSavedBytes, msg->body.size() - pCompressed->body.size());
+				return pCompressed;
+			}
+
+			// Reconstruye un estado recibido (ver flag_snapshot), retorna su número o cero si se debe descartar.
+			uint32_t ReceiveSnapshot(message<T>& msg) {
+				uint32_t nTick = this->m_snapshots.Apply(msg.body, this->m_options.snapshot.nHistory, this->m_options.limits.nMaxMessageSize);
+				msg.header.size = uint32_t(msg.body.size());
+				return nTick;
+			}
+
+			// Entrega un mensaje a la conexión del otro lado en el mismo proceso, se ejecuta en el proceso de asio de esta conexión.
+				// Si alguno de los dos lados ya se cerro, el mensaje se pierde igual que en un socket cerrado.
+			void SendLoopback(const message<T>& msg) {
+				auto pPeer = this->m_pPeer.lock();
+				if (!this->m_bDetached || !pPeer || !pPeer->IsConnected()) {
+					return;
+				}
+
+				// Solo este proceso entrega a la otra conexión, así sus contadores siguen teniendo un solo escritor.
+				this->CountDetachedSend(msg);
+
+				// Los estados los reconstruye el otro lado aquí mismo, y la confirmación se anota directo en esta conexión.
+					// Solo este proceso toca el receptor de estados del otro lado, así que tampoco se necesitan bloqueos.
+				if ((msg.header.flags & flag_snapshot) && this->m_nOwnerType == owner::server) {
+					message<T> msgState = msg;
+					uint32_t nTick = pPeer->ReceiveSnapshot(msgState);
+					if (nTick == 0) {
+						return;
+					}
+					if (nTick > this->m_nSnapshotAck.load(std::memory_order_relaxed)) {
+						this->m_nSnapshotAck.store(nTick, std::memory_order_relaxed);
+					}
+					pPeer->PushIncoming(msgState);
+					return;
+				}
+
+				pPeer->PushIncoming(msg);
+			}
+
+			// Cierra las dos conexiones del mismo proceso, como cuando un lado cierra el socket y el otro lo detecta.
+			void CloseLoopback() {
+				this->m_bDetached = false;
+				if (auto pPeer = this->m_pPeer.lock()) {
+					pPeer->m_bDetached = false;
+				}
+			}
+
+			// Función de encriptar datos.
 			uint64_t scramble(uint64_t nInput) {
 				uint64_t out = nInput ^ 0xDEADBEEFC0DECAFE;
 				out = (out & 0xF0F0F0F0F0F0F0) >> 4 | (out & 0x0F0F0F0F0F0F0F) << 4;
 				return out ^ 0xC0DEFACE12345678;
 			}
 
-			// Mtodo sincrnico, funcin utilizada por ambos, cliente y servidor para escribir datos de validacin.
+			// Método sincrónico, función utilizada por ambos, cliente y servidor para escribir datos de validación.
 			void WriteValidation() {
-				// Le indicamos a asio que escriba de forma sincrnica.
-					// Esto sera utilizado para que en el socket dado, el buffer de asio pueda escribir una validacin.
+				// Le indicamos a asio que escriba de forma sincrónica.
+					// Esto sera utilizado para que en el socket dado, el buffer de asio pueda escribir una validación.
+				// Los números de la validación van en el orden de la red (ver ToWire()).
+				this->m_nADVOut = ToWire(this->m_nADVOut);
 				asio::async_write(this->m_socket, asio::buffer(&this->m_nADVOut, sizeof(uint64_t)), [this](std::error_code ec, std::size_t length) {
 						// Verificamos que no haya errores.
 						if (!ec) {
-							// Si no hay errores, la valadicin fue enviada y los clientes lo unico que deben
-							// de hacer es sentarse a esperar.
+							// Si no hay errores, la valadición fue enviada y los clientes lo unico que deben
+							// de hacer es sentarse a esperar (y anunciar sus codecs).
+							if (m_nOwnerType == owner::client) {
+								m_bValidated = true;
+								OfferCodecs();
+							}
+
+							// La validación ya salió, así que lo que se haya enviado mientras tanto puede ir detrás de ella.
+							ReleaseWrites();
+
 							if (m_nOwnerType == owner::client) {
 								ReadHeader();
 							}
 						}
 						else {
 							// Si hubo errores, cerramos para evitar flujos.
-							m_socket.close();
+							CloseSocket();
 						}
 					});
 			}
 
-			// Mtodo sincrnico, funcin que nos servir para leer validaciones.
-				// Se agrega un parmetro el cual es la direccin del servidor al que esta procesando todo esto.
+			// Método sincrónico, función que nos servirá para leer validaciones.
+				// Se agrega un parámetro el cual es la dirección del servidor al que esta procesando todo esto.
 			void ReadValidation(cap::net::server_interface<T>* server = nullptr) {
-				// Le indicamos a asio que lea de forma sincrnica.
-					// Esta funcin leera lo que se haya agregado de validacin y lo fijara y validara con la direccin dada.
+				// Le indicamos a asio que lea de forma sincrónica.
+					// Esta función leera lo que se haya agregado de validación y lo fijara y validara con la dirección dada.
 				asio::async_read(this->m_socket, asio::buffer(&this->m_nADVIn, sizeof(uint64_t)), [this, server](std::error_code ec, std::size_t length) {
 						// Verificamos que no haya errores.
 						if (!ec) {
-							// Verificamos quien es el que ejecuta esta funcin.
+							m_nADVIn = FromWire(m_nADVIn);
+
+							// Verificamos quien es el que ejecuta esta función.
 							if (m_nOwnerType == owner::server) {
-								// Si la conexin es la de un servidor, nos encargaremos de verificar que la validacin sea correcta.
+								// Si la conexión es la de un servidor, nos encargaremos de verificar que la validación sea correcta.
 								if (m_nADVIn == m_nADVCheck) {
 									// Si el cliente valido bien, le permitiremos al cliente conectarse,
 									// pero antes ejecutaremos el evento cuando un cliente es verificado.
-									// Tambin notificamos de paso.
+									// También notificamos de paso.
 									printf("Cliente validado\n");
-									server->OnClientValidated(this->shared_from_this());
-
-									// Y como dicho previamente, el cliente fue valido ahora podremos sentarnos a escucharlo.
-									ReadHeader();
+									Validated(server);
 								}
 								else {
 									// Si el cliente no valio bien, lo desconectamos y lo agregamos a la lista negra >:(
-									printf("Cliente desconectado (Fall la validacin)\n");
+									printf("Cliente desconectado (Falló la validación)\n");
 									// Y obviamente cerramos para evitar flujos.
-									m_socket.close();
+									CloseSocket();
 								}
 							}
+							// Si reanudamos con un boleto el servidor no espera la respuesta, así que el desafío solo se descarta.
+							else if (m_bResuming) {
+								ReadHeader();
+							}
 							else {
-								// Si la conexin es de un cliente, lo unico que debe de ser es resolver la verificacin.
+								// Si la conexión es de un cliente, lo unico que debe de ser es resolver la verificación.
 								m_nADVOut = scramble(m_nADVIn);
 
 								// Y escribimos el resultado.
@@ -218,32 +933,133 @@ namespace cap {
 							}
 						}
 						else {
-							// Si hay un error significa que hubo un problema mayor que la validacin.
-							printf("Cliente desconectado (Lectura de Validacin)\n");
-							m_socket.close();
+							// Si hay un error significa que hubo un problema mayor que la validación.
+							printf("Cliente desconectado (Lectura de Validación)\n");
+							CloseSocket();
+						}
+					});
+			}
+
+			// Método ASYNC, el cliente manda su saludo en cuanto se conecta (ver handshake_options::bResumption).
+				// El saludo es el boleto de reanudación que se tenga, o cero si no hay.
+			void WriteHello() {
+				// Cada boleto sirve una sola vez, así que lo tomamos. Si el servidor lo acepta nos mandara otro.
+				this->m_nHello = this->m_nResumeToken.exchange(0);
+				this->m_bResuming = this->m_nHello != 0;
+				this->m_nHello = ToWire(this->m_nHello);
+
+				asio::async_write(this->m_socket, asio::buffer(&this->m_nHello, sizeof(uint64_t)), [this](std::error_code ec, std::size_t length) {
+						if (!ec) {
+							// Con boleto ya no hay respuesta que mandar, así que lo enviado puede salir detrás del saludo.
+								// Si el servidor rechaza el boleto cierra la conexión, y la siguiente ya no lo usara.
+							if (m_bResuming) {
+								m_bValidated = true;
+								OfferCodecs();
+								ReleaseWrites();
+							}
+
+							// Con o sin boleto el servidor manda su desafío, el cual leemos a continuación.
+							ReadValidation();
+						}
+						else {
+							CloseSocket();
 						}
 					});
 			}
 
+			// Método ASYNC, el servidor lee el saludo del cliente (ver WriteHello()).
+				// Sin boleto sigue con la validación normal, con un boleto valido el cliente queda validado de inmediato,
+				// y con uno no valido se cierra la conexión.
+			void ReadHello(cap::net::server_interface<T>* server) {
+				asio::async_read(this->m_socket, asio::buffer(&this->m_nHello, sizeof(uint64_t)), [this, server](std::error_code ec, std::size_t length) {
+						if (!ec) {
+							m_nHello = FromWire(m_nHello);
+
+							if (m_nHello == 0) {
+								ReadValidation(server);
+							}
+							else if (server->ConsumeResumeToken(m_nHello, &m_nResumedFrom)) {
+								printf("Cliente validado (Boleto de reanudación)\n");
+								Validated(server);
+							}
+							else {
+								printf("Cliente desconectado (Boleto de reanudación no valido)\n");
+								CloseSocket();
+							}
+						}
+						else {
+							printf("Cliente desconectado (Lectura del saludo)\n");
+							CloseSocket();
+						}
+					});
+			}
+
+			// Marca la conexión del servidor como validada, avisa al servidor y empieza a leer mensajes.
+				// Lo que el cliente haya mandado detrás de su respuesta (o de su saludo) espera en el socket hasta este punto,
+				// así ningún mensaje llega a la aplicación antes de que el cliente este validado.
+			void Validated(cap::net::server_interface<T>* server) {
+				this->m_bValidated = true;
+
+				// Si reanudo la sesión de otra conexión, primero le entregamos lo que se le guardo mientras no estaba (ver server_interface::StartOutbox()).
+				if (this->m_nResumedFrom != 0) {
+					server->ResumeClient(this->shared_from_this(), this->m_nResumedFrom);
+				}
+
+				server->OnClientValidated(this->shared_from_this());
+
+				// Le damos al cliente un boleto nuevo para su siguiente conexión, va antes que cualquier respuesta a sus mensajes.
+				if (this->m_options.handshake.bResumption) {
+					message<T> msg;
+					msg << server->IssueResumeToken(this->id);
+					this->SendControl(control_kind::resume_token, std::move(msg));
+				}
+
+				// Y le anunciamos nuestros codecs.
+				this->OfferCodecs();
+
+				// Y como dicho previamente, el cliente fue valido ahora podremos sentarnos a escucharlo.
+				this->ReadHeader();
+			}
+
+			// Deja de retener las escrituras (ver m_bHoldWrites) y escribe lo que se haya acumulado.
+			void ReleaseWrites() {
+				this->m_bHoldWrites = false;
+
+				if (!this->m_qMessagesOut.empty()) {
+					this->WriteHeader();
+				}
+				else {
+					this->WriteCorked();
+				}
+			}
+
+#if defined(__linux__)
+			// Opciones del socket exclusivas de Linux que asio no trae ya definidas.
+			using busy_poll = asio::detail::socket_option::integer<SOL_SOCKET, SO_BUSY_POLL>;
+			using quick_ack = asio::detail::socket_option::boolean<IPPROTO_TCP, TCP_QUICKACK>;
+			using user_timeout = asio::detail::socket_option::integer<IPPROTO_TCP, TCP_USER_TIMEOUT>;
+#endif
+
 		public:
 
-			// Crearemos una numeracin de tipo de autor de conexin.
+			// Crearemos una numeración de tipo de autor de conexión.
 			enum class owner {
 				server,
 				client
 			};
 
-			// Para crear la conexin, necesitaremos el padre de la conexin (quien crea la conexin), el contexto de la conexin,
-			// el socket donde se hace el proceso y la cola de subprocesos seguro donde se recibirn los mensajes.
-			connection(owner parent, asio::io_context& asioContext, asio::ip::tcp::socket socket, tsqueue<owned_message<T>>& qIn)
-				: m_asioContext(asioContext), m_socket(std::move(socket)), m_qMessagesIn(qIn) {
-				// Le establecemos quien es el nuevo autor de la conexin.
+			// Para crear la conexión, necesitaremos el padre de la conexión (quien crea la conexión), el contexto de la conexión,
+			// el socket donde se hace el proceso y la cola de subprocesos seguro donde se recibirán los mensajes.
+				// También se pueden dar las opciones de la conexión, si no se dan se usan las de por defecto.
+			connection(owner parent, asio::io_context& asioContext, asio::ip::tcp::socket socket, tsqueue<owned_message<T>>& qIn, const connection_options& options = {})
+				: m_asioContext(asioContext), m_socket(std::move(socket)), m_qMessagesIn(qIn), m_options(options), m_timerCork(asioContext), m_timerDrain(asioContext), m_timerRate(asioContext), m_timerIdle(asioContext) {
+				// Le establecemos quien es el nuevo autor de la conexión.
 				this->m_nOwnerType = parent;
 
-				// Construccin de la validacin.
+				// Construcción de la validación.
 				if (this->m_nOwnerType == owner::server) {
 
-					// Le daremos un numero al azar a la validacin saliente para el cliente, para que el lo resulva,
+					// Le daremos un numero al azar a la validación saliente para el cliente, para que el lo resulva,
 					// y sea aceptado.
 					this->m_nADVOut = (uint64_t(std::chrono::system_clock::now().time_since_epoch().count()) + uint64_t(rand() % sizeof(uint64_t))) % sizeof(uint64_t);
 
@@ -252,121 +1068,489 @@ namespace cap {
 				}
 				else {
 					// Si no es servidor, pues lo asignamos el valor default ya que el cliente
-					// solo debe de mandar su validacin a la hora de conectarse.
+					// solo debe de mandar su validación a la hora de conectarse.
 					this->m_nADVIn = 0;
 					this->m_nADVOut = 0;
 				}
 			}
 
-			virtual ~connection() {}
+			virtual ~connection() {
+				// Si era una conexión en el mismo proceso, el otro lado se entera de que se cerro.
+				if (this->m_bLoopback) {
+					this->CloseLoopback();
+				}
+			}
 
-			// Mtodo que retorna la ID de la conexin.
+			// Método que retorna la ID de la conexión.
 			uint32_t GetID() const {
 				return id;
 			}
 
-			// Mtodo que asigna la ID al cliente siempre y cuando la conexin sea del servidor y tambin le permita recivir y mandar informacin.
-			// Tambin pide saber que servidor ejecuta esto para poder validar al cliente.
+			// Método que asigna la ID al cliente siempre y cuando la conexión sea del servidor y también le permita recivir y mandar información.
+			// También pide saber que servidor ejecuta esto para poder validar al cliente.
 			void ConnectToClient(cap::net::server_interface<T>* server, uint32_t uid = 0) {
-				// Verificamos que el que ejecuta esto, es el servidor, si lo es permitir asignar la ID.
+				// Verificamos que el que ejecuta esto, es el servidor, si lo es permitirá asignar la ID.
 				if (this->m_nOwnerType == owner::server) {
 					// Revisamos si al socket esta encendido.
 					if (this->m_socket.is_open()) {
 						// Y asignamos la ID.
 						this->id = uid;
 
-						// Escribimos la validacin para que el cliente pueda validarse as y demostrar que es parte del sistema.
+						// Aplicamos las opciones del socket antes de empezar a mandar datos.
+						this->ApplySocketOptions();
+						this->ArmIdleTimer();
+
+						// Lo que se envíe (por ejemplo desde OnClientConnect()) espera a que salga el desafío.
+						this->m_bHoldWrites = true;
+
+						// Escribimos la validación para que el cliente pueda validarse así y demostrar que es parte del sistema.
 						this->WriteValidation();
 
-						// Y ahora esperamos sincrnicamente a que el cliente mande su validacin para leerla.
-						this->ReadValidation(server);
+						// Y ahora esperamos sincrónicamente a que el cliente mande su validación para leerla.
+							// Si se usan boletos de reanudación, antes viene el saludo del cliente.
+						if (this->m_options.handshake.bResumption) {
+							this->ReadHello(server);
+						}
+						else {
+							this->ReadValidation(server);
+						}
 					}
 				}
 			}
 
-			// Mtodo que conecta el cliente al servidor.
+			// Método que conecta el cliente al servidor.
 				// Nota, solo sirve si eres cliente.
 			void ConnectToServer(const asio::ip::tcp::resolver::results_type& endpoints) {
 				// Verificamos si es cliente el que esta ejecutando esto.
 				if (m_nOwnerType == owner::client) {
-					// Le pedimos a asio que intente conectarse al punto de la direccin dado.
-					// Le damos como parmetro el socket, el punto de la direccin y la funcin lambda a ejecutar directamente.
-						// La cual tendr un manejador de errores y de igual forma el punto de la direccin.
+					// Lo que se envíe antes de terminar la validación espera en la cola y sale justo detrás de la respuesta,
+					// así la aplicación puede mandar sus primeros mensajes sin esperar a IsValidated().
+					this->m_bHoldWrites = true;
+
+					// Le pedimos a asio que intente conectarse al punto de la dirección dado.
+					// Le damos como parámetro el socket, el punto de la dirección y la función lambda a ejecutar directamente.
+						// La cual tendrá un manejador de errores y de igual forma el punto de la dirección.
 					asio::async_connect(this->m_socket, endpoints, [this](std::error_code ec, asio::ip::tcp::endpoint endpoint) {
 							// Verificamos que no haya errores.
 							if (!ec) {
-								// Si no hay errores, indicamos que vaya a leer la validacin.
-								ReadValidation();
+								// Ya conectados, aplicamos las opciones del socket.
+								ApplySocketOptions();
+								ArmIdleTimer();
+
+								// Si no hay errores, indicamos que vaya a leer la validación.
+									// Si se usan boletos de reanudación, antes mandamos el saludo.
+								if (m_options.handshake.bResumption) {
+									WriteHello();
+								}
+								else {
+									ReadValidation();
+								}
 							}
 						});
 				}
 			}
 			
-			// Mtodo que cierra la conexin.
+			// Método que deja la conexión abierta sin socket, con la ID dada y ya validada.
+				// Sirve para entregar mensajes a los manejadores del servidor sin red, por ejemplo al reproducir una captura.
+				// Lo que se envíe por ella solo se cuenta en las métricas y se descarta.
+			void ConnectDetached(uint32_t uid) {
+				this->id = uid;
+				this->m_bValidated = true;
+				this->m_bDetached = true;
+			}
+
+			// Método que une esta conexión con otra del mismo proceso, sin sockets (ver client_interface::ConnectLoopback()).
+				// Lo que se envíe se agrega directo a la cola de entrada de la otra, en el mismo orden en que se envió.
+				// Se debe llamar antes de enviar nada, y los procesos de asio de ambas conexiones deben estar corriendo.
+			void ConnectLoopback(std::weak_ptr<connection<T>> pPeer) {
+				this->m_pPeer = std::move(pPeer);
+				this->m_bLoopback = true;
+				this->m_bDetached = true;
+			}
+
+			// Método que cierra la conexión.
 			void Disconnect() {
+				// Una conexión en el mismo proceso se cierra desde su proceso de asio, así lo que se envió antes se entrega primero.
+				if (this->m_bLoopback) {
+					asio::post(this->m_asioContext, [this]() { CloseLoopback(); });
+					return;
+				}
+
+				// Una conexión sin socket solo se marca como cerrada.
+				if (this->m_bDetached.exchange(false)) {
+					return;
+				}
+
 				// Verificamos que estemos conectados.
 				if (this->IsConnected()) {
-					// Para poder desconectarnos, debemos darle el contexto de la conexin e usar una
-					// funcin lambda para cerrar directamente. Todo esto con el mtodo post.
-					asio::post(this->m_asioContext, [this]() { m_socket.close(); });
+					// Para poder desconectarnos, debemos darle el contexto de la conexión e usar una
+					// función lambda para cerrar directamente. Todo esto con el método post.
+					asio::post(this->m_asioContext, [this]() { CloseSocket(); });
 				}
 			}
 
-			// Mtodo que retorna un valor booleano en caso de que hay una conexin establecida al servidor.
+			// Método ASYNC, cierra la conexión de golpe y avisa cuando ya ningún manejador pendiente la va a usar.
+				// Sirve para poder destruirla cuando su contexto es compartido y sigue corriendo, ya que los manejadores
+				// guardan un pointer a la conexión. fnClosed se llama en el proceso de asio, después de los manejadores
+				// que se cancelaron al cerrar. No se debe enviar nada por la conexión después de llamarlo.
+			void Close(std::function<void()> fnClosed) {
+				asio::post(this->m_asioContext, [this, fnClosed = std::move(fnClosed)]() mutable {
+						if (m_bLoopback) {
+							CloseLoopback();
+						}
+						m_bDetached = false;
+
+						m_timerCork.cancel();
+						m_timerDrain.cancel();
+						CloseSocket();
+
+						// Cerrar y cancelar forman en la cola del contexto a los manejadores pendientes, así que esto corre después de ellos.
+						asio::post(m_asioContext, std::move(fnClosed));
+					});
+			}
+
+			// Método que retorna un valor booleano en caso de que hay una conexión establecida al servidor.
 			bool IsConnected() const {
-				return this->m_socket.is_open();
+				return this->m_socket.is_open() || this->m_bDetached;
 			};
 
-			// Mtodo enva el mensaje dado.
+			// Método ASYNC, cierra la conexión de forma ordenada.
+				// Primero termina de escribir todo lo que ya se había enviado (incluyendo lo agrupado), después cierra su
+				// lado del socket (el otro lado lee fin de archivo, en vez de un reinicio que puede perder datos) y sigue
+				// leyendo hasta que el otro lado cierre el suyo. Si se llega a tpDeadline antes, cierra de golpe.
+				// fnDrained se llama en el proceso de asio cuando la conexión queda cerrada, a más tardar en tpDeadline.
+				// Los mensajes que lleguen mientras tanto se siguen agregando a la cola de entrada.
+			void Drain(std::chrono::steady_clock::time_point tpDeadline, std::function<void()> fnDrained) {
+				asio::post(this->m_asioContext, [this, tpDeadline, fnDrained = std::move(fnDrained)]() mutable {
+						// Sin socket no hay nada que esperar, y en el mismo proceso lo enviado antes ya se entrego.
+						if (m_bLoopback || m_bDetached) {
+							if (m_bLoopback) {
+								CloseLoopback();
+							}
+							m_bDetached = false;
+							fnDrained();
+							return;
+						}
+
+						if (!m_socket.is_open()) {
+							fnDrained();
+							return;
+						}
+
+						m_fnDrained = std::move(fnDrained);
+
+						// Si se vence el tiempo cerramos de golpe, lo cual también avisa que termino.
+						m_timerDrain.expires_at(tpDeadline);
+						m_timerDrain.async_wait([this](std::error_code ec) {
+								if (!ec) {
+									CloseSocket();
+								}
+							});
+
+						// Cuando se termine de escribir el ultimo mensaje enviado, cerramos nuestro lado.
+							// El resto lo hace la lectura: cuando el otro lado cierre, fallara y cerrara el socket.
+						m_deqSendWaiters.emplace_back(m_nSeqQueued, [this](std::error_code ec) {
+								if (!ec) {
+									std::error_code ecShutdown;
+									m_socket.shutdown(asio::ip::tcp::socket::shutdown_send, ecShutdown);
+								}
+							});
+
+						// Lo agrupado no tiene por que esperar su temporizador, y puede que ya no haya nada pendiente.
+						WriteCorked();
+						CompleteSendWaiters();
+					});
+			}
+
+			// Método que retorna verdadero si la conexión ya termino la validación.
+				// Del lado del cliente, los mensajes que se manden antes de esto esperan y salen detrás de la validación.
+			bool IsValidated() const {
+				return this->m_bValidated;
+			}
+
+			// Método envía el mensaje dado.
 			void Send(const message<T>& msg) {
-				// Le indicamos a asio que mande los datos con el mtodo post, dandole as
-				// El contexto donde se est trabajando y ejecutamos directamente el resultado con una
-				// funcin lambda para hacer que el servidor este en el estado de escribir mensajes.
-				asio::post(this->m_asioContext, [this, msg]() {
-						
-						// Verificamos si esta escribiendo ms mensajes.
-						bool bWritingMessage = !m_qMessagesOut.empty();
-
-						// Primero agregamos el mensaje a la cola de mensajes de salida.
-						m_qMessagesOut.push_back(msg);
-
-						// Verificamos que no este escribiendo ms mensajes.
-						if (!bWritingMessage) {
-							// Y finalmente empezamos el proceso de escribir.
-							WriteHeader();
+				// Se hace una única copia del mensaje, la cual se comparte hasta que se termine de escribir.
+				this->Send(std::make_shared<const message<T>>(msg));
+			}
+
+			// Método envía un mensaje compartido, sin copiarlo.
+				// Sirve para mandar el mismo mensaje a muchas conexiones guardando una sola copia del cuerpo.
+				// El mensaje no debe modificarse después de enviarlo.
+			void Send(std::shared_ptr<const message<T>> msg) {
+				// Sin socket no hay a donde escribir, solo se cuenta como escrito.
+					// Si la otra conexión esta en el mismo proceso, se le entrega desde nuestro proceso de asio para conservar el orden.
+				if (this->m_bLoopback) {
+					asio::post(this->m_asioContext, [this, msg = std::move(msg)]() { SendLoopback(*msg); });
+					return;
+				}
+				else if (this->m_bDetached) {
+					this->CountDetachedSend(*msg);
+					return;
+				}
+
+				// Le indicamos a asio que mande los datos con el método post, dandole así
+				// El contexto donde se está trabajando y ejecutamos directamente el resultado con una
+				// función lambda para hacer que el servidor este en el estado de escribir mensajes.
+				asio::post(this->m_asioContext, [this, msg = std::move(msg), tpSent = std::chrono::steady_clock::now()]() mutable {
+						Enqueue(std::move(msg), tpSent);
+					});
+			}
+
+			// Método ASYNC, envía el mensaje y avisa cuando se termino de escribir en el socket.
+				// Acepta cualquier forma de completar de asio: un callback void(std::error_code), asio::use_awaitable, etc.
+			template <typename CompletionToken>
+			auto AsyncSend(const message<T>& msg, CompletionToken&& token) {
+				return asio::async_initiate<CompletionToken, void(std::error_code)>([this](auto handler, std::shared_ptr<const message<T>> pMsg) {
+						// El manejador puede no ser copiable, así que lo compartimos para poder guardarlo en un std::function.
+						auto pHandler = std::make_shared<std::decay_t<decltype(handler)>>(std::move(handler));
+
+						// En el mismo proceso, el mensaje esta escrito en cuanto se entrega al otro lado.
+						if (m_bLoopback) {
+							asio::post(m_asioContext, [this, pMsg, pHandler]() {
+									SendLoopback(*pMsg);
+									auto executor = asio::get_associated_executor(*pHandler, m_asioContext.get_executor());
+									asio::post(executor, [pHandler]() { (*pHandler)(std::error_code()); });
+								});
+							return;
+						}
+
+						// Sin socket el mensaje se cuenta como escrito de inmediato.
+						if (m_bDetached) {
+							CountDetachedSend(*pMsg);
+							auto executor = asio::get_associated_executor(*pHandler, m_asioContext.get_executor());
+							asio::post(executor, [pHandler]() { (*pHandler)(std::error_code()); });
+							return;
+						}
+
+						asio::post(m_asioContext, [this, pMsg, pHandler, tpSent = std::chrono::steady_clock::now()]() {
+								uint64_t nSeq = Enqueue(pMsg, tpSent);
+
+								// Cuando se escriba, el manejador se ejecuta en su propio ejecutor.
+								m_deqSendWaiters.emplace_back(nSeq, [this, pHandler](std::error_code ec) {
+										auto executor = asio::get_associated_executor(*pHandler, m_asioContext.get_executor());
+										asio::post(executor, [pHandler, ec]() { (*pHandler)(ec); });
+									});
+							});
+					}, token, std::make_shared<const message<T>>(msg));
+			}
+
+			// Asigna el boleto de reanudación que el cliente mandara en su saludo (ver handshake_options::bResumption).
+				// Se debe llamar antes de ConnectToServer().
+			void SetResumeToken(uint64_t nToken) {
+				this->m_nResumeToken = nToken;
+			}
+
+			// Retorna el ultimo boleto de reanudación que entrego el servidor y que aun no se ha usado, o cero si no hay.
+			uint64_t GetResumeToken() const {
+				return this->m_nResumeToken;
+			}
+
+			// Del lado del servidor, retorna la ID de la conexión anterior del cliente si reanudo con su boleto, o cero.
+			uint32_t GetResumedID() const {
+				return this->m_nResumedFrom;
+			}
+
+			// Marca la conexión como de confianza, sus mensajes ya no pasan por los limites de velocidad (ver rate_limit_options).
+				// El servidor lo usa con los enlaces de la federación. Se puede llamar desde cualquier proceso.
+			void SetTrusted(bool bTrusted) {
+				this->m_bTrusted = bTrusted;
+			}
+
+			bool IsTrusted() const {
+				return this->m_bTrusted;
+			}
+
+			// Retorna el ultimo estado que confirmo el cliente (ver server_interface::BroadcastSnapshot()), o cero si ninguno.
+				// Se puede llamar desde cualquier proceso.
+			uint32_t GetSnapshotAck() const {
+				return this->m_nSnapshotAck.load(std::memory_order_relaxed);
+			}
+
+			// Retorna una copia de los contadores de la conexión, se puede llamar desde cualquier proceso.
+			connection_metrics_snapshot GetMetrics() const {
+				return this->m_metrics.Snapshot();
+			}
+
+			// Asigna el histograma donde se anotara el tiempo desde Send() hasta que el mensaje se escribe.
+				// Lo usa el servidor para juntar las latencias de todas sus conexiones en un solo histograma.
+			void SetSendLatencyHistogram(std::shared_ptr<latency_histogram> pHistogram) {
+				asio::post(this->m_asioContext, [this, pHistogram = std::move(pHistogram)]() mutable {
+						m_pSendLatency = std::move(pHistogram);
+					});
+			}
+
+			// Retorna los valores de las opciones del socket tal como quedaron aplicados por el sistema operativo.
+				// Solo tiene valores después de que la conexión se acepto o se conecto.
+			const socket_options& GetSocketOptions() const {
+				return this->m_appliedSocketOptions;
+			}
+
+			// Asigna la función que recibirá los pedazos de los mensajes grandes (ver message_limits::nStreamThreshold).
+				// Importante: se ejecuta en el proceso de asio, así que no debe bloquearse,
+				// y los datos del pedazo solo son validos durante la llamada.
+			void SetChunkHandler(std::function<void(const message_header<T>& header, const uint8_t* pData, size_t nLength, size_t nOffset, bool bLast)> handler) {
+				this->m_fnChunkHandler = std::move(handler);
+			}
+
+			// Asigna la función que se llamara una sola vez cuando se cierre el socket, en el proceso de asio.
+				// Se debe asignar desde el proceso de asio antes de empezar a usar la conexión.
+			void SetCloseHandler(std::function<void()> handler) {
+				this->m_fnCloseHandler = std::move(handler);
+			}
+
+			// Método que escribe de inmediato los mensajes acumulados por el modo agrupado, sin esperar
+			// a que se llene el buffer o se venza el tiempo.
+			void Flush() {
+				asio::post(this->m_asioContext, [this]() { WriteCorked(); });
+			}
+
+			// Método que cambia las opciones del agrupado de envíos de la conexión.
+				// Si se desactiva, lo que se haya acumulado se escribe de inmediato.
+			void SetCorking(const cork_options& options) {
+				asio::post(this->m_asioContext, [this, options]() {
+						m_options.cork = options;
+						ApplySocketOptions();
+
+						if (!m_options.cork.bEnabled) {
+							WriteCorked();
 						}
 					});
 			}
 
 		protected:
-			// Cada conexin tiene un socket nico para el control remoto.
+			// Cada conexión tiene un socket único para el control remoto.
 			asio::ip::tcp::socket m_socket;
 
-			// Este contexto es compartido con toda la instancia asio, ya que se debe usar el mismo contexto y no mltiples.
+			// Este contexto es compartido con toda la instancia asio, ya que se debe usar el mismo contexto y no múltiples.
 			asio::io_context& m_asioContext;
 
-			// Esta cola de subprocesos sostiene todos los mensajes a ser enviado hacia el control remoto de esta conexin.
-			tsqueue<message<T>> m_qMessagesOut;
+			// Esta cola de subprocesos sostiene todos los mensajes a ser enviado hacia el control remoto de esta conexión.
+				// Los mensajes se guardan compartidos, así un mismo mensaje puede estar en la cola de muchas conexiones.
+			lazy_deque<std::shared_ptr<const message<T>>> m_qMessagesOut;
 
-			// Esta cola de sobprocesos sostiene todos los mensajes a ser recividos del control remoto de esta conexin.
-			// Notar que es una referenca como el "propietario" de esta conexin, se espera que se provea una cola de subprocesos.
+			// Esta cola de sobprocesos sostiene todos los mensajes a ser recividos del control remoto de esta conexión.
+			// Notar que es una referencía como el "propietario" de esta conexión, se espera que se provea una cola de subprocesos.
 			tsqueue<owned_message<T>>& m_qMessagesIn;
 
 			// Al igual que la variable del mismo tipo, esta variable se encargara de guardar los mensajes de forma temporal.
 			message<T> m_msgTemporaryIn;
 
-			// Creamos el tipo de autor para poder especificar que tipo de conexin es y haya un tipo de evento.
+			// Bytes del encabezado en la red, solo se usan cuando no se puede leer o escribir directo (ver wire_header).
+				// El de salida solo lo usa la escritura en curso, la cual es una a la vez.
+			uint8_t m_aHeaderIn[wire_header<T>::nSize];
+			uint8_t m_aHeaderOut[wire_header<T>::nSize];
+
+			// Creamos el tipo de autor para poder especificar que tipo de conexión es y haya un tipo de evento.
 			// Notar que el "autor" decide como algunas conexiones se comportan.
 			owner m_nOwnerType = owner::server;
 
-			// Variable que guardara la ID de la conexin.
+			// Variable que guardara la ID de la conexión.
 			uint32_t id = 0;
 
-			// Valores para validacin.
+			// Valores para validación.
 			uint64_t m_nADVOut = 0;
 			uint64_t m_nADVIn = 0;
 			uint64_t m_nADVCheck = 0;
 
+			// Indica si la validación ya termino, se puede leer desde otros procesos.
+			std::atomic<bool> m_bValidated{ false };
+
+			// Saludo del cliente (ver WriteHello()), y si el cliente esta reanudando con un boleto.
+			uint64_t m_nHello = 0;
+			bool m_bResuming = false;
+
+			// Del lado del servidor, la ID de la conexión anterior del cliente si reanudo con su boleto, o cero.
+			uint32_t m_nResumedFrom = 0;
+
+			// Indica si la conexión no pasa por los limites de velocidad (ver SetTrusted()).
+			std::atomic<bool> m_bTrusted{ false };
+
+			// Boleto de reanudación para la siguiente conexión del cliente, se puede leer desde otros procesos.
+			std::atomic<uint64_t> m_nResumeToken{ 0 };
+
+			// Retiene las escrituras mientras la validación escribe en el socket, así los mensajes no se mezclan con ella.
+			bool m_bHoldWrites = false;
+
+			// Codec con el que se comprime lo que se envía, none hasta que el otro lado anuncie el nuestro.
+				// Y los buffers donde se comprime y descomprime, se conservan para no reservar memoria en cada mensaje.
+				// El de descompresión es del mismo tipo que el cuerpo, para poder intercambiarlos.
+			compression_codec m_eSendCodec = compression_codec::none;
+			std::vector<uint8_t> m_vCompressed;
+			decltype(message<T>::body) m_vDecompressed;
+
+			// Del lado del servidor, el ultimo estado que confirmo el cliente. Del lado del cliente, los estados recibidos.
+			std::atomic<uint32_t> m_nSnapshotAck{ 0 };
+			snapshot_receiver m_snapshots;
+
+			// Indica que la conexión esta abierta sin socket (ver ConnectDetached() y ConnectLoopback()).
+			std::atomic<bool> m_bDetached{ false };
+
+			// Conexión del otro lado cuando ambas están en el mismo proceso, y si esta conexión es de ese tipo.
+			std::weak_ptr<connection<T>> m_pPeer;
+			bool m_bLoopback = false;
+
+			// Opciones con las que se creo la conexión.
+			connection_options m_options;
+
+			// Manejador de los pedazos de mensajes grandes, su buffer y cuanto se lleva leído del mensaje actual.
+			std::function<void(const message_header<T>&, const uint8_t*, size_t, size_t, bool)> m_fnChunkHandler;
+			std::vector<uint8_t> m_vChunkBuffer;
+			size_t m_nStreamOffset = 0;
+
+			// Quien espera a que se cierre el socket (ver SetCloseHandler()).
+			std::function<void()> m_fnCloseHandler;
+
+			// Valores de las opciones del socket leídos después de aplicarlos.
+			socket_options m_appliedSocketOptions;
+
+			// Buffers del modo agrupado, uno donde se van acumulando los mensajes y otro que se esta escribiendo.
+			std::vector<uint8_t> m_vCorkBuffer;
+			std::vector<uint8_t> m_vCorkWriting;
+
+			// Indica si el lote agrupado se esta escribiendo en este momento.
+			bool m_bCorkWriting = false;
+
+			// Números de secuencia de los mensajes, el ultimo que se encolo, el ultimo que se escribió
+			// y el ultimo que va en el lote agrupado que se esta escribiendo.
+			uint64_t m_nSeqQueued = 0;
+			uint64_t m_nSeqWritten = 0;
+			uint64_t m_nSeqCorkWriting = 0;
+
+			// Quienes esperan a que se escriba un mensaje, con el número de secuencia que esperan.
+			lazy_deque<std::pair<uint64_t, std::function<void(std::error_code)>>> m_deqSendWaiters;
+
+			// Temporizador que limita cuanto tiempo puede esperar un mensaje en el buffer agrupado.
+			asio::steady_timer m_timerCork;
+
+			// Temporizador del limite del cierre ordenado, y quien espera a que termine (ver Drain()).
+			asio::steady_timer m_timerDrain;
+			std::function<void()> m_fnDrained;
+
+			// Cubetas de los limites de lo que se recibe, el temporizador de la espera cuando se pasan, y el buffer donde
+				// se leen los cuerpos descartados (ver ApplyRateLimit()).
+			rate_limiter m_rateLimiter;
+			asio::steady_timer m_timerRate;
+			std::vector<uint8_t> m_vDiscard;
+
+			// Temporizador que revisa si la conexión esta inactiva (ver memory_options::idleRelease), los mensajes que
+				// llevaba en la revisión anterior, y si hay una lectura de encabezado en curso (el cuerpo no se esta usando).
+			asio::steady_timer m_timerIdle;
+			uint64_t m_nIdleMark = 0;
+			bool m_bReadingHeader = false;
+
+			// Contadores de la conexión.
+			connection_metrics m_metrics;
+
+			// Momento en que se llamo a Send() por cada mensaje que aun no se termina de escribir, en orden de secuencia.
+			lazy_deque<std::chrono::steady_clock::time_point> m_deqSendTimes;
+
+			// Momento en que empezó la escritura en curso, para detectar escrituras atoradas.
+			std::chrono::steady_clock::time_point m_tpWriteStart;
+
+			// Histograma donde se anota el tiempo desde Send() hasta la escritura, si se asigno.
+			std::shared_ptr<latency_histogram> m_pSendLatency;
+
 		};
 
 	}
@@ -0,0 +1,177 @@
+#pragma once
+
+#include "net_common.h"
+#include "net_tsqueue.h"
+#include "net_message.h"
+#include "net_connection.h"
+#include "net_client.h"
+#include "net_server.h"
+#include "net_rpc.h"
+
+// API con corrutinas de C++20 (co_await) sobre las conexiones de cap::net.
+	// Solo esta disponible si el compilador soporta corrutinas (C++20, /std:c++latest en MSVC, -std=c++20 en gcc).
+	// Los marcos de las corrutinas de asio (asio::awaitable) se reservan con la memoria que asio recicla por proceso,
+	// y las operaciones de aquí no crean marcos propios, son operaciones asíncronas normales de asio.
+#if defined(ASIO_HAS_CO_AWAIT)
+
+namespace cap {
+	namespace net {
+
+		// Permite esperar con co_await a que llegue un ítem a una cola de subprocesos.
+			// Se espera un único consumidor, y que el consumidor corra en el ejecutor dado.
+		template <typename V>
+		class async_receiver {
+		public:
+			async_receiver(tsqueue<V>& queue, asio::any_io_executor executor)
+				: m_queue(queue), m_executor(executor), m_timerSignal(executor, asio::steady_timer::time_point::max()) {
+				// Cada que llegue un ítem cancelamos el temporizador desde su ejecutor, lo cual despierta a quien espere.
+				this->m_queue.SetNotify([this]() {
+						asio::post(m_executor, [this]() { m_timerSignal.cancel(); });
+					});
+			}
+
+			async_receiver(const async_receiver<V>&) = delete;
+
+			virtual ~async_receiver() {
+				this->m_queue.SetNotify(nullptr);
+			}
+
+			// Espera a que haya un ítem en la cola y lo saca.
+			asio::awaitable<V> Receive() {
+				while (this->m_queue.empty()) {
+					// El temporizador nunca se vence solo, solo se despierta al cancelarlo.
+					std::error_code ec;
+					this->m_timerSignal.expires_at(asio::steady_timer::time_point::max());
+					co_await this->m_timerSignal.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+				}
+
+				co_return this->m_queue.pop_front();
+			}
+
+		protected:
+			tsqueue<V>& m_queue;
+			asio::any_io_executor m_executor;
+			asio::steady_timer m_timerSignal;
+		};
+
+		// Envía el mensaje y espera a que se termine de escribir, retorna el error si no se pudo.
+		template <typename T>
+		asio::awaitable<std::error_code> AsyncSend(connection<T>& conn, const message<T>& msg) {
+			std::error_code ec;
+			co_await conn.AsyncSend(msg, asio::redirect_error(asio::use_awaitable, ec));
+			co_return ec;
+		}
+
+		// Hace una llamada RPC y espera su resultado.
+			// El resultado se entrega en el ejecutor de la corrutina, aunque el canal se complete desde otro proceso.
+		template <typename T, typename CompletionToken = asio::use_awaitable_t<>>
+		auto AsyncCall(rpc_channel<T>& channel, message<T> msg, std::chrono::milliseconds timeout, CompletionToken&& token = {}) {
+			return asio::async_initiate<CompletionToken, void(rpc_result<T>)>([&channel, timeout](auto handler, message<T> msg) {
+					auto pHandler = std::make_shared<std::decay_t<decltype(handler)>>(std::move(handler));
+
+					channel.Call(std::move(msg), timeout, [pHandler](rpc_result<T>& result) {
+							auto executor = asio::get_associated_executor(*pHandler);
+							asio::post(executor, [pHandler, result = std::move(result)]() mutable { (*pHandler)(std::move(result)); });
+						});
+				}, token, std::move(msg));
+		}
+
+		// Cliente con corrutinas: en vez de revisar Incoming() en un ciclo, se espera con co_await Receive().
+			// Las corrutinas corren en el mismo contexto de asio que la conexión, usando Spawn().
+		template <typename T>
+		class coro_client : public client_interface<T> {
+		public:
+			coro_client() : m_receiver(this->Incoming(), this->m_context.get_executor()) {
+			}
+
+			// Nos desconectamos antes de destruir el receptor, así el proceso de asio ya no lo puede usar.
+			virtual ~coro_client() {
+				this->Disconnect();
+			}
+
+			// Lanza una corrutina en el contexto del cliente.
+				// La corrutina sigue después de que Spawn() regresa, así que no debe ser una lambda temporal con capturas
+				// (p. ej. Spawn([&]() -> asio::awaitable<void> {...}())): la lambda se destruye al terminar la línea y sus
+				// capturas con ella. Lo que use debe llegar como parámetro de la corrutina, o la lambda debe seguir viva.
+			void Spawn(asio::awaitable<void> task) {
+				asio::co_spawn(this->m_context, std::move(task), asio::detached);
+			}
+
+			// Espera el siguiente mensaje del servidor.
+			asio::awaitable<message<T>> Receive() {
+				owned_message<T> msg = co_await this->m_receiver.Receive();
+				co_return std::move(msg.msg);
+			}
+
+			// Envía un mensaje al servidor y espera a que se escriba.
+			asio::awaitable<std::error_code> SendAsync(const message<T>& msg) {
+				if (!this->IsConnected()) {
+					co_return std::error_code(asio::error::not_connected);
+				}
+
+				co_return co_await AsyncSend(*this->m_connection, msg);
+			}
+
+		protected:
+			async_receiver<owned_message<T>> m_receiver;
+		};
+
+		// Servidor con corrutinas: las conexiones validadas se esperan con co_await Accept() y los mensajes
+		// con co_await Receive(), en vez de usar los eventos y Update().
+			// Las corrutinas corren en el contexto de asio del servidor, usando Spawn().
+		template <typename T>
+		class coro_server : public server_interface<T> {
+		public:
+			coro_server(uint16_t port, const acceptor_options& options = {})
+				: server_interface<T>(port, options),
+				m_receiver(this->m_qMessagesIn, this->m_asioContext.get_executor()),
+				m_acceptor(m_qValidated, this->m_asioContext.get_executor()) {
+			}
+
+			// Detenemos el servidor antes de destruir los receptores, así el proceso de asio ya no los puede usar.
+			virtual ~coro_server() {
+				this->Stop();
+			}
+
+			// Lanza una corrutina en el contexto del servidor.
+				// Igual que en coro_client::Spawn(), lo que use la corrutina debe llegar como parámetro, no en capturas de una lambda temporal.
+			void Spawn(asio::awaitable<void> task) {
+				asio::co_spawn(this->m_asioContext, std::move(task), asio::detached);
+			}
+
+			// Espera a que un cliente nuevo termine su validación.
+			asio::awaitable<std::shared_ptr<connection<T>>> Accept() {
+				co_return co_await this->m_acceptor.Receive();
+			}
+
+			// Espera el siguiente mensaje de cualquier cliente, junto con la conexión que lo mando.
+			asio::awaitable<owned_message<T>> Receive() {
+				owned_message<T> msg = co_await this->m_receiver.Receive();
+				this->RecordReadLatency(msg);
+				Trace<T>(trace_stage::dequeue, msg.nTraceId);
+				this->CaptureIncoming(msg);
+				co_return msg;
+			}
+
+			// Si se sobrescribe, se debe llamar a esta versión para que Accept() reciba al cliente.
+			virtual void OnClientValidated(std::shared_ptr<connection<T>> client) override {
+				this->m_qValidated.push_back(client);
+			}
+
+		protected:
+			// Por defecto se aceptan todas las conexiones, la validación decide.
+			virtual bool OnClientConnect(std::shared_ptr<connection<T>> client) override {
+				return true;
+			}
+
+			// Clientes validados que aun no se han entregado con Accept().
+			tsqueue<std::shared_ptr<connection<T>>> m_qValidated;
+
+			async_receiver<owned_message<T>> m_receiver;
+			async_receiver<std::shared_ptr<connection<T>>> m_acceptor;
+		};
+
+	}
+}
+
+#endif
\ No newline at end of file
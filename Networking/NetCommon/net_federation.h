@@ -0,0 +1,335 @@
+#pragma once
+
+#include "net_common.h"
+#include "net_message.h"
+#include "net_connection.h"
+#include "net_memory.h"
+
+#include <string_view>
+
+namespace cap {
+	namespace net {
+
+		// Otro nodo del servidor al que este se conecta: su dirección y su número de nodo.
+		struct federation_peer {
+			std::string sHost;
+			uint16_t nPort = 0;
+			uint8_t nNode = 0;
+		};
+
+		// Opciones de la federación de varios nodos del servidor (ver server_interface::StartFederation()).
+			// Cada nodo se conecta a todos los demás como un cliente más (una malla completa), y por esos enlaces les reenvía
+			// lo que manda a todos, lo que publica en los temas y los mensajes para clientes de otros nodos.
+		struct federation_options {
+			// Número de este nodo, de 1 a 255 y distinto en cada uno. Va en el byte más alto de las IDs de sus conexiones,
+				// así cualquier nodo sabe en cual esta un cliente solo con su ID.
+			uint8_t nNode = 0;
+
+			// Los demás nodos, todos deben tener la misma lista (cada uno sin si mismo).
+			std::vector<federation_peer> vPeers;
+
+			// Secreto compartido con el que un enlace se identifica al conectarse, debe ser el mismo en todos los nodos y
+				// distinto de cero. Con el, un enlace no pasa por los limites de velocidad y puede mandar a todos los clientes,
+				// así que no debe conocerlo nadie más y no debe ser un valor fijo en el código.
+				// Nota: viaja por la red tal cual (sin cifrar), así que los enlaces deben ir por una red privada o de confianza.
+			uint64_t nSecret = 0;
+
+			// Lo que se reenvía a cada nodo se junta en un lote de hasta este tamaño, que sale como un solo mensaje al
+				// llenarse o al principio y al final de cada Update(). Un mensaje más grande sale en su propio lote.
+			size_t nBatchBytes = 64 * 1024;
+
+			// Cada cuanto se vuelve a intentar un enlace caído. Lo que se reenvíe mientras no hay enlace se descarta.
+			std::chrono::milliseconds reconnectInterval{ 1000 };
+		};
+
+		// Contadores de la federación.
+		struct federation_stats {
+			// Enlaces hacia otros nodos que están validados, y enlaces de otros nodos que ya se identificaron.
+			uint64_t nLinksUp = 0;
+			uint64_t nPeers = 0;
+
+			// Mensajes reenviados, lotes en los que salieron, mensajes recibidos de otros nodos y los descartados sin enlace.
+			uint64_t nForwarded = 0;
+			uint64_t nBatches = 0;
+			uint64_t nReceived = 0;
+			uint64_t nDropped = 0;
+		};
+
+		// Tipos de los registros dentro de un lote.
+		enum class federation_kind : uint8_t {
+			// Identifica al enlace: el número de su nodo (uint8_t) y el secreto (uint64_t).
+			hello = 1,
+
+			// Un mensaje para todos los clientes del nodo.
+			broadcast = 2,
+
+			// Un mensaje para los suscritos a un tema: el tema (uint16_t de largo y sus bytes) y el mensaje.
+			publish = 3,
+
+			// Un mensaje para un cliente: su ID (uint32_t) y el mensaje.
+			direct = 4,
+		};
+
+		// Retorna el número del nodo que tiene a la conexión con la ID dada (ver federation_options::nNode).
+		inline uint8_t NodeOfID(uint32_t nID) {
+			return uint8_t(nID >> 24);
+		}
+
+		// Lote de registros para otro nodo: un mensaje con la bandera flag_federation cuyo cuerpo son los registros uno tras otro.
+			// Cada registro es su tipo (uint8_t), sus datos (ver federation_kind) y, si lleva mensaje, su encabezado como va
+			// en la red (ver wire_header) y su cuerpo. A diferencia de operator <<, se escribe y se lee hacia adelante.
+		template <typename T>
+		class federation_batch {
+		public:
+			federation_batch() {
+				this->m_msg.header.flags = flag_federation;
+			}
+
+			bool Empty() const {
+				return this->m_nRecords == 0;
+			}
+
+			size_t Records() const {
+				return this->m_nRecords;
+			}
+
+			size_t Bytes() const {
+				return this->m_msg.body.size();
+			}
+
+			void AddHello(uint8_t nNode, uint64_t nSecret) {
+				uint8_t* p = this->Grow(1 + sizeof(uint8_t) + sizeof(uint64_t));
+				p[0] = uint8_t(federation_kind::hello);
+				p[1] = nNode;
+				StoreWire(p + 2, nSecret);
+				this->m_nRecords++;
+			}
+
+			void AddBroadcast(const message<T>& msg) {
+				uint8_t* p = this->Grow(1);
+				p[0] = uint8_t(federation_kind::broadcast);
+				this->AddMessage(msg);
+			}
+
+			void AddPublish(std::string_view sTopic, const message<T>& msg) {
+				uint16_t nLength = uint16_t(std::min<size_t>(sTopic.size(), UINT16_MAX));
+				uint8_t* p = this->Grow(1 + sizeof(uint16_t) + nLength);
+				p[0] = uint8_t(federation_kind::publish);
+				StoreWire(p + 1, nLength);
+				std::memcpy(p + 1 + sizeof(uint16_t), sTopic.data(), nLength);
+				this->AddMessage(msg);
+			}
+
+			void AddDirect(uint32_t nID, const message<T>& msg) {
+				uint8_t* p = this->Grow(1 + sizeof(uint32_t));
+				p[0] = uint8_t(federation_kind::direct);
+				StoreWire(p + 1, nID);
+				this->AddMessage(msg);
+			}
+
+			// Entrega el lote armado y deja uno vacío.
+			std::shared_ptr<const message<T>> Take() {
+				this->m_msg.header.size = uint32_t(this->m_msg.body.size());
+				auto pMsg = std::make_shared<const message<T>>(std::move(this->m_msg));
+				this->m_msg = message<T>();
+				this->m_msg.header.flags = flag_federation;
+				this->m_nRecords = 0;
+				return pMsg;
+			}
+
+			// Registro leído de un lote, el tema solo es valido mientras exista el lote.
+			struct record {
+				federation_kind kind = federation_kind::hello;
+				uint8_t nNode = 0;
+				uint64_t nSecret = 0;
+				uint32_t nID = 0;
+				std::string_view sTopic;
+				message<T> msg;
+			};
+
+			// Lee el registro que empieza en nOffset del cuerpo del lote y avanza nOffset al siguiente.
+				// Retorna falso al terminar o si el registro esta incompleto o es de un tipo desconocido.
+			static bool Read(const message<T>& batch, size_t& nOffset, record& out) {
+				const uint8_t* pData = batch.body.data();
+				size_t nSize = batch.body.size();
+				if (nOffset >= nSize) {
+					return false;
+				}
+
+				size_t i = nOffset;
+				out.kind = federation_kind(pData[i++]);
+				switch (out.kind) {
+					case federation_kind::hello:
+						if (nSize - i < sizeof(uint8_t) + sizeof(uint64_t)) {
+							return false;
+						}
+						out.nNode = pData[i];
+						out.nSecret = LoadWire<uint64_t>(pData + i + 1);
+						nOffset = i + sizeof(uint8_t) + sizeof(uint64_t);
+						return true;
+
+					case federation_kind::broadcast:
+						break;
+
+					case federation_kind::publish: {
+						if (nSize - i < sizeof(uint16_t)) {
+							return false;
+						}
+						uint16_t nLength = LoadWire<uint16_t>(pData + i);
+						i += sizeof(uint16_t);
+						if (nSize - i < nLength) {
+							return false;
+						}
+						out.sTopic = std::string_view(reinterpret_cast<const char*>(pData + i), nLength);
+						i += nLength;
+					}
+					break;
+
+					case federation_kind::direct:
+						if (nSize - i < sizeof(uint32_t)) {
+							return false;
+						}
+						out.nID = LoadWire<uint32_t>(pData + i);
+						i += sizeof(uint32_t);
+						break;
+
+					default:
+						return false;
+				}
+
+				// El mensaje del registro.
+				if (nSize - i < wire_header<T>::nSize) {
+					return false;
+				}
+				wire_header<T>::Read(pData + i, out.msg.header);
+				i += wire_header<T>::nSize;
+				if (nSize - i < out.msg.header.size) {
+					return false;
+				}
+				out.msg.body.assign(pData + i, pData + i + out.msg.header.size);
+				nOffset = i + out.msg.header.size;
+				return true;
+			}
+
+		protected:
+			// Agrega nLength bytes al final del lote y retorna donde escribirlos.
+			uint8_t* Grow(size_t nLength) {
+				size_t i = this->m_msg.body.size();
+				this->m_msg.body.resize(i + nLength);
+				return this->m_msg.body.data() + i;
+			}
+
+			void AddMessage(const message<T>& msg) {
+				message_header<T> header = msg.header;
+				header.size = uint32_t(msg.body.size());
+				uint8_t* p = this->Grow(wire_header<T>::nSize + msg.body.size());
+				wire_header<T>::Write(header, p);
+				if (!msg.body.empty()) {
+					std::memcpy(p + wire_header<T>::nSize, msg.body.data(), msg.body.size());
+				}
+				this->m_nRecords++;
+			}
+
+			message<T> m_msg;
+			size_t m_nRecords = 0;
+		};
+
+		// Enlace de este nodo hacia otro: una conexión de cliente en el contexto del servidor, que se vuelve a abrir si se cae.
+			// Lo que el otro nodo mande por ella (por ejemplo desde su OnClientValidated()) se descarta.
+			// Nota: no es seguro entre procesos, el servidor lo usa desde el proceso que llama a Update().
+		template <typename T>
+		class federation_link {
+		public:
+			federation_link(asio::io_context& context, const federation_peer& peer)
+				: m_asioContext(context), m_peer(peer) {}
+
+			federation_link(const federation_link&) = delete;
+
+			virtual ~federation_link() {
+				this->Close();
+			}
+
+			uint8_t Node() const {
+				return this->m_peer.nNode;
+			}
+
+			// Indica si el enlace esta validado, lo que se envía por el sale en cuanto se pueda.
+			bool IsUp() const {
+				return this->m_pConnection && this->m_pConnection->IsConnected() && this->m_pConnection->IsValidated();
+			}
+
+			// Indica si tiene caso enviar: el enlace esta validado o aun se esta conectando (lo enviado espera a que
+				// termine la validación, y se pierde si el intento falla).
+			bool IsOpen(std::chrono::steady_clock::time_point tpNow) const {
+				return this->IsUp() || (this->m_pConnection && tpNow < this->m_tpNextAttempt);
+			}
+
+			// Si el enlace no esta abierto y ya paso el tiempo de espera, abre una conexión nueva y manda el saludo.
+			void Maintain(std::chrono::steady_clock::time_point tpNow, const connection_options& options, const federation_options& federation) {
+				this->m_qMessagesIn.clear();
+
+				if (this->IsUp()) {
+					return;
+				}
+				// Un intento que falla puede dejar el socket abierto sin avisar, así que se cuenta como caído si no se
+					// valido antes de que se venza (el intervalo de reconexión).
+				if (this->m_pConnection && tpNow < this->m_tpNextAttempt) {
+					return;
+				}
+
+				this->Close();
+				this->m_tpNextAttempt = tpNow + federation.reconnectInterval;
+
+				try {
+					asio::ip::tcp::resolver resolver(this->m_asioContext);
+					auto endpoints = resolver.resolve(this->m_peer.sHost, std::to_string(this->m_peer.nPort));
+
+					this->m_pConnection = std::allocate_shared<connection<T>>(slab_allocator<connection<T>>(), connection<T>::owner::client, this->m_asioContext, asio::ip::tcp::socket(this->m_asioContext), this->m_qMessagesIn, options);
+
+					// El saludo sale primero, en cuanto termine la validación. Se manda después de ConnectToServer(), que es
+						// quien retiene las escrituras hasta entonces.
+					this->m_pConnection->ConnectToServer(endpoints);
+
+					federation_batch<T> hello;
+					hello.AddHello(federation.nNode, federation.nSecret);
+					this->m_pConnection->Send(hello.Take());
+				}
+				catch (std::exception& e) {
+					std::cerr << "[FEDERACION] No se pudo conectar al nodo " << int(this->m_peer.nNode) << ": " << e.what() << "\n";
+					this->m_pConnection.reset();
+				}
+			}
+
+			// Manda un lote por el enlace.
+			void Send(std::shared_ptr<const message<T>> pBatch) {
+				if (this->m_pConnection) {
+					this->m_pConnection->Send(std::move(pBatch));
+				}
+			}
+
+			// Cierra el enlace. La conexión se mantiene viva hasta que corran sus manejadores pendientes,
+				// a menos que el contexto ya este detenido (al destruir el servidor), en cuyo caso ya no correrán.
+			void Close() {
+				if (!this->m_pConnection) {
+					return;
+				}
+
+				auto pConnection = std::move(this->m_pConnection);
+				if (!this->m_asioContext.stopped()) {
+					pConnection->Close([pConnection]() {});
+				}
+			}
+
+		protected:
+			asio::io_context& m_asioContext;
+			federation_peer m_peer;
+
+			std::shared_ptr<connection<T>> m_pConnection;
+			tsqueue<owned_message<T>> m_qMessagesIn;
+
+			// Cuando se vence el intento de conexión actual y se puede volver a intentar.
+			std::chrono::steady_clock::time_point m_tpNextAttempt{};
+		};
+
+	}
+}
\ No newline at end of file
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "net_common.h"
+
+#include <atomic>
+
+namespace cap {
+	namespace net {
+
+		// Grupo de contextos de asio, cada uno con su propio proceso, para que muchos clientes compartan unos cuantos procesos.
+			// Cada contexto corre en un solo proceso, así los manejadores de una conexión nunca corren al mismo tiempo
+			// (igual que con el contexto propio de cada cliente) y no se necesitan hilos de ejecución (strands) ni bloqueos.
+			// Las conexiones se reparten entre los contextos en orden circular.
+			// Importante: los clientes que usen el grupo se deben destruir antes que el grupo.
+		class io_pool {
+		public:
+			// Crea el grupo con la cantidad de procesos dada, por defecto uno por núcleo.
+			io_pool(size_t nThreads = std::max(std::thread::hardware_concurrency(), 1u)) {
+				nThreads = std::max<size_t>(nThreads, 1);
+
+				for (size_t i = 0; i < nThreads; i++) {
+					// Con un solo proceso por contexto, asio puede evitar algunos bloqueos internos.
+					this->m_vContexts.push_back(std::make_unique<asio::io_context>(1));
+					this->m_vWork.push_back(asio::make_work_guard(*this->m_vContexts.back()));
+				}
+
+				for (auto& pContext : this->m_vContexts) {
+					this->m_vThreads.emplace_back([&context = *pContext]() { context.run(); });
+				}
+			}
+
+			io_pool(const io_pool&) = delete;
+
+			virtual ~io_pool() {
+				this->Stop();
+			}
+
+			// Retorna el siguiente contexto del grupo, en orden circular.
+			asio::io_context& Next() {
+				size_t i = this->m_nNext.fetch_add(1, std::memory_order_relaxed) % this->m_vContexts.size();
+				return *this->m_vContexts[i];
+			}
+
+			// Retorna la cantidad de contextos (y de procesos) del grupo.
+			size_t Size() const {
+				return this->m_vContexts.size();
+			}
+
+			// Detiene todos los contextos y espera a sus procesos.
+			void Stop() {
+				this->m_vWork.clear();
+				for (auto& pContext : this->m_vContexts) {
+					pContext->stop();
+				}
+				for (auto& thr : this->m_vThreads) {
+					if (thr.joinable()) {
+						thr.join();
+					}
+				}
+			}
+
+		protected:
+			std::vector<std::unique_ptr<asio::io_context>> m_vContexts;
+			std::vector<asio::executor_work_guard<asio::io_context::executor_type>> m_vWork;
+			std::vector<std::thread> m_vThreads;
+			std::atomic<size_t> m_nNext{ 0 };
+		};
+
+	}
+}
\ No newline at end of file
@@ -0,0 +1,204 @@
+#pragma once
+
+#include "net_common.h"
+
+#include <cstddef>
+#include <atomic>
+
+namespace cap {
+	namespace net {
+
+		// Cola que no reserva memoria hasta que se le agrega el primer elemento.
+			// Un std::deque vacío ya reserva su mapa y un bloque (más de 500 bytes en libstdc++), lo cual con miles de
+			// conexiones inactivas, cada una con varias colas vacías, se vuelve la mayor parte de su memoria.
+			// No tiene bloqueos, solo se debe usar desde un proceso.
+		template <typename T>
+		class lazy_deque {
+		public:
+			bool empty() const {
+				return !this->m_pDeque || this->m_pDeque->empty();
+			}
+
+			size_t size() const {
+				return this->m_pDeque ? this->m_pDeque->size() : 0;
+			}
+
+			// Igual que en std::deque, la cola no debe estar vacía.
+			T& front() {
+				return this->m_pDeque->front();
+			}
+
+			T& back() {
+				return this->m_pDeque->back();
+			}
+
+			void pop_front() {
+				this->m_pDeque->pop_front();
+			}
+
+			void push_back(T item) {
+				this->Deque().push_back(std::move(item));
+			}
+
+			template <typename... Args>
+			T& emplace_back(Args&&... args) {
+				return this->Deque().emplace_back(std::forward<Args>(args)...);
+			}
+
+			// Libera la memoria de la cola si esta vacía.
+			void Release() {
+				if (this->empty()) {
+					this->m_pDeque.reset();
+				}
+			}
+
+		protected:
+			std::deque<T>& Deque() {
+				if (!this->m_pDeque) {
+					this->m_pDeque = std::make_unique<std::deque<T>>();
+				}
+				return *this->m_pDeque;
+			}
+
+			std::unique_ptr<std::deque<T>> m_pDeque;
+		};
+
+		// Reserva bloques de un mismo tamaño desde bloques grandes (slabs), con una lista de libres entre ellos.
+			// Comparado con reservar cada objeto por separado, no hay encabezado por objeto, quedan juntos en memoria
+			// y liberar y volver a reservar (conexiones que van y vienen) no fragmenta el heap.
+			// Los slabs no se devuelven al sistema: el pool crece hasta el máximo de objetos vivos y ahí se queda.
+			// Se puede usar desde varios procesos, las conexiones se crean en el proceso de asio y se destruyen donde
+			// se suelte la ultima referencia.
+		class slab_pool {
+		public:
+			slab_pool(size_t nBlockSize, size_t nBlocksPerSlab)
+				: m_nBlockSize(std::max(nBlockSize, sizeof(free_block))), m_nBlocksPerSlab(std::max<size_t>(nBlocksPerSlab, 1)) {}
+
+			slab_pool(const slab_pool&) = delete;
+
+			void* Allocate() {
+				std::scoped_lock lock(this->m_mux);
+				if (!this->m_pFree) {
+					this->AddSlab();
+				}
+
+				free_block* pBlock = this->m_pFree;
+				this->m_pFree = pBlock->pNext;
+				UsedCounter().fetch_add(this->m_nBlockSize, std::memory_order_relaxed);
+				return pBlock;
+			}
+
+			void Free(void* p) {
+				std::scoped_lock lock(this->m_mux);
+				free_block* pBlock = static_cast<free_block*>(p);
+				pBlock->pNext = this->m_pFree;
+				this->m_pFree = pBlock;
+				UsedCounter().fetch_sub(this->m_nBlockSize, std::memory_order_relaxed);
+			}
+
+			// Retorna los bytes reservados en slabs, usados o no.
+			size_t ReservedBytes() {
+				std::scoped_lock lock(this->m_mux);
+				return this->m_vSlabs.size() * this->m_nBlockSize * this->m_nBlocksPerSlab;
+			}
+
+			// Retorna los bytes de los bloques en uso y los reservados en slabs, sumando todos los pools del proceso.
+				// Sirven para medir cuanta memoria ocupan los objetos vivos, ya que los slabs no se devuelven.
+			static size_t TotalUsedBytes() {
+				return UsedCounter().load(std::memory_order_relaxed);
+			}
+
+			static size_t TotalReservedBytes() {
+				return ReservedCounter().load(std::memory_order_relaxed);
+			}
+
+			// Retorna el pool de los bloques del tamaño y alineación dados, compartido por todo el proceso.
+				// Nunca se destruye, así los objetos que se liberen al salir del programa (por ejemplo, desde otro
+				// objeto global) no lo encuentran ya destruido. El sistema recupera su memoria al terminar.
+			template <size_t nSize, size_t nAlign>
+			static slab_pool& Instance() {
+				static slab_pool* pPool = new slab_pool((nSize + nAlign - 1) / nAlign * nAlign, std::max<size_t>(65536 / nSize, 16));
+				return *pPool;
+			}
+
+		protected:
+			struct free_block {
+				free_block* pNext;
+			};
+
+			// Agrega un slab y encadena todos sus bloques a la lista de libres.
+			void AddSlab() {
+				this->m_vSlabs.push_back(std::make_unique<uint8_t[]>(this->m_nBlockSize * this->m_nBlocksPerSlab));
+				ReservedCounter().fetch_add(this->m_nBlockSize * this->m_nBlocksPerSlab, std::memory_order_relaxed);
+				uint8_t* pSlab = this->m_vSlabs.back().get();
+				for (size_t i = this->m_nBlocksPerSlab; i-- > 0;) {
+					free_block* pBlock = reinterpret_cast<free_block*>(pSlab + i * this->m_nBlockSize);
+					pBlock->pNext = this->m_pFree;
+					this->m_pFree = pBlock;
+				}
+			}
+
+			std::mutex m_mux;
+			free_block* m_pFree = nullptr;
+			std::vector<std::unique_ptr<uint8_t[]>> m_vSlabs;
+			size_t m_nBlockSize;
+			size_t m_nBlocksPerSlab;
+
+			// Contadores de todos los pools, en funciones para que haya uno solo aunque el encabezado se incluya en varios archivos.
+			static std::atomic<size_t>& UsedCounter() {
+				static std::atomic<size_t> nUsed{ 0 };
+				return nUsed;
+			}
+
+			static std::atomic<size_t>& ReservedCounter() {
+				static std::atomic<size_t> nReserved{ 0 };
+				return nReserved;
+			}
+		};
+
+		// Allocator que reserva los objetos sueltos desde el slab_pool de su tamaño.
+			// Sirve con std::allocate_shared(), así el objeto y su bloque de control quedan en un solo bloque del pool.
+			// Los arreglos y los tipos con alineación mayor a la de new se reservan normalmente.
+		template <typename T>
+		class slab_allocator {
+		public:
+			using value_type = T;
+
+			slab_allocator() noexcept = default;
+
+			template <typename U>
+			slab_allocator(const slab_allocator<U>&) noexcept {}
+
+			T* allocate(size_t n) {
+				if (n == 1 && alignof(T) <= alignof(std::max_align_t)) {
+					return static_cast<T*>(Pool().Allocate());
+				}
+				return static_cast<T*>(::operator new(n * sizeof(T)));
+			}
+
+			void deallocate(T* p, size_t n) noexcept {
+				if (n == 1 && alignof(T) <= alignof(std::max_align_t)) {
+					Pool().Free(p);
+				}
+				else {
+					::operator delete(p);
+				}
+			}
+
+			static slab_pool& Pool() {
+				return slab_pool::Instance<sizeof(T), alignof(T)>();
+			}
+
+			template <typename U>
+			bool operator == (const slab_allocator<U>&) const noexcept {
+				return true;
+			}
+
+			template <typename U>
+			bool operator != (const slab_allocator<U>&) const noexcept {
+				return false;
+			}
+		};
+
+	}
+}
\ No newline at end of file
@@ -1,44 +1,203 @@
 #pragma once
 
-// Agregando todas las libreras a usar.
+// Agregando todas las librerías a usar.
 #include "net_common.h"
+#include "net_body.h"
+#include "net_wire.h"
 
-// Crearemos la librera cap (CentOS Asio Project) que llevara la librera net para hacer las conexiones de mensajes.
+#include <array>
+#include <stdexcept>
+#include <string_view>
+
+#if __cplusplus >= 202002L || (defined(_MSVC_LANG) && _MSVC_LANG >= 202002L)
+#include <span>
+#endif
+
+// Crearemos la librería cap (CentOS Asio Project) que llevara la librería net para hacer las conexiones de mensajes.
 namespace cap {
-	// Librera net que se encargara de las conexiones y el tipo de mensajes a procesar.
+	// Librería net que se encargara de las conexiones y el tipo de mensajes a procesar.
 	namespace net {
 
-		// Crearemos una estructura enumera que se encargara de poder darle una identificacin y al tipo de mensaje a procesar, entre otros.
-			// Tambin el encabeza de los mensajes se enviara al inicio de todos los mensajes
-			// Por el cual la plantilla nos permitir usar clases numricas para asegurarnos que los mensajes son validos a la hora de compilarlos.
-			// Tambin se hace esto para hacer flexible esta clase numrica en caso de que haya diferentes tipos de mensajes.
+		// Crearemos una estructura enumera que se encargara de poder darle una identificación y al tipo de mensaje a procesar, entre otros.
+			// También el encabeza de los mensajes se enviara al inicio de todos los mensajes
+			// Por el cual la plantilla nos permitirá usar clases numéricas para asegurarnos que los mensajes son validos a la hora de compilarlos.
+			// También se hace esto para hacer flexible esta clase numérica en caso de que haya diferentes tipos de mensajes.
 		template <typename T>
 		struct message_header {
-			// Id Del mensaje con formato a especificar con tamao sin asignar de 32 bits.
+			// Id Del mensaje con formato a especificar con tamaño sin asignar de 32 bits.
 			T id{};
 			uint32_t size = 0;
+
+			// Banderas de la librería que indican como se debe tratar el mensaje (ver header_flags).
+			uint32_t flags = 0;
+		};
+
+		// Como va el encabezado en la red (ver CAP_NET_PORTABLE_WIRE en net_wire.h).
+			// En el formato nativo es el encabezado tal cual, en el portable son 12 bytes little endian: el ID (como uint32_t),
+			// el tamaño y las banderas. Si el encabezado en memoria ya es igual (little endian e ID de 32 bits) se usa directo.
+		template <typename T>
+		struct wire_header {
+			static_assert(!bPortableWire || sizeof(T) <= sizeof(uint32_t), "En el formato portable el ID del mensaje debe caber en 32 bits");
+
+			// Bytes que ocupa el encabezado en la red.
+			static constexpr size_t nSize = bPortableWire ? 3 * sizeof(uint32_t) : sizeof(message_header<T>);
+
+			// Indica si los bytes del encabezado en memoria son los mismos que en la red, así se lee y escribe directo.
+			static constexpr bool bDirect = !bPortableWire || (bLittleEndianHost && sizeof(T) == sizeof(uint32_t) && sizeof(message_header<T>) == nSize);
+
+			static void Write(const message_header<T>& header, uint8_t* p) {
+				if constexpr (bDirect) {
+					std::memcpy(p, &header, nSize);
+				}
+				else {
+					StoreWire(p, uint32_t(header.id));
+					StoreWire(p + 4, header.size);
+					StoreWire(p + 8, header.flags);
+				}
+			}
+
+			static void Read(const uint8_t* p, message_header<T>& header) {
+				if constexpr (bDirect) {
+					std::memcpy(&header, p, nSize);
+				}
+				else {
+					header.id = T(LoadWire<uint32_t>(p));
+					header.size = LoadWire<uint32_t>(p + 4);
+					header.flags = LoadWire<uint32_t>(p + 8);
+				}
+			}
+		};
+
+		// Banderas que puede llevar el encabezado de un mensaje, se pueden combinar.
+		enum header_flags : uint32_t {
+			// El mensaje es una petición RPC, al final del cuerpo lleva su ID de correlación.
+			flag_rpc_request = 1u << 0,
+
+			// El mensaje es la respuesta a una petición RPC, al final del cuerpo lleva el ID de la petición.
+			flag_rpc_response = 1u << 1,
+
+			// El mensaje es interno de la librería y la conexión lo procesa sin entregarlo a la aplicación.
+				// Al final del cuerpo lleva su tipo (ver control_kind).
+			flag_control = 1u << 2,
+
+			// El cuerpo esta comprimido (ver CompressBody()), la conexión lo descomprime antes de entregarlo.
+				// El tamaño del encabezado es el del cuerpo comprimido.
+			flag_compressed = 1u << 3,
+
+			// El cuerpo es un estado del servidor (ver server_interface::BroadcastSnapshot()), completo o como delta.
+				// El cliente lo reconstruye antes de entregarlo: el cuerpo queda con el estado completo seguido de su número (uint32_t).
+			flag_snapshot = 1u << 4,
+
+			// El mensaje es un lote de otro nodo del servidor (ver net_federation.h), el servidor lo procesa sin entregarlo a la aplicación.
+				// Solo se acepta de las conexiones que se identificaron como enlaces con el secreto de la federación.
+			flag_federation = 1u << 5,
+		};
+
+		// Tipos de los mensajes internos de la librería (ver flag_control).
+		enum class control_kind : uint8_t {
+			// El servidor le entrega al cliente un boleto de reanudación (uint64_t) para su siguiente conexión.
+			resume_token = 1,
+
+			// Un lado anuncia la máscara (uint8_t) de los codecs que puede descomprimir (ver compression_options).
+			codec_offer = 2,
+
+			// El cliente confirma el ultimo estado (uint32_t) que reconstruyo, el servidor lo usa como base de los deltas.
+			snapshot_ack = 3,
 		};
 
+		// Tamaño máximo del cuerpo de un mensaje de control, el más grande es el boleto (el tipo y un uint64_t).
+			// Como la bandera la pone el otro lado, uno más grande se toma como un abuso y se cierra la conexión.
+		constexpr uint32_t nMaxControlSize = 16;
+
+		// Vista de n elementos de tipo DataType dentro del cuerpo de un mensaje, sin copiarlos (ver PopView()).
+			// Los bytes en el cuerpo no están alineados, por eso los elementos se leen por valor (y en el orden del
+			// procesador, ver LoadWire()) en lugar de dar un puntero al tipo.
+			// Solo es valida mientras no se agregue nada al mensaje, ni se mueva o destruya.
+		template <typename DataType>
+		class message_view {
+		public:
+			message_view() = default;
+
+			message_view(const uint8_t* pData, size_t nCount)
+				: m_pData(pData), m_nCount(nCount) {}
+
+			size_t size() const {
+				return this->m_nCount;
+			}
+
+			bool empty() const {
+				return this->m_nCount == 0;
+			}
+
+			// Retorna los bytes de los elementos tal como van en la red.
+			const uint8_t* data() const {
+				return this->m_pData;
+			}
+
+			size_t Bytes() const {
+				return this->m_nCount * sizeof(DataType);
+			}
+
+			DataType operator [] (size_t i) const {
+				if constexpr (std::is_arithmetic<DataType>::value || std::is_enum<DataType>::value) {
+					return LoadWire<DataType>(this->m_pData + i * sizeof(DataType));
+				}
+				else {
+					DataType value;
+					std::memcpy(&value, this->m_pData + i * sizeof(DataType), sizeof(DataType));
+					return value;
+				}
+			}
+
+			// Copia todos los elementos a pData (con espacio para size()) de una vez.
+			void CopyTo(DataType* pData) const {
+				if constexpr (std::is_arithmetic<DataType>::value || std::is_enum<DataType>::value) {
+					CopyFromWire(pData, this->m_pData, this->m_nCount);
+				}
+				else if (this->m_nCount > 0) {
+					std::memcpy(pData, this->m_pData, this->Bytes());
+				}
+			}
+
+			std::vector<DataType> ToVector() const {
+				std::vector<DataType> v(this->m_nCount);
+				this->CopyTo(v.data());
+				return v;
+			}
+
+		protected:
+			const uint8_t* m_pData = nullptr;
+			size_t m_nCount = 0;
+		};
+
+		// Declaramos el mensaje y las funciones de las cadenas y contenedores de forma prematura para usarlas en sus operadores.
+		template <typename T>
+		struct message;
+
+		template <typename DataType, typename T>
+		message_view<DataType> PopView(message<T>& msg);
+
 		// Es la estructura del mensaje del cuerpo, que ya posee el encabezado del mensaje.
 		template <typename T>
 		struct message {
-			// Como antes se menciono, cada mensaje tiene un encabezado que ser el primero en ser procesado y por ende hay que agregarlo.
+			// Como antes se menciono, cada mensaje tiene un encabezado que será el primero en ser procesado y por ende hay que agregarlo.
 			message_header<T> header{};
 
-			// Usaremos un arreglo dinmico para poder almacenar el cuerpo con enteros sin asignar de hasta 256 (1 Byte).
-			std::vector<uint8_t> body;
+			// Usaremos un arreglo dinámico para poder almacenar el cuerpo con enteros sin asignar de hasta 256 (1 Byte).
+				// Los cuerpos pequeños se guardan dentro del mensaje, sin reservar memoria (ver body_policy).
+			message_body<body_policy<T>::nInlineCapacity> body;
 
-			// Cada que queremos leer o escribir un mensaje, el socket debe de recibir el tamao que se desea, por ende
-			// es necesario crear este mtodo que se encargara de retornar el tamao completo del paquete del mensaje, en bytes.
+			// Cada que queremos leer o escribir un mensaje, el socket debe de recibir el tamaño que se desea, por ende
+			// es necesario crear este método que se encargara de retornar el tamaño completo del paquete del mensaje, en bytes.
 			size_t size() const {
 				return body.size();
 			}
 
-			// Sobrescribimos la compatibilidad del std::cout para producir una descripcin amistosa del mensaje
+			// Sobrescribimos la compatibilidad del std::cout para producir una descripción amistosa del mensaje
 				// Principalmente esto se hace para poder depurar.
 
 			friend std::ostream& operator << (std::ostream& os, const message<T>& msg) {
-				os << "ID:" << int(msg.header.id) << " Tamao:" << msg.header.size;
+				os << "ID:" << int(msg.header.id) << " Tamaño:" << msg.header.size;
 				return os;
 			}
 
@@ -49,64 +208,242 @@ namespace cap {
 				// Revisa si el tipo de los datos esta siendo empujado es trivialmente copiable.
 				static_assert(std::is_standard_layout<DataType>::value, "Los datos son muy complejos para ser empujados dentro del vector");
 
-				// Consigue el tamao actual del cache del vector, debido a que este ser el punto donde ingresaremos datos.
+				// Consigue el tamaño actual del cache del vector, debido a que este será el punto donde ingresaremos datos.
 				size_t i = msg.body.size();
 
-				// Aumentamos el tamao del vector con el tamao de los datos que estn siendo empujados.
+				// Aumentamos el tamaño del vector con el tamaño de los datos que están siendo empujados.
 				msg.body.resize(msg.body.size() + sizeof(DataType));
 
-				// Fsicamente copiamos los datos dentro del nuevo espacio del vector.
-				std::memcpy(msg.body.data() + i, &data, sizeof(DataType));
+				// Físicamente copiamos los datos dentro del nuevo espacio del vector.
+					// Los números van en el orden de la red (ver ToWire()), lo cual solo cambia algo en el formato portable.
+				if constexpr (std::is_arithmetic<DataType>::value || std::is_enum<DataType>::value) {
+					StoreWire(msg.body.data() + i, data);
+				}
+				else {
+					std::memcpy(msg.body.data() + i, &data, sizeof(DataType));
+				}
 
-				// Recalculamos el tamao del mensaje.
+				// Recalculamos el tamaño del mensaje.
 				msg.header.size = msg.size();
 
 				// Retornamos el mensaje dado para que pueda ser concatenado.
 				return msg;
 			}
 
-			// Este mtodo ser usado para poder sacar datos de los mensajes.
+			// Este método será usado para poder sacar datos de los mensajes.
 				// Y retorna los datos para poder encajarlos de nuevo.
 			template<typename DataType>
 			friend message<T>& operator >> (message<T>& msg, DataType& data) {
 				// Revisa si el tipo de los datos esta siendo empujado es trivialmente copiable.
 				static_assert(std::is_standard_layout<DataType>::value, "Los datos son muy complejos para ser empujados dentro del vector");
 
-				//  Consigue la localizacin cache hacia el final del vector donde los datos extrados empiezan.
+				// Si el cuerpo no tiene suficientes bytes (por ejemplo, un mensaje mal formado del otro lado) no se lee nada.
+				if (msg.body.size() < sizeof(DataType)) {
+					throw std::length_error("message: cuerpo demasiado corto");
+				}
+
+				//  Consigue la localización cache hacia el final del vector donde los datos extraídos empiezan.
 				size_t i = msg.body.size() - sizeof(DataType);
 
-				// Fsicamente copea los datos del vector dentro de las variables del usuario.
-				std::memcpy(&data, msg.body.data() + i, sizeof(DataType));
+				// Físicamente copea los datos del vector dentro de las variables del usuario.
+				if constexpr (std::is_arithmetic<DataType>::value || std::is_enum<DataType>::value) {
+					data = LoadWire<DataType>(msg.body.data() + i);
+				}
+				else {
+					std::memcpy(&data, msg.body.data() + i, sizeof(DataType));
+				}
 
-				// Se encoje el vector para remover los bytes ledos, y para resetear la posicin final.
+				// Se encoje el vector para remover los bytes leídos, y para resetear la posición final.
 				msg.body.resize(i);
 
-				// Recalculando el tamao del mensaje.
+				// Recalculando el tamaño del mensaje.
 				msg.header.size = msg.size();
 
 				// Retornamos el mensaje dado para que pueda ser concatenado.
 				return msg;
 			}
 
+			// Cadenas y contenedores de tipos trivialmente copiables: se empujan de una vez (un solo resize y una sola copia)
+				// seguidos de su cantidad de elementos (uint32_t), así al sacarlos se lee primero la cantidad.
+				// Los números van en el orden de la red en bloque (ver CopyWire()).
+			template <typename Traits, typename Alloc>
+			friend message<T>& operator << (message<T>& msg, const std::basic_string<char, Traits, Alloc>& data) {
+				return PushRange(msg, data.data(), data.size());
+			}
+
+			template <typename Traits>
+			friend message<T>& operator << (message<T>& msg, std::basic_string_view<char, Traits> data) {
+				return PushRange(msg, data.data(), data.size());
+			}
+
+			template <typename DataType, typename Alloc>
+			friend message<T>& operator << (message<T>& msg, const std::vector<DataType, Alloc>& data) {
+				return PushRange(msg, data.data(), data.size());
+			}
+
+			template <typename DataType, size_t N>
+			friend message<T>& operator << (message<T>& msg, const std::array<DataType, N>& data) {
+				return PushRange(msg, data.data(), N);
+			}
+
+#if defined(__cpp_lib_span)
+			template <typename DataType, size_t nExtent>
+			friend message<T>& operator << (message<T>& msg, std::span<DataType, nExtent> data) {
+				return PushRange(msg, data.data(), data.size());
+			}
+#endif
+
+			// Sacan lo que se empujo con los anteriores copiándolo una sola vez. Para leer sin copiar se usan
+				// std::string_view y message_view (o PopString() y PopView()), que apuntan dentro del cuerpo.
+			template <typename Traits, typename Alloc>
+			friend message<T>& operator >> (message<T>& msg, std::basic_string<char, Traits, Alloc>& data) {
+				message_view<char> view = PopView<char>(msg);
+				data.assign(reinterpret_cast<const char*>(view.data()), view.size());
+				return msg;
+			}
+
+			template <typename Traits>
+			friend message<T>& operator >> (message<T>& msg, std::basic_string_view<char, Traits>& data) {
+				message_view<char> view = PopView<char>(msg);
+				data = std::basic_string_view<char, Traits>(reinterpret_cast<const char*>(view.data()), view.size());
+				return msg;
+			}
+
+			template <typename DataType, typename Alloc>
+			friend message<T>& operator >> (message<T>& msg, std::vector<DataType, Alloc>& data) {
+				message_view<DataType> view = PopView<DataType>(msg);
+				data.resize(view.size());
+				view.CopyTo(data.data());
+				return msg;
+			}
+
+			// El arreglo debe ser del mismo tamaño que el que se empujo, si no lanza std::length_error sin sacar nada.
+			template <typename DataType, size_t N>
+			friend message<T>& operator >> (message<T>& msg, std::array<DataType, N>& data) {
+				if (PeekCount(msg) != N) {
+					throw std::length_error("message");
+				}
+				PopView<DataType>(msg).CopyTo(data.data());
+				return msg;
+			}
+
+			template <typename DataType>
+			friend message<T>& operator >> (message<T>& msg, message_view<DataType>& data) {
+				data = PopView<DataType>(msg);
+				return msg;
+			}
+
 		};
 
-		// Declaramos la conexin de forma prematura para su uso.
+		// Empuja n números (enteros, flotantes o enums) de una vez, con una sola copia y sin encabezado de tamaño.
+			// En el formato portable en procesadores big endian se voltean en bloque (ver CopyWire()), así un arreglo grande
+			// no paga la conversión número por número. Las estructuras se copian tal cual con operator <<, sin convertir,
+			// por lo que en el formato portable conviene empujar sus campos por separado.
+		template <typename T, typename DataType>
+		message<T>& PushArray(message<T>& msg, const DataType* pData, size_t n) {
+			size_t i = msg.body.size();
+			msg.body.resize(i + n * sizeof(DataType));
+			CopyWire(msg.body.data() + i, pData, n);
+			msg.header.size = msg.size();
+			return msg;
+		}
+
+		// Saca los últimos n números del mensaje (empujados con PushArray()) y los deja en pData en el mismo orden.
+			// Igual que operator >>, si el cuerpo no los tiene lanza std::length_error sin leer nada.
+		template <typename T, typename DataType>
+		message<T>& PopArray(message<T>& msg, DataType* pData, size_t n) {
+			if (n > msg.body.size() / sizeof(DataType)) {
+				throw std::length_error("message: cuerpo demasiado corto");
+			}
+
+			size_t i = msg.body.size() - n * sizeof(DataType);
+			CopyFromWire(pData, msg.body.data() + i, n);
+			msg.body.resize(i);
+			msg.header.size = msg.size();
+			return msg;
+		}
+
+		// Empuja n elementos trivialmente copiables de una vez seguidos de su cantidad (uint32_t), es lo que usa operator <<
+			// con cadenas y contenedores. Más de UINT32_MAX elementos lanza std::length_error.
+		template <typename T, typename DataType>
+		message<T>& PushRange(message<T>& msg, const DataType* pData, size_t n) {
+			static_assert(std::is_trivially_copyable<DataType>::value, "Los elementos deben ser trivialmente copiables");
+			if (n > UINT32_MAX) {
+				throw std::length_error("message");
+			}
+
+			size_t i = msg.body.size();
+			msg.body.resize(i + n * sizeof(DataType) + sizeof(uint32_t));
+			if constexpr (std::is_arithmetic<DataType>::value || std::is_enum<DataType>::value) {
+				CopyWire(msg.body.data() + i, pData, n);
+			}
+			else if (n > 0) {
+				std::memcpy(msg.body.data() + i, pData, n * sizeof(DataType));
+			}
+			StoreWire(msg.body.data() + i + n * sizeof(DataType), uint32_t(n));
+			msg.header.size = msg.size();
+			return msg;
+		}
+
+		// Retorna la cantidad de elementos de lo ultimo que se empujo con PushRange(), sin sacarlo.
+		template <typename T>
+		uint32_t PeekCount(const message<T>& msg) {
+			if (msg.body.size() < sizeof(uint32_t)) {
+				throw std::length_error("message");
+			}
+			return LoadWire<uint32_t>(msg.body.data() + msg.body.size() - sizeof(uint32_t));
+		}
+
+		// Saca lo ultimo que se empujo con PushRange() y retorna una vista a sus elementos, sin copiarlos.
+			// Los bytes se quedan en la memoria del cuerpo (solo se reduce su tamaño), así la vista sigue siendo valida
+			// hasta que se agregue algo al mensaje. Si la cantidad no cabe en el cuerpo (un mensaje malformado) lanza
+			// std::length_error sin sacar nada, igual que operator >> cuando se saca más de lo que hay.
+		template <typename DataType, typename T>
+		message_view<DataType> PopView(message<T>& msg) {
+			static_assert(std::is_trivially_copyable<DataType>::value, "Los elementos deben ser trivialmente copiables");
+			size_t n = PeekCount(msg);
+			size_t nAvailable = msg.body.size() - sizeof(uint32_t);
+			if (n > nAvailable / sizeof(DataType)) {
+				throw std::length_error("message");
+			}
+
+			size_t i = nAvailable - n * sizeof(DataType);
+			message_view<DataType> view(msg.body.data() + i, n);
+			msg.body.resize(i);
+			msg.header.size = msg.size();
+			return view;
+		}
+
+		// Saca una cadena empujada con operator << como vista, sin copiarla (ver PopView()).
+		template <typename T>
+		std::string_view PopString(message<T>& msg) {
+			message_view<char> view = PopView<char>(msg);
+			return std::string_view(reinterpret_cast<const char*>(view.data()), view.size());
+		}
+
+		// Declaramos la conexión de forma prematura para su uso.
 		template <typename T>
 		class connection;
 
 		// Estructura que se encargara de establecer una estructura para poder dividir los
-		// mensajes pertenecientes y sea ms sencillo identificarlos por creador.
+		// mensajes pertenecientes y sea más sencillo identificarlos por creador.
 
 		template <typename T>
 		struct owned_message {
 
-			// Variable que se encargara de compartir la direccin de una conexin para ah mandar los datos de salida.
+			// Variable que se encargara de compartir la dirección de una conexión para ahí mandar los datos de salida.
 			std::shared_ptr<connection<T>> remote = nullptr;
 
 			// Variable de manejo de los mensajes.
 			message<T>  msg;
 
-			// Sobrescribimos la compatibilidad del std::cout para producir una descripcin amistosa del mensaje
+			// Momento en el que se termino de leer el mensaje del socket, sirve para medir cuanto espero en la cola.
+			std::chrono::steady_clock::time_point tpReceived;
+
+			// Identificador del mensaje para el rastreo (ver net_trace.h), solo se usa si el rastreo esta encendido.
+			uint64_t nTraceId = 0;
+
+			// Sobrescribimos la compatibilidad del std::cout para producir una descripción amistosa del mensaje
 				// Principalmente esto se hace para poder depurar.
 
 			friend std::ostream& operator << (std::ostream& os, const owned_message<T>& msg) {
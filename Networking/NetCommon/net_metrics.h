@@ -0,0 +1,279 @@
+#pragma once
+
+#include "net_common.h"
+
+#include <atomic>
+#include <array>
+#include <cmath>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace cap {
+	namespace net {
+
+		// Copia de los contadores de una conexión en un momento dado.
+		struct connection_metrics_snapshot {
+			// Bytes y mensajes recibidos y escritos (los bytes incluyen los encabezados).
+			uint64_t nBytesIn = 0;
+			uint64_t nBytesOut = 0;
+			uint64_t nMessagesIn = 0;
+			uint64_t nMessagesOut = 0;
+
+			// Mensajes encolados que aun no se terminan de escribir.
+			uint64_t nQueueDepth = 0;
+
+			// Escrituras que tardaron más que el umbral configurado (metrics_options::writeStallThreshold),
+			// normalmente por que el buffer del kernel estaba lleno y el otro lado no leía lo bastante rápido.
+			uint64_t nWriteStalls = 0;
+
+			// Mensajes que se enviaron comprimidos, y los bytes que se ahorraron en ellos.
+			uint64_t nCompressedOut = 0;
+			uint64_t nCompressionSavedBytes = 0;
+
+			// Mensajes recibidos que se pasaron de los limites (ver rate_limit_options): los que se retrasaron y los descartados.
+			uint64_t nRateDelayed = 0;
+			uint64_t nRateDropped = 0;
+
+			// Suma los contadores de otra conexión, sirve para sacar los totales del servidor.
+			connection_metrics_snapshot& operator += (const connection_metrics_snapshot& other) {
+				this->nBytesIn += other.nBytesIn;
+				this->nBytesOut += other.nBytesOut;
+				this->nMessagesIn += other.nMessagesIn;
+				this->nMessagesOut += other.nMessagesOut;
+				this->nQueueDepth += other.nQueueDepth;
+				this->nWriteStalls += other.nWriteStalls;
+				this->nCompressedOut += other.nCompressedOut;
+				this->nCompressionSavedBytes += other.nCompressionSavedBytes;
+				this->nRateDelayed += other.nRateDelayed;
+				this->nRateDropped += other.nRateDropped;
+				return *this;
+			}
+		};
+
+		// Contadores de una conexión.
+			// Solo los escribe el proceso de asio de la conexión, así que no se necesitan operaciones atómicas de
+			// lectura-modificación-escritura (que bloquean el bus), basta con cargar y guardar de forma relajada.
+			// Cualquier otro proceso puede leerlos en cualquier momento con Snapshot().
+		class connection_metrics {
+		public:
+			// Suma al contador, solo se debe llamar desde el proceso que escribe.
+			static void Add(std::atomic<uint64_t>& nCounter, uint64_t nValue) {
+				nCounter.store(nCounter.load(std::memory_order_relaxed) + nValue, std::memory_order_relaxed);
+			}
+
+			// Retorna una copia de los contadores.
+			connection_metrics_snapshot Snapshot() const {
+				connection_metrics_snapshot snapshot;
+				snapshot.nBytesIn = this->nBytesIn.load(std::memory_order_relaxed);
+				snapshot.nBytesOut = this->nBytesOut.load(std::memory_order_relaxed);
+				snapshot.nMessagesIn = this->nMessagesIn.load(std::memory_order_relaxed);
+				snapshot.nMessagesOut = this->nMessagesOut.load(std::memory_order_relaxed);
+				snapshot.nQueueDepth = this->nQueueDepth.load(std::memory_order_relaxed);
+				snapshot.nWriteStalls = this->nWriteStalls.load(std::memory_order_relaxed);
+				snapshot.nCompressedOut = this->nCompressedOut.load(std::memory_order_relaxed);
+				snapshot.nCompressionSavedBytes = this->nCompressionSavedBytes.load(std::memory_order_relaxed);
+				snapshot.nRateDelayed = this->nRateDelayed.load(std::memory_order_relaxed);
+				snapshot.nRateDropped = this->nRateDropped.load(std::memory_order_relaxed);
+				return snapshot;
+			}
+
+			std::atomic<uint64_t> nBytesIn{ 0 };
+			std::atomic<uint64_t> nBytesOut{ 0 };
+			std::atomic<uint64_t> nMessagesIn{ 0 };
+			std::atomic<uint64_t> nMessagesOut{ 0 };
+			std::atomic<uint64_t> nQueueDepth{ 0 };
+			std::atomic<uint64_t> nWriteStalls{ 0 };
+			std::atomic<uint64_t> nCompressedOut{ 0 };
+			std::atomic<uint64_t> nCompressionSavedBytes{ 0 };
+			std::atomic<uint64_t> nRateDelayed{ 0 };
+			std::atomic<uint64_t> nRateDropped{ 0 };
+		};
+
+		// Copia de un histograma de latencias en un momento dado, con funciones para consultarlo.
+		struct histogram_snapshot {
+			// Cantidad de muestras en cada casilla (ver latency_histogram).
+			std::vector<uint64_t> vCounts;
+
+			// Cantidad total de muestras, su suma y la mayor, en nanosegundos.
+			uint64_t nCount = 0;
+			uint64_t nSum = 0;
+			uint64_t nMax = 0;
+
+			// Retorna el promedio en nanosegundos.
+			double Mean() const {
+				return this->nCount > 0 ? double(this->nSum) / double(this->nCount) : 0.0;
+			}
+
+			// Retorna el valor en nanosegundos debajo del cual queda el porcentaje dado de las muestras (de 0 a 100).
+				// Como las casillas agrupan valores, se retorna el mayor valor de la casilla, así el error
+				// siempre es hacia arriba y nunca se reporta una latencia menor a la real.
+			uint64_t Percentile(double dPercentile) const;
+		};
+
+		// Histograma de latencias al estilo HDR (log-lineal).
+			// Cada potencia de dos se divide en 16 casillas iguales, así el error relativo es menor al 6.25% en
+			// cualquier rango, desde nanosegundos hasta horas, con una cantidad fija de memoria.
+			// Para que medir no se vuelva el cuello de botella, los conteos se reparten en varias copias (shards)
+			// y cada proceso escribe siempre en la misma, así distintos procesos casi nunca tocan la misma linea de cache.
+		class latency_histogram {
+		public:
+			// Bits de precisión dentro de cada potencia de dos, y la mayor potencia que se guarda (2^43 ns son unas 2.4 horas).
+			static constexpr uint32_t nSubBucketBits = 4;
+			static constexpr uint32_t nSubBuckets = 1u << nSubBucketBits;
+			static constexpr uint32_t nMaxExponent = 43;
+			static constexpr size_t nBuckets = size_t(nMaxExponent - nSubBucketBits + 2) * nSubBuckets;
+
+			// Cantidad de copias de los conteos.
+			static constexpr size_t nShards = 8;
+
+			latency_histogram() : m_pShards(new shard[nShards]()) {}
+
+			latency_histogram(const latency_histogram&) = delete;
+
+			// Agrega una muestra, se puede llamar desde cualquier proceso.
+			void Record(std::chrono::nanoseconds duration) {
+				uint64_t nValue = uint64_t(std::max<int64_t>(duration.count(), 0));
+				shard& s = this->m_pShards[ShardIndex()];
+
+				s.counts[BucketIndex(nValue)].fetch_add(1, std::memory_order_relaxed);
+				s.nSum.fetch_add(nValue, std::memory_order_relaxed);
+
+				// El máximo casi nunca cambia, así que primero se revisa sin escribir.
+				uint64_t nMax = s.nMax.load(std::memory_order_relaxed);
+				while (nValue > nMax && !s.nMax.compare_exchange_weak(nMax, nValue, std::memory_order_relaxed)) {}
+			}
+
+			// Retorna una copia sumando todas las copias de los conteos.
+				// No detiene a quienes escriben, así que una muestra que llegue durante la copia puede contarse a medias.
+			histogram_snapshot Snapshot() const {
+				histogram_snapshot snapshot;
+				snapshot.vCounts.assign(nBuckets, 0);
+
+				for (size_t i = 0; i < nShards; i++) {
+					const shard& s = this->m_pShards[i];
+					for (size_t b = 0; b < nBuckets; b++) {
+						uint64_t nCount = s.counts[b].load(std::memory_order_relaxed);
+						snapshot.vCounts[b] += nCount;
+						snapshot.nCount += nCount;
+					}
+					snapshot.nSum += s.nSum.load(std::memory_order_relaxed);
+					snapshot.nMax = std::max(snapshot.nMax, s.nMax.load(std::memory_order_relaxed));
+				}
+
+				return snapshot;
+			}
+
+			// Pone todos los conteos en cero.
+			void Reset() {
+				for (size_t i = 0; i < nShards; i++) {
+					shard& s = this->m_pShards[i];
+					for (auto& nCount : s.counts) {
+						nCount.store(0, std::memory_order_relaxed);
+					}
+					s.nSum.store(0, std::memory_order_relaxed);
+					s.nMax.store(0, std::memory_order_relaxed);
+				}
+			}
+
+			// Retorna la casilla donde cae un valor.
+			static size_t BucketIndex(uint64_t nValue) {
+				// Los valores más grandes que el máximo se guardan en la ultima casilla.
+				nValue = std::min<uint64_t>(nValue, (uint64_t(1) << (nMaxExponent + 1)) - 1);
+
+				// Los valores chicos tienen su propia casilla.
+				if (nValue < nSubBuckets) {
+					return size_t(nValue);
+				}
+
+				// Para los demás, la potencia de dos elige el grupo y los siguientes bits la casilla dentro del grupo.
+				uint32_t nExponent = HighestBit(nValue);
+				uint32_t nShift = nExponent - nSubBucketBits;
+				return size_t(nShift + 1) * nSubBuckets + size_t((nValue >> nShift) & (nSubBuckets - 1));
+			}
+
+			// Retorna el mayor valor que cae en la casilla dada.
+			static uint64_t BucketUpperBound(size_t nIndex) {
+				if (nIndex < nSubBuckets) {
+					return nIndex;
+				}
+
+				uint32_t nShift = uint32_t(nIndex / nSubBuckets) - 1;
+				uint64_t nSub = nIndex % nSubBuckets;
+				return ((nSubBuckets + nSub + 1) << nShift) - 1;
+			}
+
+		private:
+
+			// Una copia de los conteos, alineada para que no comparta lineas de cache con las demás.
+			struct alignas(64) shard {
+				std::array<std::atomic<uint64_t>, nBuckets> counts;
+				std::atomic<uint64_t> nSum;
+				std::atomic<uint64_t> nMax;
+			};
+
+			// Retorna la posición del bit más alto encendido, el valor no debe ser cero.
+			static uint32_t HighestBit(uint64_t nValue) {
+#if defined(_MSC_VER)
+				unsigned long nIndex = 0;
+				_BitScanReverse64(&nIndex, nValue);
+				return uint32_t(nIndex);
+#else
+				return 63u - uint32_t(__builtin_clzll(nValue));
+#endif
+			}
+
+			// Retorna la copia que le toca al proceso actual, se asigna la primera vez que el proceso escribe.
+			static size_t ShardIndex() {
+				static std::atomic<size_t> nNextShard{ 0 };
+				thread_local size_t nShard = nNextShard.fetch_add(1, std::memory_order_relaxed) % nShards;
+				return nShard;
+			}
+
+		protected:
+			std::unique_ptr<shard[]> m_pShards;
+		};
+
+		inline uint64_t histogram_snapshot::Percentile(double dPercentile) const {
+			if (this->nCount == 0) {
+				return 0;
+			}
+
+			// Buscamos la casilla donde la suma de muestras alcanza el porcentaje pedido.
+			uint64_t nTarget = uint64_t(std::ceil(std::clamp(dPercentile, 0.0, 100.0) / 100.0 * double(this->nCount)));
+			nTarget = std::max<uint64_t>(nTarget, 1);
+
+			uint64_t nSeen = 0;
+			for (size_t i = 0; i < this->vCounts.size(); i++) {
+				nSeen += this->vCounts[i];
+				if (nSeen >= nTarget) {
+					// Nunca reportamos más que el máximo que realmente se vio.
+					return std::min(latency_histogram::BucketUpperBound(i), this->nMax);
+				}
+			}
+
+			return this->nMax;
+		}
+
+		// Copia de las métricas de todo el servidor en un momento dado.
+		struct server_metrics_snapshot {
+			// Conexiones activas y conexiones aceptadas desde que inicio.
+			uint64_t nConnections = 0;
+			uint64_t nAccepted = 0;
+
+			// Conexiones cerradas al aceptar por pasarse del máximo del servidor o del de su dirección IP (ver acceptor_options).
+			uint64_t nRejected = 0;
+
+			// Suma de los contadores de todas las conexiones activas.
+			connection_metrics_snapshot totals;
+
+			// Tiempo desde que se termina de leer un mensaje del socket hasta que se entrega a OnMessage().
+			histogram_snapshot readToHandler;
+
+			// Tiempo desde que se llama a Send() hasta que el mensaje se termina de escribir en el socket.
+			histogram_snapshot sendToWrite;
+		};
+
+	}
+}
\ No newline at end of file
@@ -0,0 +1,194 @@
+#pragma once
+
+#include "net_common.h"
+#include "net_compress.h"
+#include "net_ratelimit.h"
+
+namespace cap {
+	namespace net {
+
+		// Opciones del modo "corking" (agrupado de envíos).
+			// Cuando está activo, los mensajes enviados se acumulan en un buffer de la conexión
+			// y se escriben juntos en una sola escritura cuando se alcanza el limite de bytes
+			// o cuando vence el tiempo máximo de espera, lo que pase primero.
+		struct cork_options {
+			// Activa o desactiva el agrupado de envíos.
+			bool bEnabled = false;
+
+			// Cantidad de bytes acumulados a partir de la cual se escribe de inmediato.
+			size_t nMaxBytes = 16 * 1024;
+
+			// Tiempo máximo que un mensaje puede quedarse esperando en el buffer antes de ser escrito.
+			std::chrono::microseconds maxDelay{ 200 };
+		};
+
+		// Opciones del socket de cada conexión.
+			// Los valores que no se asignen se quedan como los deje el sistema operativo.
+			// Las opciones exclusivas de Linux se ignoran en otros sistemas.
+		struct socket_options {
+			// Desactiva el algoritmo de Nagle (TCP_NODELAY), menos latencia a cambio de más paquetes.
+			std::optional<bool> bNoDelay;
+
+			// Tamaño de los buffers del kernel para envío y recepción (SO_SNDBUF/SO_RCVBUF) en bytes.
+			std::optional<int> nSendBufferSize;
+			std::optional<int> nReceiveBufferSize;
+
+			// Microsegundos que el kernel revisara activamente la tarjeta de red antes de dormir (SO_BUSY_POLL, solo Linux).
+			std::optional<int> nBusyPollMicros;
+
+			// Manda los ACK de inmediato en vez de retrasarlos (TCP_QUICKACK, solo Linux).
+				// Nota: el kernel puede volver a desactivarlo por su cuenta, así que el valor leído puede cambiar con el tiempo.
+			std::optional<bool> bQuickAck;
+
+			// Milisegundos que pueden quedar datos sin confirmar antes de que el kernel cierre la conexión (TCP_USER_TIMEOUT, solo Linux).
+			std::optional<unsigned int> nUserTimeoutMs;
+		};
+
+		// Opciones del socket que acepta conexiones en el servidor.
+		struct acceptor_options {
+			// Cantidad máxima de conexiones pendientes de aceptar que el kernel guardara.
+			int nBacklog = asio::socket_base::max_listen_connections;
+
+			// Permite volver a usar el puerto de inmediato después de reiniciar el servidor (SO_REUSEADDR).
+			bool bReuseAddress = true;
+
+			// Permite que varios procesos escuchen en el mismo puerto y el kernel reparta las conexiones (SO_REUSEPORT).
+			bool bReusePort = false;
+
+			// Cantidad de aceptaciones pendientes al mismo tiempo. Con varias, cuando llegan muchas conexiones juntas
+				// (por ejemplo al volver de una caída) se aceptan seguidas sin esperar a que se vuelva a pedir cada una.
+			size_t nPendingAccepts = 4;
+
+			// Máximo de conexiones abiertas en el servidor y por dirección IP, cero no limita.
+				// Se revisan al aceptar, antes de crear la conexión: las que se pasan solo se cierran y se cuentan
+				// (ver server_metrics_snapshot::nRejected), sin llamar a OnClientConnect().
+			size_t nMaxConnections = 0;
+			uint32_t nMaxConnectionsPerIp = 0;
+
+			// Imprime cada conexión aceptada. Con muchas conexiones por segundo imprimir es lo que más tarda.
+			bool bLogAccepts = true;
+		};
+
+		// Limites de tamaño de los mensajes entrantes.
+			// Se revisan al leer el encabezado, antes de reservar memoria para el cuerpo, así un cliente
+			// no puede hacer que el servidor reserve gigas de memoria solo con mandar un encabezado.
+		struct message_limits {
+			// Tamaño máximo del cuerpo de un mensaje normal, si se pasa se cierra la conexión.
+			uint32_t nMaxMessageSize = 16 * 1024 * 1024;
+
+			// Si es mayor a cero, los cuerpos más grandes que este valor se leen por pedazos y se entregan
+			// al manejador de pedazos de la conexión, en vez de guardarse completos en memoria.
+				// Solo aplica si la conexión tiene un manejador de pedazos asignado.
+			uint32_t nStreamThreshold = 0;
+
+			// Tamaño de cada pedazo al leer un mensaje por pedazos, es la memoria máxima que usara la conexión para ello.
+			uint32_t nChunkSize = 64 * 1024;
+
+			// Tamaño máximo de un mensaje leído por pedazos.
+			uint32_t nMaxStreamSize = UINT32_MAX;
+		};
+
+		// Opciones de las métricas de la conexión.
+		struct metrics_options {
+			// Una escritura que tarde más que esto se cuenta como atorada (connection_metrics_snapshot::nWriteStalls).
+			std::chrono::microseconds writeStallThreshold{ 1000 };
+		};
+
+		// Opciones de la validación al conectarse.
+		struct handshake_options {
+			// Si esta activo, el cliente manda un saludo en cuanto se conecta, sin esperar el desafío del servidor.
+				// El saludo puede traer un boleto de reanudación de una conexión anterior, con el cual el servidor no pide
+				// la respuesta al desafío y el cliente puede mandar sus mensajes detrás del saludo, ahorrando una ida y vuelta.
+				// Tanto el servidor como el cliente deben usar el mismo valor.
+			bool bResumption = false;
+
+			// Cuanto tiempo sirve un boleto de reanudación desde que el servidor lo entrega, cada boleto sirve una sola vez.
+			std::chrono::seconds resumeTokenLifetime{ 600 };
+		};
+
+		// Opciones de la compresión de los cuerpos de los mensajes.
+			// Cada lado anuncia sus codecs al terminar la validación, y solo se comprime hacia un lado que anuncio
+			// el codec elegido, así con un lado sin compresión todo viaja sin comprimir.
+			// Los mensajes comprimidos llevan la bandera flag_compressed y siempre se leen completos (nunca por pedazos).
+		struct compression_options {
+			// Codec con el que se comprimen los mensajes que se envían, none no comprime ni anuncia nada.
+			compression_codec codec = compression_codec::none;
+
+			// Solo se comprimen los cuerpos de al menos este tamaño, en los chicos no se gana casi nada y se gasta CPU.
+				// NetBench (compress/ y roundtrip/snapshot_) da los números para elegirlo.
+			uint32_t nThreshold = 1024;
+		};
+
+		// Opciones de los estados que el servidor envía como delta (ver server_interface::BroadcastSnapshot()).
+		struct snapshot_options {
+			// Estados recientes que se guardan como base de los deltas. Si el ultimo que confirmo un cliente es más viejo,
+				// se le manda el estado completo. El cliente debe guardar al menos tantos como el servidor.
+			uint32_t nHistory = 32;
+		};
+
+		// Limites de lo que puede mandar el otro lado de cada conexión, se revisan al leer el encabezado de cada mensaje,
+			// antes de leer el cuerpo y de que el mensaje llegue a la cola de entrada.
+			// Cada conexión lleva sus propias cubetas, así un cliente abusivo (o con un error) no afecta a los demás.
+			// Los mensajes internos de la librería (flag_control) solo cuentan en el limite global, y los de las conexiones
+			// de confianza (como los enlaces de la federación) no cuentan.
+		struct rate_limit_options {
+			// Limite de todos los mensajes de la conexión juntos.
+			rate_limit global;
+
+			// Limites por ID de mensaje, se aplican además del general. Ver SetRateLimit().
+			std::unordered_map<uint32_t, rate_limit> mapById;
+
+			// Asigna el limite de una ID de mensaje.
+			template <typename T>
+			void SetRateLimit(T id, const rate_limit& limit) {
+				this->mapById[uint32_t(id)] = limit;
+			}
+
+			// Indica si hay algún limite activo.
+			bool Enabled() const {
+				return this->global.Enabled() || !this->mapById.empty();
+			}
+		};
+
+		// Opciones de la memoria de las conexiones.
+		struct memory_options {
+			// Si una conexión pasa este tiempo sin recibir ni escribir mensajes, libera sus buffers (el cuerpo de entrada,
+				// que conserva la capacidad del mensaje más grande que ha recibido, los de compresión y agrupado, y sus colas
+				// vacías), y los vuelve a reservar cuando los necesite. Se revisa cada periodo, así se liberan entre una
+				// y dos veces este tiempo después del ultimo mensaje. Cero nunca los libera.
+			std::chrono::milliseconds idleRelease{ 30000 };
+		};
+
+		// Estructura que agrupa todas las opciones que se aplican a una conexión al momento de crearla.
+			// Tanto el servidor como el cliente guardan una copia y se la entregan a cada conexión nueva.
+		struct connection_options {
+			// Opciones del agrupado de envíos.
+			cork_options cork;
+
+			// Opciones del socket que se aplican al aceptar o al conectar.
+			socket_options socket;
+
+			// Limites de tamaño de los mensajes entrantes.
+			message_limits limits;
+
+			// Opciones de las métricas.
+			metrics_options metrics;
+
+			// Opciones de la validación al conectarse.
+			handshake_options handshake;
+
+			// Opciones de la compresión de los cuerpos.
+			compression_options compression;
+
+			// Opciones de los estados como delta.
+			snapshot_options snapshot;
+
+			// Limites de mensajes y bytes por segundo de lo que se recibe.
+			rate_limit_options rateLimits;
+
+			// Opciones de la memoria de cada conexión.
+			memory_options memory;
+		};
+
+	}
+}
\ No newline at end of file
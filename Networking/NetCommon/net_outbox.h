@@ -0,0 +1,385 @@
+#pragma once
+
+#include "net_common.h"
+#include "net_message.h"
+#include "net_capture.h"
+
+#include <unordered_map>
+#include <cstdio>
+
+namespace cap {
+	namespace net {
+
+		// Opciones del buzón de los clientes desconectados (ver server_interface::StartOutbox()).
+		struct outbox_options {
+			// Cuanto tiempo se guardan los mensajes de un cliente que no vuelve.
+				// No tiene caso que sea mayor que handshake_options::resumeTokenLifetime, después el cliente ya no puede reanudar.
+			std::chrono::seconds retention{ 600 };
+
+			// Bytes que se guardan como máximo por cliente y en total, al pasarse se descartan los mensajes más viejos.
+			size_t nMaxClientBytes = size_t(4) * 1024 * 1024;
+			size_t nMaxBytes = size_t(1024) * 1024 * 1024;
+
+			// Tamaño de cada segmento del registro, al llenarse se empieza otro archivo.
+				// Un segmento se borra en cuanto ya no tiene mensajes guardados (entregados, vencidos o descartados).
+			size_t nSegmentBytes = size_t(64) * 1024 * 1024;
+
+			// Cada cuando se espera a que lo escrito llegue al disco (fsync): al juntar nSyncMessages mensajes o al pasar
+				// syncInterval desde la ultima vez, lo que pase primero. Con ambos en cero el sistema operativo decide cuando.
+				// Con nSyncMessages en 1 cada mensaje llega al disco antes de seguir, lo más seguro y lo más lento.
+			uint32_t nSyncMessages = 0;
+			std::chrono::milliseconds syncInterval{ 1000 };
+		};
+
+		// Contadores del buzón.
+		struct outbox_stats {
+			// Mensajes y bytes guardados ahora, de cuantos clientes, y en cuantos segmentos.
+			uint64_t nMessages = 0;
+			uint64_t nBytes = 0;
+			uint64_t nClients = 0;
+			uint64_t nSegments = 0;
+
+			// Mensajes guardados, entregados al reconectar y descartados (vencidos o por los limites) desde que se abrió.
+			uint64_t nStored = 0;
+			uint64_t nReplayed = 0;
+			uint64_t nDropped = 0;
+
+			// Veces que se espero al disco.
+			uint64_t nSyncs = 0;
+		};
+
+		// Registro de los mensajes de los clientes desconectados, guardado en archivos mapeados a memoria por segmentos.
+			// Todos los clientes comparten el mismo registro: guardar solo agrega al final del segmento actual (ver
+			// mapped_append_file) y al entregar se leen los registros del cliente hacia adelante, en el orden en que se guardaron,
+			// así el disco siempre se usa de forma secuencial. En memoria solo queda un índice de donde esta cada mensaje.
+			// Cada registro es su cliente y el tamaño de su cuerpo (uint32_t), el encabezado como va en la red (ver wire_header)
+			// y el cuerpo. Los boletos de reanudación solo viven en memoria, así que el registro empieza de nuevo al abrirlo.
+			// Nota: no es seguro entre procesos, el servidor lo protege con su propio bloqueo.
+		template <typename T>
+		class outbox_log {
+		public:
+			outbox_log() = default;
+			outbox_log(const outbox_log&) = delete;
+
+			virtual ~outbox_log() {
+				this->Close();
+			}
+
+			// Empieza el registro en el directorio dado (que ya debe existir), retorna falso si no se pudo crear el primer segmento.
+			bool Open(const std::string& sDirectory, const outbox_options& options = {}) {
+				this->Close();
+
+				this->m_sDirectory = sDirectory;
+				this->m_options = options;
+				this->m_stats = outbox_stats();
+				this->m_tpLastSync = std::chrono::steady_clock::now();
+				this->m_tpLastExpire = this->m_tpLastSync;
+				this->m_bOpen = this->AddSegment();
+				return this->m_bOpen;
+			}
+
+			// Cierra y borra todos los segmentos, lo guardado se pierde.
+			void Close() {
+				for (segment& s : this->m_deqSegments) {
+					this->DeleteSegment(s);
+				}
+				this->m_deqSegments.clear();
+				this->m_mapClients.clear();
+				this->m_nFirstSegment = 0;
+				this->m_nBytes = 0;
+				this->m_nUnsynced = 0;
+				this->m_bOpen = false;
+			}
+
+			bool IsOpen() const {
+				return this->m_bOpen;
+			}
+
+			// Guarda un mensaje para el cliente, retorna falso si no se pudo (no cabe en los limites o no se pudo escribir).
+				// Si el cliente o el registro completo se pasan de sus limites, se descartan sus mensajes más viejos.
+			bool Append(uint32_t nClient, const message<T>& msg) {
+				if (!this->IsOpen()) {
+					return false;
+				}
+
+				size_t nLength = nRecordHeaderSize + wire_header<T>::nSize + msg.body.size();
+				if (nLength > this->m_options.nMaxClientBytes || nLength > this->m_options.nMaxBytes) {
+					this->m_stats.nDropped++;
+					return false;
+				}
+
+				// Hacemos lugar antes de escribir descartando lo más viejo, así el registro nuevo nunca es el descartado.
+					// Primero se van los segmentos anteriores al actual. Si aun no cabe, todo lo que estorba esta en el actual,
+					// así que empezamos otro y descartamos el actual completo.
+				while (this->m_nBytes + nLength > this->m_options.nMaxBytes && this->m_nFirstSegment < this->LastSegmentId()) {
+					this->DropSegment(this->m_nFirstSegment);
+				}
+				if (this->m_nBytes + nLength > this->m_options.nMaxBytes) {
+					if (!this->AddSegment()) {
+						this->m_stats.nDropped++;
+						return false;
+					}
+					this->DropSegment(this->m_nFirstSegment);
+				}
+
+				// Si no cabe en el segmento actual (y ya tiene algo) empezamos otro, o si no se pudo crear al reiniciarlo.
+				mapped_append_file* pFile = this->m_deqSegments.back().pFile.get();
+				if (!pFile || (pFile->Size() > 0 && pFile->Size() + nLength > this->m_options.nSegmentBytes)) {
+					if (!this->AddSegment()) {
+						this->m_stats.nDropped++;
+						return false;
+					}
+					pFile = this->m_deqSegments.back().pFile.get();
+				}
+
+				size_t nOffset = pFile->Size();
+				uint8_t* pDest = pFile->Reserve(nLength);
+				if (!pDest) {
+					this->m_stats.nDropped++;
+					return false;
+				}
+
+				StoreWire(pDest, nClient);
+				StoreWire(pDest + sizeof(uint32_t), uint32_t(msg.body.size()));
+				wire_header<T>::Write(msg.header, pDest + nRecordHeaderSize);
+				if (!msg.body.empty()) {
+					std::memcpy(pDest + nRecordHeaderSize + wire_header<T>::nSize, msg.body.data(), msg.body.size());
+				}
+
+				client_queue& queue = this->m_mapClients[nClient];
+				queue.deqEntries.push_back({ this->LastSegmentId(), nOffset, nLength, std::chrono::steady_clock::now() });
+				queue.nBytes += nLength;
+				this->m_deqSegments.back().nLive++;
+				this->m_nBytes += nLength;
+				this->m_stats.nStored++;
+
+				// Respetamos el limite del cliente descartando sus mensajes más viejos, el nuevo cabe solo así que nunca se descarta.
+					// El limite de todo el registro ya se respeto antes de escribir.
+				while (queue.nBytes > this->m_options.nMaxClientBytes) {
+					this->DropFront(queue);
+				}
+				this->ReleaseSegments();
+
+				this->m_nUnsynced++;
+				if (this->m_options.nSyncMessages > 0 && this->m_nUnsynced >= this->m_options.nSyncMessages) {
+					this->Sync();
+				}
+				return true;
+			}
+
+			// Entrega los mensajes guardados del cliente a fnDeliver(message<T>&), en el orden en que se guardaron, y los
+				// saca del registro. Retorna cuantos entrego, los que ya se vencieron no se entregan.
+			template <typename Fn>
+			size_t Replay(uint32_t nClient, Fn&& fnDeliver) {
+				auto it = this->m_mapClients.find(nClient);
+				if (it == this->m_mapClients.end()) {
+					return 0;
+				}
+
+				// Sacamos primero la cola del cliente, así el manejador puede guardar otros mensajes sin afectarla.
+				client_queue queue = std::move(it->second);
+				this->m_mapClients.erase(it);
+
+				auto tpCutoff = std::chrono::steady_clock::now() - this->m_options.retention;
+				size_t nReplayed = 0;
+				message<T> msg;
+				for (const entry& e : queue.deqEntries) {
+					segment& s = this->Segment(e.nSegment);
+					if (e.tpStored > tpCutoff) {
+						const uint8_t* pData = s.pFile->Data() + e.nOffset;
+						wire_header<T>::Read(pData + nRecordHeaderSize, msg.header);
+						msg.body.assign(pData + nRecordHeaderSize + wire_header<T>::nSize, pData + e.nLength);
+						fnDeliver(msg);
+						nReplayed++;
+					}
+					else {
+						this->m_stats.nDropped++;
+					}
+
+					s.nLive--;
+					this->m_nBytes -= e.nLength;
+				}
+
+				this->m_stats.nReplayed += nReplayed;
+				this->ReleaseSegments();
+				return nReplayed;
+			}
+
+			// Descarta los mensajes vencidos y espera al disco si ya toca (ver outbox_options).
+				// El servidor lo llama en cada Update(), los vencidos solo se buscan una vez por segundo.
+			void Maintain(std::chrono::steady_clock::time_point tpNow) {
+				if (!this->IsOpen()) {
+					return;
+				}
+
+				if (tpNow - this->m_tpLastExpire >= std::chrono::seconds(1)) {
+					this->m_tpLastExpire = tpNow;
+					auto tpCutoff = tpNow - this->m_options.retention;
+					for (auto it = this->m_mapClients.begin(); it != this->m_mapClients.end();) {
+						while (!it->second.deqEntries.empty() && it->second.deqEntries.front().tpStored <= tpCutoff) {
+							this->DropFront(it->second);
+						}
+						it = it->second.deqEntries.empty() ? this->m_mapClients.erase(it) : std::next(it);
+					}
+					this->ReleaseSegments();
+				}
+
+				if (this->m_nUnsynced > 0 && this->m_options.syncInterval.count() > 0 && tpNow - this->m_tpLastSync >= this->m_options.syncInterval) {
+					this->Sync();
+				}
+			}
+
+			// Espera a que todo lo guardado llegue al disco. Los segmentos anteriores ya se sincronizaron al empezar el siguiente.
+			void Sync() {
+				if (this->IsOpen() && this->m_deqSegments.back().pFile) {
+					this->m_deqSegments.back().pFile->Sync();
+					this->m_stats.nSyncs++;
+				}
+				this->m_nUnsynced = 0;
+				this->m_tpLastSync = std::chrono::steady_clock::now();
+			}
+
+			// Retorna cuantos mensajes tiene guardados el cliente.
+			size_t Pending(uint32_t nClient) const {
+				auto it = this->m_mapClients.find(nClient);
+				return it != this->m_mapClients.end() ? it->second.deqEntries.size() : 0;
+			}
+
+			outbox_stats Stats() const {
+				outbox_stats stats = this->m_stats;
+				stats.nBytes = this->m_nBytes;
+				stats.nClients = this->m_mapClients.size();
+				stats.nSegments = 0;
+				for (const segment& s : this->m_deqSegments) {
+					stats.nMessages += s.nLive;
+					stats.nSegments += s.pFile ? 1 : 0;
+				}
+				return stats;
+			}
+
+		protected:
+			// Cliente (uint32_t) y tamaño del cuerpo (uint32_t) al inicio de cada registro.
+			static constexpr size_t nRecordHeaderSize = 2 * sizeof(uint32_t);
+
+			// Donde esta un mensaje guardado: su segmento, su posición y tamaño en el, y cuando se guardo.
+			struct entry {
+				uint64_t nSegment;
+				size_t nOffset;
+				size_t nLength;
+				std::chrono::steady_clock::time_point tpStored;
+			};
+
+			// Mensajes de un cliente en el orden en que se guardaron, y cuantos bytes ocupan.
+			struct client_queue {
+				std::deque<entry> deqEntries;
+				size_t nBytes = 0;
+			};
+
+			// Un archivo del registro y cuantos mensajes guardados le quedan. Sin archivo ya se borro.
+			struct segment {
+				std::unique_ptr<mapped_append_file> pFile;
+				std::string sPath;
+				size_t nLive = 0;
+			};
+
+			uint64_t LastSegmentId() const {
+				return this->m_nFirstSegment + this->m_deqSegments.size() - 1;
+			}
+
+			segment& Segment(uint64_t nSegment) {
+				return this->m_deqSegments[size_t(nSegment - this->m_nFirstSegment)];
+			}
+
+			// Empieza un segmento nuevo, antes manda al disco lo que quedo en el anterior si se sincroniza.
+			bool AddSegment() {
+				if (!this->m_deqSegments.empty() && (this->m_options.nSyncMessages > 0 || this->m_options.syncInterval.count() > 0)) {
+					this->Sync();
+				}
+
+				uint64_t nId = this->m_nFirstSegment + this->m_deqSegments.size();
+				char szName[32];
+				snprintf(szName, sizeof(szName), "outbox_%06llu.log", (unsigned long long)nId);
+
+				segment s;
+				s.sPath = this->m_sDirectory.empty() ? std::string(szName) : this->m_sDirectory + "/" + szName;
+				s.pFile = std::make_unique<mapped_append_file>();
+				if (!s.pFile->Open(s.sPath)) {
+					return false;
+				}
+
+				this->m_deqSegments.push_back(std::move(s));
+				return true;
+			}
+
+			void DeleteSegment(segment& s) {
+				if (s.pFile) {
+					s.pFile->Close();
+					s.pFile.reset();
+					std::remove(s.sPath.c_str());
+				}
+			}
+
+			// Descarta el mensaje más viejo del cliente.
+			void DropFront(client_queue& queue) {
+				const entry& e = queue.deqEntries.front();
+				this->Segment(e.nSegment).nLive--;
+				queue.nBytes -= e.nLength;
+				this->m_nBytes -= e.nLength;
+				this->m_stats.nDropped++;
+				queue.deqEntries.pop_front();
+			}
+
+			// Descarta todos los mensajes del segmento, como se guardan en orden son los primeros de cada cliente.
+			void DropSegment(uint64_t nSegment) {
+				for (auto it = this->m_mapClients.begin(); it != this->m_mapClients.end();) {
+					while (!it->second.deqEntries.empty() && it->second.deqEntries.front().nSegment <= nSegment) {
+						this->DropFront(it->second);
+					}
+					it = it->second.deqEntries.empty() ? this->m_mapClients.erase(it) : std::next(it);
+				}
+				this->ReleaseSegments();
+			}
+
+			// Borra los archivos de los segmentos que ya no tienen mensajes y saca del frente los que ya se borraron.
+				// El segmento actual se borra y se empieza de nuevo solo si ya tiene algo escrito, así no crece sin limite.
+			void ReleaseSegments() {
+				for (size_t i = 0; i + 1 < this->m_deqSegments.size(); i++) {
+					if (this->m_deqSegments[i].nLive == 0) {
+						this->DeleteSegment(this->m_deqSegments[i]);
+					}
+				}
+
+				segment& last = this->m_deqSegments.back();
+				if (last.nLive == 0 && last.pFile && last.pFile->Size() > 0) {
+					this->DeleteSegment(last);
+					this->AddSegment();
+				}
+
+				while (this->m_deqSegments.size() > 1 && !this->m_deqSegments.front().pFile) {
+					this->m_deqSegments.pop_front();
+					this->m_nFirstSegment++;
+				}
+			}
+
+			std::string m_sDirectory;
+			outbox_options m_options;
+			outbox_stats m_stats;
+
+			bool m_bOpen = false;
+
+			// Segmentos desde el más viejo, el ultimo es al que se agrega, y el número del primero.
+			std::deque<segment> m_deqSegments;
+			uint64_t m_nFirstSegment = 0;
+
+			// Mensajes guardados por cliente, y los bytes de todos.
+			std::unordered_map<uint32_t, client_queue> m_mapClients;
+			size_t m_nBytes = 0;
+
+			// Mensajes guardados desde la ultima vez que se espero al disco, y cuando fue, y la ultima búsqueda de vencidos.
+			uint32_t m_nUnsynced = 0;
+			std::chrono::steady_clock::time_point m_tpLastSync;
+			std::chrono::steady_clock::time_point m_tpLastExpire;
+		};
+
+	}
+}
\ No newline at end of file
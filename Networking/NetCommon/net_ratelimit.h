@@ -0,0 +1,143 @@
+#pragma once
+
+#include "net_common.h"
+
+#include <unordered_map>
+#include <cmath>
+
+namespace cap {
+	namespace net {
+
+		// Lo que hace la conexión con un mensaje que se pasa del limite.
+		enum class rate_limit_action : uint8_t {
+			// Deja de leer del socket hasta que el mensaje quepa en el limite, así el otro lado se frena por TCP.
+			delay = 0,
+
+			// Lee el cuerpo sin guardarlo y descarta el mensaje.
+			drop = 1,
+
+			// Cierra la conexión.
+			disconnect = 2,
+		};
+
+		// Limite de mensajes y bytes por segundo (token bucket), un valor de cero no limita.
+		struct rate_limit {
+			double dMessagesPerSecond = 0.0;
+			double dBytesPerSecond = 0.0;
+
+			// Cuantos segundos del limite se pueden gastar de golpe (el tamaño de la cubeta).
+			double dBurstSeconds = 1.0;
+
+			rate_limit_action action = rate_limit_action::delay;
+
+			// Indica si el limite esta activo.
+			bool Enabled() const {
+				return this->dMessagesPerSecond > 0.0 || this->dBytesPerSecond > 0.0;
+			}
+		};
+
+		// Cubeta de fichas: se llena a la velocidad del limite hasta su capacidad, y cada mensaje gasta lo que cuesta.
+		class token_bucket {
+		public:
+			// Retorna cuanto falta para que alcancen las fichas del costo dado, cero si ya alcanzan.
+				// Rellena la cubeta con el tiempo que paso desde la ultima vez, pero no gasta nada.
+			std::chrono::nanoseconds Missing(double dRate, double dBurstSeconds, double dCost, std::chrono::steady_clock::time_point tpNow) {
+				if (dRate <= 0.0) {
+					return std::chrono::nanoseconds(0);
+				}
+
+				double dCapacity = dRate * std::max(dBurstSeconds, 0.0);
+				if (!this->m_bStarted) {
+					// Empieza llena, así los primeros mensajes de la conexión no esperan.
+					this->m_dTokens = dCapacity;
+					this->m_bStarted = true;
+				}
+				else if (tpNow > this->m_tpLast) {
+					this->m_dTokens = std::min(dCapacity, this->m_dTokens + dRate * std::chrono::duration<double>(tpNow - this->m_tpLast).count());
+				}
+				this->m_tpLast = std::max(this->m_tpLast, tpNow);
+
+				// Un mensaje más caro que la cubeta completa solo necesita que este llena, si no nunca pasaría.
+				double dNeeded = std::min(dCost, dCapacity);
+				if (this->m_dTokens >= dNeeded) {
+					return std::chrono::nanoseconds(0);
+				}
+				return std::chrono::nanoseconds(int64_t(std::ceil((dNeeded - this->m_dTokens) / dRate * 1e9)));
+			}
+
+			// Gasta el costo, la cubeta puede quedar en negativo (deuda) si se gasto antes de que alcanzara.
+			void Take(double dCost) {
+				this->m_dTokens -= dCost;
+			}
+
+		protected:
+			double m_dTokens = 0.0;
+			std::chrono::steady_clock::time_point m_tpLast{};
+			bool m_bStarted = false;
+		};
+
+		// Estado de los limites de una conexión: el general y uno por cada ID de mensaje que tenga su propio limite.
+			// Solo lo usa el proceso de asio de la conexión.
+		class rate_limiter {
+		public:
+			// Revisa si un mensaje de nBytes cabe en el limite general y en el de su ID (si tiene).
+				// Si cabe gasta sus fichas y retorna verdadero. Si no, retorna falso con la acción del limite más estricto
+				// que se excedió (cerrar, luego descartar, luego esperar) y, si es esperar, cuanto falta en wait.
+				// Al esperar las fichas se gastan de una vez, así el siguiente mensaje espera después de este.
+			bool Admit(const rate_limit& global, const rate_limit* pById, uint32_t nId, size_t nBytes, std::chrono::steady_clock::time_point tpNow,
+				rate_limit_action& action, std::chrono::nanoseconds& wait) {
+				bucket_pair* pIdBuckets = pById ? &this->m_mapById[nId] : nullptr;
+
+				wait = std::chrono::nanoseconds(0);
+				bool bExceeded = false;
+				action = rate_limit_action::delay;
+
+				auto fnCheck = [&](const rate_limit& limit, bucket_pair& buckets) {
+					std::chrono::nanoseconds missing = std::max(
+						buckets.messages.Missing(limit.dMessagesPerSecond, limit.dBurstSeconds, 1.0, tpNow),
+						buckets.bytes.Missing(limit.dBytesPerSecond, limit.dBurstSeconds, double(nBytes), tpNow));
+					if (missing.count() > 0) {
+						bExceeded = true;
+						wait = std::max(wait, missing);
+						action = std::max(action, limit.action);
+					}
+				};
+
+				if (global.Enabled()) {
+					fnCheck(global, this->m_global);
+				}
+				if (pIdBuckets) {
+					fnCheck(*pById, *pIdBuckets);
+				}
+
+				if (bExceeded && action != rate_limit_action::delay) {
+					return false;
+				}
+
+				// Cabe, o se va a esperar: se gastan las fichas en todos los limites que aplican.
+				if (global.Enabled()) {
+					this->m_global.Take(1.0, double(nBytes));
+				}
+				if (pIdBuckets) {
+					pIdBuckets->Take(1.0, double(nBytes));
+				}
+				return !bExceeded;
+			}
+
+		protected:
+			struct bucket_pair {
+				token_bucket messages;
+				token_bucket bytes;
+
+				void Take(double dMessages, double dBytes) {
+					this->messages.Take(dMessages);
+					this->bytes.Take(dBytes);
+				}
+			};
+
+			bucket_pair m_global;
+			std::unordered_map<uint32_t, bucket_pair> m_mapById;
+		};
+
+	}
+}
\ No newline at end of file
@@ -0,0 +1,256 @@
+#pragma once
+
+#include "net_common.h"
+#include "net_message.h"
+#include "net_connection.h"
+
+#include <future>
+#include <unordered_map>
+
+namespace cap {
+	namespace net {
+
+		// Estado con el que termina una llamada RPC.
+		enum class rpc_status {
+			// Llego la respuesta.
+			ok,
+			// Se venció el tiempo límite antes de que llegara la respuesta.
+			timeout,
+			// Se cancelo, normalmente por que la conexión se perdió.
+			cancelled
+		};
+
+		// Resultado de una llamada RPC, si el estado es ok el mensaje es la respuesta.
+		template <typename T>
+		struct rpc_result {
+			rpc_status status = rpc_status::cancelled;
+			message<T> msg;
+		};
+
+		// Saca el ID de correlación de una petición RPC recibida, dejando en el cuerpo solo los datos de la petición.
+			// Se debe llamar antes de leer los datos de la petición.
+			// Las banderas vienen del otro lado, así que el cuerpo puede no traer el ID: en ese caso retorna vacío sin
+			// tocar el mensaje, y quien lo recibe debe descartarlo.
+		template <typename T>
+		std::optional<uint64_t> ExtractRpcId(message<T>& request) {
+			if (request.body.size() < sizeof(uint64_t)) {
+				return std::nullopt;
+			}
+
+			uint64_t nRpcId = 0;
+			request >> nRpcId;
+			return nRpcId;
+		}
+
+		// Responde a una petición RPC con el ID de correlación que se saco con ExtractRpcId().
+		template <typename T>
+		void SendRpcReply(std::shared_ptr<connection<T>> client, uint64_t nRpcId, message<T> reply) {
+			// El ID va al final del cuerpo para que sea lo primero que se saque al recibirlo.
+			reply << nRpcId;
+			reply.header.flags = (reply.header.flags & ~uint32_t(flag_rpc_request)) | flag_rpc_response;
+			client->Send(reply);
+		}
+
+		// Capa de peticiones y respuestas sobre una conexión.
+			// Cada llamada recibe un ID de correlación que viaja al final del cuerpo, así pueden estar muchas
+			// peticiones en vuelo al mismo tiempo y las respuestas pueden llegar en cualquier orden.
+			// Los tiempos límite se revisan con una rueda de temporizadores al llamar a Update().
+			//
+			// Uso: los mensajes recibidos se pasan primero por Dispatch(), si retorna verdadero era una respuesta
+			// y ya fue entregada; Update() se debe llamar seguido (por ejemplo en el mismo ciclo que lee los mensajes).
+			// Los callbacks se ejecutan en el proceso que llame a Dispatch(), Update() o CancelAll().
+		template <typename T>
+		class rpc_channel {
+		public:
+			using clock = std::chrono::steady_clock;
+			using callback = std::function<void(rpc_result<T>& result)>;
+
+			// Se necesita la función con la que se mandan los mensajes, y opcionalmente una que diga si sigue conectado,
+			// para cancelar las llamadas pendientes cuando se pierda la conexión.
+				// La rueda de temporizadores tiene nSlots casillas de la duración tick cada una.
+			rpc_channel(std::function<void(const message<T>&)> fnSend, std::function<bool()> fnIsConnected = nullptr,
+				std::chrono::milliseconds tick = std::chrono::milliseconds(1), size_t nSlots = 512)
+				: m_fnSend(std::move(fnSend)), m_fnIsConnected(std::move(fnIsConnected)), m_tick(tick), m_vWheel(std::max<size_t>(nSlots, 1)) {
+				this->m_nLastTick = this->TickOf(clock::now());
+			}
+
+			rpc_channel(const rpc_channel<T>&) = delete;
+
+			virtual ~rpc_channel() {
+				this->CancelAll();
+			}
+
+			// Manda una petición y ejecuta el callback cuando llegue la respuesta o se venza el tiempo.
+				// Retorna el ID de correlación asignado.
+			uint64_t Call(message<T> msg, std::chrono::milliseconds timeout, callback fnCallback) {
+				uint64_t nRpcId = 0;
+				{
+					std::scoped_lock lock(this->m_muxPending);
+					nRpcId = this->m_nNextId++;
+
+					// Calculamos en que tick se vence y lo anotamos en la casilla correspondiente de la rueda.
+						// Como mínimo es el siguiente tick a revisar, si no, la casilla ya se habría pasado.
+					uint64_t nDeadline = std::max(this->TickOf(clock::now() + timeout), this->m_nLastTick + 1);
+					this->m_mapPending.emplace(nRpcId, pending_call{ std::move(fnCallback), nDeadline });
+					this->m_vWheel[nDeadline % this->m_vWheel.size()].push_back(nRpcId);
+				}
+
+				// Agregamos el ID al final del cuerpo y marcamos el mensaje como petición.
+				msg << nRpcId;
+				msg.header.flags |= flag_rpc_request;
+				this->m_fnSend(msg);
+
+				return nRpcId;
+			}
+
+			// Igual que la anterior pero retorna un futuro.
+				// Nota: el futuro se completa desde Dispatch()/Update(), así que no se debe esperar en el mismo proceso que los llama.
+			std::future<rpc_result<T>> Call(message<T> msg, std::chrono::milliseconds timeout) {
+				auto pPromise = std::make_shared<std::promise<rpc_result<T>>>();
+				std::future<rpc_result<T>> future = pPromise->get_future();
+
+				this->Call(std::move(msg), timeout, [pPromise](rpc_result<T>& result) {
+						pPromise->set_value(std::move(result));
+					});
+
+				return future;
+			}
+
+			// Revisa si el mensaje es una respuesta a alguna de nuestras peticiones, si lo es, completa la llamada y retorna verdadero.
+				// Si retorna falso el mensaje no era para nosotros y se debe procesar normalmente.
+			bool Dispatch(message<T>& msg) {
+				if (!(msg.header.flags & flag_rpc_response)) {
+					return false;
+				}
+
+				// Una respuesta sin ID no puede ser de ninguna llamada, se descarta.
+				std::optional<uint64_t> nRpcId = ExtractRpcId(msg);
+				if (!nRpcId) {
+					return true;
+				}
+
+				callback fnCallback;
+				{
+					std::scoped_lock lock(this->m_muxPending);
+					auto it = this->m_mapPending.find(*nRpcId);
+
+					// Si no la encontramos es por que ya se había vencido o cancelado, la respuesta se descarta.
+					if (it == this->m_mapPending.end()) {
+						return true;
+					}
+
+					fnCallback = std::move(it->second.fnCallback);
+					this->m_mapPending.erase(it);
+				}
+
+				rpc_result<T> result{ rpc_status::ok, std::move(msg) };
+				fnCallback(result);
+				return true;
+			}
+
+			// Vence las llamadas cuyo tiempo límite ya paso, y si se perdió la conexión cancela todas.
+			void Update() {
+				if (this->m_fnIsConnected && !this->m_fnIsConnected()) {
+					this->CancelAll();
+					return;
+				}
+
+				std::vector<callback> vExpired;
+				{
+					std::scoped_lock lock(this->m_muxPending);
+					uint64_t nNow = this->TickOf(clock::now());
+
+					// Recorremos las casillas desde la ultima vez, pero nunca más de una vuelta completa.
+					uint64_t nFirst = std::max(this->m_nLastTick + 1, nNow >= this->m_vWheel.size() ? nNow - this->m_vWheel.size() + 1 : 0);
+					for (uint64_t nTick = nFirst; nTick <= nNow; nTick++) {
+						std::vector<uint64_t>& vSlot = this->m_vWheel[nTick % this->m_vWheel.size()];
+
+						// Las que ya se completaron se quitan, las que se vencen se juntan,
+						// y las que son de vueltas futuras de la rueda se quedan.
+						vSlot.erase(std::remove_if(vSlot.begin(), vSlot.end(), [&](uint64_t nRpcId) {
+								auto it = this->m_mapPending.find(nRpcId);
+								if (it == this->m_mapPending.end()) {
+									return true;
+								}
+
+								if (it->second.nDeadline <= nNow) {
+									vExpired.push_back(std::move(it->second.fnCallback));
+									this->m_mapPending.erase(it);
+									return true;
+								}
+
+								return false;
+							}), vSlot.end());
+					}
+
+					this->m_nLastTick = std::max(this->m_nLastTick, nNow);
+				}
+
+				// Los callbacks se ejecutan fuera del bloqueo, así pueden hacer otras llamadas.
+				for (auto& fnCallback : vExpired) {
+					rpc_result<T> result{ rpc_status::timeout, {} };
+					fnCallback(result);
+				}
+			}
+
+			// Cancela todas las llamadas pendientes.
+			void CancelAll() {
+				std::unordered_map<uint64_t, pending_call> mapCancelled;
+				{
+					std::scoped_lock lock(this->m_muxPending);
+					mapCancelled.swap(this->m_mapPending);
+
+					for (auto& vSlot : this->m_vWheel) {
+						vSlot.clear();
+					}
+				}
+
+				for (auto& [nRpcId, call] : mapCancelled) {
+					rpc_result<T> result{ rpc_status::cancelled, {} };
+					call.fnCallback(result);
+				}
+			}
+
+			// Retorna la cantidad de llamadas en vuelo.
+			size_t Pending() {
+				std::scoped_lock lock(this->m_muxPending);
+				return this->m_mapPending.size();
+			}
+
+		private:
+
+			// Datos de una llamada en vuelo.
+			struct pending_call {
+				callback fnCallback;
+				uint64_t nDeadline = 0;
+			};
+
+			// Convierte un punto del tiempo al número de tick de la rueda.
+			uint64_t TickOf(clock::time_point time) const {
+				return uint64_t(time.time_since_epoch() / this->m_tick);
+			}
+
+		protected:
+
+			// Funciones para mandar mensajes y para saber si sigue conectado.
+			std::function<void(const message<T>&)> m_fnSend;
+			std::function<bool()> m_fnIsConnected;
+
+			// Protege las llamadas pendientes y la rueda, ya que Call() se puede usar desde otro proceso.
+			std::mutex m_muxPending;
+
+			// Llamadas en vuelo por ID de correlación.
+			std::unordered_map<uint64_t, pending_call> m_mapPending;
+
+			// Rueda de temporizadores, cada casilla guarda los IDs que se vencen en un tick que cae en ella.
+			clock::duration m_tick;
+			std::vector<std::vector<uint64_t>> m_vWheel;
+			uint64_t m_nLastTick = 0;
+
+			// Siguiente ID de correlación a asignar.
+			uint64_t m_nNextId = 1;
+
+		};
+
+	}
+}
\ No newline at end of file
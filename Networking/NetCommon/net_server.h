@@ -4,12 +4,69 @@
 #include "net_tsqueue.h"
 #include "net_message.h"
 #include "net_connection.h"
+#include "net_topics.h"
+#include "net_capture.h"
+#include "net_admission.h"
+#include "net_outbox.h"
+#include "net_federation.h"
+
+#include <unordered_map>
+#include <future>
+#include <condition_variable>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <bcrypt.h>
+#pragma comment(lib, "bcrypt.lib")
+#elif defined(__linux__)
+#include <sys/random.h>
+#include <cerrno>
+#endif
 
 namespace cap {
 	namespace net {
 
+		// Llena el buffer con bytes del generador criptográfico del sistema operativo, retorna falso si no los pudo dar.
+			// Sirve para lo que otro no debe poder adivinar (como los boletos de reanudación): cada llamada pide bytes
+			// nuevos al sistema, así no hay un estado en el proceso que se pueda reconstruir viendo algunos resultados.
+			// Donde no hay una llamada directa se usa std::random_device, que en esos sistemas lee del dispositivo del kernel.
+		inline bool SecureRandom(void* pData, size_t nSize) {
+			uint8_t* p = static_cast<uint8_t*>(pData);
+#if defined(_WIN32)
+			return BCryptGenRandom(nullptr, p, ULONG(nSize), BCRYPT_USE_SYSTEM_PREFERRED_RNG) == 0;
+#elif defined(__linux__)
+			while (nSize > 0) {
+				ssize_t nRead = getrandom(p, nSize, 0);
+				if (nRead < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+					return false;
+				}
+				p += nRead;
+				nSize -= size_t(nRead);
+			}
+			return true;
+#else
+			try {
+				std::random_device device;
+				while (nSize > 0) {
+					uint32_t nValue = device();
+					size_t nCopy = std::min(nSize, sizeof(nValue));
+					std::memcpy(p, &nValue, nCopy);
+					p += nCopy;
+					nSize -= nCopy;
+				}
+				return true;
+			}
+			catch (std::exception&) {
+				return false;
+			}
+#endif
+		}
+
 		// Esta clase se encargara de hacer los procesos guardados en la cosa de subprocesos.
-		// Tambin es la clase principal que nos permitira crear el servidor el cual tambin
+		// También es la clase principal que nos permitira crear el servidor el cual también
 		// manipulara quienes pueden conectarse y como seran tratados.
 		template <typename T>
 		class server_interface {
@@ -17,7 +74,7 @@ namespace cap {
 
 		protected:
 
-			// Evento que se llama cuando un cliente se conecta, se puede vetar la conexin si se retorna falso.
+			// Evento que se llama cuando un cliente se conecta, se puede vetar la conexión si se retorna falso.
 			virtual bool OnClientConnect(std::shared_ptr<connection<T>> client) {
 				return false;
 			}
@@ -32,32 +89,332 @@ namespace cap {
 
 			}
 
+			// Evento cuando llega un pedazo de un mensaje grande leído por pedazos (ver message_limits::nStreamThreshold).
+				// Importante: se ejecuta en el proceso de asio, no en Update(), así que no debe bloquearse.
+				// Los datos solo son validos durante la llamada, bLast indica que es el ultimo pedazo del mensaje.
+			virtual void OnMessageChunk(std::shared_ptr<connection<T>> client, const message_header<T>& header, const uint8_t* pData, size_t nLength, size_t nOffset, bool bLast) {
+
+			}
+
+			// Evento cuando un cliente reanuda con su boleto la sesión de su conexión anterior (con la ID nPreviousID).
+				// Se llama en el proceso de asio, antes de OnClientValidated() y después de entregarle lo que se guardo
+				// en el buzón (ver StartOutbox()). Sirve para que la aplicación cambie sus referencias a la conexión nueva.
+			virtual void OnClientResumed(std::shared_ptr<connection<T>> client, uint32_t nPreviousID) {
+
+			}
+
 			// Cola de subprocesos segura que servira para paquetes de mensajes entrantes
 			tsqueue<owned_message<T>> m_qMessagesIn;
 
-			// Como siempre, la orden de declaracin, contexto y su proceso para que el contexto no cierre.
-			// Mejor visto como la orden de inicializacin.
+			// Como siempre, la orden de declaración, contexto y su proceso para que el contexto no cierre.
+			// Mejor visto como la orden de inicialización.
 
 			asio::io_context m_asioContext;
 			std::thread m_threadContext;
 
+			// Mantiene vivo al contexto mientras el servidor este iniciado, aunque no tenga operaciones pendientes
+			// (por ejemplo si no escucha en ningún puerto y solo tiene conexiones en el mismo proceso).
+			std::optional<asio::executor_work_guard<asio::io_context::executor_type>> m_workGuard;
+
 			// Esta variable aceptara un socket que sera reservado para el servidor, pero necesita un contexto.
 			asio::ip::tcp::acceptor m_asioAcceptor;
 
-			// Variable que nos permitir tener una lista dinmica que puede crecer hacia delante o hacia atrs que nos ayudara a manipular
-			// y/o almacenar a los nuevos clientes que se conecten, la cual tendr una conexin compartida.
+			// Variable que nos permitirá tener una lista dinámica que puede crecer hacia delante o hacia atrás que nos ayudara a manipular
+			// y/o almacenar a los nuevos clientes que se conecten, la cual tendrá una conexión compartida.
 			std::deque<std::shared_ptr<connection<T>>> m_deqConnections;
 
-			// Clientes sern identificados con un sistema ms aplio por medio de un ID, esta variable indica el maximo de IDs
+			// Clientes serán identificados con un sistema más aplio por medio de un ID, esta variable indica el maximo de IDs
 			uint32_t nIDCounter = 10000;
 
+			// Opciones que se le aplicaran a cada conexión nueva.
+			connection_options m_connectionOptions;
+
+			// Registro de los temas y sus conexiones suscritas.
+			topic_registry<T> m_topics;
+
+			// Histogramas de latencia de todo el servidor, compartidos con las conexiones.
+				// Desde que se lee un mensaje hasta OnMessage(), y desde Send() hasta que se escribe.
+			std::shared_ptr<latency_histogram> m_pReadLatency = std::make_shared<latency_histogram>();
+			std::shared_ptr<latency_histogram> m_pSendLatency = std::make_shared<latency_histogram>();
+
+			// Conexiones aceptadas desde que inicio el servidor.
+			std::atomic<uint64_t> m_nAccepted{ 0 };
+
+			// Opciones del socket que acepta, las conexiones por socket que siguen abiertas y por dirección IP,
+				// y las que se rechazaron al aceptar. La tabla y la cuenta solo se usan desde el proceso de asio.
+			acceptor_options m_acceptorOptions;
+			size_t m_nOpenConnections = 0;
+			ip_connection_table m_ipConnections;
+			std::atomic<uint64_t> m_nRejected{ 0 };
+
+			// Boletos de reanudación entregados, cuando se vencen y a que conexión se entregaron, solo se usan desde el proceso de asio.
+				// Cada boleto sale directo del generador del sistema (ver SecureRandom()).
+			struct resume_ticket {
+				std::chrono::steady_clock::time_point tpExpires;
+				uint32_t nID = 0;
+			};
+			std::unordered_map<uint64_t, resume_ticket> m_mapResumeTokens;
+			size_t m_nResumeTokensSweep = 1024;
+
+			// Captura de los mensajes entrantes, solo existe mientras se esta capturando.
+			std::unique_ptr<capture_writer<T>> m_pCapture;
+
+			// Buzón de los clientes desconectados (solo existe si se inicio con StartOutbox()), y a que conexión se paso
+				// cada ID que reanudo alguien, para mandarle a la nueva lo que aun llegue para la anterior.
+				// Se usan desde Update() y desde el proceso de asio (al reanudar), siempre con m_muxOutbox.
+			struct resumed_client {
+				uint32_t nID = 0;
+				std::weak_ptr<connection<T>> pClient;
+			};
+			std::mutex m_muxOutbox;
+			std::unique_ptr<outbox_log<T>> m_pOutbox;
+			std::unordered_map<uint32_t, resumed_client> m_mapResumedClients;
+			size_t m_nResumedSweep = 1024;
+
+			// Federación con otros nodos del servidor (ver StartFederation()), solo se usa desde el proceso que llama a Update().
+				// El enlace hacia cada nodo con su lote pendiente, y las conexiones de otros nodos que ya se identificaron
+				// (salen de m_deqConnections, así no reciben lo que se manda a los clientes).
+			struct federation_route {
+				std::unique_ptr<federation_link<T>> pLink;
+				federation_batch<T> batch;
+			};
+			federation_options m_federation;
+			std::vector<federation_route> m_vFederationRoutes;
+			std::vector<std::shared_ptr<connection<T>>> m_vFederationPeers;
+			federation_stats m_federationStats;
+
+			// Estados recientes enviados con BroadcastSnapshot() y el número del siguiente (el cero significa "ninguno").
+				// Y los contadores acumulados, con el tiempo por cliente en su propio histograma.
+			snapshot_history m_snapshotHistory;
+			uint32_t m_nSnapshotTick = 1;
+			snapshot_stats m_snapshotStats;
+			latency_histogram m_snapshotEncode;
+
+			// Arma el mensaje de un estado, como delta contra nBaseTick o completo si nBaseTick es cero.
+				// Si el delta no queda más chico que el estado, también se manda completo. Retorna el tipo en kind.
+			std::shared_ptr<const message<T>> MakeSnapshotMessage(T id, uint32_t nTick, uint32_t nBaseTick, const std::vector<uint8_t>& vState, snapshot_kind& kind) {
+				auto pMsg = std::make_shared<message<T>>();
+				pMsg->header.id = id;
+				pMsg->header.flags |= flag_snapshot;
+
+				snapshot_trailer trailer;
+				trailer.nTick = nTick;
+				trailer.nSize = uint32_t(vState.size());
+				trailer.kind = snapshot_kind::full;
+
+				if (const std::vector<uint8_t>* pBase = nBaseTick != 0 ? this->m_snapshotHistory.Find(nBaseTick) : nullptr) {
+					delta::Encode(vState.data(), vState.size(), pBase->data(), pBase->size(), pMsg->body);
+					if (pMsg->body.size() < vState.size()) {
+						trailer.nBaseTick = nBaseTick;
+						trailer.kind = snapshot_kind::delta;
+					}
+				}
+
+				if (trailer.kind == snapshot_kind::full) {
+					pMsg->body.assign(vState.begin(), vState.end());
+				}
+
+				trailer.Append(pMsg->body);
+				pMsg->header.size = uint32_t(pMsg->body.size());
+				kind = trailer.kind;
+				return pMsg;
+			}
+
+			// Anota cuanto espero el mensaje desde que se leyó del socket.
+				// Los que no vienen del socket (por ejemplo los vacíos que solo despiertan a Update()) no tienen la hora
+				// de lectura, y se saltan para no anotar el tiempo desde el origen del reloj.
+			void RecordReadLatency(const owned_message<T>& msg) {
+				if (msg.tpReceived != std::chrono::steady_clock::time_point{}) {
+					this->m_pReadLatency->Record(std::chrono::steady_clock::now() - msg.tpReceived);
+				}
+			}
+
+			// Guarda el mensaje en la captura si hay una en curso.
+				// Se llama justo antes de entregarlo al manejador, ya que el manejador puede modificarlo.
+			void CaptureIncoming(const owned_message<T>& msg) {
+				// Los mensajes sin conexión (por ejemplo los que solo despiertan a Update()) no se guardan.
+				if (this->m_pCapture && msg.remote) {
+					this->m_pCapture->Write(msg.remote->GetID(), msg.msg, msg.tpReceived);
+				}
+			}
+
+			// Crea una conexión del servidor con el socket dado.
+				// Se reserva (junto con su bloque de control) desde el slab_pool de las conexiones, así miles de conexiones
+				// quedan juntas en memoria y las que se cierran dejan su lugar a las siguientes (ver net_memory.h).
+			std::shared_ptr<connection<T>> MakeConnection(asio::ip::tcp::socket socket) {
+				return std::allocate_shared<connection<T>>(slab_allocator<connection<T>>(), connection<T>::owner::server, this->m_asioContext, std::move(socket), this->m_qMessagesIn, this->m_connectionOptions);
+			}
+
+			// Retorna la ruta hacia el nodo dado, o nullptr si no es de la federación.
+			federation_route* FederationRoute(uint8_t nNode) {
+				for (federation_route& route : this->m_vFederationRoutes) {
+					if (route.pLink->Node() == nNode) {
+						return &route;
+					}
+				}
+				return nullptr;
+			}
+
+			// Agrega un registro de nBytes (más o menos) al lote de la ruta con fnAdd(federation_batch<T>&).
+				// Si no cabe en el lote, primero sale lo que ya tenia.
+			template <typename Fn>
+			void ForwardTo(federation_route& route, size_t nBytes, Fn&& fnAdd) {
+				if (!route.batch.Empty() && route.batch.Bytes() + nBytes > this->m_federation.nBatchBytes) {
+					this->FlushRoute(route, std::chrono::steady_clock::now());
+				}
+				fnAdd(route.batch);
+				this->m_federationStats.nForwarded++;
+			}
+
+			template <typename Fn>
+			void ForwardToAll(size_t nBytes, Fn&& fnAdd) {
+				for (federation_route& route : this->m_vFederationRoutes) {
+					this->ForwardTo(route, nBytes, fnAdd);
+				}
+			}
+
+			// Manda el lote pendiente de la ruta, o lo descarta si no hay enlace.
+			void FlushRoute(federation_route& route, std::chrono::steady_clock::time_point tpNow) {
+				if (route.batch.Empty()) {
+					return;
+				}
+
+				size_t nRecords = route.batch.Records();
+				auto pBatch = route.batch.Take();
+				if (route.pLink->IsOpen(tpNow)) {
+					route.pLink->Send(std::move(pBatch));
+					this->m_federationStats.nBatches++;
+				}
+				else {
+					this->m_federationStats.nDropped += nRecords;
+				}
+			}
+
+			// Vuelve a abrir los enlaces caídos y olvida las conexiones de otros nodos que ya se cerraron.
+			void MaintainFederation() {
+				if (this->m_vFederationRoutes.empty() && this->m_vFederationPeers.empty()) {
+					return;
+				}
+
+				auto tpNow = std::chrono::steady_clock::now();
+				for (federation_route& route : this->m_vFederationRoutes) {
+					route.pLink->Maintain(tpNow, this->m_connectionOptions, this->m_federation);
+				}
+
+				this->m_vFederationPeers.erase(std::remove_if(this->m_vFederationPeers.begin(), this->m_vFederationPeers.end(),
+					[](const std::shared_ptr<connection<T>>& peer) { return !peer->IsConnected(); }), this->m_vFederationPeers.end());
+			}
+
+			// Procesa un lote que llego de otro nodo (ver flag_federation).
+				// El primer lote de una conexión debe empezar con el saludo y el secreto de la federación, con lo cual la conexión se
+				// vuelve de confianza y deja de contarse como cliente. Si no, se cierra. Lo que llega de otro nodo solo se entrega a
+				// los clientes de este, nunca se reenvía, ya que cada nodo manda directo a todos los demás.
+			void HandleFederation(owned_message<T>& msg) {
+				if (!msg.remote) {
+					return;
+				}
+
+				bool bPeer = std::find(this->m_vFederationPeers.begin(), this->m_vFederationPeers.end(), msg.remote) != this->m_vFederationPeers.end();
+
+				size_t nOffset = 0;
+				typename federation_batch<T>::record record;
+				while (federation_batch<T>::Read(msg.msg, nOffset, record)) {
+					if (!bPeer) {
+						if (record.kind != federation_kind::hello || this->m_federation.nSecret == 0 || record.nSecret != this->m_federation.nSecret) {
+							break;
+						}
+
+						bPeer = true;
+						msg.remote->SetTrusted(true);
+						this->m_vFederationPeers.push_back(msg.remote);
+						this->m_deqConnections.erase(std::remove(this->m_deqConnections.begin(), this->m_deqConnections.end(), msg.remote), this->m_deqConnections.end());
+						printf("[FEDERACION] Enlace del nodo %d [%u].\n", int(record.nNode), msg.remote->GetID());
+						continue;
+					}
+
+					this->m_federationStats.nReceived++;
+					switch (record.kind) {
+						case federation_kind::broadcast:
+							this->MessageLocalClients(record.msg);
+							break;
+
+						case federation_kind::publish:
+							this->PublishLocal(std::string(record.sTopic), record.msg);
+							break;
+
+						case federation_kind::direct:
+							this->DeliverLocal(record.nID, record.msg);
+							break;
+
+						default:
+							break;
+					}
+				}
+
+				if (!bPeer) {
+					printf("[FEDERACION] Conexión [%u] cerrada (saludo no valido).\n", msg.remote->GetID());
+					msg.remote->Disconnect();
+				}
+			}
+
+			// Entrega un mensaje a un cliente de este nodo por su ID, o lo guarda en el buzón si ya se fue (ver StartOutbox()).
+			bool DeliverLocal(uint32_t nID, const message<T>& msg) {
+				if (std::shared_ptr<connection<T>> client = this->FindClient(nID)) {
+					bool bConnected = client->IsConnected();
+					this->MessageClient(client, msg);
+					return bConnected;
+				}
+				return this->StoreForClient(nID, msg);
+			}
+
+			void MaintainOutbox() {
+				std::scoped_lock lock(this->m_muxOutbox);
+				if (this->m_pOutbox) {
+					this->m_pOutbox->Maintain(std::chrono::steady_clock::now());
+				}
+			}
+
+			// Ejecuta el evento de desconexión del cliente y limpia todo lo que el servidor guarde de el.
+			void NotifyClientDisconnect(std::shared_ptr<connection<T>> client) {
+				this->OnClientDisconnect(client);
+
+				if (client) {
+					this->m_topics.UnsubscribeAll(client->GetID());
+				}
+			}
+
 		public:
 			// Crea el servidor con Ipv4 y un puerto a agregar.
-			server_interface(uint16_t port) : m_asioAcceptor(m_asioContext, asio::ip::tcp::endpoint(asio::ip::tcp::v4(), port)) {
+				// Opcionalmente se pueden dar las opciones del socket que acepta las conexiones.
+			server_interface(uint16_t port, const acceptor_options& options = {}) : m_asioAcceptor(m_asioContext), m_acceptorOptions(options) {
+				asio::ip::tcp::endpoint endpoint(asio::ip::tcp::v4(), port);
+
+				// Abrimos el socket a mano en vez de dejar que asio lo haga, así podemos configurarlo antes de enlazarlo al puerto.
+				this->m_asioAcceptor.open(endpoint.protocol());
+				this->m_asioAcceptor.set_option(asio::socket_base::reuse_address(options.bReuseAddress));
+
+#if defined(SO_REUSEPORT)
+				if (options.bReusePort) {
+					this->m_asioAcceptor.set_option(asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true));
+				}
+#endif
+
+				// Finalmente lo enlazamos al puerto y empezamos a escuchar con la cola de pendientes pedida.
+				this->m_asioAcceptor.bind(endpoint);
+				this->m_asioAcceptor.listen(options.nBacklog);
+			}
+
+			// Crea el servidor sin escuchar en ningún puerto, solo acepta conexiones del mismo proceso (ver AcceptLoopback()).
+				// Sirve para probar y medir la lógica de la aplicación sin sockets ni puertos.
+			server_interface() : m_asioAcceptor(m_asioContext) {
 			}
 
 			virtual ~server_interface() {
 				Stop();
+
+				// La cola de entrada se declara antes que el contexto, así que las conexiones de los mensajes que queden
+					// (p. ej. lotes de otros nodos que llegaron después del ultimo Update()) se sueltan mientras el contexto existe.
+				this->m_qMessagesIn.clear();
 			}
 
 			// Evento cuando un cliente ha sido validado.
@@ -65,18 +422,96 @@ namespace cap {
 
 			}
 
+			// Crea un boleto de reanudación nuevo para un cliente validado (ver handshake_options::bResumption).
+				// Lo llaman las conexiones en el proceso de asio, de paso se limpian los boletos vencidos.
+			uint64_t IssueResumeToken(uint32_t nID = 0) {
+				auto tpNow = std::chrono::steady_clock::now();
+
+				// Solo limpiamos cuando la tabla crece al doble, así el costo se reparte entre muchos boletos.
+				if (this->m_mapResumeTokens.size() >= this->m_nResumeTokensSweep) {
+					for (auto it = this->m_mapResumeTokens.begin(); it != this->m_mapResumeTokens.end();) {
+						it = it->second.tpExpires <= tpNow ? this->m_mapResumeTokens.erase(it) : std::next(it);
+					}
+					this->m_nResumeTokensSweep = std::max<size_t>(1024, this->m_mapResumeTokens.size() * 2);
+				}
+
+				// El cero significa "sin boleto", y un boleto repetido le quitaría el suyo a otro cliente.
+					// Si el sistema no da bytes aleatorios, el cliente se queda sin boleto y solo no podrá reanudar.
+				uint64_t nToken = 0;
+				do {
+					if (!SecureRandom(&nToken, sizeof(nToken))) {
+						return 0;
+					}
+				} while (nToken == 0 || this->m_mapResumeTokens.count(nToken) > 0);
+
+				this->m_mapResumeTokens[nToken] = { tpNow + this->m_connectionOptions.handshake.resumeTokenLifetime, nID };
+				return nToken;
+			}
+
+			// Revisa y gasta un boleto de reanudación, retorna verdadero si existía y no se había vencido.
+				// Si se da pPreviousID, ahí se deja la ID de la conexión a la que se entrego.
+				// Lo llaman las conexiones en el proceso de asio.
+			bool ConsumeResumeToken(uint64_t nToken, uint32_t* pPreviousID = nullptr) {
+				auto it = this->m_mapResumeTokens.find(nToken);
+				if (it == this->m_mapResumeTokens.end()) {
+					return false;
+				}
+
+				bool bValid = it->second.tpExpires > std::chrono::steady_clock::now();
+				if (bValid && pPreviousID) {
+					*pPreviousID = it->second.nID;
+				}
+				this->m_mapResumeTokens.erase(it);
+				return bValid;
+			}
+
+			// Entrega a la conexión que reanudo la sesión de nPreviousID lo que se le guardo en el buzón, y avisa con OnClientResumed().
+				// Lo llaman las conexiones en el proceso de asio al validarse con un boleto.
+			void ResumeClient(std::shared_ptr<connection<T>> client, uint32_t nPreviousID) {
+				{
+					std::scoped_lock lock(this->m_muxOutbox);
+					if (this->m_pOutbox) {
+						// Las IDs que se pasaron a conexiones que ya se fueron solo se limpian cuando la tabla crece al doble.
+						if (this->m_mapResumedClients.size() >= this->m_nResumedSweep) {
+							for (auto it = this->m_mapResumedClients.begin(); it != this->m_mapResumedClients.end();) {
+								it = it->second.pClient.expired() ? this->m_mapResumedClients.erase(it) : std::next(it);
+							}
+							this->m_nResumedSweep = std::max<size_t>(1024, this->m_mapResumedClients.size() * 2);
+						}
+
+						this->m_mapResumedClients[nPreviousID] = { client->GetID(), client };
+						this->m_pOutbox->Replay(nPreviousID, [&](const message<T>& msg) { client->Send(msg); });
+					}
+				}
+
+				this->OnClientResumed(client, nPreviousID);
+			}
+
+			// Cambia las opciones que se le aplicaran a las conexiones que se acepten de aquí en adelante.
+				// Se recomienda llamarlo antes de Start().
+			void SetConnectionOptions(const connection_options& options) {
+				this->m_connectionOptions = options;
+			}
+
 			// Inicializa el server.
 			bool Start() {
-				// Intentaremos hacer los procesos para la conexin, si hay falla imprimir la excepcin y retornara falso.
+				// Intentaremos hacer los procesos para la conexión, si hay falla imprimirá la excepción y retornara falso.
 				try {
-					// Al iniciar esperara a que los clientes se conecten.
-					this->WaitForClientConnection();
+					// Al iniciar esperara a que los clientes se conecten, si es que escucha en algún puerto.
+						// Con varias aceptaciones pendientes, cada una se vuelve a pedir al terminar, así siempre hay las mismas.
+					if (this->m_asioAcceptor.is_open()) {
+						for (size_t i = 0; i < std::max<size_t>(this->m_acceptorOptions.nPendingAccepts, 1); i++) {
+							this->WaitForClientConnection();
+						}
+					}
+
+					this->m_workGuard.emplace(this->m_asioContext.get_executor());
 
 					// He inicializara un proceso con el contexto.
 					this->m_threadContext = std::thread([this]() { m_asioContext.run(); });
 				}
 				catch (std::exception& e) {
-					std::cerr << "[SERVIDOR] Excepcin encontrada: " << e.what() << "\n";
+					std::cerr << "[SERVIDOR] Excepción encontrada: " << e.what() << "\n";
 					return false;
 				}
 
@@ -88,9 +523,10 @@ namespace cap {
 			// Detiene al server.
 			void Stop() {
 				// Pedimos que el contexto finalice su trabajo.
+				this->m_workGuard.reset();
 				this->m_asioContext.stop();
 
-				// Verificamos si el proceso del contexto se puede bloquear, si es as, bloqueamos.
+				// Verificamos si el proceso del contexto se puede bloquear, si es así, bloqueamos.
 				if (this->m_threadContext.joinable()) {
 					this->m_threadContext.join();
 				}
@@ -99,54 +535,221 @@ namespace cap {
 				printf("[SERVIDOR] Se detuvo.\n");
 			}
 
-			// Mtodo ASYNC, indica a asio para que espero por una conexin.
+			// Detiene al server de forma ordenada, a diferencia de Stop() que descarta lo que no se haya escrito.
+				// Deja de aceptar conexiones, cada conexión termina de escribir lo que ya tenia enviado y cierra su lado
+				// del socket (ver connection::Drain()), y se espera a que todas se cierren o a que pase el tiempo dado.
+				// Después se llama a OnClientDisconnect() por cada cliente y se detiene el contexto.
+				// Los mensajes que lleguen mientras tanto se quedan en la cola de entrada y se pueden procesar con Update().
+				// Se debe llamar desde el mismo proceso que llama a Update(), retorna falso si alguna conexión se tuvo que cerrar de golpe.
+			bool Shutdown(std::chrono::milliseconds timeout = std::chrono::seconds(5)) {
+				auto tpDeadline = std::chrono::steady_clock::now() + timeout;
+
+				// Conexiones que faltan por cerrarse, y si alguna se cerro antes de tiempo.
+				struct drain_state {
+					std::mutex mux;
+					std::condition_variable cv;
+					size_t nPending = 0;
+					bool bForced = false;
+				};
+				auto pState = std::make_shared<drain_state>();
+
+				// Si el contexto esta corriendo, el cierre se hace desde su proceso, igual que las conexiones se aceptan ahí.
+				if (this->m_threadContext.joinable()) {
+					std::promise<void> started;
+
+					asio::post(this->m_asioContext, [this, pState, tpDeadline, &started]() {
+							// Primero dejamos de aceptar.
+							std::error_code ec;
+							m_asioAcceptor.close(ec);
+
+							{
+								std::scoped_lock lock(pState->mux);
+								pState->nPending = m_deqConnections.size();
+							}
+
+							for (auto& client : m_deqConnections) {
+								auto fnDrained = [pState, tpDeadline]() {
+									std::scoped_lock lock(pState->mux);
+									pState->bForced |= std::chrono::steady_clock::now() >= tpDeadline;
+									if (--pState->nPending == 0) {
+										pState->cv.notify_all();
+									}
+								};
+
+								if (client) {
+									client->Drain(tpDeadline, fnDrained);
+								}
+								else {
+									fnDrained();
+								}
+							}
+
+							started.set_value();
+						});
+
+					started.get_future().wait();
+
+					// Cada conexión avisa a más tardar en el limite, se da un margen por si el proceso de asio va atrasado.
+					std::unique_lock<std::mutex> lock(pState->mux);
+					pState->bForced |= !pState->cv.wait_until(lock, tpDeadline + std::chrono::seconds(1), [&]() { return pState->nPending == 0; });
+				}
+
+				// Ya cerradas, avisamos de cada desconexión y las olvidamos.
+				for (auto& client : this->m_deqConnections) {
+					if (client) {
+						this->NotifyClientDisconnect(client);
+					}
+				}
+				this->m_deqConnections.clear();
+
+				this->Stop();
+
+				std::scoped_lock lock(pState->mux);
+				return !pState->bForced;
+			}
+
+			// Revisa si se puede aceptar una conexión más desde la dirección dada (ver acceptor_options), y si si, la cuenta.
+				// Se llama en el proceso de asio antes de crear la conexión.
+			bool AdmitConnection(const ip_connection_table::key& address) {
+				const acceptor_options& options = this->m_acceptorOptions;
+				if (options.nMaxConnections > 0 && this->m_nOpenConnections >= options.nMaxConnections) {
+					return false;
+				}
+				if (options.nMaxConnectionsPerIp > 0 && !this->m_ipConnections.Acquire(address, options.nMaxConnectionsPerIp)) {
+					return false;
+				}
+
+				this->m_nOpenConnections++;
+				return true;
+			}
+
+			// Descuenta una conexión que se cerro o que no se aprobó.
+			void ReleaseConnection(const ip_connection_table::key& address) {
+				if (this->m_acceptorOptions.nMaxConnectionsPerIp > 0) {
+					this->m_ipConnections.Release(address);
+				}
+				this->m_nOpenConnections--;
+			}
+
+			// Método ASYNC, indica a asio para que espero por una conexión.
 			void WaitForClientConnection() {
-				// Esta funcin es sincrnica, y se encargara de aceptar clientes ya verificados.
-					// Se usara una funcin lambda para simplificarlo, la cual tendr de parmetros un manejador de cdigo y
-					// un socket donde estar el server.
+				// Esta función es sincrónica, y se encargara de aceptar clientes ya verificados.
+					// Se usara una función lambda para simplificarlo, la cual tendrá de parámetros un manejador de código y
+					// un socket donde estará el server.
 				this->m_asioAcceptor.async_accept([this](std::error_code ec, asio::ip::tcp::socket socket) {
 						// Si no hay error verificaremos, si lo hay, informaremos el por que.
 						if (!ec) {
-							// Informamos de que la conexin fue aceptada.
-							std::cout << "[SERVIDOR] Se ha generado una nueva conexin: " << socket.remote_endpoint() << "\n";
-							
-							// Crearemos una nueva conexin compartida con la funcin crear comparticin.
-							std::shared_ptr<connection<T>> newConn = std::make_shared<connection<T>>(connection<T>::owner::server, m_asioContext, std::move(socket), m_qMessagesIn);
+							// La dirección puede fallar si el cliente ya cerro, en ese caso no hay nada que aceptar.
+							asio::ip::tcp::endpoint remote = socket.remote_endpoint(ec);
+							ip_connection_table::key address = ip_connection_table::Key(remote.address());
 
-							// Hecha la conexin, el cliente deber tener la opcin de cancelar la conexin.
+							// Antes de crear la conexión revisamos los limites, las que se pasan solo se cierran.
+							if (ec || !AdmitConnection(address)) {
+								m_nRejected.fetch_add(1, std::memory_order_relaxed);
+							}
+							else {
+								// Informamos de que la conexión fue aceptada.
+								if (m_acceptorOptions.bLogAccepts) {
+									printf("[SERVIDOR] Se ha generado una nueva conexión: %s:%u\n", remote.address().to_string().c_str(), unsigned(remote.port()));
+								}
 
-							// As que usaremos un if para darle tal opcin con el evento al conectarse el cliente.
-							if (OnClientConnect(newConn)) {
-								// La conexin se permiti, as que agregaremos un contenedor de nuevas conexiones y la moveremos
-								// en caso de que esta cambie de posicin.
-								m_deqConnections.push_back(std::move(newConn));
+								// Crearemos una nueva conexión compartida con la función crear compartición.
+								std::shared_ptr<connection<T>> newConn = this->MakeConnection(std::move(socket));
 
-								// Ya agregado, es momento de asignarle un ID con el mtodo siguiente, he indicarle que este servidor quiere validarlo.
-								m_deqConnections.back()->ConnectToClient(this, nIDCounter++);
+								// Los pedazos de mensajes grandes se entregan al evento respectivo.
+									// Se guarda un pointer débil para que la conexión no se mantenga viva a si misma.
+								std::weak_ptr<connection<T>> wConn = newConn;
+								newConn->SetChunkHandler([this, wConn](const message_header<T>& header, const uint8_t* pData, size_t nLength, size_t nOffset, bool bLast) {
+										if (auto pConn = wConn.lock()) {
+											OnMessageChunk(pConn, header, pData, nLength, nOffset, bLast);
+										}
+									});
 
-								// Y ahora indicamos que el cliente se conecto con la ID asignada.
-								std::cout << "[" << m_deqConnections.back()->GetID() << "] Conexin aprobada.\n";
-							}
-							else {
-								// Si se ejecuta este apartado, es por que el cliente deneg la conexin.
-								printf("[-----] Conexin denegada\n");
-							}
+								// Hecha la conexión, el cliente deberá tener la opción de cancelar la conexión.
+
+								// Así que usaremos un if para darle tal opción con el evento al conectarse el cliente.
+								if (OnClientConnect(newConn)) {
+									// Su lugar se libera en cuanto se cierre el socket, sin esperar a que Update() note la desconexión.
+									newConn->SetCloseHandler([this, address]() { ReleaseConnection(address); });
+
+									// La conexión se permitió, así que agregaremos un contenedor de nuevas conexiones y la moveremos
+									// en caso de que esta cambie de posición.
+									newConn->SetSendLatencyHistogram(m_pSendLatency);
+									m_nAccepted.fetch_add(1, std::memory_order_relaxed);
+									m_deqConnections.push_back(std::move(newConn));
 
+									// Ya agregado, es momento de asignarle un ID con el método siguiente, he indicarle que este servidor quiere validarlo.
+									m_deqConnections.back()->ConnectToClient(this, nIDCounter++);
+
+									// Y ahora indicamos que el cliente se conecto con la ID asignada.
+									if (m_acceptorOptions.bLogAccepts) {
+										printf("[%u] Conexión aprobada.\n", m_deqConnections.back()->GetID());
+									}
+								}
+								else {
+									// Si se ejecuta este apartado, es por que el cliente denegó la conexión.
+									ReleaseConnection(address);
+									printf("[-----] Conexión denegada\n");
+								}
+							}
 						}
 						else {
-							// Si se ejecuta esto es o por que hubo un error, o por que la validacin no fue aceptada.
-							std::cout << "[SERVIDOR] Se ha generado un nuevo error de conexin: " << ec.message() << "\n";
+							// Si se ejecuta esto es o por que hubo un error, o por que la validación no fue aceptada.
+								// Al cerrar el socket que acepta, todas las aceptaciones pendientes terminan con error.
+							if (m_asioAcceptor.is_open()) {
+								printf("[SERVIDOR] Se ha generado un nuevo error de conexión: %s\n", ec.message().c_str());
+							}
 						}
 
-						// Como esto es una funcin sincrnica, y el trabajo del servidor
-						// Tenemos que darle ms trabajo, hacindole que vuelva a esperar por otra conexin.
-						WaitForClientConnection();
+						// Como esto es una función sincrónica, y el trabajo del servidor
+						// Tenemos que darle más trabajo, haciéndole que vuelva a esperar por otra conexión.
+							// A menos que se haya cerrado el socket que acepta, por ejemplo en Shutdown().
+						if (m_asioAcceptor.is_open()) {
+							WaitForClientConnection();
+						}
 					}
 				);
 			}
 
-			// Enva un mensaje a un cliente en especifico.
-				// Se agrega como parmetro una conexin compartida (cliente) y el mensaje a enviar.
+			// Acepta una conexión de un cliente del mismo proceso, sin sockets, la usa client_interface::ConnectLoopback().
+				// Pasa por OnClientConnect() y OnClientValidated() en el proceso de asio igual que una conexión de red,
+				// y espera a que terminen, así al regresar la conexión ya esta validada.
+				// Retorna la conexión del lado del servidor, o nullptr si OnClientConnect() la rechazo.
+				// El servidor debe estar iniciado con Start(), y no se debe llamar desde su proceso de asio.
+			std::shared_ptr<connection<T>> AcceptLoopback(std::shared_ptr<connection<T>> pClient) {
+				std::promise<std::shared_ptr<connection<T>>> promise;
+
+				asio::post(this->m_asioContext, [this, pClient, &promise]() {
+						std::shared_ptr<connection<T>> newConn = this->MakeConnection(asio::ip::tcp::socket(m_asioContext));
+
+						// Las unimos antes de preguntar, así lo que se envíe en OnClientConnect() también llega, como por la red.
+						newConn->ConnectLoopback(pClient);
+						pClient->ConnectLoopback(newConn);
+
+						if (!OnClientConnect(newConn)) {
+							printf("[-----] Conexión denegada\n");
+							newConn->Disconnect();
+							promise.set_value(nullptr);
+							return;
+						}
+
+						newConn->SetSendLatencyHistogram(m_pSendLatency);
+						m_nAccepted.fetch_add(1, std::memory_order_relaxed);
+						m_deqConnections.push_back(newConn);
+
+						// No hay reto que resolver, así que ambos lados quedan validados de una vez.
+						newConn->ConnectDetached(nIDCounter++);
+						pClient->ConnectDetached(pClient->GetID());
+						OnClientValidated(newConn);
+
+						promise.set_value(newConn);
+					});
+
+				return promise.get_future().get();
+			}
+
+			// Envía un mensaje a un cliente en especifico.
+				// Se agrega como parámetro una conexión compartida (cliente) y el mensaje a enviar.
 			void MessageClient(std::shared_ptr<connection<T>> client, const message<T>& msg) {
 				// Verificamos si el cliente es valido y este esta conectado.
 				if (client && client->IsConnected()) {
@@ -154,34 +757,49 @@ namespace cap {
 					client->Send(msg);
 				}
 				else {
-					// Y si no cumple con lo anterior, se puede asumir que esta desconectado, as que hay que ejecutar el evento respectivo.
-					this->OnClientDisconnect(client);
+					// Si hay buzón, se le guarda el mensaje por si vuelve (o se le manda si ya volvió).
+					if (client && client->IsValidated()) {
+						this->StoreForClient(client->GetID(), msg);
+					}
+
+					// Y si no cumple con lo anterior, se puede asumir que esta desconectado, así que hay que ejecutar el evento respectivo.
+					this->NotifyClientDisconnect(client);
 					// Y eliminarlo
 					client.reset();
 					this->m_deqConnections.erase(std::remove(this->m_deqConnections.begin(), this->m_deqConnections.end(), client), this->m_deqConnections.end());
 				}
 			}
 
-			// Enva un mensaje a todos los clientes.
-				// Se agrega como parmetro el mensaje, y una conexin compartida (cliente) a ser ignorado.
+			// Envía un mensaje a todos los clientes.
+				// Se agrega como parámetro el mensaje, y una conexión compartida (cliente) a ser ignorado.
+				// Con la federación también se reenvía a los clientes de los demás nodos (ver StartFederation()).
 			void MessageAllClients(const message<T>& msg, std::shared_ptr<connection<T>> pIgnoreClient = nullptr) {
+				this->MessageLocalClients(msg, pIgnoreClient);
+				this->ForwardToAll(msg.body.size(), [&](federation_batch<T>& batch) { batch.AddBroadcast(msg); });
+			}
+
+			// Envía un mensaje a todos los clientes de este nodo, sin reenviarlo a los demás nodos de la federación.
+			void MessageLocalClients(const message<T>& msg, std::shared_ptr<connection<T>> pIgnoreClient = nullptr) {
+
+				// Hacemos una sola copia del mensaje, la cual compartirán todas las conexiones.
+				auto pShared = std::make_shared<const message<T>>(msg);
 
 				// Este booleano se utilizara en caso de que haya algun cliente que ya es invalido, para desconectarlo
 				bool bInvalidClientExists = false;
 
-				// Utilizaremos un foreach para mandar el mensaje a todos los clientes, tomando el valor de referencia de las conexines.
+				// Utilizaremos un foreach para mandar el mensaje a todos los clientes, tomando el valor de referencia de las conexiónes.
 				for (auto& client : this->m_deqConnections) {
 					// Verificamos si el cliente es valido y este esta conectado.
 					if (client && client->IsConnected()) {
-						// Y tambin verificamos si no es un cliente a ignorar.
+						// Y también verificamos si no es un cliente a ignorar.
 						if (client != pIgnoreClient) {
 							// Y si cumple con lo anterior, podemos mandarle un respectivo mensaje.
-							client->Send(msg);
+							client->Send(pShared);
 						}
 					}
 					else {
-						// Y si no cumple con lo anterior, se puede asumir que esta desconectado, as que hay que ejecutar el evento respectivo.
-						this->OnClientDisconnect(client);
+						// Y si no cumple con lo anterior, se puede asumir que esta desconectado, así que hay que ejecutar el evento respectivo.
+						this->NotifyClientDisconnect(client);
 						// Y eliminarlo
 						client.reset();
 
@@ -191,36 +809,442 @@ namespace cap {
 				}
 
 				// Si se llego a encontrar un cliente invalido, se eliminaran todos los invalidos, ya que
-				// esta funcin se encargara automaticamente de eliminar los ya inexistentes.
+				// esta función se encargara automaticamente de eliminar los ya inexistentes.
 				if (bInvalidClientExists) {
 					this->m_deqConnections.erase(std::remove(this->m_deqConnections.begin(), this->m_deqConnections.end(), nullptr), this->m_deqConnections.end());
 				}
 			}
 		
-			// Esta funcin ser llamada por el usuario para poder actualizar los procesos en la cola.
-				// Se agrega un parmetro de 32 bytes sin asignar, el cual tiene como predeterminado el valor -1
-				// debido a que como es un entero sin asignar, ponerle -1 hace que llegue a su mximo valor (2,147,483,648).
-				// Y tambin un parmetro para indicar si el programa debe de esperarse.
+			// Envía un estado (por ejemplo, el mundo del juego en este tick) a todos los clientes validados.
+				// A cada cliente se le manda el delta contra el ultimo estado que confirmo, o el estado completo si aun no
+				// confirma ninguno o si el que confirmo ya salio del historial (ver snapshot_options). Los clientes con la
+				// misma base comparten el mismo mensaje, así el delta se calcula una sola vez por base y no por cliente.
+				// Lo reciben con la ID dada y la bandera flag_snapshot, ya reconstruido (ver flag_snapshot).
+				// Retorna los contadores de este envío (sin el histograma, ver GetSnapshotStats()).
+				// Se debe llamar desde el mismo proceso que llama a Update(), ya que recorre las conexiones.
+			snapshot_stats BroadcastSnapshot(T id, std::vector<uint8_t> vState) {
+				const uint32_t nHistory = std::max<uint32_t>(this->m_connectionOptions.snapshot.nHistory, 1);
+				const uint32_t nTick = this->m_nSnapshotTick++;
+
+				this->m_snapshotHistory.Push(nTick, std::move(vState), nHistory);
+				const std::vector<uint8_t>& vCurrent = *this->m_snapshotHistory.Find(nTick);
+
+				snapshot_stats stats;
+				stats.nSnapshots = 1;
+
+				// Mensajes ya armados en este envío, por base (cero es el completo).
+				struct prepared {
+					uint32_t nBaseTick;
+					snapshot_kind kind;
+					std::shared_ptr<const message<T>> pMsg;
+				};
+				std::vector<prepared> vPrepared;
+
+				bool bInvalidClientExists = false;
+
+				for (auto& client : this->m_deqConnections) {
+					if (client && client->IsConnected()) {
+						// Los que no se han validado no reciben nada, igual que con los demás mensajes de la aplicación.
+						if (!client->IsValidated()) {
+							continue;
+						}
+
+						auto tpStart = std::chrono::steady_clock::now();
+
+						// La base es la ultima confirmación, si aun esta en el historial.
+						uint32_t nAck = client->GetSnapshotAck();
+						uint32_t nBaseTick = (nAck != 0 && nAck < nTick && nTick - nAck < nHistory) ? nAck : 0;
+
+						auto it = std::find_if(vPrepared.begin(), vPrepared.end(), [nBaseTick](const prepared& p) { return p.nBaseTick == nBaseTick; });
+						if (it == vPrepared.end()) {
+							snapshot_kind kind = snapshot_kind::full;
+							auto pMsg = this->MakeSnapshotMessage(id, nTick, nBaseTick, vCurrent, kind);
+							vPrepared.push_back({ nBaseTick, kind, std::move(pMsg) });
+							it = vPrepared.end() - 1;
+						}
+
+						this->m_snapshotEncode.Record(std::chrono::steady_clock::now() - tpStart);
+
+						client->Send(it->pMsg);
+
+						(it->kind == snapshot_kind::delta ? stats.nDeltas : stats.nFull)++;
+						stats.nStateBytes += vCurrent.size();
+						stats.nSentBytes += it->pMsg->body.size();
+					}
+					else {
+						// Igual que en MessageAllClients(), los desconectados se notifican y se eliminan.
+						this->NotifyClientDisconnect(client);
+						client.reset();
+						bInvalidClientExists = true;
+					}
+				}
+
+				if (bInvalidClientExists) {
+					this->m_deqConnections.erase(std::remove(this->m_deqConnections.begin(), this->m_deqConnections.end(), nullptr), this->m_deqConnections.end());
+				}
+
+				this->m_snapshotStats.nSnapshots += stats.nSnapshots;
+				this->m_snapshotStats.nFull += stats.nFull;
+				this->m_snapshotStats.nDeltas += stats.nDeltas;
+				this->m_snapshotStats.nStateBytes += stats.nStateBytes;
+				this->m_snapshotStats.nSentBytes += stats.nSentBytes;
+				return stats;
+			}
+
+			// Retorna los contadores acumulados de BroadcastSnapshot(), con el tiempo de CPU por cliente.
+				// Se debe llamar desde el mismo proceso que llama a Update().
+			snapshot_stats GetSnapshotStats() const {
+				snapshot_stats stats = this->m_snapshotStats;
+				stats.encode = this->m_snapshotEncode.Snapshot();
+				return stats;
+			}
+
+			// Retorna una copia de las métricas del servidor: los totales de las conexiones activas y los histogramas de latencia.
+				// Se debe llamar desde el mismo proceso que llama a Update(), ya que recorre las conexiones.
+			server_metrics_snapshot GetMetrics() const {
+				server_metrics_snapshot snapshot;
+				snapshot.nAccepted = this->m_nAccepted.load(std::memory_order_relaxed);
+				snapshot.nRejected = this->m_nRejected.load(std::memory_order_relaxed);
+
+				for (const auto& client : this->m_deqConnections) {
+					if (client) {
+						snapshot.totals += client->GetMetrics();
+						snapshot.nConnections++;
+					}
+				}
+
+				snapshot.readToHandler = this->m_pReadLatency->Snapshot();
+				snapshot.sendToWrite = this->m_pSendLatency->Snapshot();
+				return snapshot;
+			}
+
+			// Empieza a guardar todos los mensajes entrantes en un archivo de captura (ver net_capture.h), retorna falso si no se pudo crear.
+				// Se guardan con la ID de su conexión y el momento en el que se leyeron, para reproducirlos después con Replay().
+				// Los mensajes leídos por pedazos no se guardan.
+				// Se debe llamar desde el mismo proceso que llama a Update().
+			bool StartCapture(const std::string& sPath) {
+				auto pCapture = std::make_unique<capture_writer<T>>();
+				if (!pCapture->Open(sPath)) {
+					return false;
+				}
+
+				this->m_pCapture = std::move(pCapture);
+				return true;
+			}
+
+			// Empieza el buzón de los clientes desconectados en el directorio dado (ver outbox_log), retorna falso si no se pudo crear.
+				// Lo que se le mande con MessageClient() a un cliente validado que ya se desconecto se guarda, y si vuelve con
+				// su boleto de reanudación (ver handshake_options::bResumption, necesario para usarlo) se le entrega en orden
+				// al validarse, antes que cualquier otro mensaje. Si ya había vuelto, se le manda directo a su conexión nueva.
+				// Los mensajes a todos, a los temas y los estados no se guardan.
+			bool StartOutbox(const std::string& sDirectory, const outbox_options& options = {}) {
+				auto pOutbox = std::make_unique<outbox_log<T>>();
+				if (!pOutbox->Open(sDirectory, options)) {
+					return false;
+				}
+
+				std::scoped_lock lock(this->m_muxOutbox);
+				this->m_pOutbox = std::move(pOutbox);
+				this->m_mapResumedClients.clear();
+				return true;
+			}
+
+			// Cierra el buzón y borra sus archivos, lo guardado se pierde.
+			void StopOutbox() {
+				std::scoped_lock lock(this->m_muxOutbox);
+				this->m_pOutbox.reset();
+				this->m_mapResumedClients.clear();
+			}
+
+			// Retorna los contadores del buzón, todos en cero si no hay.
+			outbox_stats GetOutboxStats() {
+				std::scoped_lock lock(this->m_muxOutbox);
+				return this->m_pOutbox ? this->m_pOutbox->Stats() : outbox_stats();
+			}
+
+			// Guarda un mensaje para el cliente con la ID dada que se desconecto, retorna falso si no hay buzón o no se pudo guardar.
+				// Si el cliente ya reanudo en otra conexión (o en varias, una tras otra), se manda a la ultima si sigue conectada.
+			bool StoreForClient(uint32_t nID, const message<T>& msg) {
+				std::scoped_lock lock(this->m_muxOutbox);
+				if (!this->m_pOutbox) {
+					return false;
+				}
+
+				for (auto it = this->m_mapResumedClients.find(nID); it != this->m_mapResumedClients.end(); it = this->m_mapResumedClients.find(nID)) {
+					std::shared_ptr<connection<T>> pClient = it->second.pClient.lock();
+					if (pClient && pClient->IsConnected()) {
+						pClient->Send(msg);
+						return true;
+					}
+					nID = it->second.nID;
+				}
+
+				return this->m_pOutbox->Append(nID, msg);
+			}
+
+			// Une este servidor con los demás nodos de la federación (ver federation_options), retorna falso si las opciones
+				// no son validas (falta el número de nodo o el secreto). Se debe llamar antes de Start(), ya que el número del
+				// nodo va en las IDs de las conexiones desde la primera.
+				// Los enlaces se abren (y se vuelven a abrir si se caen) desde Update(). Desde entonces:
+				//   MessageAllClients() y Publish() también se reenvían a los clientes de los demás nodos.
+				//   MessageClientById() entrega a un cliente de cualquier nodo.
+				// Los demás nodos deben usar las mismas opciones de conexión y el mismo tipo de mensajes.
+			bool StartFederation(const federation_options& options) {
+				if (options.nNode == 0 || options.nSecret == 0) {
+					return false;
+				}
+
+				this->m_federation = options;
+				this->nIDCounter = (uint32_t(options.nNode) << 24) | (this->nIDCounter & 0x00FFFFFF);
+
+				this->m_vFederationRoutes.clear();
+				for (const federation_peer& peer : options.vPeers) {
+					if (peer.nNode != options.nNode && !this->FederationRoute(peer.nNode)) {
+						federation_route route;
+						route.pLink = std::make_unique<federation_link<T>>(this->m_asioContext, peer);
+						this->m_vFederationRoutes.push_back(std::move(route));
+					}
+				}
+				return true;
+			}
+
+			// Cierra los enlaces con los demás nodos, lo que estaba en sus lotes se descarta.
+				// Se debe llamar desde el mismo proceso que llama a Update().
+			void StopFederation() {
+				this->m_vFederationRoutes.clear();
+				for (auto& peer : this->m_vFederationPeers) {
+					peer->Disconnect();
+				}
+				this->m_vFederationPeers.clear();
+				this->m_federation = federation_options();
+			}
+
+			// Manda de inmediato los lotes pendientes hacia los demás nodos, Update() lo hace al principio y al final.
+				// Se debe llamar desde el mismo proceso que llama a Update().
+			void FlushFederation() {
+				auto tpNow = std::chrono::steady_clock::now();
+				for (federation_route& route : this->m_vFederationRoutes) {
+					this->FlushRoute(route, tpNow);
+				}
+			}
+
+			// Retorna los contadores de la federación.
+				// Se debe llamar desde el mismo proceso que llama a Update().
+			federation_stats GetFederationStats() const {
+				federation_stats stats = this->m_federationStats;
+				for (const federation_route& route : this->m_vFederationRoutes) {
+					stats.nLinksUp += route.pLink->IsUp() ? 1 : 0;
+				}
+				stats.nPeers = this->m_vFederationPeers.size();
+				return stats;
+			}
+
+			// Envía un mensaje al cliente con la ID dada, en este nodo o en cualquier otro de la federación.
+				// Retorna falso si no se pudo entregar ni guardar en el buzón (ver StartOutbox()) en este nodo, o si la ID es
+				// de un nodo que no es de la federación. Lo que va a otro nodo sale en su lote y ese nodo lo entrega igual.
+			bool MessageClientById(uint32_t nID, const message<T>& msg) {
+				uint8_t nNode = NodeOfID(nID);
+				if (!this->m_vFederationRoutes.empty() && nNode != this->m_federation.nNode) {
+					federation_route* pRoute = this->FederationRoute(nNode);
+					if (!pRoute) {
+						return false;
+					}
+
+					this->ForwardTo(*pRoute, msg.body.size(), [&](federation_batch<T>& batch) { batch.AddDirect(nID, msg); });
+					return true;
+				}
+
+				return this->DeliverLocal(nID, msg);
+			}
+
+			// Retorna la conexión de este nodo con la ID dada, o nullptr si no hay.
+				// Las conexiones se agregan en orden de ID, así que se busca por bisección. Las de una reproducción (ver Replay())
+				// pueden romper ese orden, en cuyo caso se recorren todas.
+			std::shared_ptr<connection<T>> FindClient(uint32_t nID) {
+				auto it = std::lower_bound(this->m_deqConnections.begin(), this->m_deqConnections.end(), nID,
+					[](const std::shared_ptr<connection<T>>& client, uint32_t n) { return client && client->GetID() < n; });
+				if (it == this->m_deqConnections.end() || !*it || (*it)->GetID() != nID) {
+					it = std::find_if(this->m_deqConnections.begin(), this->m_deqConnections.end(),
+						[nID](const std::shared_ptr<connection<T>>& client) { return client && client->GetID() == nID; });
+				}
+				return it != this->m_deqConnections.end() ? *it : nullptr;
+			}
+
+			// Termina la captura en curso y cierra el archivo.
+				// Se debe llamar desde el mismo proceso que llama a Update().
+			void StopCapture() {
+				this->m_pCapture.reset();
+			}
+
+			// Reproduce una captura entregando sus mensajes a OnMessage(), sin sockets de por medio.
+				// Cada ID de conexión de la captura se vuelve una conexión sin socket (ver connection::ConnectDetached()),
+				// la cual pasa por OnClientConnect() y OnClientValidated() la primera vez que aparece, y por
+				// OnClientDisconnect() al terminar. Lo que los manejadores envíen se descarta.
+				// Se debe llamar desde el mismo proceso que llama a Update(), o sin haber llamado a Start().
+			replay_result Replay(capture_reader<T>& reader, const replay_options& options = {}) {
+				replay_result result;
+				latency_histogram hHandler;
+
+				// Conexiones de la captura por su ID, las que se rechazaron se guardan vacías para ignorar sus mensajes.
+				std::unordered_map<uint32_t, std::shared_ptr<connection<T>>> mapConnections;
+
+				captured_message<T> captured;
+				auto tpStart = std::chrono::steady_clock::now();
+
+				while (reader.Next(captured)) {
+					auto it = mapConnections.find(captured.nConnection);
+					if (it == mapConnections.end()) {
+						auto pConn = this->MakeConnection(asio::ip::tcp::socket(this->m_asioContext));
+						pConn->ConnectDetached(captured.nConnection);
+
+						if (this->OnClientConnect(pConn)) {
+							this->m_deqConnections.push_back(pConn);
+							this->OnClientValidated(pConn);
+						}
+						else {
+							pConn.reset();
+						}
+
+						it = mapConnections.emplace(captured.nConnection, std::move(pConn)).first;
+					}
+
+					if (!it->second) {
+						continue;
+					}
+
+					// Con el ritmo original, esperamos a que llegue el momento en el que se recibió.
+					if (options.pacing == replay_pacing::original && options.dSpeed > 0.0) {
+						std::this_thread::sleep_until(tpStart + std::chrono::duration_cast<std::chrono::steady_clock::duration>(captured.time / options.dSpeed));
+					}
+
+					result.nBytes += captured.msg.body.size();
+
+					auto tpHandler = std::chrono::steady_clock::now();
+					this->OnMessage(it->second, captured.msg);
+					hHandler.Record(std::chrono::steady_clock::now() - tpHandler);
+
+					result.nMessages++;
+				}
+
+				result.dSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tpStart).count();
+				result.nConnections = mapConnections.size();
+				result.handler = hHandler.Snapshot();
+
+				// Al terminar, desconectamos a todas las conexiones de la captura.
+				for (auto& [nID, pConn] : mapConnections) {
+					if (pConn) {
+						pConn->Disconnect();
+						this->NotifyClientDisconnect(pConn);
+						this->m_deqConnections.erase(std::remove(this->m_deqConnections.begin(), this->m_deqConnections.end(), pConn), this->m_deqConnections.end());
+					}
+				}
+
+				return result;
+			}
+
+			// Suscribe al cliente a un tema, retorna falso si ya estaba suscrito.
+			bool Subscribe(const std::string& sTopic, std::shared_ptr<connection<T>> client) {
+				return this->m_topics.Subscribe(sTopic, std::move(client));
+			}
+
+			// Desuscribe al cliente de un tema, retorna falso si no estaba suscrito.
+			bool Unsubscribe(const std::string& sTopic, std::shared_ptr<connection<T>> client) {
+				return client && this->m_topics.Unsubscribe(sTopic, client->GetID());
+			}
+
+			// Envía un mensaje a todos los clientes suscritos a un tema.
+				// Se agrega como parámetro el tema, el mensaje, y una conexión compartida (cliente) a ser ignorado.
+				// Con la federación también se reenvía a los suscritos de los demás nodos (ver StartFederation()).
+			void Publish(const std::string& sTopic, const message<T>& msg, std::shared_ptr<connection<T>> pIgnoreClient = nullptr) {
+				this->PublishLocal(sTopic, msg, pIgnoreClient);
+				this->ForwardToAll(sTopic.size() + msg.body.size(), [&](federation_batch<T>& batch) { batch.AddPublish(sTopic, msg); });
+			}
+
+			// Envía un mensaje a los suscritos al tema en este nodo, sin reenviarlo a los demás nodos de la federación.
+			void PublishLocal(const std::string& sTopic, const message<T>& msg, std::shared_ptr<connection<T>> pIgnoreClient = nullptr) {
+				// Hacemos una sola copia del mensaje, la cual compartirán todos los miembros del tema.
+				auto pShared = std::make_shared<const message<T>>(msg);
+
+				// Los clientes desconectados se juntan aparte, ya que eliminarlos mientras recorremos el tema movería a los miembros.
+				std::vector<std::shared_ptr<connection<T>>> vDisconnected;
+
+				for (const auto& client : this->m_topics.Members(sTopic)) {
+					if (client->IsConnected()) {
+						if (client != pIgnoreClient) {
+							client->Send(pShared);
+						}
+					}
+					else {
+						vDisconnected.push_back(client);
+					}
+				}
+
+				// Si se encontraron clientes desconectados, los eliminamos de todos lados.
+				if (!vDisconnected.empty()) {
+					for (auto& client : vDisconnected) {
+						this->NotifyClientDisconnect(client);
+					}
+
+					this->m_deqConnections.erase(std::remove_if(this->m_deqConnections.begin(), this->m_deqConnections.end(),
+						[&](const std::shared_ptr<connection<T>>& c) { return std::find(vDisconnected.begin(), vDisconnected.end(), c) != vDisconnected.end(); }),
+						this->m_deqConnections.end());
+				}
+			}
+
+			// Esta función será llamada por el usuario para poder actualizar los procesos en la cola.
+				// Se agrega un parámetro de 32 bytes sin asignar, el cual tiene como predeterminado el valor -1
+				// debido a que como es un entero sin asignar, ponerle -1 hace que llegue a su máximo valor (2,147,483,648).
+				// Y también un parámetro para indicar si el programa debe de esperarse.
 			void Update(size_t nMaxMessages = -1, bool bWait = false) {
 
+				// Los enlaces con los demás nodos se abren y los lotes pendientes salen antes de esperar.
+				this->MaintainFederation();
+				this->FlushFederation();
+
 				// Si indicamos previamente que el programa se esperara, este esperara.
-				if (bWait) {
+					// Con la federación la espera dura a lo mucho el intervalo de reconexión, para volver a abrir los enlaces caídos.
+				if (bWait && !this->m_vFederationRoutes.empty()) {
+					this->m_qMessagesIn.wait_for(this->m_federation.reconnectInterval);
+				}
+				else if (bWait) {
 					this->m_qMessagesIn.wait();
 				}
 
-				// Variable que servir para contar los mensajes ledos.
+				// Variable que servirá para contar los mensajes leídos.
 				size_t nMessagesCount = 0;
 
-				// Si llega a encontrar mensajes vacos, ya no leer nada.
+				// El buzón descarta lo vencido y manda al disco lo pendiente cuando toca.
+				this->MaintainOutbox();
+
+				// Si llega a encontrar mensajes vacíos, ya no leerá nada.
 				while (nMessagesCount < nMaxMessages && !this->m_qMessagesIn.empty()) {
 					// Obtiene el mensaje frontal.
 					auto msg = this->m_qMessagesIn.pop_front();
 
+					// Anotamos cuanto espero el mensaje desde que se leyó del socket.
+					this->RecordReadLatency(msg);
+					Trace<T>(trace_stage::dequeue, msg.nTraceId);
+
+					// Los lotes de otros nodos no son mensajes de clientes.
+					if (msg.msg.header.flags & flag_federation) {
+						this->HandleFederation(msg);
+						nMessagesCount++;
+						continue;
+					}
+
+					// Lo guardamos si se esta capturando.
+					this->CaptureIncoming(msg);
+
 					// Pasa el mensaje al manejador/evento correspondiente.
+					Trace<T>(trace_stage::handler_start, msg.nTraceId);
 					this->OnMessage(msg.remote, msg.msg);
+					Trace<T>(trace_stage::handler_end, msg.nTraceId);
 
 					nMessagesCount++;
 				}
+
+				// Lo que se reenvió mientras se procesaban los mensajes sale en un lote por nodo.
+				this->FlushFederation();
 			}
 		};
 
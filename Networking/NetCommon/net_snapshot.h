@@ -0,0 +1,357 @@
+#pragma once
+
+#include "net_common.h"
+#include "net_metrics.h"
+#include "net_wire.h"
+
+#include <cstring>
+
+// SSE2 esta en todos los procesadores x86-64, en 32 bits solo si el compilador lo tiene activado.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CAP_NET_SSE2 1
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace cap {
+	namespace net {
+
+		// Tipos de los cuerpos de los estados (ver flag_snapshot).
+		enum class snapshot_kind : uint8_t {
+			// El cuerpo es el estado completo.
+			full = 0,
+
+			// El cuerpo es la diferencia (XOR comprimido por corridas) contra un estado anterior que el cliente confirmo.
+			delta = 1,
+		};
+
+		// Datos que van al final del cuerpo de un estado, después del contenido.
+		struct snapshot_trailer {
+			// Número del estado, y del estado contra el que se calculo el delta (cero en uno completo).
+			uint32_t nTick = 0;
+			uint32_t nBaseTick = 0;
+
+			// Tamaño del estado completo.
+			uint32_t nSize = 0;
+
+			snapshot_kind kind = snapshot_kind::full;
+
+			// Bytes que ocupa al final del cuerpo.
+			static constexpr size_t nBytes = 3 * sizeof(uint32_t) + sizeof(uint8_t);
+
+			// Agrega los datos al final del cuerpo.
+			template <typename Buffer>
+			void Append(Buffer& vBody) const {
+				size_t i = vBody.size();
+				vBody.resize(i + nBytes);
+				StoreWire(vBody.data() + i, this->nTick);
+				StoreWire(vBody.data() + i + 4, this->nBaseTick);
+				StoreWire(vBody.data() + i + 8, this->nSize);
+				vBody[i + 12] = uint8_t(this->kind);
+			}
+
+			// Saca los datos del final del cuerpo, retorna falso si el cuerpo es demasiado chico.
+			template <typename Buffer>
+			bool Pop(Buffer& vBody) {
+				if (vBody.size() < nBytes) {
+					return false;
+				}
+
+				size_t i = vBody.size() - nBytes;
+				this->nTick = LoadWire<uint32_t>(vBody.data() + i);
+				this->nBaseTick = LoadWire<uint32_t>(vBody.data() + i + 4);
+				this->nSize = LoadWire<uint32_t>(vBody.data() + i + 8);
+				this->kind = snapshot_kind(vBody[i + 12]);
+				vBody.resize(i);
+				return true;
+			}
+		};
+
+		// Codificación de la diferencia entre dos estados.
+			// Se calcula el XOR byte a byte contra la base (rellenada con ceros si es más corta), el cual es casi todo ceros
+			// cuando el estado cambia poco. Se guarda como una lista de (corrida de ceros, cantidad de literales, literales),
+			// con las longitudes en varint. Lo que queda después del ultimo literal es igual a la base.
+			// La búsqueda de las corridas de ceros, que es donde se va casi todo el tiempo, usa SSE2 de 16 en 16 bytes.
+		namespace delta {
+			// Cantidad de bytes iguales seguidos que terminan un literal, con menos sale más caro cortar que seguir.
+			constexpr size_t nMinEqualRun = 8;
+
+			// Retorna la posición del bit más bajo encendido, el valor no debe ser cero.
+			inline uint32_t LowestBit(uint32_t nValue) {
+#if defined(_MSC_VER)
+				unsigned long nIndex = 0;
+				_BitScanForward(&nIndex, nValue);
+				return uint32_t(nIndex);
+#else
+				return uint32_t(__builtin_ctz(nValue));
+#endif
+			}
+
+			// Retorna la primera posición desde i (hasta n) donde a y b son distintos, o n si son iguales.
+			inline size_t FirstDifference(const uint8_t* a, const uint8_t* b, size_t i, size_t n) {
+#if defined(CAP_NET_SSE2)
+				for (; i + 16 <= n; i += 16) {
+					__m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+					__m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+					uint32_t nEqual = uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)));
+					if (nEqual != 0xFFFF) {
+						return i + LowestBit(~nEqual & 0xFFFF);
+					}
+				}
+#endif
+				// Sin SSE2 (y para el resto) comparamos de 8 en 8 bytes, y el bloque distinto de uno en uno.
+				for (; i + 8 <= n; i += 8) {
+					uint64_t va, vb;
+					std::memcpy(&va, a + i, sizeof(va));
+					std::memcpy(&vb, b + i, sizeof(vb));
+					if (va != vb) {
+						break;
+					}
+				}
+				for (; i < n; i++) {
+					if (a[i] != b[i]) {
+						return i;
+					}
+				}
+				return n;
+			}
+
+			// Escribe pOut[k] = a[k] ^ b[k], de 16 en 16 bytes con SSE2.
+			inline void Xor(uint8_t* pOut, const uint8_t* a, const uint8_t* b, size_t n) {
+				size_t i = 0;
+#if defined(CAP_NET_SSE2)
+				for (; i + 16 <= n; i += 16) {
+					__m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+					__m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(pOut + i), _mm_xor_si128(va, vb));
+				}
+#endif
+				for (; i < n; i++) {
+					pOut[i] = a[i] ^ b[i];
+				}
+			}
+
+			template <typename Buffer>
+			void WriteVarint(Buffer& vOut, size_t nValue) {
+				while (nValue >= 0x80) {
+					vOut.push_back(uint8_t(nValue) | 0x80);
+					nValue >>= 7;
+				}
+				vOut.push_back(uint8_t(nValue));
+			}
+
+			inline bool ReadVarint(const uint8_t*& p, const uint8_t* pEnd, size_t& nValue) {
+				nValue = 0;
+				for (uint32_t nShift = 0; nShift < 64; nShift += 7) {
+					if (p >= pEnd) {
+						return false;
+					}
+					uint8_t nByte = *p++;
+					nValue |= size_t(nByte & 0x7F) << nShift;
+					if (!(nByte & 0x80)) {
+						return true;
+					}
+				}
+				return false;
+			}
+
+			// Agrega a vOut la diferencia de pState contra pBase.
+			template <typename Buffer>
+			void Encode(const uint8_t* pState, size_t nState, const uint8_t* pBase, size_t nBase, Buffer& vOut) {
+				// Solo se comparan los bytes que existen en ambos, después de eso todo es literal.
+				size_t nCommon = std::min(nState, nBase);
+				size_t i = 0;
+
+				while (i < nState) {
+					// Corrida de bytes iguales a la base.
+					size_t nZeroStart = i;
+					if (i < nCommon) {
+						i = FirstDifference(pState, pBase, i, nCommon);
+					}
+					if (i == nState) {
+						break;
+					}
+
+					// Literales hasta encontrar suficientes bytes iguales seguidos, o el final.
+					size_t nLiteralStart = i;
+					size_t nEqual = 0;
+					for (; i < nState && nEqual < nMinEqualRun; i++) {
+						nEqual = (i < nCommon && pState[i] == pBase[i]) ? nEqual + 1 : 0;
+					}
+					i -= nEqual;
+					size_t nLiterals = i - nLiteralStart;
+
+					WriteVarint(vOut, nLiteralStart - nZeroStart);
+					WriteVarint(vOut, nLiterals);
+
+					// Los literales son el XOR contra la base, y lo que pasa del final de la base va tal cual.
+					size_t nOut = vOut.size();
+					vOut.resize(nOut + nLiterals);
+					size_t nXor = nLiteralStart < nCommon ? std::min(nLiterals, nCommon - nLiteralStart) : 0;
+					Xor(vOut.data() + nOut, pState + nLiteralStart, pBase + nLiteralStart, nXor);
+					std::memcpy(vOut.data() + nOut + nXor, pState + nLiteralStart + nXor, nLiterals - nXor);
+				}
+			}
+
+			// Copia en pOut los bytes de la base desde nFrom, rellenando con ceros lo que pasa de su final.
+			inline void CopyBase(uint8_t* pOut, const uint8_t* pBase, size_t nBase, size_t nFrom, size_t nCount) {
+				size_t nCopy = nFrom < nBase ? std::min(nCount, nBase - nFrom) : 0;
+				if (nCopy > 0) {
+					std::memcpy(pOut, pBase + nFrom, nCopy);
+				}
+				if (nCount > nCopy) {
+					std::memset(pOut + nCopy, 0, nCount - nCopy);
+				}
+			}
+
+			// Reconstruye en pOut (de nOut bytes) el estado a partir de su diferencia contra pBase.
+				// Revisa todos los limites, un delta mal formado solo hace que retorne falso.
+			inline bool Decode(const uint8_t* pDelta, size_t nDelta, const uint8_t* pBase, size_t nBase, uint8_t* pOut, size_t nOut) {
+				const uint8_t* p = pDelta;
+				const uint8_t* pEnd = pDelta + nDelta;
+				size_t o = 0;
+
+				while (p < pEnd) {
+					size_t nZeros = 0, nLiterals = 0;
+					if (!ReadVarint(p, pEnd, nZeros) || !ReadVarint(p, pEnd, nLiterals)) {
+						return false;
+					}
+					if (nZeros > nOut - o) {
+						return false;
+					}
+					CopyBase(pOut + o, pBase, nBase, o, nZeros);
+					o += nZeros;
+
+					if (nLiterals > nOut - o || nLiterals > size_t(pEnd - p)) {
+						return false;
+					}
+					size_t nXor = o < nBase ? std::min(nLiterals, nBase - o) : 0;
+					Xor(pOut + o, p, pBase + o, nXor);
+					if (nLiterals > nXor) {
+						std::memcpy(pOut + o + nXor, p + nXor, nLiterals - nXor);
+					}
+					o += nLiterals;
+					p += nLiterals;
+				}
+
+				// Lo que no se menciono es igual a la base.
+				CopyBase(pOut + o, pBase, nBase, o, nOut - o);
+				return true;
+			}
+		}
+
+		// Estados recientes y su número, los guardan el servidor (para calcular deltas) y el cliente (para aplicarlos).
+		class snapshot_history {
+		public:
+			// Agrega un estado con el número dado, descartando los más viejos si ya hay nMax.
+			void Push(uint32_t nTick, std::vector<uint8_t> vState, size_t nMax) {
+				while (!this->m_deqStates.empty() && this->m_deqStates.size() >= std::max<size_t>(nMax, 1)) {
+					this->m_deqStates.pop_front();
+				}
+				this->m_deqStates.emplace_back(nTick, std::move(vState));
+			}
+
+			// Busca un estado por su número, nullptr si no se tiene (o ya se descarto).
+			const std::vector<uint8_t>* Find(uint32_t nTick) const {
+				// Casi siempre se busca uno de los más recientes, así que se busca desde el final.
+				for (auto it = this->m_deqStates.rbegin(); it != this->m_deqStates.rend(); ++it) {
+					if (it->first == nTick) {
+						return &it->second;
+					}
+				}
+				return nullptr;
+			}
+
+			// Retorna el buffer del estado más viejo si ya hay nMax, para reutilizar su memoria en el siguiente.
+			std::vector<uint8_t> Recycle(size_t nMax) {
+				std::vector<uint8_t> vState;
+				if (!this->m_deqStates.empty() && this->m_deqStates.size() >= std::max<size_t>(nMax, 1)) {
+					vState = std::move(this->m_deqStates.front().second);
+					this->m_deqStates.pop_front();
+				}
+				return vState;
+			}
+
+		protected:
+			std::deque<std::pair<uint32_t, std::vector<uint8_t>>> m_deqStates;
+		};
+
+		// Lado del cliente: reconstruye los estados que llegan y guarda los recientes para los siguientes deltas.
+		class snapshot_receiver {
+		public:
+			// Reemplaza el cuerpo recibido por el estado completo seguido de su número (uint32_t), igual que un dato
+			// empujado al mensaje, así la aplicación lo saca con msg >> nTick y lo que queda es el estado.
+				// Retorna el número del estado, o cero si no se pudo reconstruir (base desconocida, mal formado o más
+				// grande que nMaxSize), en cuyo caso el mensaje se debe descartar.
+			template <typename Buffer>
+			uint32_t Apply(Buffer& vBody, size_t nHistory, size_t nMaxSize) {
+				snapshot_trailer trailer;
+				if (!trailer.Pop(vBody) || trailer.nTick == 0 || trailer.nSize > nMaxSize) {
+					return 0;
+				}
+
+				// La historia se crea con el primer estado, así las conexiones que nunca reciben estados no la pagan.
+				if (!this->m_pHistory) {
+					this->m_pHistory = std::make_unique<snapshot_history>();
+				}
+
+				std::vector<uint8_t> vState = this->m_pHistory->Recycle(nHistory);
+				if (trailer.kind == snapshot_kind::full) {
+					if (vBody.size() != trailer.nSize) {
+						return 0;
+					}
+					vState.assign(vBody.begin(), vBody.end());
+				}
+				else if (trailer.kind == snapshot_kind::delta) {
+					const std::vector<uint8_t>* pBase = this->m_pHistory->Find(trailer.nBaseTick);
+					if (!pBase) {
+						return 0;
+					}
+
+					vState.resize(trailer.nSize);
+					if (!delta::Decode(vBody.data(), vBody.size(), pBase->data(), pBase->size(), vState.data(), vState.size())) {
+						return 0;
+					}
+				}
+				else {
+					return 0;
+				}
+
+				// El cuerpo queda con el estado y su número, y el estado se guarda para los siguientes deltas.
+				vBody.resize(vState.size() + sizeof(uint32_t));
+				std::memcpy(vBody.data(), vState.data(), vState.size());
+				StoreWire(vBody.data() + vState.size(), trailer.nTick);
+				this->m_pHistory->Push(trailer.nTick, std::move(vState), nHistory);
+
+				return trailer.nTick;
+			}
+
+		protected:
+			std::unique_ptr<snapshot_history> m_pHistory;
+		};
+
+		// Contadores de los estados enviados por el servidor (ver server_interface::BroadcastSnapshot()).
+		struct snapshot_stats {
+			// Estados publicados, y envíos a los clientes completos y como delta.
+			uint64_t nSnapshots = 0;
+			uint64_t nFull = 0;
+			uint64_t nDeltas = 0;
+
+			// Bytes que se habrían enviado mandando siempre el estado completo, y los que se enviaron (sin encabezados).
+			uint64_t nStateBytes = 0;
+			uint64_t nSentBytes = 0;
+
+			// Tiempo de CPU por cliente para armar su envío, incluye a los que reutilizan un delta que ya se calculo.
+			histogram_snapshot encode;
+
+			// Proporción de bytes enviados contra los que se habrían enviado completos.
+			double Ratio() const {
+				return this->nStateBytes > 0 ? double(this->nSentBytes) / double(this->nStateBytes) : 1.0;
+			}
+		};
+
+	}
+}
\ No newline at end of file
@@ -0,0 +1,145 @@
+#pragma once
+
+#include "net_common.h"
+#include "net_connection.h"
+
+#include <unordered_map>
+
+namespace cap {
+	namespace net {
+
+		// Registro de suscripciones por tema (salas, partidas, símbolos, etc.).
+			// Cada tema guarda sus miembros en un arreglo continuo para recorrerlos rápido al publicar,
+			// y un índice por ID de conexión para poder suscribir y desuscribir en tiempo constante.
+			// Nota: no es seguro entre procesos, se espera que se use desde el mismo proceso que llama a Update().
+		template <typename T>
+		class topic_registry {
+		private:
+
+			// Datos de un tema.
+			struct topic {
+				// Miembros del tema, sin huecos para que recorrerlos sea lo más rápido posible.
+				std::vector<std::shared_ptr<connection<T>>> vMembers;
+
+				// Posición de cada miembro dentro del arreglo, usando su ID como llave.
+				std::unordered_map<uint32_t, size_t> mapIndex;
+			};
+
+		public:
+
+			// Suscribe a la conexión al tema, si el tema no existe se crea.
+				// Retorna falso si ya estaba suscrita.
+			bool Subscribe(const std::string& sTopic, std::shared_ptr<connection<T>> client) {
+				if (!client) {
+					return false;
+				}
+
+				topic& t = this->m_mapTopics[sTopic];
+				uint32_t nID = client->GetID();
+
+				// Si ya esta suscrita no hacemos nada.
+				if (t.mapIndex.count(nID) > 0) {
+					return false;
+				}
+
+				// Lo agregamos al final del arreglo y guardamos su posición.
+				t.mapIndex.emplace(nID, t.vMembers.size());
+				t.vMembers.push_back(std::move(client));
+
+				// Y anotamos el tema en la lista de la conexión, para poder limpiarla cuando se desconecte.
+				this->m_mapSubscriptions[nID].push_back(sTopic);
+				return true;
+			}
+
+			// Desuscribe a la conexión del tema, retorna falso si no estaba suscrita.
+			bool Unsubscribe(const std::string& sTopic, uint32_t nID) {
+				if (!this->RemoveMember(sTopic, nID)) {
+					return false;
+				}
+
+				// Quitamos el tema de la lista de la conexión.
+				auto itSubs = this->m_mapSubscriptions.find(nID);
+				if (itSubs != this->m_mapSubscriptions.end()) {
+					std::vector<std::string>& vTopics = itSubs->second;
+					vTopics.erase(std::remove(vTopics.begin(), vTopics.end(), sTopic), vTopics.end());
+
+					if (vTopics.empty()) {
+						this->m_mapSubscriptions.erase(itSubs);
+					}
+				}
+
+				return true;
+			}
+
+			// Desuscribe a la conexión de todos sus temas, se usa cuando la conexión se va.
+			void UnsubscribeAll(uint32_t nID) {
+				auto itSubs = this->m_mapSubscriptions.find(nID);
+				if (itSubs == this->m_mapSubscriptions.end()) {
+					return;
+				}
+
+				for (const std::string& sTopic : itSubs->second) {
+					this->RemoveMember(sTopic, nID);
+				}
+
+				this->m_mapSubscriptions.erase(itSubs);
+			}
+
+			// Retorna los miembros de un tema, o un arreglo vacío si el tema no existe.
+			const std::vector<std::shared_ptr<connection<T>>>& Members(const std::string& sTopic) const {
+				static const std::vector<std::shared_ptr<connection<T>>> vEmpty;
+
+				auto it = this->m_mapTopics.find(sTopic);
+				return it != this->m_mapTopics.end() ? it->second.vMembers : vEmpty;
+			}
+
+			// Retorna la cantidad de temas con al menos un miembro.
+			size_t TopicCount() const {
+				return this->m_mapTopics.size();
+			}
+
+		private:
+
+			// Quita al miembro del arreglo del tema, moviendo al ultimo miembro a su lugar para no dejar huecos.
+			bool RemoveMember(const std::string& sTopic, uint32_t nID) {
+				auto itTopic = this->m_mapTopics.find(sTopic);
+				if (itTopic == this->m_mapTopics.end()) {
+					return false;
+				}
+
+				topic& t = itTopic->second;
+				auto itIndex = t.mapIndex.find(nID);
+				if (itIndex == t.mapIndex.end()) {
+					return false;
+				}
+
+				// Movemos al ultimo a la posición que queda libre y actualizamos su índice.
+				size_t nPos = itIndex->second;
+				t.mapIndex.erase(itIndex);
+
+				if (nPos != t.vMembers.size() - 1) {
+					t.vMembers[nPos] = std::move(t.vMembers.back());
+					t.mapIndex[t.vMembers[nPos]->GetID()] = nPos;
+				}
+				t.vMembers.pop_back();
+
+				// Si el tema se quedo sin miembros, lo eliminamos.
+				if (t.vMembers.empty()) {
+					this->m_mapTopics.erase(itTopic);
+				}
+
+				return true;
+			}
+
+		protected:
+
+			// Temas por nombre.
+			std::unordered_map<std::string, topic> m_mapTopics;
+
+			// Temas a los que esta suscrita cada conexión, usando su ID como llave.
+			std::unordered_map<uint32_t, std::vector<std::string>> m_mapSubscriptions;
+
+		};
+
+	}
+}
\ No newline at end of file
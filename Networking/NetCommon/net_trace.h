@@ -0,0 +1,238 @@
+#pragma once
+
+#include "net_common.h"
+
+#include <atomic>
+#include <fstream>
+
+namespace cap {
+	namespace net {
+
+		// Etapas del recorrido de un mensaje que se pueden anotar.
+		enum class trace_stage : uint8_t {
+			// Entrantes: se termino de leer del socket, se agrego a la cola de entrada, se saco de la cola,
+			// y empezó y termino su manejador (OnMessage).
+			read_complete,
+			enqueue,
+			dequeue,
+			handler_start,
+			handler_end,
+
+			// Salientes: se llamo a Send() y se termino de escribir en el socket.
+			send_enqueue,
+			write_complete
+		};
+
+		// Política de rastreo por tipo de mensaje, por defecto el rastreo esta apagado y no genera código.
+			// Para encenderlo se especializa para el tipo de mensajes de la aplicación:
+			//   namespace cap { namespace net { template <> struct trace_policy<CustomMsgTypes> : trace_enabled {}; } }
+			// Debe declararse antes de usar las clases de cap::net con ese tipo.
+		template <typename T>
+		struct trace_policy {
+			static constexpr bool enabled = false;
+		};
+
+		// Base para encender el rastreo en una especialización de trace_policy.
+		struct trace_enabled {
+			static constexpr bool enabled = true;
+		};
+
+		// Evento anotado, se guarda en binario tal cual y solo se convierte a texto al exportar.
+		struct trace_event {
+			// Momento del evento en nanosegundos del reloj steady_clock.
+			int64_t nTime = 0;
+
+			// Identificador del mensaje: el ID de la conexión en los 32 bits altos y su número de mensaje en los bajos.
+				// Los entrantes y los salientes se cuentan por separado, la etapa dice de cual se trata.
+			uint64_t nMessageId = 0;
+
+			trace_stage stage = trace_stage::read_complete;
+		};
+
+		// Buffer circular de eventos de un proceso.
+			// Solo escribe el proceso dueño, sin bloqueos; si se llena se sobrescriben los eventos más viejos.
+		class trace_buffer {
+		public:
+			// Cantidad de eventos que caben en cada buffer.
+			static constexpr size_t nCapacity = size_t(1) << 16;
+
+			trace_buffer(uint32_t nThread) : m_nThread(nThread), m_vEvents(nCapacity) {}
+
+			// Agrega un evento, solo lo debe llamar el proceso dueño.
+			void Push(const trace_event& event) {
+				uint64_t nHead = this->m_nHead.load(std::memory_order_relaxed);
+				this->m_vEvents[nHead % nCapacity] = event;
+				this->m_nHead.store(nHead + 1, std::memory_order_release);
+			}
+
+			// Copia los eventos guardados, del más viejo al más nuevo.
+				// Si el dueño sigue escribiendo mientras se copia, los eventos más viejos pueden salir revueltos,
+				// así que conviene exportar cuando el programa este tranquilo.
+			std::vector<trace_event> Copy() const {
+				uint64_t nHead = this->m_nHead.load(std::memory_order_acquire);
+				uint64_t nFirst = nHead > nCapacity ? nHead - nCapacity : 0;
+
+				std::vector<trace_event> vEvents;
+				vEvents.reserve(size_t(nHead - nFirst));
+				for (uint64_t i = nFirst; i < nHead; i++) {
+					vEvents.push_back(this->m_vEvents[i % nCapacity]);
+				}
+				return vEvents;
+			}
+
+			// Olvida los eventos guardados.
+				// Como el dueño escribe sin bloqueos, solo se debe llamar cuando no este escribiendo.
+			void Clear() {
+				this->m_nHead.store(0, std::memory_order_release);
+			}
+
+			// Número del proceso dueño, en el orden en el que se crearon los buffers.
+			uint32_t Thread() const {
+				return this->m_nThread;
+			}
+
+		protected:
+			uint32_t m_nThread = 0;
+			std::vector<trace_event> m_vEvents;
+			std::atomic<uint64_t> m_nHead{ 0 };
+		};
+
+		// Registro de los buffers de todos los procesos, y exportación a formato de Chrome (chrome://tracing o Perfetto).
+			// Los buffers se guardan compartidos, así sus eventos se pueden exportar aunque su proceso ya haya terminado.
+		class tracer {
+		public:
+			// Retorna el buffer del proceso actual, la primera vez se crea y se registra.
+			static trace_buffer& Local() {
+				thread_local std::shared_ptr<trace_buffer> pLocal = Register();
+				return *pLocal;
+			}
+
+			// Anota un evento en el buffer del proceso actual.
+			static void Record(trace_stage stage, uint64_t nMessageId, std::chrono::steady_clock::time_point tp) {
+				trace_event event;
+				event.nTime = std::chrono::duration_cast<std::chrono::nanoseconds>(tp.time_since_epoch()).count();
+				event.nMessageId = nMessageId;
+				event.stage = stage;
+				Local().Push(event);
+			}
+
+			// Olvida los eventos de todos los procesos.
+			static void Clear() {
+				std::scoped_lock lock(Mutex());
+				for (auto& pBuffer : Buffers()) {
+					pBuffer->Clear();
+				}
+			}
+
+			// Escribe todos los eventos en el formato JSON de Chrome.
+				// Cada mensaje es un evento asíncrono que empieza en su primera etapa y termina en la ultima, con las
+				// etapas intermedias como marcas, así se ve en una sola fila cuanto tardo cada parte de su recorrido.
+			static void ExportChromeTrace(std::ostream& os) {
+				std::vector<std::shared_ptr<trace_buffer>> vBuffers;
+				{
+					std::scoped_lock lock(Mutex());
+					vBuffers = Buffers();
+				}
+
+				os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+
+				bool bFirst = true;
+				for (auto& pBuffer : vBuffers) {
+					for (const trace_event& event : pBuffer->Copy()) {
+						// Las etapas iniciales abren el evento, las finales lo cierran y las demás son marcas.
+						char cPhase = 'n';
+						if (event.stage == trace_stage::read_complete || event.stage == trace_stage::send_enqueue) {
+							cPhase = 'b';
+						}
+						else if (event.stage == trace_stage::handler_end || event.stage == trace_stage::write_complete) {
+							cPhase = 'e';
+						}
+
+						// Los entrantes y salientes se separan por categoría, ya que sus números de mensaje se pueden repetir.
+						bool bOutgoing = event.stage == trace_stage::send_enqueue || event.stage == trace_stage::write_complete;
+
+						char sEvent[256];
+						snprintf(sEvent, sizeof(sEvent),
+							"%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"id\":\"0x%" PRIx64 "\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,"
+							"\"args\":{\"connection\":%u,\"message\":%u,\"stage\":\"%s\"}}",
+							bFirst ? "" : ",\n", bOutgoing ? "send" : "receive", bOutgoing ? "out" : "in", cPhase, event.nMessageId,
+							pBuffer->Thread(), double(event.nTime) / 1e3,
+							uint32_t(event.nMessageId >> 32), uint32_t(event.nMessageId), StageName(event.stage));
+						os << sEvent;
+						bFirst = false;
+					}
+				}
+
+				os << "]}\n";
+			}
+
+			// Igual que la anterior, pero escribe a un archivo, retorna falso si no se pudo abrir.
+			static bool ExportChromeTrace(const std::string& sPath) {
+				std::ofstream file(sPath);
+				if (!file) {
+					return false;
+				}
+
+				ExportChromeTrace(file);
+				return true;
+			}
+
+			// Retorna el nombre de la etapa.
+			static const char* StageName(trace_stage stage) {
+				switch (stage) {
+				case trace_stage::read_complete: return "read_complete";
+				case trace_stage::enqueue: return "enqueue";
+				case trace_stage::dequeue: return "dequeue";
+				case trace_stage::handler_start: return "handler_start";
+				case trace_stage::handler_end: return "handler_end";
+				case trace_stage::send_enqueue: return "send_enqueue";
+				case trace_stage::write_complete: return "write_complete";
+				}
+				return "unknown";
+			}
+
+		private:
+
+			// Crea el buffer de un proceso y lo agrega al registro.
+			static std::shared_ptr<trace_buffer> Register() {
+				std::scoped_lock lock(Mutex());
+				auto pBuffer = std::make_shared<trace_buffer>(uint32_t(Buffers().size()));
+				Buffers().push_back(pBuffer);
+				return pBuffer;
+			}
+
+			static std::mutex& Mutex() {
+				static std::mutex mux;
+				return mux;
+			}
+
+			static std::vector<std::shared_ptr<trace_buffer>>& Buffers() {
+				static std::vector<std::shared_ptr<trace_buffer>> vBuffers;
+				return vBuffers;
+			}
+		};
+
+		// Anota una etapa de un mensaje si el rastreo esta encendido para el tipo T.
+			// Si esta apagado, la función queda vacía y el compilador la elimina, incluyendo la lectura del reloj.
+		template <typename T>
+		inline void Trace(trace_stage stage, uint64_t nMessageId) {
+			if constexpr (trace_policy<T>::enabled) {
+				tracer::Record(stage, nMessageId, std::chrono::steady_clock::now());
+			}
+		}
+
+		// Igual que la anterior, pero con un momento que ya se había medido.
+		template <typename T>
+		inline void Trace(trace_stage stage, uint64_t nMessageId, std::chrono::steady_clock::time_point tp) {
+			if constexpr (trace_policy<T>::enabled) {
+				tracer::Record(stage, nMessageId, tp);
+			}
+		}
+
+		// Arma el identificador de un mensaje con el ID de la conexión y su número de mensaje.
+		inline uint64_t TraceId(uint32_t nConnection, uint64_t nMessage) {
+			return (uint64_t(nConnection) << 32) | uint32_t(nMessage);
+		}
+
+	}
+}
\ No newline at end of file
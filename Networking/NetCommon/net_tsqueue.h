@@ -2,14 +2,14 @@
 #include "net_common.h"
 
 // Debido a que es un namespace, si se vuelve a llamar en otro pragama,
-// lo que sucede es que en sus mtodos se agregan haciendo que tenga an ms elementos.
-	// En esta librera se usara para poder procesar seguramente los subprocesos hechos por los clientes
+// lo que sucede es que en sus métodos se agregan haciendo que tenga aún más elementos.
+	// En esta librería se usara para poder procesar seguramente los subprocesos hechos por los clientes
 	// en el servidor.
 
 namespace cap {
 	namespace net {
 
-		// Est clase se encargara de procesar la cola de subprocesos hechos de manera segura.
+		// Está clase se encargara de procesar la cola de subprocesos hechos de manera segura.
 		template<typename T>
 		class tsqueue {
 		public:
@@ -17,58 +17,74 @@ namespace cap {
 			tsqueue(const tsqueue<T>&) = delete;
 			virtual ~tsqueue() { this->clear(); }
 
-			// Retorna y mantiene el tem al frente de la cola de subprocesos.
+			// Retorna y mantiene el ítem al frente de la cola de subprocesos.
 			const T& front() {
 				// Protege a la variable para evitar problemas en caso de que se este ejecutando otra cosa.
 				std::scoped_lock lock(muxQueue);
 				return this->deqQueue.front();
 			}
 
-			// Retorna y mantiene el tem en la parte trasera de la cola de subprocesos.
+			// Retorna y mantiene el ítem en la parte trasera de la cola de subprocesos.
 			const T& back() {
 				// Protege a la variable para evitar problemas en caso de que se este ejecutando otra cosa.
 				std::scoped_lock lock(muxQueue);
 				return this->deqQueue.back();
 			}
 
-			// Agrega un tem a la parte trasera de la cola de subprocesos.
+			// Agrega un ítem a la parte trasera de la cola de subprocesos.
 			void push_back(const T& item) {
-				// Protege a la variable para evitar problemas en caso de que se este ejecutando otra cosa.
-				std::scoped_lock lock(muxQueue);
+				{
+					// Protege a la variable para evitar problemas en caso de que se este ejecutando otra cosa.
+					std::scoped_lock lock(muxQueue);
 
-				// Llamaremos a la lista dinmica y agregaremos el tem a la parte trasera usando la funcin move.
-				this->deqQueue.emplace_back(std::move(item));
+					// Llamaremos a la lista dinámica y agregaremos el ítem a la parte trasera usando la función move.
+					this->deqQueue.emplace_back(std::move(item));
+
+					// Y si alguien pidió que le avisáramos, también le avisamos.
+					if (this->fnNotify) {
+						this->fnNotify();
+					}
+				}
 
 				// Bloqueamos en caso de que haya subprocesos o procesos para evitar errores de supercarga.
+					// Se hace después de soltar la cola, ya que wait() bloquea en el orden contrario.
 				std::unique_lock<std::mutex> ul(muxBlocking);
 
 				// Notificamos a la variable que se encarga de bloquear que lo haga para salir del modo de espera.
 				this->cvBlocking.notify_one();
 			}
 
-			// Agrega un tem a la parte trasera de la cola de subprocesos.
+			// Agrega un ítem a la parte trasera de la cola de subprocesos.
 			void push_front(const T& item) {
-				// Protege a la variable para evitar problemas en caso de que se este ejecutando otra cosa.
-				std::scoped_lock lock(muxQueue);
+				{
+					// Protege a la variable para evitar problemas en caso de que se este ejecutando otra cosa.
+					std::scoped_lock lock(muxQueue);
+
+					// Llamaremos a la lista dinámica y agregaremos el ítem a la parte frontera usando la función move.
+					this->deqQueue.emplace_front(std::move(item));
 
-				// Llamaremos a la lista dinmica y agregaremos el tem a la parte frontera usando la funcin move.
-				this->deqQueue.emplace_front(std::move(item));
+					// Y si alguien pidió que le avisáramos, también le avisamos.
+					if (this->fnNotify) {
+						this->fnNotify();
+					}
+				}
 
 				// Bloqueamos en caso de que haya subprocesos o procesos para evitar errores de supercarga.
+					// Se hace después de soltar la cola, ya que wait() bloquea en el orden contrario.
 				std::unique_lock<std::mutex> ul(muxBlocking);
 
 				// Notificamos a la variable que se encarga de bloquear que lo haga para salir del modo de espera.
 				this->cvBlocking.notify_one();
 			}
 
-			// Retorna verdadero si la cola de subprocesos esta vaca.
+			// Retorna verdadero si la cola de subprocesos esta vacía.
 			bool empty() {
 				// Protege a la variable para evitar problemas en caso de que se este ejecutando otra cosa.
 				std::scoped_lock lock(muxQueue);
 				return deqQueue.empty();
 			}
 
-			// Retorna el numero de tems que tiene la cola de subprocesos.
+			// Retorna el numero de ítems que tiene la cola de subprocesos.
 			size_t count() {
 				// Protege a la variable para evitar problemas en caso de que se este ejecutando otra cosa.
 				std::scoped_lock lock(muxQueue);
@@ -82,57 +98,73 @@ namespace cap {
 				this->deqQueue.clear();
 			}
 
-			// Remueve y retorna el tem de la parte frontera de la cola de subprocesos.
+			// Remueve y retorna el ítem de la parte frontera de la cola de subprocesos.
 			T pop_front() {
 				// Protege a la variable para evitar problemas en caso de que se este ejecutando otra cosa.
 				std::scoped_lock lock(muxQueue);
 
-				// Tomamos la parte frontera de la cola de subprocesos con la funcin move, para as evitar problemas en caso
-				// de que se cambie o se mueva el tem.
+				// Tomamos la parte frontera de la cola de subprocesos con la función move, para así evitar problemas en caso
+				// de que se cambie o se mueva el ítem.
 				auto t = std::move(deqQueue.front());
 
-				// Hacemos que se elimine el tem frontal.
+				// Hacemos que se elimine el ítem frontal.
 				this->deqQueue.pop_front();
 
 				return t;
 			}
 
-			// Remueve y retorna el tem de la parte trasera de la cola de subprocesos.
+			// Remueve y retorna el ítem de la parte trasera de la cola de subprocesos.
 			T pop_back() {
 				// Protege a la variable para evitar problemas en caso de que se este ejecutando otra cosa.
 				std::scoped_lock lock(muxQueue);
 
-				// Tomamos la parte trasera de la cola de subprocesos con la funcin move, para as evitar problemas en caso
-				// de que se cambie o se mueva el tem.
+				// Tomamos la parte trasera de la cola de subprocesos con la función move, para así evitar problemas en caso
+				// de que se cambie o se mueva el ítem.
 				auto t = std::move(deqQueue.back());
 
-				// Hacemos que se elimine el tem trasera.
+				// Hacemos que se elimine el ítem trasera.
 				this->deqQueue.pop_back();
 
 				return t;
 			}
 
+			// Asigna una función que se llamara cada que se agregue un ítem.
+				// Sirve para despertar a quien espere ítems sin tener que bloquear un proceso (por ejemplo, una corrutina).
+				// La función se llama con la cola bloqueada, así que no debe usar la cola.
+			void SetNotify(std::function<void()> fnNotify) {
+				std::scoped_lock lock(muxQueue);
+				this->fnNotify = std::move(fnNotify);
+			}
+
 			// Hace que los procesos sean protegidos hasta que deje de estar vacio la cola de subprocesos.
 			void wait() {
-				// Mientras la cola de subprocesos este vaca, el server descansara hasta que tenga nuevos procesos.
-				while (this->empty()) {
-					// Bloqueamos para evitar problemas.
-					std::unique_lock<std::mutex> ul(muxBlocking);
+				// Bloqueamos antes de revisar si esta vacía, así un ítem que llegue entre la revisión y la espera
+				// no se pierde (quien agrega también bloquea antes de notificar).
+				std::unique_lock<std::mutex> ul(muxBlocking);
 
+				// Mientras la cola de subprocesos este vacía, el server descansara hasta que tenga nuevos procesos.
+				while (this->empty()) {
 					// Y indicamos a la variable que se quede a la espera.
 					this->cvBlocking.wait(ul);
 				}
 			}
 
+			// Igual que wait(), pero se rinde después del tiempo dado. Retorna falso si la cola sigue vacía.
+			template <typename Rep, typename Period>
+			bool wait_for(std::chrono::duration<Rep, Period> timeout) {
+				std::unique_lock<std::mutex> ul(muxBlocking);
+				return this->cvBlocking.wait_for(ul, timeout, [this]() { return !this->empty(); });
+			}
+
 		private:
 
 		protected:
 			
-			// Variable que nos servir en caso de que el tsqueue necesito permisos exclusivos cuando llegue a cierto punto del cdigo.
-			// Y tambin nos permite bloquear ciertos objetos.
+			// Variable que nos servirá en caso de que el tsqueue necesito permisos exclusivos cuando llegue a cierto punto del código.
+			// Y también nos permite bloquear ciertos objetos.
 			std::mutex muxQueue;
 
-			// Variable que nos permitir tener una lista dinmica que puede crecer hacia delante o hacia atrs que nos ayudara a manipular
+			// Variable que nos permitirá tener una lista dinámica que puede crecer hacia delante o hacia atrás que nos ayudara a manipular
 			// los subprocesos.
 			std::deque<T> deqQueue;
 
@@ -142,6 +174,9 @@ namespace cap {
 			// Variable que nos servira en caso de que la variable cvBlocking necesite permisos.
 			std::mutex muxBlocking;
 
+			// Función que se llama cada que se agrega un ítem, si fue asignada.
+			std::function<void()> fnNotify;
+
 		};
 	}
 }
\ No newline at end of file
@@ -0,0 +1,225 @@
+#pragma once
+
+#include "net_common.h"
+
+#include <cstring>
+#include <type_traits>
+
+// SSSE3 tiene el shuffle de bytes (pshufb) con el que se voltean 16 bytes de una vez. MSVC no define __SSSE3__,
+// así que ahí se usa cuando se compila con AVX (que lo incluye). Sin el, con SSE2 se hace con shuffles de 16 bits y corrimientos.
+#if defined(__SSSE3__) || defined(__AVX__)
+#include <tmmintrin.h>
+#define CAP_NET_SSSE3 1
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#if !defined(CAP_NET_SSE2)
+#define CAP_NET_SSE2 1
+#endif
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define CAP_NET_NEON 1
+#endif
+
+#if defined(_MSC_VER)
+#include <stdlib.h>
+#endif
+
+// Orden de los bytes del procesador. Windows solo corre en procesadores little endian.
+#if defined(_WIN32) || !defined(__BYTE_ORDER__) || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define CAP_NET_LITTLE_ENDIAN 1
+#endif
+
+// Formato de los mensajes en la red, se elige al compilar y ambos lados deben usar el mismo:
+	// Sin definir nada (el nativo, el más rápido), el encabezado y los datos van tal cual están en memoria, con el orden de
+	// bytes y el relleno del procesador, así que solo se pueden comunicar procesadores y compiladores iguales.
+	// Con CAP_NET_PORTABLE_WIRE el encabezado va empacado en 12 bytes little endian (ID, tamaño y banderas de 32 bits),
+	// y los números que se empujan a los mensajes (y los de la librería: validación, estados, compresión) van en
+	// little endian. En procesadores little endian es el mismo formato que el nativo con IDs de 32 bits, sin costo.
+namespace cap {
+	namespace net {
+
+#if defined(CAP_NET_PORTABLE_WIRE)
+		constexpr bool bPortableWire = true;
+#else
+		constexpr bool bPortableWire = false;
+#endif
+
+#if defined(CAP_NET_LITTLE_ENDIAN)
+		constexpr bool bLittleEndianHost = true;
+#else
+		constexpr bool bLittleEndianHost = false;
+#endif
+
+		// Indica si los números se voltean al enviarlos, solo en el formato portable en procesadores big endian.
+		constexpr bool bSwapWire = bPortableWire && !bLittleEndianHost;
+
+		namespace bswap {
+			inline uint16_t Swap(uint16_t n) {
+				return uint16_t((n >> 8) | (n << 8));
+			}
+
+			inline uint32_t Swap(uint32_t n) {
+#if defined(_MSC_VER)
+				return _byteswap_ulong(n);
+#else
+				return __builtin_bswap32(n);
+#endif
+			}
+
+			inline uint64_t Swap(uint64_t n) {
+#if defined(_MSC_VER)
+				return _byteswap_uint64(n);
+#else
+				return __builtin_bswap64(n);
+#endif
+			}
+
+			// Voltea los bytes de cualquier número (entero, flotante o enum) de 1, 2, 4 u 8 bytes.
+			template <typename DataType>
+			DataType SwapValue(DataType value) {
+				static_assert(std::is_arithmetic<DataType>::value || std::is_enum<DataType>::value, "Solo se voltean números");
+				if constexpr (sizeof(DataType) == 1) {
+					return value;
+				}
+				else {
+					using bits = std::conditional_t<sizeof(DataType) == 2, uint16_t, std::conditional_t<sizeof(DataType) == 4, uint32_t, uint64_t>>;
+					static_assert(sizeof(bits) == sizeof(DataType), "Tamaño de número no soportado");
+					bits n;
+					std::memcpy(&n, &value, sizeof(n));
+					n = Swap(n);
+					std::memcpy(&value, &n, sizeof(n));
+					return value;
+				}
+			}
+
+			// Copia n elementos de nSize bytes (2, 4 u 8) de pSrc a pDst volteando los bytes de cada uno.
+				// Con SSSE3, SSE2 o NEON se voltean de 16 en 16 bytes, el resto (y sin SIMD) de uno en uno.
+				// pSrc y pDst pueden ser el mismo buffer, pero no encimarse de otra forma.
+			inline void SwapCopy(uint8_t* pDst, const uint8_t* pSrc, size_t n, size_t nSize) {
+				size_t nBytes = n * nSize;
+				size_t i = 0;
+#if defined(CAP_NET_SSSE3)
+				// La mascara dice de que byte del bloque sale cada byte del resultado.
+				__m128i mask;
+				if (nSize == 2) {
+					mask = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+				}
+				else if (nSize == 4) {
+					mask = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+				}
+				else {
+					mask = _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+				}
+				for (; i + 16 <= nBytes; i += 16) {
+					__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSrc + i));
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(pDst + i), _mm_shuffle_epi8(v, mask));
+				}
+#elif defined(CAP_NET_SSE2)
+				// Primero se acomodan las palabras de 16 bits de cada elemento en orden inverso, y después se voltean
+					// los dos bytes de cada palabra.
+				for (; i + 16 <= nBytes; i += 16) {
+					__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSrc + i));
+					if (nSize == 4) {
+						v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+					}
+					else if (nSize == 8) {
+						v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3)), _MM_SHUFFLE(0, 1, 2, 3));
+					}
+					v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(pDst + i), v);
+				}
+#elif defined(CAP_NET_NEON)
+				for (; i + 16 <= nBytes; i += 16) {
+					uint8x16_t v = vld1q_u8(pSrc + i);
+					v = nSize == 2 ? vrev16q_u8(v) : nSize == 4 ? vrev32q_u8(v) : vrev64q_u8(v);
+					vst1q_u8(pDst + i, v);
+				}
+#endif
+				for (; i < nBytes; i += nSize) {
+					if (nSize == 2) {
+						uint16_t v;
+						std::memcpy(&v, pSrc + i, sizeof(v));
+						v = Swap(v);
+						std::memcpy(pDst + i, &v, sizeof(v));
+					}
+					else if (nSize == 4) {
+						uint32_t v;
+						std::memcpy(&v, pSrc + i, sizeof(v));
+						v = Swap(v);
+						std::memcpy(pDst + i, &v, sizeof(v));
+					}
+					else {
+						uint64_t v;
+						std::memcpy(&v, pSrc + i, sizeof(v));
+						v = Swap(v);
+						std::memcpy(pDst + i, &v, sizeof(v));
+					}
+				}
+			}
+		}
+
+		// Convierte un número del orden del procesador al de la red y de regreso (es la misma operación).
+			// Solo voltea en el formato portable en procesadores big endian, si no regresa el mismo valor.
+		template <typename DataType>
+		DataType ToWire(DataType value) {
+			if constexpr (bSwapWire) {
+				return bswap::SwapValue(value);
+			}
+			else {
+				return value;
+			}
+		}
+
+		template <typename DataType>
+		DataType FromWire(DataType value) {
+			return ToWire(value);
+		}
+
+		// Escribe y lee un número en el orden de la red en un buffer de bytes, sin importar la alineación.
+		template <typename DataType>
+		void StoreWire(uint8_t* p, DataType value) {
+			value = ToWire(value);
+			std::memcpy(p, &value, sizeof(value));
+		}
+
+		template <typename DataType>
+		DataType LoadWire(const uint8_t* p) {
+			DataType value;
+			std::memcpy(&value, p, sizeof(value));
+			return FromWire(value);
+		}
+
+		// Copia n números al orden de la red (o de regreso), de una vez para todo el arreglo.
+			// Sin volteo es un memcpy, con volteo usa bswap::SwapCopy().
+		template <typename DataType>
+		void CopyWire(uint8_t* pDst, const DataType* pSrc, size_t n) {
+			static_assert(std::is_arithmetic<DataType>::value || std::is_enum<DataType>::value, "Solo se convierten arreglos de números");
+			if (n == 0) {
+				return;
+			}
+			if constexpr (bSwapWire && sizeof(DataType) > 1) {
+				bswap::SwapCopy(pDst, reinterpret_cast<const uint8_t*>(pSrc), n, sizeof(DataType));
+			}
+			else {
+				std::memcpy(pDst, pSrc, n * sizeof(DataType));
+			}
+		}
+
+		template <typename DataType>
+		void CopyFromWire(DataType* pDst, const uint8_t* pSrc, size_t n) {
+			static_assert(std::is_arithmetic<DataType>::value || std::is_enum<DataType>::value, "Solo se convierten arreglos de números");
+			if (n == 0) {
+				return;
+			}
+			if constexpr (bSwapWire && sizeof(DataType) > 1) {
+				bswap::SwapCopy(reinterpret_cast<uint8_t*>(pDst), pSrc, n, sizeof(DataType));
+			}
+			else {
+				std::memcpy(pDst, pSrc, n * sizeof(DataType));
+			}
+		}
+
+	}
+}
\ No newline at end of file
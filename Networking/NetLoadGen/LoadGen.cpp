@@ -0,0 +1,450 @@
+/*********************************************************************
+* Generador de carga para servidores hechos con CapNet.              *
+* Abre N clientes repartidos en unos cuantos procesos que comparten  *
+* contextos de asio, manda pings a una tasa fija y mide el tiempo de *
+* ida y vuelta corrigiendo la omisión coordinada.                    *
+*                                                                    *
+* Funciona contra NetServer (mensaje ServerPing) o contra su propio  *
+* servidor de eco con --server. No necesita teclado ni ventana.      *
+*                                                                    *
+* En Linux se puede compilar con:                                    *
+*   g++ -std=c++17 -O2 -I../asio-1.18.0/include -I../NetCommon       *
+*       LoadGen.cpp -o NetLoadGen -pthread                           *
+*********************************************************************/
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cap_net.h>
+
+// Mismos tipos de mensajes que NetServer, así se le puede medir directamente.
+enum class CustomMsgTypes : uint32_t {
+	ServerAccept,
+	ServerDeny,
+	ServerPing,
+	MessageAll,
+	ServerMessage,
+};
+
+using load_message = cap::net::message<CustomMsgTypes>;
+using load_clock = std::chrono::steady_clock;
+
+// Configuración de la prueba, se llena con los argumentos.
+struct loadgen_config {
+	std::string sHost = "127.0.0.1";
+	uint16_t nPort = 60000;
+
+	// Conexiones a abrir y procesos de asio entre los que se reparten.
+	size_t nConnections = 100;
+	size_t nThreads = 2;
+
+	// Mensajes por segundo entre todas las conexiones.
+	double dRate = 10000.0;
+
+	// Segundos que dura la prueba, y cuantos de ellos al principio no se miden.
+	double dDuration = 10.0;
+	double dWarmup = 2.0;
+
+	// Tamaños de los cuerpos de los mensajes y su peso (que tan seguido se usa cada uno).
+	std::vector<std::pair<size_t, double>> vMix = { { 64, 1.0 } };
+
+	// Levanta un servidor de eco en el mismo programa en vez de usar uno externo.
+	bool bServer = false;
+
+	// Imprime el resultado como JSON en vez de texto, y/o lo guarda en un archivo.
+	bool bJson = false;
+	std::string sOutPath;
+};
+
+// Servidor de eco para --server, regresa cada ping tal cual.
+class EchoServer : public cap::net::server_interface<CustomMsgTypes> {
+public:
+	EchoServer(uint16_t nPort) : cap::net::server_interface<CustomMsgTypes>(nPort) {}
+
+	// Despierta al proceso que espera en Update() con un mensaje vacío sin conexión.
+	void Wake() {
+		this->m_qMessagesIn.push_back({});
+	}
+
+protected:
+	virtual bool OnClientConnect(std::shared_ptr<cap::net::connection<CustomMsgTypes>> client) override {
+		return true;
+	}
+
+	virtual void OnMessage(std::shared_ptr<cap::net::connection<CustomMsgTypes>> client, load_message& msg) override {
+		if (msg.header.id == CustomMsgTypes::ServerPing) {
+			client->Send(msg);
+		}
+	}
+};
+
+// Resultados que comparten todas las conexiones.
+	// Los histogramas ya están repartidos por proceso, y los contadores se suman con operaciones atómicas relajadas.
+struct loadgen_results {
+	// Desde el momento en el que se debió mandar el ping (corregido) y desde que realmente se mando (sin corregir).
+	cap::net::latency_histogram hCorrected;
+	cap::net::latency_histogram hUncorrected;
+
+	std::atomic<uint64_t> nSent{ 0 };
+	std::atomic<uint64_t> nReceived{ 0 };
+	std::atomic<uint64_t> nBytes{ 0 };
+};
+
+// Un cliente del generador y el estado de sus envíos.
+	// Todo lo que no es atómico solo se usa desde el proceso de su contexto.
+struct load_connection {
+	// El cliente usa el siguiente contexto del grupo, y el temporizador el mismo, así todo corre en un solo proceso.
+	load_connection(cap::net::io_pool& pool) : client(pool), timer(client.GetContext()) {
+	}
+
+	cap::net::client_interface<CustomMsgTypes> client;
+	asio::steady_timer timer;
+
+	// Momento en el que toca mandar el siguiente ping, y cada cuanto se manda uno.
+	load_clock::time_point tpNext;
+	load_clock::duration interval{};
+
+	// Pings en vuelo en orden: cuando se debió mandar y cuando se mando. TCP y el servidor respetan el orden,
+	// así que cada respuesta corresponde al primero de la lista.
+	std::deque<std::pair<load_clock::time_point, load_clock::time_point>> deqInFlight;
+
+	// Generador para elegir el tamaño de cada mensaje según la mezcla.
+	std::mt19937 rng;
+	std::discrete_distribution<size_t> mix;
+
+	// Indica si ya hay una revisión de la cola de entrada pendiente en el contexto.
+	bool bDrainPosted = false;
+};
+
+// Separa un texto por un carácter.
+std::vector<std::string> Split(const std::string& sText, char cSeparator) {
+	std::vector<std::string> vParts;
+	std::stringstream ss(sText);
+	std::string sPart;
+	while (std::getline(ss, sPart, cSeparator)) {
+		if (!sPart.empty()) {
+			vParts.push_back(sPart);
+		}
+	}
+	return vParts;
+}
+
+// Imprime como se usa el programa.
+void PrintUsage() {
+	printf("Uso: NetLoadGen [opciones]\n"
+		"  --host <ip>            servidor (127.0.0.1)\n"
+		"  --port <n>             puerto (60000)\n"
+		"  --connections <n>      conexiones a abrir (100)\n"
+		"  --threads <n>          procesos de asio compartidos por las conexiones (2)\n"
+		"  --rate <n>             mensajes por segundo en total (10000)\n"
+		"  --duration <s>         segundos de la prueba (10)\n"
+		"  --warmup <s>           segundos iniciales que no se miden (2)\n"
+		"  --mix <b:p,...>        tamaños del cuerpo y su peso, por ejemplo 64:70,1024:25,16384:5 (64:1)\n"
+		"  --server               levanta un servidor de eco propio en el puerto dado\n"
+		"  --json                 imprime el resultado como JSON\n"
+		"  --out <archivo>        guarda el resultado como JSON en el archivo\n");
+}
+
+// Lee los argumentos, retorna falso si alguno no es valido.
+bool ParseArgs(int argc, char** argv, loadgen_config& config) {
+	for (int i = 1; i < argc; i++) {
+		std::string sArg = argv[i];
+
+		// Las opciones sin valor.
+		if (sArg == "--server") { config.bServer = true; continue; }
+		if (sArg == "--json") { config.bJson = true; continue; }
+		if (sArg == "--help" || sArg == "-h") { return false; }
+
+		// Las demás necesitan un valor.
+		if (i + 1 >= argc) {
+			fprintf(stderr, "Falta el valor de %s\n", sArg.c_str());
+			return false;
+		}
+		std::string sValue = argv[++i];
+
+		try {
+			if (sArg == "--host") config.sHost = sValue;
+			else if (sArg == "--port") config.nPort = uint16_t(std::stoul(sValue));
+			else if (sArg == "--connections") config.nConnections = std::stoul(sValue);
+			else if (sArg == "--threads") config.nThreads = std::stoul(sValue);
+			else if (sArg == "--rate") config.dRate = std::stod(sValue);
+			else if (sArg == "--duration") config.dDuration = std::stod(sValue);
+			else if (sArg == "--warmup") config.dWarmup = std::stod(sValue);
+			else if (sArg == "--out") config.sOutPath = sValue;
+			else if (sArg == "--mix") {
+				config.vMix.clear();
+				for (const std::string& sEntry : Split(sValue, ',')) {
+					std::vector<std::string> vPair = Split(sEntry, ':');
+					config.vMix.emplace_back(std::stoul(vPair.at(0)), vPair.size() > 1 ? std::stod(vPair[1]) : 1.0);
+				}
+			}
+			else {
+				fprintf(stderr, "Opción desconocida: %s\n", sArg.c_str());
+				return false;
+			}
+		}
+		catch (std::exception&) {
+			fprintf(stderr, "Valor no valido para %s: %s\n", sArg.c_str(), sValue.c_str());
+			return false;
+		}
+	}
+
+	if (config.nConnections == 0 || config.nThreads == 0 || config.dRate <= 0.0 || config.vMix.empty()) {
+		fprintf(stderr, "Las conexiones, procesos, tasa y mezcla deben ser mayores a cero.\n");
+		return false;
+	}
+
+	return true;
+}
+
+// Saca las respuestas que llegaron a una conexión y anota sus latencias.
+void Drain(load_connection& lc, loadgen_results& results, load_clock::time_point tpMeasureStart) {
+	lc.bDrainPosted = false;
+
+	while (!lc.client.Incoming().empty()) {
+		cap::net::owned_message<CustomMsgTypes> msg = lc.client.Incoming().pop_front();
+
+		// Otros mensajes del servidor (por ejemplo ServerAccept de NetServer) no son respuestas.
+		if (msg.msg.header.id != CustomMsgTypes::ServerPing || lc.deqInFlight.empty()) {
+			continue;
+		}
+
+		auto [tpIntended, tpActual] = lc.deqInFlight.front();
+		lc.deqInFlight.pop_front();
+
+		// Solo medimos lo que se debió mandar después del calentamiento.
+			// El momento de llegada es cuando se termino de leer del socket, no cuando la revisamos.
+		if (tpIntended >= tpMeasureStart) {
+			results.hCorrected.Record(msg.tpReceived - tpIntended);
+			results.hUncorrected.Record(msg.tpReceived - tpActual);
+			results.nReceived.fetch_add(1, std::memory_order_relaxed);
+			results.nBytes.fetch_add(sizeof(cap::net::message_header<CustomMsgTypes>) + msg.msg.body.size(), std::memory_order_relaxed);
+		}
+	}
+}
+
+// Manda todos los pings que ya tocaban y programa el siguiente.
+	// Si el proceso se atraso, se mandan todos los atrasados de una vez con su momento original,
+	// así el atraso se cuenta en la latencia corregida en vez de esconderse (omisión coordinada).
+void SendDue(load_connection& lc, const std::vector<std::shared_ptr<const load_message>>& vPayloads, loadgen_results& results,
+	load_clock::time_point tpMeasureStart, load_clock::time_point tpEnd) {
+	auto tpNow = load_clock::now();
+
+	while (lc.tpNext <= tpNow && lc.tpNext < tpEnd) {
+		// Los mensajes ya están armados y se comparten, así no se copia el cuerpo en cada envío.
+		lc.client.Send(vPayloads[lc.mix(lc.rng)]);
+		lc.deqInFlight.emplace_back(lc.tpNext, tpNow);
+
+		if (lc.tpNext >= tpMeasureStart) {
+			results.nSent.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		lc.tpNext += lc.interval;
+	}
+
+	if (lc.tpNext < tpEnd) {
+		lc.timer.expires_at(lc.tpNext);
+		lc.timer.async_wait([&lc, &vPayloads, &results, tpMeasureStart, tpEnd](std::error_code ec) {
+				if (!ec) {
+					SendDue(lc, vPayloads, results, tpMeasureStart, tpEnd);
+				}
+			});
+	}
+}
+
+// Escribe un histograma como objeto JSON en microsegundos.
+std::string HistogramJson(const cap::net::histogram_snapshot& h) {
+	char sJson[256];
+	snprintf(sJson, sizeof(sJson), "{\"count\":%" PRIu64 ",\"mean\":%.3f,\"p50\":%.3f,\"p90\":%.3f,\"p99\":%.3f,\"p99.9\":%.3f,\"max\":%.3f}",
+		h.nCount, h.Mean() / 1e3, h.Percentile(50.0) / 1e3, h.Percentile(90.0) / 1e3, h.Percentile(99.0) / 1e3, h.Percentile(99.9) / 1e3, h.nMax / 1e3);
+	return sJson;
+}
+
+int main(int argc, char** argv) {
+	loadgen_config config;
+	if (!ParseArgs(argc, argv, config)) {
+		PrintUsage();
+		return 1;
+	}
+
+	// Si se pidió, levantamos el servidor de eco en este mismo programa.
+	std::unique_ptr<EchoServer> pServer;
+	std::atomic<bool> bServerRunning{ true };
+	std::thread thrServer;
+	if (config.bServer) {
+		pServer = std::make_unique<EchoServer>(config.nPort);
+		cap::net::connection_options serverOptions;
+		serverOptions.socket.bNoDelay = true;
+		pServer->SetConnectionOptions(serverOptions);
+		pServer->Start();
+
+		thrServer = std::thread([&]() {
+				while (bServerRunning) {
+					pServer->Update(-1, true);
+				}
+			});
+	}
+
+	// Detiene el servidor de eco si se levanto, el proceso debe terminar antes de destruir el std::thread.
+		// Lo despertamos con un mensaje vacío para que vea que ya terminamos.
+	auto StopServer = [&]() {
+		if (pServer) {
+			bServerRunning = false;
+			pServer->Wake();
+			thrServer.join();
+			pServer.reset();
+		}
+	};
+
+	// Contextos compartidos por todos los clientes, cada uno con su proceso.
+	cap::net::io_pool pool(config.nThreads);
+
+	// Los mensajes de cada tamaño de la mezcla se arman una sola vez.
+	std::vector<std::shared_ptr<const load_message>> vPayloads;
+	std::vector<double> vWeights;
+	for (auto& [nSize, dWeight] : config.vMix) {
+		load_message msg;
+		msg.header.id = CustomMsgTypes::ServerPing;
+		msg.body.assign(nSize, 0xAB);
+		msg.header.size = uint32_t(msg.body.size());
+		vPayloads.push_back(std::make_shared<const load_message>(std::move(msg)));
+		vWeights.push_back(dWeight);
+	}
+
+	loadgen_results results;
+
+	// Sin TCP_NODELAY el kernel retrasa los mensajes chicos y lo que se mediría seria el ACK retrasado.
+	cap::net::connection_options options;
+	options.socket.bNoDelay = true;
+
+	// Creamos los clientes repartidos entre los contextos del grupo y los conectamos.
+	std::vector<std::unique_ptr<load_connection>> vConnections;
+	for (size_t i = 0; i < config.nConnections; i++) {
+		auto pLc = std::make_unique<load_connection>(pool);
+		pLc->rng.seed(uint32_t(i + 1));
+		pLc->mix = std::discrete_distribution<size_t>(vWeights.begin(), vWeights.end());
+		pLc->client.SetConnectionOptions(options);
+		if (!pLc->client.Connect(config.sHost, config.nPort)) {
+			// Sin conexión no hay prueba, pero se detiene todo antes de salir.
+			pLc.reset();
+			for (auto& pConnected : vConnections) {
+				pConnected->client.Disconnect();
+			}
+			vConnections.clear();
+			pool.Stop();
+			StopServer();
+			return 1;
+		}
+		vConnections.push_back(std::move(pLc));
+	}
+
+	// Esperamos a que todas terminen la validación, así su tiempo no se cuenta en la latencia de los pings.
+	auto tpConnectDeadline = load_clock::now() + std::chrono::seconds(10);
+	size_t nValidated = 0;
+	while (load_clock::now() < tpConnectDeadline) {
+		nValidated = size_t(std::count_if(vConnections.begin(), vConnections.end(), [](auto& pLc) { return pLc->client.IsValidated(); }));
+		if (nValidated == vConnections.size()) {
+			break;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+
+	if (!config.bJson) {
+		printf("[GENERADOR] %zu de %zu conexiones validadas, %zu procesos.\n", nValidated, vConnections.size(), pool.Size());
+	}
+
+	// Calculamos los tiempos de la prueba, empezando un poco después para que todos los contextos estén listos.
+	auto tpStart = load_clock::now() + std::chrono::milliseconds(100);
+	auto tpMeasureStart = tpStart + std::chrono::duration_cast<load_clock::duration>(std::chrono::duration<double>(config.dWarmup));
+	auto tpEnd = tpMeasureStart + std::chrono::duration_cast<load_clock::duration>(std::chrono::duration<double>(config.dDuration));
+
+	// Cada conexión manda a una parte de la tasa total, y sus arranques se reparten dentro del intervalo
+	// para que no manden todas al mismo tiempo.
+	auto interval = std::chrono::duration_cast<load_clock::duration>(std::chrono::duration<double>(double(config.nConnections) / config.dRate));
+	for (size_t i = 0; i < vConnections.size(); i++) {
+		load_connection& lc = *vConnections[i];
+		if (!lc.client.IsValidated()) {
+			continue;
+		}
+
+		lc.interval = interval;
+		lc.tpNext = tpStart + interval * i / vConnections.size();
+
+		// Las respuestas se revisan en el contexto de la conexión cada que llegan.
+			// El aviso se llama con la cola bloqueada, así que solo programa la revisión.
+		lc.client.Incoming().SetNotify([&lc, &results, tpMeasureStart]() {
+				if (!lc.bDrainPosted) {
+					lc.bDrainPosted = true;
+					asio::post(lc.client.GetContext(), [&lc, &results, tpMeasureStart]() { Drain(lc, results, tpMeasureStart); });
+				}
+			});
+
+		asio::post(lc.client.GetContext(), [&lc, &vPayloads, &results, tpMeasureStart, tpEnd]() {
+				SendDue(lc, vPayloads, results, tpMeasureStart, tpEnd);
+			});
+	}
+
+	// Esperamos a que termine la prueba, y un poco más para que lleguen las ultimas respuestas.
+	std::this_thread::sleep_until(tpEnd + std::chrono::seconds(1));
+
+	// Detenemos todo: primero los clientes (mientras los contextos siguen corriendo), después el grupo.
+		// Los temporizadores se cancelan en su contexto, ya que no se pueden tocar desde este proceso.
+	for (auto& pLc : vConnections) {
+		load_connection& lc = *pLc;
+		std::promise<void> cancelled;
+		asio::post(lc.client.GetContext(), [&lc, &cancelled]() {
+				lc.timer.cancel();
+				lc.client.Incoming().SetNotify(nullptr);
+				cancelled.set_value();
+			});
+		cancelled.get_future().wait();
+		lc.client.Disconnect();
+	}
+	vConnections.clear();
+	pool.Stop();
+	StopServer();
+
+	// Armamos el resultado.
+	cap::net::histogram_snapshot hCorrected = results.hCorrected.Snapshot();
+	cap::net::histogram_snapshot hUncorrected = results.hUncorrected.Snapshot();
+	uint64_t nSent = results.nSent.load();
+	uint64_t nReceived = results.nReceived.load();
+	double dThroughput = nReceived / config.dDuration;
+	double dMBps = results.nBytes.load() / config.dDuration / (1024.0 * 1024.0);
+
+	std::string sMix;
+	for (auto& [nSize, dWeight] : config.vMix) {
+		char sEntry[64];
+		snprintf(sEntry, sizeof(sEntry), "%s%zu:%g", sMix.empty() ? "" : ",", nSize, dWeight);
+		sMix += sEntry;
+	}
+
+	std::ostringstream json;
+	json << "{\"config\":{\"host\":\"" << config.sHost << "\",\"port\":" << config.nPort << ",\"connections\":" << config.nConnections
+		<< ",\"threads\":" << config.nThreads << ",\"rate\":" << config.dRate << ",\"duration\":" << config.dDuration
+		<< ",\"warmup\":" << config.dWarmup << ",\"mix\":\"" << sMix << "\"},"
+		<< "\"validated\":" << nValidated << ",\"sent\":" << nSent << ",\"received\":" << nReceived
+		<< ",\"lost\":" << (nSent > nReceived ? nSent - nReceived : 0)
+		<< ",\"throughput_msgs\":" << dThroughput << ",\"throughput_mbps\":" << dMBps
+		<< ",\"latency_us\":" << HistogramJson(hCorrected) << ",\"latency_uncorrected_us\":" << HistogramJson(hUncorrected) << "}";
+
+	if (config.bJson) {
+		printf("%s\n", json.str().c_str());
+	}
+	else {
+		printf("[GENERADOR] Tasa objetivo %.0f msg/s por %.1f s (calentamiento %.1f s), mezcla %s\n", config.dRate, config.dDuration, config.dWarmup, sMix.c_str());
+		printf("  enviados: %" PRIu64 ", recibidos: %" PRIu64 ", sin respuesta: %" PRIu64 "\n", nSent, nReceived, nSent > nReceived ? nSent - nReceived : 0);
+		printf("  rendimiento: %.0f msg/s, %.2f MB/s\n", dThroughput, dMBps);
+		printf("  latencia corregida:    p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us\n",
+			hCorrected.Percentile(50.0) / 1e3, hCorrected.Percentile(99.0) / 1e3, hCorrected.Percentile(99.9) / 1e3, hCorrected.nMax / 1e3);
+		printf("  latencia sin corregir: p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us\n",
+			hUncorrected.Percentile(50.0) / 1e3, hUncorrected.Percentile(99.0) / 1e3, hUncorrected.Percentile(99.9) / 1e3, hUncorrected.nMax / 1e3);
+	}
+
+	if (!config.sOutPath.empty()) {
+		std::ofstream file(config.sOutPath);
+		file << json.str() << "\n";
+	}
+
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,187 @@
+/*********************************************************************
+* Reproductor de capturas de NetServer (SimpleServer --capture).     *
+* Entrega los mensajes capturados a los mismos manejadores que usa   *
+* NetServer, sin sockets de por medio, y mide cuanto tarda cada uno. *
+* Sirve para comparar cambios en los manejadores con trafico real.   *
+*                                                                    *
+* Uso: NetReplay <captura> [--original] [--speed x]                  *
+*                [--repetitions n] [--json]                          *
+*                                                                    *
+* En Linux se puede compilar con:                                    *
+*   g++ -std=c++17 -O2 -I../asio-1.18.0/include -I../NetCommon       *
+*       Replay.cpp -o NetReplay -pthread                             *
+*********************************************************************/
+
+#include <iostream>
+#include <map>
+#include <cap_net.h>
+
+// Mismos tipos de mensajes que NetServer, las capturas solo se pueden leer con el mismo tipo.
+enum class CustomMsgTypes : uint32_t {
+	ServerAccept,
+	ServerDeny,
+	ServerPing,
+	MessageAll,
+	ServerMessage,
+};
+
+using replay_message = cap::net::message<CustomMsgTypes>;
+
+// Mismos manejadores que el CustomServer de NetServer, pero sin imprimir cada mensaje,
+// ya que imprimir tardaría más que el manejador y no dejaría ver sus cambios.
+class ReplayServer : public cap::net::server_interface<CustomMsgTypes> {
+public:
+	// Sin puerto, la reproducción no usa sockets.
+	ReplayServer() : cap::net::server_interface<CustomMsgTypes>() {}
+
+protected:
+	virtual bool OnClientConnect(std::shared_ptr<cap::net::connection<CustomMsgTypes>> client) override {
+		replay_message msg;
+		msg.header.id = CustomMsgTypes::ServerAccept;
+		client->Send(msg);
+
+		return true;
+	}
+
+	virtual void OnMessage(std::shared_ptr<cap::net::connection<CustomMsgTypes>> client, replay_message& msg) override {
+		switch (msg.header.id) {
+			case CustomMsgTypes::ServerPing: {
+				// Una petición sin ID (mal formada en la captura) se ignora.
+				if (msg.header.flags & cap::net::flag_rpc_request) {
+					if (std::optional<uint64_t> nRpcId = cap::net::ExtractRpcId(msg)) {
+						cap::net::SendRpcReply(client, *nRpcId, msg);
+					}
+				}
+				else {
+					client->Send(msg);
+				}
+			}
+			break;
+
+			case CustomMsgTypes::MessageAll: {
+				replay_message msgAll;
+				msgAll.header.id = CustomMsgTypes::MessageAll;
+				msgAll << client->GetID();
+				this->MessageAllClients(msgAll, client);
+			}
+			break;
+
+			default:
+				break;
+		}
+	}
+};
+
+// Configuración de la reproducción, se llena con los argumentos.
+struct replay_config {
+	std::string sPath;
+	cap::net::replay_options options;
+
+	// Veces que se reproduce la captura, se reporta cada una.
+	size_t nRepetitions = 1;
+
+	bool bJson = false;
+};
+
+// Imprime como se usa el programa.
+void PrintUsage() {
+	printf("Uso: NetReplay <captura> [opciones]\n"
+		"  --original             respeta el tiempo en que llegaron los mensajes (por defecto lo más rápido posible)\n"
+		"  --speed <x>            con --original, multiplica la velocidad\n"
+		"  --repetitions <n>      veces que se reproduce la captura (1)\n"
+		"  --json                 imprime el resultado como JSON en la ultima linea\n");
+}
+
+// Lee los argumentos, retorna falso si alguno no es valido.
+bool ParseArgs(int argc, char** argv, replay_config& config) {
+	for (int i = 1; i < argc; i++) {
+		std::string sArg = argv[i];
+
+		if (sArg == "--original") { config.options.pacing = cap::net::replay_pacing::original; continue; }
+		if (sArg == "--json") { config.bJson = true; continue; }
+
+		if (sArg.rfind("--", 0) != 0) {
+			config.sPath = sArg;
+			continue;
+		}
+
+		if (i + 1 >= argc) {
+			return false;
+		}
+		std::string sValue = argv[++i];
+
+		if (sArg == "--speed") config.options.dSpeed = std::atof(sValue.c_str());
+		else if (sArg == "--repetitions") config.nRepetitions = std::max<size_t>(std::strtoul(sValue.c_str(), nullptr, 10), 1);
+		else return false;
+	}
+
+	return !config.sPath.empty();
+}
+
+// Imprime un resumen de lo que contiene la captura.
+void PrintSummary(cap::net::capture_reader<CustomMsgTypes>& reader) {
+	// Mensajes y bytes por ID de mensaje, y las conexiones distintas.
+	std::map<uint32_t, std::pair<uint64_t, uint64_t>> mapById;
+	std::map<uint32_t, uint64_t> mapConnections;
+	std::chrono::nanoseconds duration{ 0 };
+
+	cap::net::captured_message<CustomMsgTypes> captured;
+	while (reader.Next(captured)) {
+		auto& [nCount, nBytes] = mapById[uint32_t(captured.msg.header.id)];
+		nCount++;
+		nBytes += captured.msg.body.size();
+		mapConnections[captured.nConnection]++;
+		duration = captured.time;
+	}
+	reader.Rewind();
+
+	fprintf(stderr, "captura: %zu conexiones, %.3f s\n", mapConnections.size(), std::chrono::duration<double>(duration).count());
+	for (auto& [nId, counts] : mapById) {
+		fprintf(stderr, "  id %u: %" PRIu64 " mensajes, %" PRIu64 " bytes\n", nId, counts.first, counts.second);
+	}
+}
+
+int main(int argc, char** argv) {
+	replay_config config;
+	if (!ParseArgs(argc, argv, config)) {
+		PrintUsage();
+		return 1;
+	}
+
+	cap::net::capture_reader<CustomMsgTypes> reader;
+	if (!reader.Open(config.sPath)) {
+		fprintf(stderr, "No se pudo abrir la captura %s (o no es una captura de NetServer)\n", config.sPath.c_str());
+		return 1;
+	}
+
+	PrintSummary(reader);
+
+	ReplayServer server;
+	std::vector<cap::net::replay_result> vResults;
+
+	for (size_t i = 0; i < config.nRepetitions; i++) {
+		reader.Rewind();
+		cap::net::replay_result result = server.Replay(reader, config.options);
+
+		fprintf(stderr, "reproducción %zu: %" PRIu64 " mensajes en %.3f s (%.0f mensajes/s), manejador p50 %" PRIu64 " ns, p99 %" PRIu64 " ns, máx %" PRIu64 " ns\n",
+			i + 1, result.nMessages, result.dSeconds, result.dSeconds > 0.0 ? double(result.nMessages) / result.dSeconds : 0.0,
+			result.handler.Percentile(50.0), result.handler.Percentile(99.0), result.handler.nMax);
+
+		vResults.push_back(std::move(result));
+	}
+
+	if (config.bJson) {
+		printf("{\"capture\":\"%s\",\"pacing\":\"%s\",\"runs\":[", config.sPath.c_str(),
+			config.options.pacing == cap::net::replay_pacing::original ? "original" : "fastest");
+		for (size_t i = 0; i < vResults.size(); i++) {
+			const cap::net::replay_result& r = vResults[i];
+			printf("%s{\"messages\":%" PRIu64 ",\"bytes\":%" PRIu64 ",\"connections\":%" PRIu64 ",\"seconds\":%.6f,"
+				"\"handler_mean_ns\":%.1f,\"handler_p50_ns\":%" PRIu64 ",\"handler_p99_ns\":%" PRIu64 ",\"handler_max_ns\":%" PRIu64 "}",
+				i > 0 ? "," : "", r.nMessages, r.nBytes, r.nConnections, r.dSeconds,
+				r.handler.Mean(), r.handler.Percentile(50.0), r.handler.Percentile(99.0), r.handler.nMax);
+		}
+		printf("]}\n");
+	}
+
+	return 0;
+}
\ No newline at end of file
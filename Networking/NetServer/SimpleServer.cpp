@@ -1,4 +1,4 @@
-// Agregamos las libreras necesarias.
+// Agregamos las librerías necesarias.
 #include <iostream>
 #include <stdio.h>
 #include <cap_net.h>
@@ -13,14 +13,14 @@ enum class CustomMsgTypes : uint32_t {
 };
 
 // Crearemos la subclase que usara el servidor con la interfaz del servidor y con el tipo de mensajes a manejar.
-// Tambin esta clase es donde implementaremos el resultado o el proceso de los eventos que hay en la interfaz. 
+// También esta clase es donde implementaremos el resultado o el proceso de los eventos que hay en la interfaz. 
 class CustomServer : public cap::net::server_interface<CustomMsgTypes> {
 private:
 
 protected:
 	// Sobrescribimos el evento cuando el cliente se conecta al indicado.
 
-		// Evento el cual ejecutara un proceso antes de la aceptacin del cliente.
+		// Evento el cual ejecutara un proceso antes de la aceptación del cliente.
 	virtual bool OnClientConnect(std::shared_ptr<cap::net::connection<CustomMsgTypes>> client) {
 		// Crearemos un mensaje el cual mandaremos al cliente para indicarle que fue aceptado.
 		cap::net::message<CustomMsgTypes> msg;
@@ -42,31 +42,44 @@ protected:
 		// En este evento nos encargaremos de leer los ID especiales del mensaje para indicarle que hacer.
 	virtual void OnMessage(std::shared_ptr<cap::net::connection<CustomMsgTypes>> client, cap::net::message<CustomMsgTypes>& msg) {
 		// Creamos un switch para leer y ejecutar un caso dependiendo del ID del mensaje, y de igual forma
-		// informar que un cliente en especifico ha hecho una peticin especial.
+		// informar que un cliente en especifico ha hecho una petición especial.
 		switch (msg.header.id) {
 
 			// Caso en el que el cliente pidio el tiempo de respuesta del servidor.
 			case CustomMsgTypes::ServerPing: {
 				printf("[%u]: Pingeando al Servidor.\n", client->GetID());
 
-				// Regresamos el mensaje al cliente ya que la peticin es para medir el tiempo de respuesta.
-				client->Send(msg);
+				// Regresamos el mensaje al cliente ya que la petición es para medir el tiempo de respuesta.
+					// Si llego como petición RPC, respondemos con su ID de correlación para que el cliente la empareje.
+					// Una petición sin ID esta mal formada, así que no se responde y se cierra la conexión.
+				if (msg.header.flags & cap::net::flag_rpc_request) {
+					std::optional<uint64_t> nRpcId = cap::net::ExtractRpcId(msg);
+					if (!nRpcId) {
+						printf("[%u]: Petición RPC sin ID, se desconecta.\n", client->GetID());
+						client->Disconnect();
+						break;
+					}
+					cap::net::SendRpcReply(client, *nRpcId, msg);
+				}
+				else {
+					client->Send(msg);
+				}
 			}
 			break;
 
 			// Caso en el que un cliente pidio mandar un mensaje a todos.
 			case CustomMsgTypes::MessageAll: {
-				// Notificamos que el servidor recibio la peticin.
+				// Notificamos que el servidor recibio la petición.
 				printf("[%u]: Mando un mensaje a todos.\n", client->GetID());
 
-				// Creamos el mensaje con su ID de respuesta para ejecutar la accin pedida.
+				// Creamos el mensaje con su ID de respuesta para ejecutar la acción pedida.
 				cap::net::message<CustomMsgTypes> msg;
 				msg.header.id = CustomMsgTypes::MessageAll;
 
 				// Le agregamos el mensaje a ser transmitido.
 				msg << client->GetID();
 
-				// Y ejecutamos la funcin que nos ayudara a ejecutar la accin que necesitamos.
+				// Y ejecutamos la función que nos ayudara a ejecutar la acción que necesitamos.
 				this->MessageAllClients(msg, client);
 			}
 			break;
@@ -75,19 +88,96 @@ protected:
 
 public:
 	// Constructor del server que pide como parametro el puerto.
-	CustomServer(uint16_t nPort) : cap::net::server_interface<CustomMsgTypes>(nPort) {}
+	CustomServer(uint16_t nPort) : cap::net::server_interface<CustomMsgTypes>(nPort) {
+		// Cada MessageAll se reenvía a todos los clientes, así que un solo cliente mandándolo sin parar satura a todo el servidor.
+			// Se permiten 10 por segundo (con ráfagas de hasta 20) y los demás se descartan, y en general se frena
+			// a quien pase de 1000 mensajes o 1 MB por segundo.
+		cap::net::connection_options options;
+		options.rateLimits.global.dMessagesPerSecond = 1000.0;
+		options.rateLimits.global.dBytesPerSecond = 1024.0 * 1024.0;
+
+		cap::net::rate_limit messageAll;
+		messageAll.dMessagesPerSecond = 10.0;
+		messageAll.dBurstSeconds = 2.0;
+		messageAll.action = cap::net::rate_limit_action::drop;
+		options.rateLimits.SetRateLimit(CustomMsgTypes::MessageAll, messageAll);
+
+		this->SetConnectionOptions(options);
+	}
 
 
 	virtual void OnClientValidated(std::shared_ptr<cap::net::connection<CustomMsgTypes>> client) {
 	}
 };
 
-int main() {
+int main(int argc, char** argv) {
+
+	// Argumentos:
+		// "--capture archivo" guarda todos los mensajes entrantes, para reproducirlos después con NetReplay.
+		// "--port puerto" escucha en otro puerto (60000 por defecto), para correr varios nodos en la misma maquina.
+		// "--node número --secret número --peer host:puerto:número ..." une este servidor con los demás nodos, p. ej. en una terminal
+		//     SimpleServer --port 60001 --node 1 --secret <secreto> --peer 127.0.0.1:60002:2
+		// y en otra
+		//     SimpleServer --port 60002 --node 2 --secret <secreto> --peer 127.0.0.1:60001:1
+		// Así los MessageAll llegan a los clientes de ambos nodos. El secreto es obligatorio, debe ser el mismo en todos
+		// los nodos y que nadie más lo conozca (ver federation_options::nSecret).
+	uint16_t nPort = 60000;
+	std::string sCapture;
+	cap::net::federation_options federation;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		std::string sArg = argv[i];
+		if (sArg == "--capture") {
+			sCapture = argv[i + 1];
+		}
+		else if (sArg == "--port") {
+			nPort = uint16_t(std::stoi(argv[i + 1]));
+		}
+		else if (sArg == "--secret") {
+			federation.nSecret = std::stoull(argv[i + 1]);
+		}
+		else if (sArg == "--node") {
+			federation.nNode = uint8_t(std::stoi(argv[i + 1]));
+		}
+		else if (sArg == "--peer") {
+			std::string sPeer = argv[i + 1];
+			size_t nFirst = sPeer.find(':');
+			size_t nSecond = sPeer.find(':', nFirst + 1);
+			if (nFirst == std::string::npos || nSecond == std::string::npos) {
+				printf("[SERVIDOR] Nodo %s no valido, debe ser host:puerto:número\n", sPeer.c_str());
+				continue;
+			}
+
+			cap::net::federation_peer peer;
+			peer.sHost = sPeer.substr(0, nFirst);
+			peer.nPort = uint16_t(std::stoi(sPeer.substr(nFirst + 1, nSecond - nFirst - 1)));
+			peer.nNode = uint8_t(std::stoi(sPeer.substr(nSecond + 1)));
+			federation.vPeers.push_back(peer);
+		}
+	}
+
+	// Crearemos el servidor en el puerto pedido y lo iniciamos.
+	CustomServer server(nPort);
+
+	// La federación va antes de Start(), ya que el número del nodo va en las IDs de los clientes.
+	if (federation.nNode != 0) {
+		if (!server.StartFederation(federation)) {
+			printf("[SERVIDOR] La federación necesita --secret con un número distinto de cero\n");
+			return 1;
+		}
+		printf("[SERVIDOR] Nodo %d con %zu nodos más\n", int(federation.nNode), federation.vPeers.size());
+	}
 
-	// Crearemos el servidor en puerto 60000 y lo iniciamos.
-	CustomServer server(60000);
 	server.Start();
 
+	if (!sCapture.empty()) {
+		if (server.StartCapture(sCapture)) {
+			printf("[SERVIDOR] Capturando mensajes en %s\n", sCapture.c_str());
+		}
+		else {
+			printf("[SERVIDOR] No se pudo crear la captura %s\n", sCapture.c_str());
+		}
+	}
+
 	// Creamos un while donde se estara ejecutando el Update()
 	while (1) {
 		server.Update(-1, true);